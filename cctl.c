@@ -0,0 +1,229 @@
+/* Control the containers of a launcher daemon (see create_container -D). */
+#define _GNU_SOURCE				/* snprintf */
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strcmp */
+#include <sys/wait.h>			/* WIFEXITED */
+#include "lib/launcher.h"
+
+enum { int_max = 2147483647 };
+
+struct cmdline_opts {
+	const char *sock_path;
+	int count;
+	char **cmds;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cctl program: control the containers of a launcher daemon\n"
+		 "\n"
+		 "Usage: cctl -s <socket> [options] <command> [, <command> ...]\n"
+		 "Example: ./cctl -s /tmp/docker-c.sock create web /bin/httpd -f , start web\n"
+		 "\n"
+		 "The commands (separated by a lone ',') go to the daemon in one\n"
+		 "message and are answered together; a command on a container which\n"
+		 "is being created or stopped waits for it.\n"
+		 "\n"
+		 "Commands are:\n"
+		 " create <name> [program [args]]  set up a container, its program waits\n"
+		 " start <name>           let the program run\n"
+		 " stop <name> [signal]   send a signal (default 9) and wait for the exit\n"
+		 " delete <name>          remove a stopped container\n"
+		 " list                   print the containers\n"
+		 "\n"
+		 "Options are:\n"
+		 " -s <socket>  unix socket of the daemon\n"
+		 " -c <count>   repeat the commands count times, %d in a name is the\n"
+		 "              number of the time (web-%d is web-0, web-1, ...)\n"
+		 " -h           display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->sock_path = NULL;
+	opts->count = 1;
+	opts->cmds = NULL;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if ((optc == 's' || optc == 'c') && idx + 1 >= argc) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 's':
+				opts->sock_path = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'c':
+				opts->count = pos_atoi(argv[idx + 1]);
+				if (opts->count <= 0) {
+					fprintf(stderr, "invalid count %s\n", argv[idx + 1]);
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else {
+			opts->cmds = &argv[idx];
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* The expand_name writes name to buf with the first %d replaced by i. */
+static void expand_name(const char *name, int i, char *buf, int size)
+{
+	const char *d = strstr(name, "%d");
+
+	if (d)
+		snprintf(buf, size, "%.*s%d%s", (int) (d - name), name, i, d + 2);
+	else
+		snprintf(buf, size, "%s", name);
+}
+
+/* The add_command appends the command cmd (NULL-terminated, the ',' is
+ * replaced) to the message for the time i.
+ */
+static int add_command(struct lch_msg *m, char **cmd, int i)
+{
+	static const char *names[] = { "create", "start", "stop", "delete", "list", NULL };
+	char name[lch_name_len + 16];
+	int op, sig = 0;
+
+	for (op = 0; names[op] && strcmp(names[op], cmd[0]); op++);
+	if (!names[op]) {
+		fprintf(stderr, "unknown command %s\n", cmd[0]);
+		return 1;
+	}
+	op += lch_create;
+
+	if (op == lch_list && !cmd[1])
+		return lch_add(m, op, "", 0, NULL);
+
+	if (op == lch_list || !cmd[1] || (op != lch_create && op != lch_stop && cmd[2]) ||
+		(op == lch_stop && cmd[2] && cmd[3])) {
+		fprintf(stderr, "usage of %s is wrong; try -h for help\n", cmd[0]);
+		return 3;
+	}
+	if (op == lch_stop && cmd[2]) {
+		sig = pos_atoi(cmd[2]);
+		if (sig <= 0 || sig >= 65) {
+			fprintf(stderr, "invalid signal %s\n", cmd[2]);
+			return 4;
+		}
+	}
+
+	expand_name(cmd[1], i, name, sizeof(name));
+	return lch_add(m, op, name, sig, op == lch_create && cmd[2] ? cmd + 2 : NULL);
+}
+
+/* The print_reply prints a reply as a line, it returns 1 on an error. */
+static int print_reply(const struct lch_reply *r)
+{
+	if (r->err) {
+		printf("%s %.*s: %s\n", lch_op_name(r->op), lch_name_len, r->name, strerror(r->err));
+		return 1;
+	}
+
+	printf("%s %.*s: %s", lch_op_name(r->op), lch_name_len, r->name, lch_state_name(r->state));
+	if (r->pid)
+		printf(" pid=%d", r->pid);
+	if (r->state == lch_stopped && WIFEXITED(r->status))
+		printf(" exit=%d", WEXITSTATUS(r->status));
+	if (r->state == lch_stopped && WIFSIGNALED(r->status))
+		printf(" signal=%d", WTERMSIG(r->status));
+	putchar('\n');
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	static struct lch_msg msg;
+	struct lch_reply *rep;
+	char **cmd, **end;
+	int i, n, ret = 0;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.sock_path == NULL) {
+		fprintf(stderr, "The -s parameter must be specified\n");
+		return 2;
+	}
+
+	if (opts.cmds == NULL) {
+		fprintf(stderr, "A command must be specified; try -h for help\n");
+		return 3;
+	}
+
+	/* Every command is cut off at its ',', argv ends with NULL. */
+	for (end = opts.cmds; *end; end++) {
+		if (!strcmp(*end, ","))
+			*end = NULL;
+	}
+
+	lch_init(&msg);
+	for (i = 0; i < opts.count; i++) {
+		for (cmd = opts.cmds; cmd < end; cmd += n + 1) {
+			for (n = 0; cmd[n]; n++);
+			if (n == 0) {
+				fprintf(stderr, "empty command\n");
+				return 4;
+			}
+			if (add_command(&msg, cmd, i))
+				return 4;
+		}
+	}
+
+	n = lch_call(opts.sock_path, &msg, &rep);
+	if (n < 0) {
+		fprintf(stderr, "lch_call is failed\n");
+		return 5;
+	}
+
+	for (i = 0; i < n; i++)
+		ret |= print_reply(&rep[i]);
+	free(rep);
+
+	return ret ? 6 : 0;
+}
@@ -0,0 +1,111 @@
+/* Run a program in a container through its exec agent
+ * (see create_container -e).
+ */
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <sys/wait.h>			/* WEXITSTATUS */
+#include "lib/execagent.h"
+
+enum { max_env = 64 };
+
+struct cmdline_opts {
+	const char *sock_path;
+	char *env[max_env + 1];
+	int envc;
+	char **argv;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cexec program: run a program through the exec agent of a container\n"
+		 "\n"
+		 "Usage: cexec -s <socket> [options] <program> [args]\n"
+		 "Example: ./cexec -s /tmp/container.sock -e HOME=/ /bin/ls /\n"
+		 "\n"
+		 "Options are:\n"
+		 " -s <socket>     unix socket of the exec agent\n"
+		 " -e <var=value>  set environment variable (may be repeated)\n"
+		 " -h              display this help\n");
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->sock_path = NULL;
+	opts->env[0] = NULL;
+	opts->envc = 0;
+	opts->argv = NULL;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if ((optc == 's' || optc == 'e') && idx + 1 >= argc) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 's':
+				opts->sock_path = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'e':
+				if (opts->envc == max_env) {
+					fprintf(stderr, "too many environment variables\n");
+					return 2;
+				}
+				opts->env[opts->envc++] = argv[idx + 1];
+				opts->env[opts->envc] = NULL;
+				idx += 2;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else {
+			opts->argv = &argv[idx];
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	int fds[agent_nfds] = { 0, 1, 2 };
+	int status;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.sock_path == NULL) {
+		fprintf(stderr, "The -s parameter must be specified\n");
+		return 2;
+	}
+
+	if (opts.argv == NULL) {
+		fprintf(stderr, "Program must be specified that will run inside the container\n");
+		return 3;
+	}
+
+	if (agent_exec(opts.sock_path, opts.argv, opts.env, fds, &status)) {
+		fprintf(stderr, "agent_exec is failed\n");
+		return 4;
+	}
+
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return WEXITSTATUS(status);
+}
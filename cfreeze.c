@@ -0,0 +1,131 @@
+/* Freeze and thaw containers started with create_container -n. */
+#define _GNU_SOURCE
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strcmp */
+#include <time.h>				/* clock_gettime */
+#include "lib/cgrouplib.h"
+
+enum { int_max = 2147483647, def_timeout = 1000 };
+
+struct cmdline_opts {
+	int freeze;					/* 1 - freeze, 0 - thaw, -1 - not given */
+	int timeout;
+	char **names;
+	int nnames;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cfreeze program: freeze or thaw containers with the cgroup freezer\n"
+		 "\n"
+		 "Usage: cfreeze [options] -f|-u <name>...\n"
+		 "Example: ./cfreeze -f web1 web2 web3\n"
+		 "\n"
+		 "A frozen container keeps its memory and sockets, but gets no CPU\n"
+		 "time until it is thawed. All containers are frozen (thawed) at once.\n"
+		 "\n"
+		 "Options are:\n"
+		 " -f           freeze the containers\n"
+		 " -u           thaw the containers\n"
+		 " -t <ms>      wait at most ms for the containers (default 1000)\n"
+		 " -h           display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->freeze = -1;
+	opts->timeout = def_timeout;
+	opts->names = NULL;
+	opts->nnames = 0;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if (optc == 't' && (idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 'f':
+			case 'u':
+				opts->freeze = optc == 'f';
+				idx++;
+				break;
+			case 't':
+				opts->timeout = pos_atoi(argv[idx + 1]);
+				if (opts->timeout < 0) {
+					fprintf(stderr, "invalid timeout\n");
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else {
+			opts->names = &argv[idx];
+			opts->nnames = argc - idx;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	struct timespec start, end;
+	int left;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.freeze < 0 || opts.nnames == 0) {
+		fprintf(stderr, "-f or -u and the containers must be specified\n");
+		return 2;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	left = cgroup_freeze(opts.names, opts.nnames, opts.freeze, opts.timeout);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (left < 0)
+		return 3;
+
+	printf("%d of %d containers %s in %ld us\n", opts.nnames - left, opts.nnames, opts.freeze ? "frozen" : "thawed",
+		   (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000);
+	return left ? 4 : 0;
+}
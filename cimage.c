@@ -0,0 +1,339 @@
+/* Manage the local layer store of images (see lib/layerstore.h). */
+#define _GNU_SOURCE
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strcmp */
+#include <unistd.h>				/* read */
+#include <fcntl.h>				/* open */
+#include <dirent.h>				/* opendir */
+#include <limits.h>				/* PATH_MAX */
+#include <time.h>				/* clock_gettime */
+#include <sys/stat.h>			/* fstat */
+#include <sys/mman.h>			/* mmap */
+#include "lib/layerstore.h"
+#include "lib/ocilayout.h"
+
+enum { cmd_none, cmd_import, cmd_remove, cmd_list, cmd_gc, cmd_bench };
+
+static const char *def_store = "/var/lib/docker-c";
+
+struct cmdline_opts {
+	const char *store;
+	int cmd;
+	const char *name;			/* of the image, the file for -B */
+	const char *layout;			/* OCI image layout to import from */
+	char **layers;				/* <file>[@sha256:<hex>] */
+	int nlayers;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cimage program: manage the local image layer store\n"
+		 "\n"
+		 "Usage: cimage [-s store] -i <image> <layer>[@sha256:<hex>]...\n"
+		 "       cimage [-s store] -i <image> -o <layout> [<ref>]\n"
+		 "       cimage [-s store] -r <image> | -l | -g\n"
+		 "       cimage -B <file>\n"
+		 "Example: ./cimage -i alpine alpine-minirootfs-3.21.3-x86_64.tar.gz\n"
+		 "\n"
+		 "Options are:\n"
+		 " -s <dir>     the store (default /var/lib/docker-c)\n"
+		 " -i <image>   import layers (bottom first) as image, a layer\n"
+		 "              with a digest is checked against it; the layers are\n"
+		 "              unpacked for create_container -i\n"
+		 " -o <layout>  import the image tagged ref (default the first one)\n"
+		 "              from an OCI image layout directory\n"
+		 " -r <image>   remove image\n"
+		 " -l           list images and their layers\n"
+		 " -g           remove layers no image refers to\n"
+		 " -B <file>    measure the SHA-256 speed of every implementation\n"
+		 " -h           display this help\n");
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->store = def_store;
+	opts->cmd = cmd_none;
+	opts->name = NULL;
+	opts->layout = NULL;
+	opts->layers = NULL;
+	opts->nlayers = 0;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if ((optc == 's' || optc == 'i' || optc == 'r' || optc == 'o' || optc == 'B') &&
+				(idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 's':
+				opts->store = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'i':
+				opts->cmd = cmd_import;
+				opts->name = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'o':
+				opts->layout = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'r':
+				opts->cmd = cmd_remove;
+				opts->name = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'l':
+				opts->cmd = cmd_list;
+				idx++;
+				break;
+			case 'g':
+				opts->cmd = cmd_gc;
+				idx++;
+				break;
+			case 'B':
+				opts->cmd = cmd_bench;
+				opts->name = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 2;
+			}
+		} else {
+			opts->layers = &argv[idx];
+			opts->nlayers = argc - idx;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/* The import_image imports the layers, unpacks them and adds the image. */
+static int import_image(struct layer_store *s, const char *name, char **layers, int n)
+{
+	static layer_digest digests[store_max_layers];
+	const char *expect;
+	char *at;
+	int i, fd, ret = 0;
+
+	if (n == 0 || n > store_max_layers) {
+		fprintf(stderr, "1 to %d layers are needed\n", store_max_layers);
+		return 1;
+	}
+
+	if (store_begin(s))
+		return 2;
+
+	for (i = 0; i < n; i++) {
+		expect = NULL;
+		at = strchr(layers[i], '@');
+		if (at) {
+			*at = '\0';
+			expect = at + 1;
+			if (strncmp(expect, "sha256:", 7) == 0)
+				expect += 7;
+		}
+
+		fd = open(layers[i], O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			perror(layers[i]);
+			ret = 3;
+			goto out;
+		}
+		if (store_import(s, fd, expect, digests[i])) {
+			close(fd);
+			ret = 4;
+			goto out;
+		}
+		close(fd);
+		printf("%s sha256:%s\n", layers[i], digests[i]);
+	}
+
+	if (oci_unpack(s, digests, n, 0))
+		ret = 5;
+	else if (store_add_image(s, name, digests, n))
+		ret = 6;
+
+ out:
+	store_end(s);
+	return ret;
+}
+
+/* The import_layout imports the image ref of an OCI image layout. */
+static int import_layout(struct layer_store *s, const char *name, const char *layout, const char *ref)
+{
+	static layer_digest digests[store_max_layers];
+	char path[PATH_MAX];
+	int i, n, fd, ret = 0;
+
+	n = oci_read_layers(layout, ref, digests, store_max_layers);
+	if (n <= 0) {
+		fprintf(stderr, "%s: no image to import\n", layout);
+		return 1;
+	}
+
+	if (store_begin(s))
+		return 2;
+
+	for (i = 0; i < n; i++) {
+		snprintf(path, PATH_MAX, "%s/blobs/sha256/%s", layout, digests[i]);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			perror(path);
+			ret = 3;
+			goto out;
+		}
+		if (store_import(s, fd, digests[i], digests[i])) {
+			close(fd);
+			ret = 4;
+			goto out;
+		}
+		close(fd);
+		printf("layer sha256:%s\n", digests[i]);
+	}
+
+	if (oci_unpack(s, digests, n, 0))
+		ret = 5;
+	else if (store_add_image(s, name, digests, n))
+		ret = 6;
+
+ out:
+	store_end(s);
+	return ret;
+}
+
+static int list_images(struct layer_store *s, const char *root)
+{
+	static layer_digest digests[store_max_layers];
+	char path[4096];
+	struct dirent *de;
+	DIR *dir;
+	int i, n;
+
+	snprintf(path, sizeof(path), "%s/images", root);
+	dir = opendir(path);
+	if (!dir) {
+		perror(path);
+		return 1;
+	}
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.')
+			continue;
+		n = store_layers(s, de->d_name, digests, store_max_layers);
+		printf("%s\n", de->d_name);
+		for (i = 0; i < n; i++)
+			printf("  sha256:%s\n", digests[i]);
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The bench hashes a file mapped in memory with every implementation. */
+static int bench(const char *path)
+{
+	unsigned char digest[sha256_len];
+	char hex[sha256_hex_len + 1];
+	struct sha256_ctx ctx;
+	struct stat st;
+	const char *impl;
+	double start, secs;
+	void *data;
+	int fd, portable;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		return 1;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return 2;
+	}
+
+	for (portable = 1; portable >= 0; portable--) {
+		impl = sha256_select(portable);
+		start = now();
+		sha256_init(&ctx);
+		sha256_update(&ctx, data, st.st_size);
+		sha256_final(&ctx, digest);
+		secs = now() - start;
+		sha256_hex(digest, hex);
+		printf("%-8s %8.1f MB/s %s\n", impl, st.st_size / secs / 1e6, hex);
+	}
+
+	munmap(data, st.st_size);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	struct layer_store s;
+	uint64_t freed;
+	int ret = 0, removed;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.cmd == cmd_none) {
+		fprintf(stderr, "Nothing to do; try -h for help\n");
+		return 2;
+	}
+
+	if (opts.cmd == cmd_bench)
+		return bench(opts.name) ? 3 : 0;
+
+	if (store_open(&s, opts.store))
+		return 4;
+
+	switch (opts.cmd) {
+	case cmd_import:
+		if (opts.layout)
+			ret = import_layout(&s, opts.name, opts.layout, opts.nlayers ? opts.layers[0] : NULL);
+		else
+			ret = import_image(&s, opts.name, opts.layers, opts.nlayers);
+		break;
+	case cmd_remove:
+		ret = store_remove_image(&s, opts.name);
+		break;
+	case cmd_list:
+		ret = list_images(&s, opts.store);
+		break;
+	case cmd_gc:
+		ret = store_gc(&s, &removed, &freed);
+		if (ret == 0)
+			printf("%d layers, %llu bytes removed\n", removed, (unsigned long long) freed);
+		break;
+	}
+
+	store_close(&s);
+	return ret ? 5 : 0;
+}
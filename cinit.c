@@ -0,0 +1,118 @@
+/* A minimal init for PID 1 of a container (see create_container -I).
+ *
+ * It forks the program in a process group of its own, forwards the
+ * signals it gets to the group (so a shell and its pipeline all get a
+ * SIGTERM), reaps every process reparented to it and exits with the
+ * status of the program.
+ * It is linked statically: create_container loads it to a memfd and runs
+ * it in a rootfs that has no (or another) libc.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strcmp */
+#include <unistd.h>				/* fork */
+#include <signal.h>				/* sigprocmask */
+#include <sys/types.h>
+#include <sys/wait.h>			/* waitid */
+#include <sys/signalfd.h>		/* signalfd */
+#include <sys/prctl.h>			/* prctl */
+
+/* The reap waits for every process that has exited. It returns the
+ * status of the program (as exit(3) takes it) once the program has
+ * exited, otherwise -1.
+ */
+static int reap(pid_t prog)
+{
+	siginfo_t info;
+	int status = -1;
+
+	for (;;) {
+		info.si_pid = 0;
+		if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG) || info.si_pid == 0)
+			break;
+		if (info.si_pid != prog)
+			continue;
+		/* A program killed by a signal: the same as a shell reports. */
+		status = info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+	}
+
+	return status;
+}
+
+int main(int argc, char **argv)
+{
+	struct signalfd_siginfo si;
+	sigset_t all, old;
+	pid_t prog;
+	int sfd, status;
+
+	if (argc > 1 && strcmp(argv[1], "--") == 0) {
+		argv++;
+		argc--;
+	}
+	if (argc < 2) {
+		fputs("Usage: cinit [--] program [args]\n", stderr);
+		return 2;
+	}
+
+	/* Run from a memfd, the name would be the number of the descriptor. */
+	prctl(PR_SET_NAME, "cinit", 0, 0, 0);
+
+	/* Signals are taken from the signalfd only. PID 1 of a namespace
+	 * gets no signal without a handler from inside the namespace, but
+	 * blocked signals are queued.
+	 */
+	sigfillset(&all);
+	if (sigprocmask(SIG_SETMASK, &all, &old)) {
+		perror("sigprocmask");
+		return 3;
+	}
+
+	sfd = signalfd(-1, &all, SFD_CLOEXEC);
+	if (sfd < 0) {
+		perror("signalfd");
+		return 4;
+	}
+
+	prog = fork();
+	if (prog == -1) {
+		perror("fork");
+		return 5;
+	}
+
+	if (prog == 0) {
+		/* ^C of a terminal goes to the program, as without the init;
+		 * SIGTTOU is still blocked here.
+		 */
+		setpgid(0, 0);
+		if (isatty(0))
+			tcsetpgrp(0, getpgrp());
+		sigprocmask(SIG_SETMASK, &old, NULL);
+		execvp(argv[1], argv + 1);
+		perror(argv[1]);
+		_exit(127);
+	}
+	/* Also here: a signal may come before the child has run. */
+	setpgid(prog, prog);
+
+	for (;;) {
+		if (read(sfd, &si, sizeof(si)) != sizeof(si)) {
+			perror("read signalfd");
+			kill(-prog, SIGKILL);
+			return 6;
+		}
+
+		if (si.ssi_signo != SIGCHLD) {
+			/* The program may have moved to another group. */
+			if (kill(-prog, si.ssi_signo))
+				kill(prog, si.ssi_signo);
+			continue;
+		}
+
+		/* Signals are merged: one SIGCHLD may stand for many exits. */
+		status = reap(prog);
+		if (status >= 0)
+			return status;
+	}
+}
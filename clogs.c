@@ -0,0 +1,234 @@
+/* Print the log of a container written by create_container -l. */
+#define _GNU_SOURCE
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strcmp */
+#include <unistd.h>				/* write */
+#include <poll.h>				/* poll */
+#include <time.h>				/* localtime */
+#include <sys/inotify.h>		/* inotify_init1 */
+#include "lib/logring.h"
+
+enum { int_max = 2147483647, follow_ms = 200 };
+
+struct cmdline_opts {
+	const char *path;
+	int follow;
+	int last;					/* -1 - all records */
+	int timestamps;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("clogs program: print the log of a container\n"
+		 "\n"
+		 "Usage: clogs [options] <log file>\n"
+		 "Example: ./clogs -f -n 10 /tmp/web.log\n"
+		 "\n"
+		 "Options are:\n"
+		 " -f           follow the log\n"
+		 " -n <count>   print the last count chunks only\n"
+		 " -t           print the time of every chunk\n"
+		 " -h           display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->path = NULL;
+	opts->follow = 0;
+	opts->last = -1;
+	opts->timestamps = 0;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if (optc == 'n' && (idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 'f':
+				opts->follow = 1;
+				idx++;
+				break;
+			case 'n':
+				opts->last = pos_atoi(argv[idx + 1]);
+				if (opts->last < 0) {
+					fprintf(stderr, "invalid count\n");
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 't':
+				opts->timestamps = 1;
+				idx++;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else {
+			opts->path = argv[idx];
+			idx++;
+		}
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const char *buf, int len)
+{
+	int n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0)
+			return 1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int print_record(const struct log_record *rec, const char *buf, int timestamps)
+{
+	int fd = rec->stream == log_stderr ? 2 : 1;
+	char stamp[64];
+	time_t sec;
+	int len;
+
+	if (timestamps) {
+		sec = rec->time_ns / 1000000000ULL;
+		len = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&sec));
+		len += snprintf(stamp + len, sizeof(stamp) - len, ".%06u ", (unsigned) (rec->time_ns / 1000 % 1000000));
+		if (write_full(fd, stamp, len))
+			return 1;
+	}
+
+	return write_full(fd, buf, rec->len);
+}
+
+/* The wait_log waits for the shipper to write more: splice(2) to the file
+ * is seen by inotify, the timeout is a fallback.
+ */
+static void wait_log(int ifd)
+{
+	struct pollfd pfd;
+	char buf[4096];
+
+	pfd.fd = ifd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, ifd >= 0 ? 1 : 0, follow_ms) > 0)
+		read(ifd, buf, sizeof(buf));
+}
+
+/* The print_log prints the records from the oldest one still in the log
+ * (or the last count ones), then follows the log if asked. A reader that
+ * falls behind the shipper skips what has been overwritten.
+ */
+static int print_log(const struct cmdline_opts *opts)
+{
+	static char buf[log_chunk];
+	struct log_file lf;
+	struct log_record rec;
+	uint64_t n, head, lost = 0;
+	int ret, ifd = -1;
+
+	if (log_map(&lf, opts->path))
+		return 1;
+
+	head = lf.hdr->rec_head;
+	n = head > lf.hdr->nslots ? head - lf.hdr->nslots : 0;
+	if (opts->last >= 0 && head - n > (uint64_t) opts->last)
+		n = head - opts->last;
+
+	if (opts->follow) {
+		ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		if (ifd >= 0 && inotify_add_watch(ifd, opts->path, IN_MODIFY) < 0) {
+			close(ifd);
+			ifd = -1;
+		}
+	}
+
+	for (;;) {
+		ret = log_read(&lf, n, &rec, buf);
+		if (ret == 0) {
+			if (print_record(&rec, buf, opts->timestamps))
+				break;
+			n++;
+			continue;
+		}
+		if (ret == 2) {
+			lost++;
+			n++;
+			/* Jump to the oldest record which may be intact. */
+			head = lf.hdr->rec_head;
+			if (head > lf.hdr->nslots && n < head - lf.hdr->nslots) {
+				lost += head - lf.hdr->nslots - n;
+				n = head - lf.hdr->nslots;
+			}
+			continue;
+		}
+		if (!opts->follow)
+			break;
+		wait_log(ifd);
+	}
+
+	if (lost)
+		fprintf(stderr, "clogs: %llu chunks are overwritten before they are read\n", (unsigned long long) lost);
+	if (ifd >= 0)
+		close(ifd);
+	log_close(&lf);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.path == NULL) {
+		fprintf(stderr, "Log file must be specified\n");
+		return 2;
+	}
+
+	if (print_log(&opts)) {
+		fprintf(stderr, "print_log is failed\n");
+		return 3;
+	}
+
+	return 0;
+}
@@ -0,0 +1,721 @@
+/* Resource metrics collector for containers started with create_container -n. */
+#define _GNU_SOURCE				/* pread */
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* strtoull */
+#include <string.h>				/* strcmp */
+#include <unistd.h>				/* pread */
+#include <errno.h>				/* EINTR */
+#include <time.h>				/* clock_gettime */
+#include <poll.h>				/* poll */
+#include <dirent.h>				/* opendir */
+#include <sys/types.h>			/* open */
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>			/* mmap */
+#include <sys/inotify.h>		/* inotify_init1 */
+#include <sys/resource.h>		/* setrlimit */
+#include <sys/socket.h>
+#include <linux/rtnetlink.h>	/* RTM_GETSTATS */
+#include <linux/if_link.h>		/* IFLA_STATS_LINK_64 */
+#include "lib/netlinklib.h"
+#include "lib/cgrouplib.h"
+#include "lib/metrics.h"
+
+enum { max_containers = 4096, ifmap_size = max_containers * 2, stat_buf = 4096,
+	def_interval = 1000, def_slots = 65536, veth_tries = 5, int_max = 2147483647
+};
+
+enum { f_cpu, f_mem, f_memstat, f_io, f_pids, nr_files };
+
+static const char *stat_files[nr_files] = {
+	"cpu.stat", "memory.current", "memory.stat", "io.stat", "pids.current"
+};
+
+static const char *def_ring = "/dev/shm/docker-c-metrics";
+
+/* The files of a container are opened once when it is found and then
+ * re-read with pread(2) on every tick.
+ */
+struct container {
+	char name[metrics_name_len];
+	int fd[nr_files];
+	int ifindex;				/* host side veth, 0 if unknown */
+	int tries;					/* attempts to find the veth */
+	struct metrics_sample sample;
+};
+
+struct collector {
+	struct container ct[max_containers];
+	int n;
+	int ifmap[ifmap_size];		/* ifindex hash -> index in ct + 1 */
+	int sock;
+	struct metrics_ring *ring;
+};
+
+struct cmdline_opts {
+	const char *ring_path;
+	int interval;
+	int nslots;
+	int read;
+};
+
+static struct collector coll;
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cmetrics program: sample resource usage of all containers\n"
+		 "\n"
+		 "Usage: cmetrics [options]\n"
+		 "Example: ./cmetrics -i 1000 & ./cmetrics -r\n"
+		 "\n"
+		 "Options are:\n"
+		 " -o <file>      ring buffer file (default /dev/shm/docker-c-metrics)\n"
+		 " -i <ms>        sampling interval (default 1000)\n"
+		 " -s <slots>     number of samples in the ring (default 65536)\n"
+		 " -r             print the latest samples from the ring and exit\n"
+		 " -h             display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->ring_path = def_ring;
+	opts->interval = def_interval;
+	opts->nslots = def_slots;
+	opts->read = 0;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		char optc;
+
+		if (argv[idx][0] != '-') {
+			fprintf(stderr, "stray parameter '%s'\n", argv[idx]);
+			return 1;
+		}
+
+		optc = argv[idx][1];
+		if ((optc == 'o' || optc == 'i' || optc == 's') && idx + 1 >= argc) {
+			fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+			return 2;
+		}
+
+		switch (optc) {
+		case 'o':
+			opts->ring_path = argv[idx + 1];
+			idx += 2;
+			break;
+		case 'i':
+			opts->interval = pos_atoi(argv[idx + 1]);
+			if (opts->interval <= 0) {
+				fprintf(stderr, "invalid interval\n");
+				return 3;
+			}
+			idx += 2;
+			break;
+		case 's':
+			opts->nslots = pos_atoi(argv[idx + 1]);
+			if (opts->nslots <= 0) {
+				fprintf(stderr, "invalid number of slots\n");
+				return 3;
+			}
+			idx += 2;
+			break;
+		case 'r':
+			opts->read = 1;
+			idx++;
+			break;
+		case 'h':
+			help();
+			exit(0);
+		default:
+			fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+			return 4;
+		}
+	}
+
+	return 0;
+}
+
+/* The map_ring maps the ring file, creating it if needed. */
+static struct metrics_ring *map_ring(const char *path, int nslots, int writer)
+{
+	struct metrics_ring *ring;
+	struct stat st;
+	size_t size;
+	int fd;
+
+	fd = open(path, writer ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	if (writer) {
+		size = METRICS_RING_SIZE(nslots);
+		if (ftruncate(fd, size)) {
+			perror("ftruncate");
+			close(fd);
+			return NULL;
+		}
+	} else {
+		if (fstat(fd, &st) || st.st_size < sizeof(struct metrics_ring)) {
+			fprintf(stderr, "%s is not a metrics ring\n", path);
+			close(fd);
+			return NULL;
+		}
+		size = st.st_size;
+	}
+
+	ring = mmap(NULL, size, writer ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	if (writer) {
+		if (ring->magic != metrics_magic || ring->version != metrics_version || ring->nslots != nslots ||
+			ring->sample_size != sizeof(struct metrics_sample)) {
+			memset(ring, 0, sizeof(struct metrics_ring));
+			ring->nslots = nslots;
+			ring->sample_size = sizeof(struct metrics_sample);
+			ring->version = metrics_version;
+			__sync_synchronize();
+			ring->magic = metrics_magic;
+		}
+	} else if (ring->magic != metrics_magic || ring->version != metrics_version ||
+			   ring->sample_size != sizeof(struct metrics_sample) || METRICS_RING_SIZE(ring->nslots) > size) {
+		fprintf(stderr, "%s is not a metrics ring\n", path);
+		munmap(ring, size);
+		return NULL;
+	}
+
+	return ring;
+}
+
+/* The ring_write publishes a sample (see lib/metrics.h). */
+static void ring_write(struct metrics_ring *ring, struct metrics_sample *sample)
+{
+	uint64_t n = ring->head;
+	struct metrics_sample *slot = &ring->slots[n % ring->nslots];
+
+	slot->seq = 2 * n + 1;
+	__sync_synchronize();
+	memcpy((char *) slot + sizeof(slot->seq), (char *) sample + sizeof(sample->seq),
+		   sizeof(*sample) - sizeof(sample->seq));
+	__sync_synchronize();
+	slot->seq = 2 * n + 2;
+	__sync_synchronize();
+	ring->head = n + 1;
+}
+
+/* The ring_read copies sample number n. It returns 1 if the sample has
+ * been overwritten meanwhile.
+ */
+static int ring_read(const struct metrics_ring *ring, uint64_t n, struct metrics_sample *sample)
+{
+	const struct metrics_sample *slot = &ring->slots[n % ring->nslots];
+	uint64_t seq;
+
+	seq = slot->seq;
+	__sync_synchronize();
+	memcpy(sample, slot, sizeof(*sample));
+	__sync_synchronize();
+
+	return seq != 2 * n + 2 || slot->seq != seq;
+}
+
+/* The read_key returns the value of "key value" line of a flat keyed file. */
+static uint64_t read_key(const char *buf, const char *key)
+{
+	int len = strlen(key);
+	const char *p = buf;
+
+	while (p && *p) {
+		if (!strncmp(p, key, len) && p[len] == ' ')
+			return strtoull(p + len + 1, NULL, 10);
+		p = strchr(p, '\n');
+		if (p)
+			p++;
+	}
+
+	return 0;
+}
+
+/* The read_io sums the nested keyed io.stat over all devices. */
+static void read_io(const char *buf, struct metrics_sample *s)
+{
+	const char *p = buf;
+
+	s->io_rbytes = s->io_wbytes = s->io_rios = s->io_wios = 0;
+	while ((p = strchr(p, '=')) != NULL) {
+		const char *key = p;
+		uint64_t val = strtoull(p + 1, NULL, 10);
+
+		while (key > buf && key[-1] != ' ')
+			key--;
+		if (!strncmp(key, "rbytes=", 7))
+			s->io_rbytes += val;
+		else if (!strncmp(key, "wbytes=", 7))
+			s->io_wbytes += val;
+		else if (!strncmp(key, "rios=", 5))
+			s->io_rios += val;
+		else if (!strncmp(key, "wios=", 5))
+			s->io_wios += val;
+		p++;
+	}
+}
+
+/* The read_stat re-reads a stat file from the beginning. Missing files
+ * (controller not enabled) read as empty.
+ */
+static int read_stat(int fd, char *buf)
+{
+	int n;
+
+	buf[0] = '\0';
+	if (fd < 0)
+		return 0;
+
+	n = pread(fd, buf, stat_buf - 1, 0);
+	if (n < 0)
+		return errno == ENODEV ? 1 : 0;
+
+	buf[n] = '\0';
+	return 0;
+}
+
+/* The sample_container reads all cgroup stats of a container. It returns
+ * 1 if the cgroup has been removed.
+ */
+static int sample_container(struct container *ct)
+{
+	char buf[stat_buf];
+	struct metrics_sample *s = &ct->sample;
+
+	if (read_stat(ct->fd[f_cpu], buf))
+		return 1;
+	s->cpu_usage_usec = read_key(buf, "usage_usec");
+	s->cpu_user_usec = read_key(buf, "user_usec");
+	s->cpu_system_usec = read_key(buf, "system_usec");
+	s->cpu_throttled_usec = read_key(buf, "throttled_usec");
+
+	read_stat(ct->fd[f_mem], buf);
+	s->mem_current = strtoull(buf, NULL, 10);
+
+	read_stat(ct->fd[f_memstat], buf);
+	s->mem_anon = read_key(buf, "anon");
+	s->mem_file = read_key(buf, "file");
+
+	read_stat(ct->fd[f_io], buf);
+	read_io(buf, s);
+
+	read_stat(ct->fd[f_pids], buf);
+	s->pids_current = strtoull(buf, NULL, 10);
+
+	return 0;
+}
+
+/* The link_netns_cb remembers the host side veth of the netns with id
+ * found in *arg (links with IFLA_LINK_NETNSID point to other namespaces).
+ */
+static int link_netns_cb(struct nlmsghdr *nlh, void *arg)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_MAX + 1];
+	int *nsid_ifindex = arg;
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return 0;
+
+	parse_rtattr(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+	if (tb[IFLA_LINK_NETNSID] && *(int *) RTA_DATA(tb[IFLA_LINK_NETNSID]) == nsid_ifindex[0])
+		nsid_ifindex[1] = ifi->ifi_index;
+
+	return 0;
+}
+
+/* The find_veth finds the host side veth of the container: the link whose
+ * peer lives in the network namespace of the first process of the cgroup.
+ */
+static int find_veth(int sock, const char *name)
+{
+	char buf[cgroup_max_path];
+	char msg[page_size];
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	int nsid_ifindex[2] = { -1, 0 };
+	int fd, pid = 0;
+	FILE *f;
+
+	if (cgroup_path(name, "cgroup.procs", buf, cgroup_max_path))
+		return 0;
+	f = fopen(buf, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%d", &pid) != 1)
+		pid = 0;
+	fclose(f);
+	if (!pid)
+		return 0;
+
+	snprintf(buf, cgroup_max_path, "/proc/%d/ns/net", pid);
+	fd = open(buf, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	memset(&msg, 0, page_size);
+	nlh = (struct nlmsghdr *) msg;
+	ifi = (struct ifinfomsg *) NLMSG_DATA(nlh);
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	nlh->nlmsg_type = RTM_GETLINK;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	ifi->ifi_family = AF_UNSPEC;
+
+	/* Dumping links assigns an id to the peer netns if it has none yet. */
+	nsid_ifindex[0] = netns_id(sock, fd);
+	if (nsid_ifindex[0] < 0) {
+		netlink_dump(sock, nlh, link_netns_cb, nsid_ifindex);
+		nsid_ifindex[0] = netns_id(sock, fd);
+	}
+	if (nsid_ifindex[0] >= 0)
+		netlink_dump(sock, nlh, link_netns_cb, nsid_ifindex);
+
+	close(fd);
+	return nsid_ifindex[1];
+}
+
+/* The rebuild_ifmap rebuilds the ifindex hash after containers change. */
+static void rebuild_ifmap(void)
+{
+	int i, h;
+
+	memset(coll.ifmap, 0, sizeof(coll.ifmap));
+	for (i = 0; i < coll.n; i++) {
+		if (!coll.ct[i].ifindex)
+			continue;
+		for (h = coll.ct[i].ifindex % ifmap_size; coll.ifmap[h]; h = (h + 1) % ifmap_size);
+		coll.ifmap[h] = i + 1;
+	}
+}
+
+static struct container *lookup_ifindex(int ifindex)
+{
+	int h, i;
+
+	for (h = ifindex % ifmap_size; coll.ifmap[h]; h = (h + 1) % ifmap_size) {
+		i = coll.ifmap[h] - 1;
+		if (coll.ct[i].ifindex == ifindex)
+			return &coll.ct[i];
+	}
+
+	return NULL;
+}
+
+static void add_container(const char *name)
+{
+	char buf[cgroup_max_path];
+	struct container *ct;
+	int i;
+
+	for (i = 0; i < coll.n; i++) {
+		if (!strcmp(coll.ct[i].name, name))
+			return;
+	}
+	if (coll.n == max_containers || strlen(name) >= metrics_name_len)
+		return;
+
+	ct = &coll.ct[coll.n];
+	memset(ct, 0, sizeof(*ct));
+	strcpy(ct->name, name);
+	strcpy(ct->sample.name, name);
+	for (i = 0; i < nr_files; i++) {
+		ct->fd[i] = -1;
+		if (!cgroup_path(name, stat_files[i], buf, cgroup_max_path))
+			ct->fd[i] = open(buf, O_RDONLY | O_CLOEXEC);
+	}
+	if (ct->fd[f_cpu] < 0) {
+		for (i = 0; i < nr_files; i++) {
+			if (ct->fd[i] >= 0)
+				close(ct->fd[i]);
+		}
+		return;
+	}
+
+	ct->ifindex = find_veth(coll.sock, name);
+	coll.n++;
+}
+
+static void del_container(int idx)
+{
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		if (coll.ct[idx].fd[i] >= 0)
+			close(coll.ct[idx].fd[i]);
+	}
+	coll.ct[idx] = coll.ct[--coll.n];
+}
+
+/* The scan_containers adds every cgroup under docker-c. It runs at start
+ * and when inotify reports a new cgroup.
+ */
+static void scan_containers(void)
+{
+	char buf[cgroup_max_path];
+	struct dirent *ent;
+	DIR *dir;
+
+	if (cgroup_dir(buf, cgroup_max_path))
+		return;
+
+	dir = opendir(buf);
+	if (!dir)
+		return;
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_type == DT_DIR && ent->d_name[0] != '.')
+			add_container(ent->d_name);
+	}
+	closedir(dir);
+
+	rebuild_ifmap();
+}
+
+static int stats_cb(struct nlmsghdr *nlh, void *arg)
+{
+	struct if_stats_msg *ifsm = NLMSG_DATA(nlh);
+	struct rtattr *tb[IFLA_STATS_MAX + 1];
+	struct rtnl_link_stats64 *st;
+	struct container *ct;
+
+	if (nlh->nlmsg_type != RTM_NEWSTATS)
+		return 0;
+
+	ct = lookup_ifindex(ifsm->ifindex);
+	if (!ct)
+		return 0;
+
+	parse_rtattr(tb, IFLA_STATS_MAX, (struct rtattr *) ((char *) ifsm + NLMSG_ALIGN(sizeof(*ifsm))),
+				 nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm)));
+	if (!tb[IFLA_STATS_LINK_64])
+		return 0;
+
+	/* What the host side receives the container has sent. */
+	st = RTA_DATA(tb[IFLA_STATS_LINK_64]);
+	ct->sample.net_rx_bytes = st->tx_bytes;
+	ct->sample.net_tx_bytes = st->rx_bytes;
+	ct->sample.net_rx_packets = st->tx_packets;
+	ct->sample.net_tx_packets = st->rx_packets;
+	ct->sample.net_rx_dropped = st->tx_dropped;
+	ct->sample.net_tx_dropped = st->rx_dropped;
+
+	return 0;
+}
+
+/* The sample_links gets counters of all links in one RTM_GETSTATS dump. */
+static void sample_links(void)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh;
+	struct if_stats_msg *ifsm;
+
+	memset(&msg, 0, page_size);
+	nlh = (struct nlmsghdr *) msg;
+	ifsm = (struct if_stats_msg *) NLMSG_DATA(nlh);
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg));
+	nlh->nlmsg_type = RTM_GETSTATS;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	ifsm->family = AF_UNSPEC;
+	ifsm->filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+
+	netlink_dump(coll.sock, nlh, stats_cb, NULL);
+}
+
+static void sample_all(void)
+{
+	struct timespec ts;
+	uint64_t now;
+	int i, changed = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	for (i = coll.n - 1; i >= 0; i--) {
+		if (sample_container(&coll.ct[i])) {
+			del_container(i);
+			changed = 1;
+		}
+	}
+
+	/* A cgroup is seen before the launcher has moved the container in. */
+	for (i = 0; i < coll.n; i++) {
+		if (!coll.ct[i].ifindex && coll.ct[i].tries < veth_tries) {
+			coll.ct[i].tries++;
+			coll.ct[i].ifindex = find_veth(coll.sock, coll.ct[i].name);
+			changed |= coll.ct[i].ifindex != 0;
+		}
+	}
+
+	if (changed)
+		rebuild_ifmap();
+
+	for (i = 0; i < coll.n; i++) {
+		if (coll.ct[i].ifindex) {
+			sample_links();
+			break;
+		}
+	}
+
+	for (i = 0; i < coll.n; i++) {
+		coll.ct[i].sample.time_ns = now;
+		ring_write(coll.ring, &coll.ct[i].sample);
+	}
+}
+
+static void raise_nofile(void)
+{
+	struct rlimit rl;
+
+	if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* The collect samples all containers every interval until killed. New
+ * containers are picked up through inotify on the docker-c cgroup.
+ */
+static int collect(struct cmdline_opts *opts)
+{
+	char buf[cgroup_max_path];
+	char ev[page_size];
+	struct pollfd pfd;
+	uint64_t next;
+	int timeout;
+
+	raise_nofile();
+
+	coll.ring = map_ring(opts->ring_path, opts->nslots, 1);
+	if (!coll.ring)
+		return 1;
+
+	coll.sock = create_socket();
+	if (coll.sock < 0)
+		return 2;
+
+	if (cgroup_dir(buf, cgroup_max_path))
+		return 3;
+	if (mkdir(buf, 0755) && errno != EEXIST) {
+		perror(buf);
+		return 4;
+	}
+
+	pfd.fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0 || inotify_add_watch(pfd.fd, buf, IN_CREATE | IN_ONLYDIR) < 0) {
+		perror("inotify");
+		return 5;
+	}
+
+	scan_containers();
+	next = now_ms();
+	for (;;) {
+		timeout = next > now_ms() ? next - now_ms() : 0;
+		if (poll(&pfd, 1, timeout) > 0) {
+			while (read(pfd.fd, ev, sizeof(ev)) > 0);
+			scan_containers();
+			continue;
+		}
+
+		sample_all();
+		next += opts->interval;
+	}
+
+	return 0;
+}
+
+/* The print_latest prints the samples of the latest tick. */
+static int print_latest(struct cmdline_opts *opts)
+{
+	struct metrics_ring *ring;
+	struct metrics_sample s;
+	uint64_t head, n, last = 0;
+
+	ring = map_ring(opts->ring_path, 0, 0);
+	if (!ring)
+		return 1;
+
+	printf("%-16s %12s %12s %12s %12s %6s %12s %12s\n", "NAME", "CPU_USEC", "MEM", "IO_READ",
+		   "IO_WRITE", "PIDS", "NET_RX", "NET_TX");
+
+	head = ring->head;
+	__sync_synchronize();
+	for (n = head; n > 0 && head - n < ring->nslots; n--) {
+		if (ring_read(ring, n - 1, &s))
+			break;
+		if (last && s.time_ns != last)
+			break;
+		last = s.time_ns;
+		s.name[metrics_name_len - 1] = '\0';
+		printf("%-16s %12llu %12llu %12llu %12llu %6llu %12llu %12llu\n", s.name,
+			   (unsigned long long) s.cpu_usage_usec, (unsigned long long) s.mem_current,
+			   (unsigned long long) s.io_rbytes, (unsigned long long) s.io_wbytes,
+			   (unsigned long long) s.pids_current, (unsigned long long) s.net_rx_bytes,
+			   (unsigned long long) s.net_tx_bytes);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.read)
+		return print_latest(&opts) ? 2 : 0;
+
+	if (collect(&opts)) {
+		fprintf(stderr, "collect is failed\n");
+		return 3;
+	}
+
+	return 0;
+}
@@ -0,0 +1,389 @@
+/* Userspace port proxy into a container (see create_container -P) and
+ * its benchmark: splice(2) against a plain read/write copy loop.
+ */
+#define _GNU_SOURCE				/* wait4 */
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strchr */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* EINTR */
+#include <fcntl.h>				/* open */
+#include <signal.h>				/* sigwait */
+#include <time.h>				/* clock_gettime */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>		/* struct rusage */
+#include <sys/wait.h>			/* wait4 */
+#include <sys/socket.h>			/* socket */
+#include <netinet/in.h>			/* sockaddr_in */
+#include <arpa/inet.h>			/* htons */
+#include "lib/portproxy.h"
+
+enum { max_path = 32, int_max = 2147483647, bench_port = 18231, bench_chunk = 64 * 1024 };
+
+struct cmdline_opts {
+	int target;
+	int workers;
+	int copy;
+	int bench_mb;
+	struct proxy_port ports[proxy_max_ports];
+	int nports;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cproxy program: forward host TCP ports into a container\n"
+		 "\n"
+		 "Usage: cproxy [options] <host port>:<addr>:<port>...\n"
+		 "       cproxy -B <MB>\n"
+		 "Example: ./cproxy -t 1234 8080:127.0.0.1:80\n"
+		 "\n"
+		 "Options are:\n"
+		 " -t <pid>      connect in the network namespace of pid\n"
+		 " -w <workers>  number of workers (default one per CPU)\n"
+		 " -c            copy with read/write instead of splice\n"
+		 " -B <MB>       benchmark: send MB through the proxy on the loopback\n"
+		 "               with splice and with the copy loop, one worker each\n"
+		 " -h            display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The parse_port parses <host port>:<addr>:<port>. */
+static int parse_port(char *spec, struct proxy_port *p)
+{
+	char *addr, *port;
+
+	addr = strchr(spec, ':');
+	port = addr ? strchr(addr + 1, ':') : NULL;
+	if (!port) {
+		fprintf(stderr, "port spec is <host port>:<addr>:<port>\n");
+		return 1;
+	}
+	*addr++ = '\0';
+	*port++ = '\0';
+
+	p->host_port = pos_atoi(spec);
+	p->addr = addr;
+	p->port = pos_atoi(port);
+	if (p->host_port <= 0 || p->host_port > 65535 || p->port <= 0 || p->port > 65535) {
+		fprintf(stderr, "invalid port %s:%s\n", spec, port);
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->target = 0;
+	opts->workers = 0;
+	opts->copy = 0;
+	opts->bench_mb = 0;
+	opts->nports = 0;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if ((optc == 't' || optc == 'w' || optc == 'B') && (idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 't':
+				opts->target = pos_atoi(argv[idx + 1]);
+				if (opts->target <= 0) {
+					fprintf(stderr, "invalid pid for target\n");
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 'w':
+				opts->workers = pos_atoi(argv[idx + 1]);
+				if (opts->workers <= 0 || opts->workers > proxy_max_workers) {
+					fprintf(stderr, "number of workers must be in 1..%d\n", proxy_max_workers);
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 'B':
+				opts->bench_mb = pos_atoi(argv[idx + 1]);
+				if (opts->bench_mb <= 0) {
+					fprintf(stderr, "invalid size of the benchmark\n");
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 'c':
+				opts->copy = 1;
+				idx++;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else {
+			if (opts->nports == proxy_max_ports) {
+				fprintf(stderr, "too many ports\n");
+				return 4;
+			}
+			if (parse_port(argv[idx], &opts->ports[opts->nports++]))
+				return 5;
+			idx++;
+		}
+	}
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_time(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/* The start_sink forks a server on the loopback which reads everything
+ * it is sent and answers with the number of bytes read. It returns the
+ * pid of the server and its port in *port.
+ */
+static int start_sink(int *port)
+{
+	static char buf[bench_chunk];
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	long long total;
+	int lsock, conn, n, pid;
+
+	lsock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lsock < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lsock, (struct sockaddr *) &sa, sizeof(sa)) || listen(lsock, 1) ||
+		getsockname(lsock, (struct sockaddr *) &sa, &len)) {
+		perror("sink");
+		close(lsock);
+		return -1;
+	}
+	*port = ntohs(sa.sin_port);
+
+	pid = fork();
+	if (pid == -1)
+		perror("fork sink");
+	if (pid != 0) {
+		close(lsock);
+		return pid;
+	}
+
+	conn = accept(lsock, NULL, NULL);
+	if (conn < 0) {
+		perror("accept");
+		_exit(1);
+	}
+	total = 0;
+	while ((n = read(conn, buf, bench_chunk)) > 0)
+		total += n;
+	write(conn, &total, sizeof(total));
+	_exit(0);
+}
+
+/* The send_data sends mb megabytes to port on the loopback and waits for
+ * the sink to confirm them.
+ */
+static int send_data(int port, int mb)
+{
+	static char buf[bench_chunk];
+	struct sockaddr_in sa;
+	long long total, sent = (long long) mb * 1024 * 1024, left;
+	int sock, n, ret = 0;
+
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+		perror("connect");
+		close(sock);
+		return 2;
+	}
+
+	memset(buf, 'x', bench_chunk);
+	for (left = sent; left > 0; left -= n) {
+		n = write(sock, buf, left < bench_chunk ? left : bench_chunk);
+		if (n < 0) {
+			perror("write");
+			ret = 3;
+			goto out;
+		}
+	}
+	shutdown(sock, SHUT_WR);
+
+	if (read(sock, &total, sizeof(total)) != sizeof(total) || total != sent) {
+		fprintf(stderr, "the sink has not got all data\n");
+		ret = 4;
+	}
+
+ out:
+	close(sock);
+	return ret;
+}
+
+/* The bench_mode runs one transfer through a proxy with one worker and
+ * prints the throughput and the CPU time the proxy has used.
+ */
+static int bench_mode(int mb, int copy)
+{
+	struct proxy_port port;
+	struct proxy_conf conf;
+	struct rusage ru;
+	double start, secs;
+	int sink, proxy, ret;
+
+	sink = start_sink(&port.port);
+	if (sink < 0)
+		return 1;
+
+	port.host_port = bench_port;
+	port.addr = "127.0.0.1";
+	memset(&conf, 0, sizeof(conf));
+	conf.netns = -1;
+	conf.workers = 1;
+	conf.copy = copy;
+	conf.bind_addr = "127.0.0.1";
+	conf.ports = &port;
+	conf.nports = 1;
+
+	proxy = proxy_start(&conf);
+	if (proxy < 0) {
+		kill(sink, SIGKILL);
+		waitpid(sink, NULL, 0);
+		return 2;
+	}
+
+	start = now();
+	ret = send_data(bench_port, mb);
+	secs = now() - start;
+
+	kill(proxy, SIGTERM);
+	wait4(proxy, NULL, 0, &ru);
+	kill(sink, SIGKILL);
+	waitpid(sink, NULL, 0);
+	if (ret)
+		return 3;
+
+	printf("%-6s %6d MB %8.1f MB/s  proxy cpu %.3f s (%.3f s/GB)\n", copy ? "copy" : "splice", mb, mb / secs,
+		   cpu_time(&ru), cpu_time(&ru) * 1024 / mb);
+	return 0;
+}
+
+/* The run_proxy runs the proxy until SIGINT or SIGTERM. */
+static int run_proxy(const struct cmdline_opts *opts)
+{
+	struct proxy_conf conf;
+	char buf[max_path];
+	sigset_t mask;
+	int pid, sig;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.netns = -1;
+	conf.workers = opts->workers;
+	conf.copy = opts->copy;
+	conf.ports = opts->ports;
+	conf.nports = opts->nports;
+
+	if (opts->target) {
+		snprintf(buf, max_path, "/proc/%d/ns/net", opts->target);
+		conf.netns = open(buf, O_RDONLY | O_CLOEXEC);
+		if (conf.netns < 0) {
+			perror("open ns/net");
+			return 1;
+		}
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	pid = proxy_start(&conf);
+	if (conf.netns >= 0)
+		close(conf.netns);
+	if (pid < 0)
+		return 2;
+
+	sigwait(&mask, &sig);
+	proxy_stop(pid);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.bench_mb) {
+		if (bench_mode(opts.bench_mb, 0) || bench_mode(opts.bench_mb, 1))
+			return 2;
+		return 0;
+	}
+
+	if (opts.nports == 0) {
+		fprintf(stderr, "At least one port must be specified\n");
+		return 3;
+	}
+
+	if (run_proxy(&opts)) {
+		fprintf(stderr, "run_proxy is failed\n");
+		return 4;
+	}
+
+	return 0;
+}
@@ -11,11 +11,69 @@
 #include <stdlib.h>				/* exit */
 #include <string.h>				/* strlen */
 #include "lib/netlinklib.h"
+#include "lib/execagent.h"
+#include "lib/teardown.h"
+#include "lib/cgrouplib.h"
+#include "lib/nftlib.h"
+#include "lib/portproxy.h"
+#include "lib/logring.h"
+#include "lib/seccomplib.h"
+#include "lib/helperlib.h"
+#include "lib/layerstore.h"
+#include "lib/prewarm.h"
+#include "lib/psimon.h"
+#include "lib/fastpath.h"
+#include "lib/launcher.h"
 #include <signal.h>				/* SIGCHILD */
 #include <sys/wait.h>			/* wait */
 #include <grp.h>				/* setgroups */
+#include <linux/if_link.h>		/* MACVLAN_MODE_BRIDGE */
+#include <linux/pkt_sched.h>	/* TC_H_ROOT */
+#include <limits.h>				/* PATH_MAX */
+#include <sys/fsuid.h>			/* setfsuid */
+#include <time.h>				/* clock_gettime */
+
+enum { stack_size = 1024 * 64, max_path = 32, max_features = 8, max_ports = 16, int_max = 2147483647 };
+
+/* Network tuning from the -N spec. */
+struct net_tuning {
+	struct link_opts link;
+	const char *rps_mask;
+	int xps;
+	const char *feature[max_features];
+	int on[max_features];
+	int nfeatures;
+};
+
+/* Traffic control of the host side of the veth pair from the -Q spec,
+ * rates in bytes per second, 0 - unlimited. The qdisc shapes the traffic
+ * to the container, the police drops the traffic from it above the rate.
+ */
+struct net_shaping {
+	const char *qdisc;			/* fq_codel, tbf, htb or NULL */
+	unsigned long long rate;
+	unsigned int burst;			/* bytes, 0 - 10 ms of the rate */
+	int latency_ms;				/* tbf queue */
+	unsigned long long police;
+	unsigned int police_burst;
+};
+
+/* A unit of a rate or size in the -Q spec: value * mult / div. */
+struct unit {
+	const char *suffix;
+	unsigned long long mult;
+	int div;
+};
+
+static const struct unit rate_units[] = {
+	{"", 1, 8}, {"bit", 1, 8}, {"kbit", 1000, 8}, {"mbit", 1000000, 8}, {"gbit", 1000000000, 8},
+	{"bps", 1, 1}, {"kbps", 1000, 1}, {"mbps", 1000000, 1}, {"gbps", 1000000000, 1}, {NULL, 0, 0}
+};
 
-enum { stack_size = 1024 * 8, max_path = 32 };
+static const struct unit size_units[] = {
+	{"", 1, 1}, {"b", 1, 1}, {"k", 1 << 10, 1}, {"kb", 1 << 10, 1}, {"m", 1 << 20, 1}, {"mb", 1 << 20, 1},
+	{NULL, 0, 0}
+};
 
 static char child_stack[stack_size];
 
@@ -27,17 +85,709 @@ struct veth_netns {
 	const char *ip_addr_peer;
 	int ip_peer_prefix;
 	int child_pid;
+	const struct net_tuning *tuning;
+	const struct net_shaping *shaping;	/* NULL - none */
+	int fp_map;					/* map of the fast path, -1 - none */
+};
+
+/* A macvlan or ipvlan link given by -L. It replaces the veth pair: the
+ * launcher creates it in the netns of the child and the child sets it up.
+ */
+struct link_spec {
+	const char *kind;			/* NULL - veth pair */
+	int mode;
+	char *parent;
+	char *addr;
+	int prefix;
+	char *gw;
 };
 
 struct child_args {
 	char **argv;
 	int pipe_fd[2];
+	int agent_sock;
+	const struct link_spec *link;
+	const struct veth_netns *veth;
+	int log_fds[2];				/* stdout and stderr, -1 - inherited */
+	const struct sc_filter *seccomp;
+	int init_fd;				/* memfd of cinit, -1 - no init */
+	const char *overlay;		/* NULL, ovl_tmpfs or a directory */
+	const char *layers;			/* of the -i image, top first, or NULL */
+	int tree;					/* mount of the image, see clone_tree */
+};
+
+struct cmdline_opts {
+	const char *name;
+	const char *agent_path;
+	struct net_tuning tuning;
+	struct net_shaping shaping;
+	const char *uplink;			/* of the fast path */
+	struct link_spec link;
+	struct nft_port ports[max_ports];
+	int nports;
+	struct proxy_port proxy_ports[proxy_max_ports];
+	int nproxy;
+	const char *log_path;
+	int log_mb;
+	const char *seccomp_path;
+	int init;
+	const char *overlay;
+	const char *image;
+	const char *prewarm;
+	int prewarm_evict;			/* drop the image from the cache to record */
+	int psi_ms;					/* stall per second to report, 0 - none */
+	int psi_high_mb;			/* initial memory.high, 0 - unset */
+	int psi_max_mb;				/* memory.high is not raised above it */
+	const char *daemon_path;	/* socket of -D, NULL - one container */
+	int workers;				/* of -D, 0 - one per CPU */
+	char **argv;
+};
+
+/* What the containers of a launcher share: the one container of main or
+ * those the daemon creates.
+ */
+struct launcher {
+	const struct cmdline_opts *opts;
+	struct teardown_queue td;
+	char image_root[PATH_MAX];
+	struct child_args args;		/* the template of the children */
+	int fp_map;					/* map of the fast path, -1 - none */
+};
+
+/* A container being launched, see launch. */
+struct container {
+	const char *name;			/* NULL - no cgroup */
+	struct child_args args;
+	struct veth_netns vn;
+	char ifname[max_path];
+	char peername[max_path];
+	char ip_if[max_path];
+	char ip_peer[max_path];
+	int pid;					/* 0 - not cloned */
+	int pidfd;					/* -1 - not asked for */
 };
 
 static char *def_prog[] = { "/bin/sh", NULL };
 
+/* The overlay of -O tmpfs lives on a tmpfs mounted over ovl_stage in the
+ * mount namespace of the container, so the host sees an empty directory.
+ */
+static const char ovl_tmpfs[] = "tmpfs";
+static const char ovl_stage[] = "/run/docker-c";
+
+/* The store of cimage; -i takes the layers of an image from there. */
+static const char *def_store = "/var/lib/docker-c";
+
+/* Root of the container on the host, see the uid and gid maps. */
+enum { cont_root_id = 500 };
+
+/* The init, next to the launcher; it is not in the rootfs. */
+static char init_name[] = "cinit";
+
+/* The window of the -M stall, the shortest one is 500 ms. */
+enum { psi_window_us = 1000000 };
+
+/* The memory.high of the -M monitor and its ceiling, in bytes. */
+struct psi_limit {
+	long long high;
+	long long max;
+};
+
+/* The daemon gives each container a /30 of 172.20.0.0/20 by its slot. */
+static const char *daemon_net = "172.20";
+
+/* The queue of -Q qdisc=tbf holds this much of the rate. */
+enum { tbf_def_latency_ms = 50 };
+
+/* Name of the macvlan/ipvlan link in the container. */
+static const char *upper_ifname = "eth0";
+
 /*static char *def_prog[] = { "nc", "nc", "-l", "172.16.0.3", "7070", NULL };*/
 
+/* The help prints information about using program. */
+static void help()
+{
+	puts("create_container program: run a program in a new container\n"
+		 "\n"
+		 "Usage: create_container [options] [program [args]]\n"
+		 "Example: ./create_container -e /tmp/container.sock /bin/sh\n"
+		 "\n"
+		 "Options are:\n"
+		 " -n <name>    name of container, puts it in cgroup docker-c/<name>\n"
+		 " -e <socket>  start exec agent listening on unix socket (see cexec)\n"
+		 " -N <spec>    tune the veth pair, spec is a comma separated list of\n"
+		 "              queues=N, txq=N, rxq=N, mtu=N, gso_max=N, gro_max=N,\n"
+		 "              txqlen=N, rps=<hex cpu mask>, xps (a CPU per tx queue)\n"
+		 "              and offloads <feature>=on|off (gro, gso, tso, lro or\n"
+		 "              any ethtool -k name)\n"
+		 " -Q <spec>    shape the traffic of the veth pair, spec is a comma\n"
+		 "              separated list of qdisc=fq_codel|tbf|htb, rate=<rate>,\n"
+		 "              burst=<size> and latency=<ms> (tbf) for the traffic to\n"
+		 "              the container, police=<rate> and pburst=<size> drop the\n"
+		 "              traffic from it above the rate; rates in bit, kbit, mbit,\n"
+		 "              gbit or bps, kbps, mbps, gbps, sizes in b, k or m\n"
+		 " -B <uplink>  fast path: move packets between the uplink and the veth\n"
+		 "              pair with tc BPF programs (bpf_redirect_peer and\n"
+		 "              bpf_redirect_neigh) instead of the host stack\n"
+		 " -L <spec>    use macvlan or ipvlan over a host link instead of veth,\n"
+		 "              spec is <macvlan|ipvlan-l2|ipvlan-l3>:<parent>:<ip>/<prefix>[:<gw>]\n"
+		 " -p <spec>    publish a TCP port of the container (may be repeated),\n"
+		 "              <host port>:<port> is DNATed from every host address,\n"
+		 "              <port>/notrack skips conntrack for traffic sent to the\n"
+		 "              container address directly; veth only. Forwarding from\n"
+		 "              other hosts needs net.ipv4.ip_forward=1\n"
+		 " -P <spec>    forward a host TCP port to 127.0.0.1:<port> in the\n"
+		 "              container with a userspace proxy (may be repeated),\n"
+		 "              spec is <host port>:<port>; needs no firewall\n"
+		 " -l <file>[:<MB>]  write stdout and stderr of the container to a ring\n"
+		 "              log file of MB megabytes (default 16), see clogs\n"
+		 " -S <profile>  confine the program and the exec agent with a seccomp\n"
+		 "              profile, see cseccomp and seccomp.profile\n"
+		 " -I           run the program under a minimal init (cinit next to\n"
+		 "              create_container, it needs not be in the rootfs)\n"
+		 "              which reaps orphans and forwards signals\n"
+		 " -O <dir>     mount the rootfs as an overlay: the image is the read-only\n"
+		 "              lower layer, changes go to <dir>/upper (kept after the\n"
+		 "              container exits) or, with -O tmpfs, to memory\n"
+		 " -i <image>   run an image of the store (see cimage) instead of\n"
+		 "              alpine: its layers are the lower directories of the\n"
+		 "              overlay, -O tmpfs unless -O is given\n"
+		 " -W <profile>[:evict]  prewarm the page cache with the files the\n"
+		 "              image needs to start, while the container is set up;\n"
+		 "              the first run (without the profile) records it, with\n"
+		 "              evict from a cold cache: the image is dropped from the\n"
+		 "              cache first, for the other containers of it too\n"
+		 " -M <ms>[:<MB>[:<max MB>]]  report (on stderr) cpu, memory and io\n"
+		 "              stalls of more than ms per second and oom kills, needs\n"
+		 "              -n; with MB the memory.high is set and raised by a\n"
+		 "              quarter on memory pressure up to max MB (default 4 * MB)\n"
+		 " -D <socket>[:<N>]  run as a daemon which creates, starts, stops,\n"
+		 "              deletes and lists containers on requests sent to the\n"
+		 "              unix socket (see cctl), with N workers (default one\n"
+		 "              per CPU); the options apply to every container and\n"
+		 "              the program is the default one. A container gets its\n"
+		 "              own veth pair (vc<slot> and vp<slot>) and a /30 of\n"
+		 "              172.20.0.0/20. Not with -n, -e, -p, -P, -l, -L, -W,\n"
+		 "              -M or -O <dir>\n"
+		 " -h           display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The feature_name maps short offload names to ethtool feature names. */
+static const char *feature_name(const char *name)
+{
+	if (!strcmp(name, "gro"))
+		return "rx-gro";
+	if (!strcmp(name, "gso"))
+		return "tx-generic-segmentation";
+	if (!strcmp(name, "tso"))
+		return "tx-tcp-segmentation";
+	if (!strcmp(name, "lro"))
+		return "rx-lro";
+	return name;
+}
+
+/* The parse_net_spec parses the -N spec (key=value,...) into tuning. */
+static int parse_net_spec(char *spec, struct net_tuning *t)
+{
+	char *key, *val;
+	int n;
+
+	for (key = strtok(spec, ","); key; key = strtok(NULL, ",")) {
+		val = strchr(key, '=');
+		if (val)
+			*val++ = '\0';
+
+		if (!strcmp(key, "xps") && !val) {
+			t->xps = 1;
+			continue;
+		}
+		if (!val) {
+			fprintf(stderr, "%s needs a value\n", key);
+			return 1;
+		}
+
+		if (!strcmp(key, "rps")) {
+			t->rps_mask = val;
+			continue;
+		}
+
+		if (!strcmp(val, "on") || !strcmp(val, "off")) {
+			if (t->nfeatures == max_features) {
+				fprintf(stderr, "too many offloads\n");
+				return 2;
+			}
+			t->feature[t->nfeatures] = feature_name(key);
+			t->on[t->nfeatures++] = !strcmp(val, "on");
+			continue;
+		}
+
+		n = pos_atoi(val);
+		if (n <= 0) {
+			fprintf(stderr, "invalid value of %s\n", key);
+			return 3;
+		}
+		if (!strcmp(key, "queues")) {
+			t->link.num_tx_queues = n;
+			t->link.num_rx_queues = n;
+		} else if (!strcmp(key, "txq")) {
+			t->link.num_tx_queues = n;
+		} else if (!strcmp(key, "rxq")) {
+			t->link.num_rx_queues = n;
+		} else if (!strcmp(key, "mtu")) {
+			t->link.mtu = n;
+		} else if (!strcmp(key, "gso_max")) {
+			t->link.gso_max_size = n;
+		} else if (!strcmp(key, "gro_max")) {
+			t->link.gro_max_size = n;
+		} else if (!strcmp(key, "txqlen")) {
+			t->link.txqlen = n;
+		} else {
+			fprintf(stderr, "unknown network option %s\n", key);
+			return 4;
+		}
+	}
+
+	return 0;
+}
+
+/* The parse_unit converts s with a suffix of units. */
+static int parse_unit(const char *s, const struct unit *units, unsigned long long *v)
+{
+	unsigned long long n;
+	char *end;
+
+	if (*s < '0' || *s > '9')
+		return 1;
+	n = strtoull(s, &end, 10);
+	for (; units->suffix; units++) {
+		if (!strcasecmp(end, units->suffix)) {
+			*v = n * units->mult / units->div;
+			return *v == 0;
+		}
+	}
+	return 2;
+}
+
+/* The parse_shaping_spec parses the -Q spec (key=value,...). */
+static int parse_shaping_spec(char *spec, struct net_shaping *s)
+{
+	unsigned long long size = 0;
+	char *key, *val;
+	int shaper;
+
+	for (key = strtok(spec, ","); key; key = strtok(NULL, ",")) {
+		val = strchr(key, '=');
+		if (!val) {
+			fprintf(stderr, "%s needs a value\n", key);
+			return 1;
+		}
+		*val++ = '\0';
+
+		if (!strcmp(key, "qdisc")) {
+			if (strcmp(val, "fq_codel") && strcmp(val, "tbf") && strcmp(val, "htb")) {
+				fprintf(stderr, "qdisc is fq_codel, tbf or htb\n");
+				return 2;
+			}
+			s->qdisc = val;
+		} else if (!strcmp(key, "rate") || !strcmp(key, "police")) {
+			if (parse_unit(val, rate_units, !strcmp(key, "rate") ? &s->rate : &s->police)) {
+				fprintf(stderr, "invalid rate %s\n", val);
+				return 3;
+			}
+		} else if (!strcmp(key, "burst") || !strcmp(key, "pburst")) {
+			if (parse_unit(val, size_units, &size) || size > int_max) {
+				fprintf(stderr, "invalid size %s\n", val);
+				return 4;
+			}
+			if (!strcmp(key, "burst"))
+				s->burst = size;
+			else
+				s->police_burst = size;
+		} else if (!strcmp(key, "latency")) {
+			s->latency_ms = pos_atoi(val);
+			if (s->latency_ms <= 0) {
+				fprintf(stderr, "invalid latency %s\n", val);
+				return 5;
+			}
+		} else {
+			fprintf(stderr, "unknown shaping option %s\n", key);
+			return 6;
+		}
+	}
+
+	shaper = s->qdisc && strcmp(s->qdisc, "fq_codel");
+	if (shaper != (s->rate != 0)) {
+		fprintf(stderr, "rate goes with qdisc=tbf or htb\n");
+		return 7;
+	}
+
+	return 0;
+}
+
+/* The parse_link_spec parses the -L spec kind:parent:ip/prefix[:gw]. */
+static int parse_link_spec(char *spec, struct link_spec *link)
+{
+	char *kind, *prefix;
+
+	kind = strtok(spec, ":");
+	link->parent = strtok(NULL, ":");
+	link->addr = strtok(NULL, ":");
+	link->gw = strtok(NULL, ":");
+	if (!kind || !link->parent || !link->addr) {
+		fprintf(stderr, "link spec is kind:parent:ip/prefix[:gw]\n");
+		return 1;
+	}
+
+	if (!strcmp(kind, "macvlan")) {
+		link->kind = "macvlan";
+		link->mode = MACVLAN_MODE_BRIDGE;
+	} else if (!strcmp(kind, "ipvlan-l2")) {
+		link->kind = "ipvlan";
+		link->mode = IPVLAN_MODE_L2;
+	} else if (!strcmp(kind, "ipvlan-l3")) {
+		link->kind = "ipvlan";
+		link->mode = IPVLAN_MODE_L3;
+	} else {
+		fprintf(stderr, "unknown link kind %s\n", kind);
+		return 2;
+	}
+
+	prefix = strchr(link->addr, '/');
+	if (!prefix) {
+		fprintf(stderr, "prefix of %s is not given\n", link->addr);
+		return 3;
+	}
+	*prefix++ = '\0';
+	link->prefix = pos_atoi(prefix);
+	if (link->prefix < 0 || link->prefix > 32) {
+		fprintf(stderr, "invalid prefix %s\n", prefix);
+		return 4;
+	}
+
+	return 0;
+}
+
+/* The parse_port_spec parses the -p spec <host port>:<port> or
+ * <port>/notrack.
+ */
+static int parse_port_spec(char *spec, struct nft_port *p)
+{
+	char *port, *flag;
+
+	memset(p, 0, sizeof(*p));
+
+	flag = strchr(spec, '/');
+	if (flag) {
+		*flag++ = '\0';
+		if (strcmp(flag, "notrack")) {
+			fprintf(stderr, "unknown port flag %s\n", flag);
+			return 1;
+		}
+		p->notrack = 1;
+	}
+
+	port = strchr(spec, ':');
+	if (port) {
+		*port++ = '\0';
+		p->host_port = pos_atoi(spec);
+	} else {
+		port = spec;
+	}
+	p->cont_port = pos_atoi(port);
+
+	if (p->cont_port <= 0 || p->cont_port > 65535 || p->host_port < 0 || p->host_port > 65535) {
+		fprintf(stderr, "invalid port %s\n", port);
+		return 2;
+	}
+	if (!p->host_port && !p->notrack) {
+		fprintf(stderr, "host port of %d is not given\n", p->cont_port);
+		return 3;
+	}
+	if (p->host_port && p->notrack) {
+		fprintf(stderr, "a notrack port is not published on the host\n");
+		return 4;
+	}
+
+	return 0;
+}
+
+/* The parse_proxy_spec parses the -P spec <host port>:<port>. */
+static int parse_proxy_spec(char *spec, struct proxy_port *p)
+{
+	char *port;
+
+	port = strchr(spec, ':');
+	if (!port) {
+		fprintf(stderr, "proxy spec is <host port>:<port>\n");
+		return 1;
+	}
+	*port++ = '\0';
+
+	p->host_port = pos_atoi(spec);
+	p->port = pos_atoi(port);
+	p->addr = "127.0.0.1";
+	if (p->host_port <= 0 || p->host_port > 65535 || p->port <= 0 || p->port > 65535) {
+		fprintf(stderr, "invalid port %s:%s\n", spec, port);
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The parse_log_spec parses the -l spec <file>[:<MB>]. */
+static int parse_log_spec(char *spec, struct cmdline_opts *opts)
+{
+	char *mb;
+
+	opts->log_path = spec;
+	mb = strrchr(spec, ':');
+	if (!mb)
+		return 0;
+
+	*mb++ = '\0';
+	opts->log_mb = pos_atoi(mb);
+	if (opts->log_mb <= 0 || opts->log_mb > 4096) {
+		fprintf(stderr, "log size must be in 1..4096 MB\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* The parse_psi_spec parses the -M spec <ms>[:<MB>[:<max MB>]]. */
+static int parse_psi_spec(char *spec, struct cmdline_opts *opts)
+{
+	char *mb, *max = NULL;
+
+	mb = strchr(spec, ':');
+	if (mb) {
+		*mb++ = '\0';
+		max = strchr(mb, ':');
+		if (max)
+			*max++ = '\0';
+		opts->psi_high_mb = pos_atoi(mb);
+		if (opts->psi_high_mb <= 0 || opts->psi_high_mb > (int_max >> 2)) {
+			fprintf(stderr, "invalid memory.high %s\n", mb);
+			return 1;
+		}
+		opts->psi_max_mb = max ? pos_atoi(max) : opts->psi_high_mb * 4;
+		if (opts->psi_max_mb < opts->psi_high_mb) {
+			fprintf(stderr, "invalid memory.high ceiling %s\n", max);
+			return 3;
+		}
+	}
+
+	opts->psi_ms = pos_atoi(spec);
+	if (opts->psi_ms <= 0 || opts->psi_ms >= 1000) {
+		fprintf(stderr, "stall must be in 1..999 ms\n");
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The parse_prewarm_spec parses the -W spec <profile>[:evict]. */
+static void parse_prewarm_spec(char *spec, struct cmdline_opts *opts)
+{
+	char *n;
+
+	opts->prewarm = spec;
+	n = strrchr(spec, ':');
+	if (n && !strcmp(n, ":evict")) {
+		*n = '\0';
+		opts->prewarm_evict = 1;
+	}
+}
+
+/* The parse_daemon_spec parses the -D spec <socket>[:<workers>]. */
+static int parse_daemon_spec(char *spec, struct cmdline_opts *opts)
+{
+	char *n;
+
+	opts->daemon_path = spec;
+	n = strrchr(spec, ':');
+	if (!n)
+		return 0;
+
+	*n++ = '\0';
+	opts->workers = pos_atoi(n);
+	if (opts->workers <= 0 || opts->workers > lch_max_workers) {
+		fprintf(stderr, "workers must be in 1..%d\n", lch_max_workers);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->name = NULL;
+	opts->agent_path = NULL;
+	memset(&opts->tuning, 0, sizeof(opts->tuning));
+	memset(&opts->shaping, 0, sizeof(opts->shaping));
+	opts->uplink = NULL;
+	memset(&opts->link, 0, sizeof(opts->link));
+	opts->nports = 0;
+	opts->nproxy = 0;
+	opts->log_path = NULL;
+	opts->log_mb = log_def_mb;
+	opts->seccomp_path = NULL;
+	opts->init = 0;
+	opts->overlay = NULL;
+	opts->image = NULL;
+	opts->prewarm = NULL;
+	opts->prewarm_evict = 0;
+	opts->psi_ms = 0;
+	opts->psi_high_mb = 0;
+	opts->psi_max_mb = 0;
+	opts->daemon_path = NULL;
+	opts->workers = 0;
+	opts->argv = def_prog;
+}
+
+/* The valid_name accepts a name which is a file name (of its cgroup),
+ * as the daemon does for the names of its containers.
+ */
+static int valid_name(const char *name)
+{
+	return name[0] && !strchr(name, '/') && strcmp(name, ".") && strcmp(name, "..");
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if ((optc == 'n' || optc == 'e' || optc == 'N' || optc == 'Q' || optc == 'B' || optc == 'L' || optc == 'p' || optc == 'P' ||
+				 optc == 'l' || optc == 'S' || optc == 'O' || optc == 'i' ||
+				 optc == 'W' || optc == 'M' || optc == 'D') && (idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 'n':
+				opts->name = argv[idx + 1];
+				if (!valid_name(opts->name)) {
+					fprintf(stderr, "invalid name %s\n", opts->name);
+					return 13;
+				}
+				idx += 2;
+				break;
+			case 'e':
+				opts->agent_path = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'N':
+				if (parse_net_spec(argv[idx + 1], &opts->tuning))
+					return 3;
+				idx += 2;
+				break;
+			case 'Q':
+				if (parse_shaping_spec(argv[idx + 1], &opts->shaping))
+					return 11;
+				idx += 2;
+				break;
+			case 'B':
+				opts->uplink = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'L':
+				if (parse_link_spec(argv[idx + 1], &opts->link))
+					return 4;
+				idx += 2;
+				break;
+			case 'p':
+				if (opts->nports == max_ports) {
+					fprintf(stderr, "too many ports\n");
+					return 5;
+				}
+				if (parse_port_spec(argv[idx + 1], &opts->ports[opts->nports++]))
+					return 6;
+				idx += 2;
+				break;
+			case 'P':
+				if (opts->nproxy == proxy_max_ports) {
+					fprintf(stderr, "too many proxy ports\n");
+					return 7;
+				}
+				if (parse_proxy_spec(argv[idx + 1], &opts->proxy_ports[opts->nproxy++]))
+					return 8;
+				idx += 2;
+				break;
+			case 'l':
+				if (parse_log_spec(argv[idx + 1], opts))
+					return 9;
+				idx += 2;
+				break;
+			case 'S':
+				opts->seccomp_path = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'I':
+				opts->init = 1;
+				idx++;
+				break;
+			case 'O':
+				opts->overlay = strcmp(argv[idx + 1], ovl_tmpfs) ? argv[idx + 1] : ovl_tmpfs;
+				idx += 2;
+				break;
+			case 'i':
+				opts->image = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'W':
+				parse_prewarm_spec(argv[idx + 1], opts);
+				idx += 2;
+				break;
+			case 'M':
+				if (parse_psi_spec(argv[idx + 1], opts))
+					return 10;
+				idx += 2;
+				break;
+			case 'D':
+				if (parse_daemon_spec(argv[idx + 1], opts))
+					return 12;
+				idx += 2;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 2;
+			}
+		} else {
+			opts->argv = &argv[idx];
+			break;
+		}
+	}
+
+	return 0;
+}
+
 static int update_map(const char *mapping, const char *map_file)
 {
 	int fd;
@@ -103,9 +853,79 @@ static int proc_setgroups_write(int child_pid, const char *str)
 	return 0;
 }
 
+/* The tune_link applies settings which can't be given at creation: RPS
+ * and XPS masks and offloads. They stay with the link when it is moved
+ * to another network namespace.
+ */
+static int tune_link(const char *ifname, const struct net_tuning *t)
+{
+	if (t->rps_mask && if_set_rps(ifname, t->rps_mask)) {
+		fprintf(stderr, "if_set_rps %s is failed\n", ifname);
+		return 1;
+	}
+
+	if (t->xps && if_set_xps(ifname)) {
+		fprintf(stderr, "if_set_xps %s is failed\n", ifname);
+		return 2;
+	}
+
+	if (t->nfeatures && ethtool_set_features(ifname, t->feature, t->on, t->nfeatures))
+		return 3;
+
+	return 0;
+}
+
+/* The default_burst returns 10 ms of rate, but no less than a GSO packet
+ * of veth.
+ */
+static unsigned int default_burst(unsigned long long rate)
+{
+	unsigned long long burst = rate / 100;
+
+	if (burst < 65536)
+		return 65536;
+	return burst > int_max ? int_max : burst;
+}
+
+/* The shape_link sets up traffic control of the host side of the veth
+ * pair. HTB has a single class (1:1), the default one, which queues to
+ * fq_codel (if the kernel has it).
+ */
+static int shape_link(int sock, const char *ifname, const struct net_shaping *s)
+{
+	unsigned int burst, handle = TC_H_MAKE(1 << 16, 0), cls = TC_H_MAKE(1 << 16, 1);
+	unsigned long long limit;
+
+	burst = s->burst ? s->burst : default_burst(s->rate);
+	if (s->qdisc && !strcmp(s->qdisc, "fq_codel") && qdisc_add(sock, ifname, "fq_codel", TC_H_ROOT, 0))
+		return 1;
+	if (s->qdisc && !strcmp(s->qdisc, "tbf")) {
+		limit = s->rate * (s->latency_ms ? s->latency_ms : tbf_def_latency_ms) / 1000 + burst;
+		if (qdisc_add_tbf(sock, ifname, s->rate, burst, limit > int_max ? int_max : limit))
+			return 2;
+	}
+	if (s->qdisc && !strcmp(s->qdisc, "htb")) {
+		if (qdisc_add_htb(sock, ifname, handle, 1) ||
+			class_add_htb(sock, ifname, handle, cls, s->rate, s->rate, burst))
+			return 3;
+		if (qdisc_add(sock, ifname, "fq_codel", cls, 0))
+			fprintf(stderr, "class 1:1 keeps pfifo\n");
+	}
+
+	if (s->police) {
+		burst = s->police_burst ? s->police_burst : default_burst(s->police);
+		handle = TC_H_MAKE(TC_H_INGRESS, 0);
+		if (qdisc_add(sock, ifname, "ingress", TC_H_INGRESS, handle) ||
+			filter_add_police(sock, ifname, handle, s->police, burst))
+			return 4;
+	}
+
+	return 0;
+}
+
 static int prepare_veth_netns(const struct veth_netns *vethinfo)
 {
-	int sock, fd;
+	int sock, fd, ret = 0;
 	char buf[max_path];
 
 	sock = create_socket();
@@ -113,98 +933,358 @@ static int prepare_veth_netns(const struct veth_netns *vethinfo)
 		return 1;
 	}
 
-	if (create_veth_pair(sock, vethinfo->ifname, vethinfo->peername))
-		return 2;
+	if (create_veth_pair(sock, vethinfo->ifname, vethinfo->peername,
+						 vethinfo->tuning ? &vethinfo->tuning->link : NULL)) {
+		ret = 2;
+		goto out;
+	}
+
+	if (vethinfo->tuning && (tune_link(vethinfo->ifname, vethinfo->tuning) ||
+							 tune_link(vethinfo->peername, vethinfo->tuning))) {
+		ret = 8;
+		goto out;
+	}
+
+	if (vethinfo->shaping && shape_link(sock, vethinfo->ifname, vethinfo->shaping)) {
+		ret = 9;
+		goto out;
+	}
+
+	/* The MAC address of the peer is read before it moves. */
+	if (vethinfo->fp_map >= 0 && (fp_attach_veth(sock, vethinfo->ifname) ||
+								  fp_add(vethinfo->fp_map, vethinfo->ip_addr_peer, vethinfo->ifname,
+										 vethinfo->peername))) {
+		ret = 10;
+		goto out;
+	}
 
 	if (if_up(sock, vethinfo->ifname)) {
 		fprintf(stderr, "if_up %s is failed\n", vethinfo->ifname);
-		return 3;
+		ret = 3;
+		goto out;
 	}
 
 	/* Add address for ifname. */
 	if (addr_add(sock, vethinfo->ifname, vethinfo->ip_addr_if, vethinfo->ip_if_prefix)) {
 		fprintf(stderr, "addr_add %s is failed\n", vethinfo->ifname);
-		return 4;
-	}
-
-	if (if_up(sock, vethinfo->peername)) {
-		fprintf(stderr, "if_up %s is failed\n", vethinfo->peername);
-		return 5;
-	}
-
-	/* Add address for peername. */
-	if (addr_add(sock, vethinfo->peername, vethinfo->ip_addr_peer, vethinfo->ip_peer_prefix)) {
-		fprintf(stderr, "addr_add %s is failed\n", vethinfo->peername);
-		return 6;
+		ret = 4;
+		goto out;
 	}
 
-	/* Move peername to netns. */
+	/* Move peername to netns. A moved link loses its addresses and goes
+	 * down, so the child sets it up (see setup_veth_peer).
+	 */
 	if (vethinfo->child_pid) {
 		snprintf(buf, max_path, "/proc/%d/ns/net", vethinfo->child_pid);
 		fd = open(buf, O_RDONLY);
 		if (fd < 0) {
 			perror("open ns/net");
-			return 7;
+			ret = 7;
+			goto out;
 		}
 		if_to_netns(sock, vethinfo->peername, fd);
 		close(fd);
 	}
 
+ out:
 	close(sock);
-	return 0;
+	return ret;
 }
 
-static int prepare_mntns(const char *rootfs)
+/* The prepare_upper_link creates the macvlan/ipvlan link right in the
+ * network namespace of the child, so no move is needed.
+ */
+static int prepare_upper_link(const struct link_spec *link, int child_pid)
 {
-	const char *put_old = ".put_old";
+	char buf[max_path];
+	int sock, fd, ret = 0;
 
-	/* mount --bind rootfs rootfs
-	 * Make the directory act as a mount point and then
-	 * turned it into a rooted filesystem.
-	 */
-	if (mount(rootfs, rootfs, "ext4", MS_BIND, NULL)) {
-		perror("mount rootfs");
+	sock = create_socket();
+	if (sock < 0)
 		return 1;
-	}
 
-	if (chdir(rootfs)) {
-		perror("chdir rootfs");
+	snprintf(buf, max_path, "/proc/%d/ns/net", child_pid);
+	fd = open(buf, O_RDONLY);
+	if (fd < 0) {
+		perror("open ns/net");
+		close(sock);
 		return 2;
 	}
 
-	if (mkdir(put_old, 0777) && errno != EEXIST) {
-		perror("mkdir put_old");
-		return 3;
-	}
+	if (create_upper_link(sock, link->kind, link->mode, upper_ifname, link->parent, fd))
+		ret = 3;
 
-	/* Move the root mount to the directory put_old
-	 * and makes the current direcctory the new root mount
-	 */
-	if (syscall(SYS_pivot_root, ".", put_old) == -1) {
-		perror("pivot_root");
-		return 4;
-	}
+	close(fd);
+	close(sock);
+	return ret;
+}
 
-	if (mount("proc", "/proc", "proc", 0, NULL) == -1) {
-		perror("mount proc");
-		return 5;
+/* The setup_upper_link brings the link up and sets its address and the
+ * default route. It runs in the child, which owns its network namespace.
+ */
+static int setup_upper_link(int sock, const struct link_spec *link)
+{
+	if (if_up(sock, upper_ifname)) {
+		fprintf(stderr, "if_up %s is failed\n", upper_ifname);
+		return 1;
 	}
 
-	/* MNT_DETACH - make the mount anavailable for new accesses,
-	 * immediately disconnect the filesystem and all filesystems
-	 * mounted below it from each other and from the mount table,
-	 * and actually perform the unmount when the mount ceases to be busy.
-	 */
-	if (umount2(put_old, MNT_DETACH) == -1) {
-		perror("unmount2 put_old");
-		return 6;
+	if (addr_add(sock, upper_ifname, link->addr, link->prefix)) {
+		fprintf(stderr, "addr_add %s is failed\n", upper_ifname);
+		return 2;
 	}
 
-	return 0;
+	if (link->gw && route_add_default(sock, link->gw))
+		return 3;
+
+	return 0;
+}
+
+/* The setup_veth_peer brings the peer up in the child, sets its address
+ * and the default route through the host end of the pair.
+ */
+static int setup_veth_peer(int sock, const struct veth_netns *vethinfo)
+{
+	if (if_up(sock, vethinfo->peername)) {
+		fprintf(stderr, "if_up %s is failed\n", vethinfo->peername);
+		return 1;
+	}
+
+	/* Add address for peername. */
+	if (addr_add(sock, vethinfo->peername, vethinfo->ip_addr_peer, vethinfo->ip_peer_prefix)) {
+		fprintf(stderr, "addr_add %s is failed\n", vethinfo->peername);
+		return 2;
+	}
+
+	if (route_add_default(sock, vethinfo->ip_addr_if))
+		return 3;
+
+	return 0;
+}
+
+/* The rootfs is assembled with the mount API of Linux 5.2: file systems
+ * are created detached (fsopen, fsmount) and attached with move_mount,
+ * no mount looks up a source by path or string of options.
+ */
+
+static int fs_open(const char *type)
+{
+	int fs;
+
+	fs = fsopen(type, FSOPEN_CLOEXEC);
+	if (fs < 0)
+		perror(type);
+	return fs;
+}
+
+/* The fs_mount creates the configured file system and returns a detached
+ * mount of it.
+ */
+static int fs_mount(int fs, const char *what, unsigned int attrs)
+{
+	int mnt = -1;
+
+	if (fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == 0)
+		mnt = fsmount(fs, FSMOUNT_CLOEXEC, attrs);
+	if (mnt < 0)
+		perror(what);
+	close(fs);
+	return mnt;
+}
+
+static int attach(int mnt, const char *path)
+{
+	int ret;
+
+	ret = move_mount(mnt, "", AT_FDCWD, path, MOVE_MOUNT_F_EMPTY_PATH);
+	if (ret)
+		perror(path);
+	close(mnt);
+	return ret;
 }
 
-static int prepare_child()
+/* The stage_overlay creates the directories of an overlay, on a new tmpfs
+ * for -O tmpfs, and returns the directory they are in.
+ */
+static const char *stage_overlay(const char *dir)
 {
+	const char *sub[] = { "upper", "work", "merged" };
+	int fs, mnt, i;
+
+	/* The child is still the root of the host to the kernel, which is not
+	 * mapped in its user namespace. Files are created (by overlay too, with
+	 * the credentials of its mounter) as the root of the container.
+	 */
+	setfsuid(0);
+	setfsgid(0);
+
+	if (dir != ovl_tmpfs)
+		return dir;
+
+	fs = fs_open("tmpfs");
+	if (fs < 0)
+		return NULL;
+	if (fsconfig(fs, FSCONFIG_SET_STRING, "mode", "0755", 0)) {
+		perror("tmpfs mode");
+		close(fs);
+		return NULL;
+	}
+	mnt = fs_mount(fs, "overlay tmpfs", MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV);
+	if (mnt < 0)
+		return NULL;
+
+	/* The directories are made before the tmpfs is attached. */
+	for (i = 0; i < 3; i++) {
+		if (mkdirat(mnt, sub[i], 0755)) {
+			perror("mkdir overlay");
+			close(mnt);
+			return NULL;
+		}
+	}
+
+	return attach(mnt, ovl_stage) ? NULL : ovl_stage;
+}
+
+/* The set_lowerdirs gives overlay its lower directories: rootfs, or the
+ * layers of an image (top first, separated by ':') which are under rootfs.
+ * Each one is a lowerdir+ option (Linux 6.8), which takes a path of any
+ * length; older kernels get them in one lowerdir option, a page at most.
+ */
+static int set_lowerdirs(int fs, const char *rootfs, const char *layers)
+{
+	char path[PATH_MAX], all[4096];
+	const char *p, *end;
+	int n, len = 0, legacy = 0;
+
+	for (p = layers ? layers : "", n = 0;; p = end + 1, n++) {
+		end = strchr(p, ':');
+		if (!end)
+			end = p + strlen(p);
+		if (layers)
+			snprintf(path, PATH_MAX, "%s/%.*s", rootfs, (int) (end - p), p);
+		else
+			snprintf(path, PATH_MAX, "%s", rootfs);
+
+		if (!legacy && fsconfig(fs, FSCONFIG_SET_STRING, "lowerdir+", path, 0)) {
+			if (n > 0 || errno != EINVAL) {
+				perror(path);
+				return 1;
+			}
+			legacy = 1;
+		}
+		if (legacy) {
+			len += snprintf(all + len, sizeof(all) - len, "%s%s", n ? ":" : "", path);
+			if (len >= (int) sizeof(all)) {
+				fprintf(stderr, "too many layers\n");
+				return 2;
+			}
+		}
+
+		if (!*end)
+			break;
+	}
+
+	if (legacy && fsconfig(fs, FSCONFIG_SET_STRING, "lowerdir", all, 0)) {
+		perror("lowerdir");
+		return 3;
+	}
+	return 0;
+}
+
+/* The mount_overlay mounts an overlay over rootfs with rootfs as the lower
+ * layer (a lower directory is looked up before the mount covers it), or
+ * the layers of an image. The upper and work directories are in dir.
+ * Overlays in a user namespace need Linux 5.11; userxattr (user.overlay.*
+ * instead of trusted.* xattrs) is left out if the kernel doesn't know it.
+ * A copy up keeps the owner: in an idmapped tree every owner is mapped,
+ * otherwise a file of an id not mapped in the container can be read, but
+ * not changed (EOVERFLOW).
+ */
+static int mount_overlay(const char *rootfs, const char *layers, const char *dir)
+{
+	char upper[PATH_MAX], work[PATH_MAX];
+	int fs, mnt;
+
+	snprintf(upper, PATH_MAX, "%s/upper", dir);
+	snprintf(work, PATH_MAX, "%s/work", dir);
+
+	fs = fs_open("overlay");
+	if (fs < 0)
+		return 1;
+	if (set_lowerdirs(fs, rootfs, layers) || fsconfig(fs, FSCONFIG_SET_STRING, "upperdir", upper, 0) ||
+		fsconfig(fs, FSCONFIG_SET_STRING, "workdir", work, 0)) {
+		perror("overlay options");
+		close(fs);
+		return 2;
+	}
+	fsconfig(fs, FSCONFIG_SET_FLAG, "userxattr", NULL, 0);
+
+	mnt = fs_mount(fs, "mount overlay", 0);
+	if (mnt < 0)
+		return 3;
+	return attach(mnt, rootfs) ? 4 : 0;
+}
+
+/* The prepare_mntns makes rootfs the root. The tree is the image (the
+ * rootfs or the unpacked layers of the store) which the parent cloned
+ * and idmapped to the user namespace: it is moved onto rootfs, where an
+ * overlay may cover it. The copy of the host mount table made by
+ * CLONE_NEWNS is dropped in one detach of the old root.
+ */
+static int prepare_mntns(const char *rootfs, int tree, const char *layers, const char *overlay)
+{
+	char path[PATH_MAX];
+	const char *dir = NULL;
+	int fs, mnt;
+
+	if (overlay) {
+		dir = stage_overlay(overlay);
+		if (!dir)
+			return 1;
+	}
+
+	if (attach(tree, rootfs))
+		return 2;
+
+	if (overlay && mount_overlay(rootfs, layers, dir))
+		return 3;
+
+	/* The proc of the pid namespace of the child. */
+	fs = fs_open("proc");
+	if (fs < 0)
+		return 4;
+	mnt = fs_mount(fs, "mount proc", MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV | MOUNT_ATTR_NOEXEC);
+	snprintf(path, PATH_MAX, "%s/proc", rootfs);
+	if (mnt < 0 || attach(mnt, path))
+		return 5;
+
+	if (chdir(rootfs)) {
+		perror("chdir rootfs");
+		return 6;
+	}
+
+	/* The old root is stacked on the new one and detached at once, with
+	 * the mounts below it; no put_old directory is made in the image.
+	 */
+	if (syscall(SYS_pivot_root, ".", ".") == -1) {
+		perror("pivot_root");
+		return 7;
+	}
+	if (umount2(".", MNT_DETACH) == -1) {
+		perror("umount2 old root");
+		return 8;
+	}
+	if (chdir("/")) {
+		perror("chdir /");
+		return 9;
+	}
+
+	return 0;
+}
+
+static int prepare_child(const struct child_args *args)
+{
+	char rootfs[PATH_MAX];
 	int sock;
 	sock = create_socket();
 	if (sock < 0)
@@ -214,6 +1294,11 @@ static int prepare_child()
 		fprintf(stderr, "if_up %s is failed\n", "lo");
 		return 2;
 	}
+
+	if (args->link->kind && setup_upper_link(sock, args->link))
+		return 4;
+	if (!args->link->kind && setup_veth_peer(sock, args->veth))
+		return 4;
 	close(sock);
 
 	if (sethostname("container", 9) < 0) {
@@ -221,7 +1306,11 @@ static int prepare_child()
 		return 3;
 	}
 
-	if (prepare_mntns("alpine"))
+	/* An image is mounted on <dir>/merged of its overlay. */
+	strcpy(rootfs, "alpine");
+	if (args->layers)
+		snprintf(rootfs, PATH_MAX, "%s/merged", args->overlay == ovl_tmpfs ? ovl_stage : args->overlay);
+	if (prepare_mntns(rootfs, args->tree, args->layers, args->overlay))
 		return 5;
 
 	/* 405 - guest in alpine image */
@@ -250,110 +1339,753 @@ static int child_fn(void *arg)
 	}
 	close(args->pipe_fd[0]);
 
-	if (prepare_child()) {
+	if (prepare_child(args)) {
 		fprintf(stderr, "prepare_child is failed\n");
 		exit(2);
 	}
 
 /*	sleep(600);*/
 	printf("About to exec %s\n", args->argv[0]);
+	fflush(stdout);
+
+	/* From here on the output goes to the log; the agent logs its
+	 * errors there too.
+	 */
+	if (args->log_fds[0] >= 0 && (dup2(args->log_fds[0], 1) < 0 || dup2(args->log_fds[1], 2) < 0)) {
+		perror("dup2 log");
+		exit(5);
+	}
+
+	/* The filter is inherited by the agent and everything it starts. */
+	if (args->seccomp && sc_install(args->seccomp))
+		exit(6);
+
+	/* The agent stays in the container namespaces, so a later exec
+	 * costs one fork instead of joining every namespace again.
+	 */
+	if (args->agent_sock >= 0) {
+		int pid = fork();
+		if (pid == -1) {
+			perror("fork agent");
+			exit(3);
+		}
+		if (pid == 0)
+			agent_serve(args->agent_sock);
+		close(args->agent_sock);
+	}
+
+	if (args->init_fd >= 0) {
+		helper_exec(args->init_fd, args->argv);
+		fflush(stderr);
+		_exit(4);
+	}
+
 	/* Execute a shell command */
 	execvp(args->argv[0], args->argv);
 	perror(args->argv[0]);
 	fflush(stderr);
-	_exit(3);
+	_exit(4);
 }
 
-static int restore(const char *ifname, const char *rootfs)
+/* The start_proxy starts the port proxy into the network namespace of
+ * the child, a worker per CPU.
+ */
+static int start_proxy(const struct cmdline_opts *opts, int child_pid)
 {
-	int sock;
+	struct proxy_conf conf;
+	char buf[max_path];
+	int pid;
+
+	snprintf(buf, max_path, "/proc/%d/ns/net", child_pid);
+	memset(&conf, 0, sizeof(conf));
+	conf.netns = open(buf, O_RDONLY | O_CLOEXEC);
+	if (conf.netns < 0) {
+		perror("open ns/net");
+		return -1;
+	}
+	conf.ports = opts->proxy_ports;
+	conf.nports = opts->nproxy;
+
+	pid = proxy_start(&conf);
+	close(conf.netns);
+	return pid;
+}
+
+/* The on_pressure prints an event of the monitor as a line of key=value
+ * pairs and raises memory.high (arg, 0 - unset) on memory pressure until
+ * it reaches the ceiling.
+ */
+static void on_pressure(const struct psi_event *e, void *arg)
+{
+	struct psi_limit *lim = arg;
+	struct timespec ts;
+	char val[32];
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	fprintf(stderr, "psi time=%ld.%03ld container=%s event=%s", (long) ts.tv_sec, ts.tv_nsec / 1000000,
+			e->name, psi_kind_name(e->kind));
+	if (e->pressure)
+		fprintf(stderr, " %.*s", (int) strcspn(e->pressure, "\n"), e->pressure);
+	if (e->kind == psi_ev_oom || e->kind == psi_ev_oom_kill)
+		fprintf(stderr, " count=%llu", e->count);
+	if (e->kind == psi_ev_memory && lim->high && lim->high < lim->max) {
+		lim->high += lim->high / 4;
+		if (lim->high > lim->max)
+			lim->high = lim->max;
+		snprintf(val, sizeof(val), "%lld", lim->high);
+		if (cgroup_write(e->name, "memory.high", val) == 0)
+			fprintf(stderr, " memory.high=%s", val);
+	}
+	fputc('\n', stderr);
+}
+
+/* The start_monitor forks the pressure monitor of the container, which
+ * ends with the container.
+ */
+static int start_monitor(const struct cmdline_opts *opts)
+{
+	static struct psi_monitor mon;
+	struct psi_limit lim;
+	char val[32];
+	int pid;
+
+	pid = fork();
+	if (pid == -1)
+		perror("fork monitor");
+	if (pid != 0)
+		return pid;
+
+	signal(SIGINT, SIG_IGN);
+	lim.high = (long long) opts->psi_high_mb << 20;
+	lim.max = (long long) opts->psi_max_mb << 20;
+	if (lim.high) {
+		snprintf(val, sizeof(val), "%lld", lim.high);
+		if (cgroup_write(opts->name, "memory.high", val)) {
+			fprintf(stderr, "no memory.high, it is not raised\n");
+			lim.high = 0;
+		}
+	}
+	if (psi_init(&mon) || psi_add(&mon, opts->name, opts->psi_ms * 1000, psi_window_us))
+		_exit(1);
+	psi_run(&mon, on_pressure, &lim);
+	psi_close(&mon);
+	_exit(0);
+}
+
+/* The start_fast_path attaches the program of the fast path to the
+ * uplink and returns the map of containers.
+ */
+static int start_fast_path(const char *uplink)
+{
+	int sock, map;
 
 	sock = create_socket();
-	if (sock < 0) {
-		return 1;
+	if (sock < 0)
+		return -1;
+
+	map = fp_map_open();
+	if (map >= 0 && fp_attach_uplink(sock, uplink, map)) {
+		close(map);
+		map = -1;
 	}
 
-	if (if_del(sock, ifname)) {
+	close(sock);
+	return map;
+}
+
+/* The init_argv returns argv prefixed with the init, "--" keeps the
+ * options of the program from the init.
+ */
+static char **init_argv(char **argv)
+{
+	char **res;
+	int n;
+
+	for (n = 0; argv[n]; n++);
+	res = malloc((n + 3) * sizeof(*res));
+	if (!res) {
+		perror("malloc");
+		return NULL;
+	}
+	res[0] = init_name;
+	res[1] = "--";
+	memcpy(res + 2, argv, (n + 1) * sizeof(*res));
+	return res;
+}
+
+/* The load_init loads cinit from the directory of the launcher to a
+ * memfd. It returns the descriptor or -1.
+ */
+static int load_init(void)
+{
+	char path[PATH_MAX];
+	char *slash;
+	int len;
+
+	len = readlink("/proc/self/exe", path, sizeof(path) - sizeof(init_name) - 1);
+	if (len < 0) {
+		perror("readlink /proc/self/exe");
+		return -1;
+	}
+	path[len] = '\0';
+	slash = strrchr(path, '/');
+	strcpy(slash ? slash + 1 : path, init_name);
+
+	return helper_load(path);
+}
+
+/* The prepare_overlay_dirs creates what the child can't as root of its
+ * user namespace: the mount point of the tmpfs, or the upper and work
+ * directories owned by the root of the container and the mount point of
+ * an image.
+ */
+static int prepare_overlay_dirs(const char *overlay)
+{
+	char buf[PATH_MAX];
+	const char *sub[] = { "upper", "work", "merged" };
+	int i;
+
+	if (overlay == ovl_tmpfs) {
+		if (mkdir(ovl_stage, 0755) && errno != EEXIST) {
+			perror(ovl_stage);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (mkdir(overlay, 0755) && errno != EEXIST) {
+		perror(overlay);
 		return 2;
 	}
 
-	close(sock);
+	for (i = 0; i < 3; i++) {
+		snprintf(buf, PATH_MAX, "%s/%s", overlay, sub[i]);
+		if (mkdir(buf, 0755) && errno != EEXIST) {
+			perror(buf);
+			return 3;
+		}
+		if (chown(buf, cont_root_id, cont_root_id)) {
+			perror(buf);
+			return 4;
+		}
+	}
+
 	return 0;
 }
 
-int main(void)
+/* The image_layers opens the store and writes the layers of image, top
+ * first and separated by ':', to buf. The layers stay pinned, so the
+ * collector leaves them alone while the container runs.
+ */
+static int image_layers(struct layer_store *s, const char *image, char *buf, int size)
+{
+	static layer_digest layers[store_max_layers];
+	char path[PATH_MAX];
+	int i, k, n, len = 0;
+
+	if (store_open(s, def_store))
+		return 1;
+	if (store_begin(s))
+		return 2;
+
+	n = store_layers(s, image, layers, store_max_layers);
+	if (n <= 0) {
+		fprintf(stderr, "no image %s; import it with cimage\n", image);
+		return 3;
+	}
+
+	for (i = n - 1; i >= 0; i--) {
+		/* A layer listed twice is used where it is topmost: overlayfs
+		 * refuses a lower directory given twice (ELOOP).
+		 */
+		for (k = i + 1; k < n && strcmp(layers[k], layers[i]); k++);
+		if (k < n)
+			continue;
+		if (store_layer_path(s, layers[i], path, PATH_MAX) || access(path, F_OK)) {
+			fprintf(stderr, "layer %s is not unpacked; import %s again\n", layers[i], image);
+			return 4;
+		}
+		if (store_pin(s, layers[i]))
+			return 6;
+		len += snprintf(buf + len, size - len, "%s%s", len ? ":" : "", layers[i]);
+		if (len >= size) {
+			fprintf(stderr, "too many layers in %s\n", image);
+			return 5;
+		}
+	}
+
+	store_end(s);
+	return 0;
+}
+
+/* The clone_tree makes a detached copy of the mount of the image. The
+ * child inherits the descriptor, and attaches the mount in its mount
+ * namespace once the parent has idmapped it (see idmap_tree).
+ */
+static int clone_tree(const char *path)
+{
+	int fd;
+
+	fd = open_tree(AT_FDCWD, path, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+	if (fd < 0)
+		perror(path);
+	return fd;
+}
+
+/* The idmap_tree maps the owners of the files of the tree through the
+ * user namespace of the child: a file of uid 0 on the disk is the root
+ * of the container. The image needs no chown, so containers with other
+ * maps share it. Without idmapped mounts (Linux 5.12, and support of the
+ * file system) the tree is a plain bind mount, its files are owned by
+ * unmapped ids in the container.
+ */
+static int idmap_tree(int tree, int child_pid)
+{
+	struct mount_attr attr;
+	char buf[max_path];
+	int fd, ret = 0;
+
+	snprintf(buf, max_path, "/proc/%d/ns/user", child_pid);
+	fd = open(buf, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("open ns/user");
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.attr_set = MOUNT_ATTR_IDMAP;
+	attr.userns_fd = fd;
+	if (mount_setattr(tree, "", AT_EMPTY_PATH, &attr, sizeof(attr))) {
+		if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+			fprintf(stderr, "warning: no idmapped mounts, the rootfs is not shifted\n");
+		else {
+			perror("mount_setattr idmap");
+			ret = 2;
+		}
+	}
+
+	close(fd);
+	return ret;
+}
+
+/* The restore queues removal of what the container has left on the host.
+ * The reaper does the work in the background, the launcher doesn't wait.
+ */
+static int restore(struct teardown_queue *td, const char *name, const char *ifname, const char *nft_name,
+				   const char *rootfs)
+{
+	char buf[cgroup_max_path];
+
+	if (ifname && teardown_add(td, td_link, ifname))
+		return 1;
+
+	if (nft_name && teardown_add(td, td_nft, nft_name))
+		return 4;
+
+	if (name) {
+		if (cgroup_path(name, NULL, buf, cgroup_max_path))
+			return 2;
+		if (teardown_add(td, td_cgroup, buf))
+			return 3;
+	}
+
+	return 0;
+}
+
+/* The abort_child tells the child to exit, the caller of launch reaps it. */
+static int abort_child(struct container *c, int ret)
+{
+	write(c->args.pipe_fd[1], "-1", 1);
+	close(c->args.pipe_fd[1]);
+	if (c->args.tree >= 0)
+		close(c->args.tree);
+	return ret;
+}
+
+/* The abort_launch tells the child to exit, like abort_child, and queues
+ * removal of what launch has made on the host: the veth pair with its
+ * fast path entry and, if the network is done (cgroup is set), the cgroup.
+ */
+static int abort_launch(struct launcher *l, struct container *c, int cgroup, int ret)
+{
+	if (!l->opts->link.kind && c->vn.fp_map >= 0)
+		fp_del(c->vn.fp_map, c->vn.ip_addr_peer);
+	restore(&l->td, cgroup ? c->name : NULL, l->opts->link.kind ? NULL : c->vn.ifname, NULL, "alpine");
+	return abort_child(c, ret);
+}
+
+/* The launch clones the child of c and sets it up: the uid and gid maps,
+ * the tree of the image, the network and the cgroup. The program waits
+ * until the write end of the sync pipe is closed. If launch fails after
+ * the clone (c->pid is set), the child is told to exit and what is made
+ * for it on the host is queued for removal. flags are added to those of
+ * the clone.
+ */
+static int launch(struct launcher *l, struct container *c, int flags)
 {
-	int child_pid;
-	struct child_args ch_args;
-	struct veth_netns vn;
 	char buf[max_path];
 
-	if (pipe(ch_args.pipe_fd) == -1) {
+	c->pid = 0;
+	c->pidfd = -1;
+	if (pipe(c->args.pipe_fd) == -1) {
 		perror("pipe");
 		return 1;
 	}
 
-	ch_args.argv = def_prog;
+	c->args.tree = clone_tree(l->image_root);
+	if (c->args.tree < 0) {
+		close(c->args.pipe_fd[0]);
+		close(c->args.pipe_fd[1]);
+		return 1;
+	}
+
+	/* CLONE_NEWNS - create a new namespace for mount as well as get
+	 * copy of all mount points. The pidfd is stored only if flags have
+	 * CLONE_PIDFD.
+	 */
+	c->pid = clone(child_fn, child_stack + stack_size - 1, CLONE_NEWNS |
+				   CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWNET | CLONE_NEWPID |
+				   CLONE_NEWUSER | CLONE_NEWCGROUP | flags, &c->args, &c->pidfd);
+	if (c->pid == -1) {
+		perror("clone");
+		c->pid = 0;
+		close(c->args.pipe_fd[0]);
+		close(c->args.pipe_fd[1]);
+		close(c->args.tree);
+		return 3;
+	}
+
+	close(c->args.pipe_fd[0]);
+	c->vn.child_pid = c->pid;
+
+	snprintf(buf, max_path, "/proc/%d/uid_map", c->pid);
+	if (update_map("0 500 65534", buf))
+		return abort_child(c, 4);
+
+	if (proc_setgroups_write(c->pid, "deny"))
+		return abort_child(c, 5);
+
+	snprintf(buf, max_path, "/proc/%d/gid_map", c->pid);
+	if (update_map("0 500 65534", buf))
+		return abort_child(c, 6);
+
+	if (idmap_tree(c->args.tree, c->pid))
+		return abort_child(c, 6);
+	close(c->args.tree);
+	c->args.tree = -1;
+
+	if (l->opts->link.kind) {
+		if (prepare_upper_link(&l->opts->link, c->pid))
+			return abort_child(c, 7);
+	} else if (prepare_veth_netns(&c->vn)) {
+		return abort_launch(l, c, 0, 7);
+	}
+
+	if (c->name && cgroup_create(c->name, c->pid))
+		return abort_launch(l, c, 1, 9);
+
+	return 0;
+}
+
+/* The set_veth names the veth pair of the container and its addresses:
+ * the pair of the launcher, or the one of a slot of the daemon (slot >= 0).
+ */
+static void set_veth(const struct launcher *l, struct container *c, int slot)
+{
+	const struct cmdline_opts *opts = l->opts;
+	int a = slot * 4;
+
+	if (slot < 0) {
+		strcpy(c->ifname, "veth0");
+		strcpy(c->peername, "ceth0");
+		strcpy(c->ip_if, "172.16.0.2");
+		strcpy(c->ip_peer, "172.16.0.3");
+	} else {
+		snprintf(c->ifname, max_path, "vc%d", slot);
+		snprintf(c->peername, max_path, "vp%d", slot);
+		snprintf(c->ip_if, max_path, "%s.%d.%d", daemon_net, a >> 8, (a & 0xff) + 1);
+		snprintf(c->ip_peer, max_path, "%s.%d.%d", daemon_net, a >> 8, (a & 0xff) + 2);
+	}
+
+	c->vn.ifname = c->ifname;
+	c->vn.peername = c->peername;
+	c->vn.ip_addr_if = c->ip_if;
+	c->vn.ip_if_prefix = slot < 0 ? 24 : 30;
+	c->vn.ip_addr_peer = c->ip_peer;
+	c->vn.ip_peer_prefix = c->vn.ip_if_prefix;
+	c->vn.tuning = &opts->tuning;
+	c->vn.shaping = opts->shaping.qdisc || opts->shaping.police ? &opts->shaping : NULL;
+	c->vn.fp_map = l->fp_map;
+}
+
+/* The daemon_create runs in a worker of the daemon. The container is
+ * cloned with CLONE_PARENT: it is a child of the daemon, which gets its
+ * pidfd and the sync pipe.
+ */
+static int daemon_create(void *arg, const char *name, int slot, char **argv, int *pid, int *pidfd, int *hold)
+{
+	struct launcher *l = arg;
+	struct container c;
+	int ret;
+
+	c.name = name;
+	c.args = l->args;
+	c.args.veth = &c.vn;
+	if (argv)
+		c.args.argv = l->opts->init ? init_argv(argv) : argv;
+	if (!c.args.argv)
+		return ENOMEM;
+	set_veth(l, &c, slot);
+
+	errno = 0;
+	ret = launch(l, &c, CLONE_PARENT | CLONE_PIDFD | SIGCHLD);
+	if (argv && l->opts->init)
+		free(c.args.argv);
+
+	*pid = c.pid;
+	*pidfd = c.pidfd;
+	*hold = ret ? -1 : c.args.pipe_fd[1];
+	if (ret)
+		return errno ? errno : EIO;
+	return 0;
+}
+
+/* The daemon_remove queues removal of what a deleted container has left
+ * on the host.
+ */
+static void daemon_remove(void *arg, const char *name, int slot)
+{
+	struct launcher *l = arg;
+	struct container c;
+
+	set_veth(l, &c, slot);
+	if (l->fp_map >= 0)
+		fp_del(l->fp_map, c.vn.ip_addr_peer);
+	restore(&l->td, name, c.vn.ifname, NULL, "alpine");
+}
+
+/* The serve runs the launcher as a daemon until SIGINT or SIGTERM, see
+ * lib/launcher.h.
+ */
+static int serve(struct launcher *l)
+{
+	struct lch_ops ops;
+	int lsock, ret;
+
+	lsock = lch_listen(l->opts->daemon_path);
+	if (lsock < 0)
+		return 12;
+
+	ops.create = daemon_create;
+	ops.remove = daemon_remove;
+	ops.arg = l;
+	ret = lch_serve(lsock, l->opts->workers, &ops);
+
+	close(lsock);
+	unlink(l->opts->daemon_path);
+	teardown_stop(&l->td);
+	return ret ? 13 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	static struct launcher l;
+	struct container c;
+	char pid_name[max_path];
+	const char *nft_name = NULL;
+	static struct sc_profile profile;
+	static struct sc_filter filter;
+	static struct layer_store store;
+	static char layers[store_max_layers * (sha256_hex_len + 1)];
+	int prewarm_pid, record = 0;
+	int proxy_pid = -1;
+	int i, ret;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.psi_ms && !opts.name) {
+		fprintf(stderr, "-M needs -n\n");
+		return 1;
+	}
+
+	if (opts.nports && opts.link.kind) {
+		fprintf(stderr, "-p works with the veth pair only\n");
+		return 1;
+	}
+
+	if ((opts.shaping.qdisc || opts.shaping.police || opts.uplink) && opts.link.kind) {
+		fprintf(stderr, "-Q and -B work with the veth pair only\n");
+		return 1;
+	}
+
+	if (opts.shaping.police && opts.uplink) {
+		fprintf(stderr, "police and -B both need the ingress of the veth\n");
+		return 1;
+	}
+
+	/* Containers of the daemon are named by the requests; what is set up
+	 * once per launcher (a log, an agent socket, host ports) can't be
+	 * shared by them.
+	 */
+	if (opts.daemon_path && (opts.name || opts.agent_path || opts.nports || opts.nproxy || opts.log_path ||
+							 opts.link.kind || opts.prewarm || opts.psi_ms ||
+							 (opts.overlay && opts.overlay != ovl_tmpfs))) {
+		fprintf(stderr, "-D doesn't go with -n, -e, -p, -P, -l, -L, -W, -M or -O <dir>\n");
+		return 1;
+	}
+
+	l.opts = &opts;
+	l.fp_map = -1;
+
+	/* The profile is compiled once here, the child only loads it. */
+	l.args.seccomp = NULL;
+	if (opts.seccomp_path) {
+		if (sc_parse_profile(opts.seccomp_path, &profile) || sc_compile(&profile, 0, &filter))
+			return 1;
+		l.args.seccomp = &filter;
+	}
+
+	/* The reaper is forked first, so it holds no descriptors of the child. */
+	if (teardown_start(&l.td))
+		return 1;
+
+	/* The reads overlap the setup of the container; the replayer holds
+	 * no descriptors of the child either.
+	 */
+	snprintf(l.image_root, PATH_MAX, "%s/layers", def_store);
+	if (!opts.image)
+		strcpy(l.image_root, "alpine");
+	if (opts.prewarm) {
+		prewarm_pid = prewarm_start(l.image_root, opts.prewarm);
+		if (prewarm_pid < 0)
+			return 1;
+		record = prewarm_pid == 0;
+	}
+
+	/* The shipper is not waited for: it ends when the last process of
+	 * the container closes its output.
+	 */
+	l.args.log_fds[0] = l.args.log_fds[1] = -1;
+	if (opts.log_path && log_shipper_start(opts.log_path, (uint64_t) opts.log_mb << 20, l.args.log_fds) < 0)
+		return 1;
+
+	l.args.argv = opts.init ? init_argv(opts.argv) : opts.argv;
+	if (!l.args.argv)
+		return 1;
+	l.args.init_fd = opts.init ? load_init() : -1;
+	if (opts.init && l.args.init_fd < 0)
+		return 1;
+	l.args.layers = NULL;
+	if (opts.image) {
+		if (image_layers(&store, opts.image, layers, sizeof(layers)))
+			return 1;
+		l.args.layers = layers;
+		if (!opts.overlay)
+			opts.overlay = ovl_tmpfs;
+	}
+	if (record && opts.prewarm_evict && prewarm_evict(l.image_root, l.args.layers))
+		return 1;
+	l.args.overlay = opts.overlay;
+	if (opts.overlay && prepare_overlay_dirs(opts.overlay))
+		return 1;
+	l.args.link = &opts.link;
+	l.args.veth = NULL;
+	l.args.agent_sock = -1;
+	if (opts.agent_path) {
+		l.args.agent_sock = agent_listen(opts.agent_path);
+		if (l.args.agent_sock < 0)
+			return 1;
+	}
 
 	if (setgroups(0, NULL) < 0) {
 		perror("sentgroups");
 		return 2;
 	}
 
-	/* SIGCHLD means send a signal the parent after the child has finished
-	 * CLONE_NEWNS - create a new namespace for mount as well as get
-	 * copy of all mount points.
-	 */
-	child_pid = clone(child_fn, child_stack + stack_size - 1, CLONE_NEWNS |
-					  CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWNET | CLONE_NEWPID |
-					  CLONE_NEWUSER | CLONE_NEWCGROUP | SIGCHLD, &ch_args);
-	if (child_pid == -1) {
-		perror("clone");
-		return 3;
+	/* The map is close-on-exec, the programs of the containers don't get it. */
+	if (opts.uplink) {
+		l.fp_map = start_fast_path(opts.uplink);
+		if (l.fp_map < 0)
+			return 11;
 	}
 
-	close(ch_args.pipe_fd[0]);
+	if (opts.daemon_path)
+		return serve(&l);
 
-	vn.ifname = "veth0";
-	vn.peername = "ceth0";
-	vn.ip_addr_if = "172.16.0.2";
-	vn.ip_if_prefix = 24;
-	vn.ip_addr_peer = "172.16.0.3";
-	vn.ip_peer_prefix = 24;
-	vn.child_pid = child_pid;
+	c.name = opts.name;
+	c.args = l.args;
+	c.args.veth = &c.vn;
+	set_veth(&l, &c, -1);
 
-	snprintf(buf, max_path, "/proc/%d/uid_map", child_pid);
-	if (update_map("0 500 65534", buf)) {
-		write(ch_args.pipe_fd[1], "-1", 1);
-		wait(NULL);
-		return 4;
+	/* SIGCHLD means send a signal the parent after the child has finished */
+	ret = launch(&l, &c, SIGCHLD);
+	if (ret) {
+		if (c.pid)
+			waitpid(c.pid, NULL, 0);
+		return ret;
 	}
 
-	if (proc_setgroups_write(child_pid, "deny")) {
-		write(ch_args.pipe_fd[1], "-1", 1);
-		wait(NULL);
-		return 5;
+	if (c.args.agent_sock >= 0)
+		close(c.args.agent_sock);
+	for (i = 0; i < 2; i++) {
+		if (c.args.log_fds[i] >= 0)
+			close(c.args.log_fds[i]);
 	}
 
-	snprintf(buf, max_path, "/proc/%d/gid_map", child_pid);
-	if (update_map("0 500 65534", buf)) {
-		write(ch_args.pipe_fd[1], "-1", 1);
-		wait(NULL);
-		return 6;
+	/* The table of an unnamed container is named after its pid. */
+	if (opts.nports) {
+		snprintf(pid_name, max_path, "%d", c.pid);
+		nft_name = opts.name ? opts.name : pid_name;
+		if (nft_publish(nft_name, c.vn.ip_addr_peer, c.vn.ifname, opts.ports, opts.nports)) {
+			fprintf(stderr, "nft_publish is failed\n");
+			abort_child(&c, 10);
+			waitpid(c.pid, NULL, 0);
+			restore(&l.td, opts.name, c.vn.ifname, NULL, "alpine");
+			return 10;
+		}
 	}
 
-	if (prepare_veth_netns(&vn)) {
-		write(ch_args.pipe_fd[1], "-1", 1);
-		wait(NULL);
-		return 7;
+	close(c.args.pipe_fd[1]);
+
+	/* The profile is what the container has touched by then. */
+	if (record)
+		prewarm_record_start(l.image_root, l.args.layers, opts.prewarm, prewarm_window);
+
+	/* The proxy is forked once the child is released: it would hold the
+	 * sync pipe open otherwise. It connects on demand, so a service that
+	 * isn't listening yet is no problem.
+	 */
+	if (opts.nproxy) {
+		proxy_pid = start_proxy(&opts, c.pid);
+		if (proxy_pid < 0) {
+			fprintf(stderr, "start_proxy is failed\n");
+			kill(c.pid, SIGKILL);
+		}
 	}
 
-	close(ch_args.pipe_fd[1]);
+	/* The monitor is not waited for: it ends when the cgroup empties. */
+	if (opts.psi_ms && start_monitor(&opts) < 0)
+		fprintf(stderr, "start_monitor is failed\n");
+
+	waitpid(c.pid, NULL, 0);
+
+	/* The packets to the address are left to the host stack again. */
+	if (l.fp_map >= 0)
+		fp_del(l.fp_map, c.vn.ip_addr_peer);
+
+	if (proxy_pid > 0)
+		proxy_stop(proxy_pid);
 
-	wait(NULL);
+	if (opts.agent_path)
+		unlink(opts.agent_path);
 
-	if (restore(vn.ifname, "alpine"))
+	/* A macvlan/ipvlan link goes away with the network namespace. */
+	if (restore(&l.td, opts.name, opts.link.kind ? NULL : c.vn.ifname, nft_name, "alpine"))
 		return 8;
+	teardown_stop(&l.td);
 
 	return 0;
 }
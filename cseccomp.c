@@ -0,0 +1,291 @@
+/* Compile seccomp profiles (see create_container -S), print the filter
+ * and measure its overhead per syscall against a linear filter.
+ */
+#define _GNU_SOURCE				/* syscall */
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strcmp */
+#include <unistd.h>				/* syscall */
+#include <time.h>				/* clock_gettime */
+#include <sys/wait.h>			/* waitpid */
+#include <linux/seccomp.h>		/* SECCOMP_RET_ALLOW */
+#include "lib/seccomplib.h"
+
+enum { int_max = 2147483647, max_nr = 512, def_iterations = 2000000 };
+
+enum { mode_none, mode_linear, mode_tree };
+
+static const char *mode_names[] = { "none", "linear", "tree" };
+
+struct cmdline_opts {
+	const char *profile;
+	int linear;
+	int bench;
+	const char *bench_syscall;
+	int iterations;
+};
+
+static struct sc_profile profile;
+static struct sc_filter filter;
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cseccomp program: compile a seccomp profile and benchmark filters\n"
+		 "\n"
+		 "Usage: cseccomp [options] <profile>\n"
+		 "       cseccomp -B [-s syscall] [-i iterations]\n"
+		 "Example: ./cseccomp seccomp.profile\n"
+		 "\n"
+		 "Options are:\n"
+		 " -l             compile a linear filter instead of the binary search\n"
+		 " -B             measure the cost of a syscall with no filter, with a\n"
+		 "                linear and with a binary search filter allowing every\n"
+		 "                known syscall\n"
+		 " -s <syscall>   syscall to measure (default getppid)\n"
+		 " -i <count>     number of calls (default 2000000)\n"
+		 " -h             display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	opts->profile = NULL;
+	opts->linear = 0;
+	opts->bench = 0;
+	opts->bench_syscall = "getppid";
+	opts->iterations = def_iterations;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1;
+	while (idx < argc) {
+		if (argv[idx][0] == '-') {
+			char optc = argv[idx][1];
+			if ((optc == 's' || optc == 'i') && (idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 'l':
+				opts->linear = 1;
+				idx++;
+				break;
+			case 'B':
+				opts->bench = 1;
+				idx++;
+				break;
+			case 's':
+				opts->bench_syscall = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'i':
+				opts->iterations = pos_atoi(argv[idx + 1]);
+				if (opts->iterations <= 0) {
+					fprintf(stderr, "invalid number of calls\n");
+					return 2;
+				}
+				idx += 2;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else {
+			opts->profile = argv[idx];
+			idx++;
+		}
+	}
+
+	return 0;
+}
+
+static void print_action(uint32_t k)
+{
+	switch (k & SECCOMP_RET_ACTION_FULL) {
+	case SECCOMP_RET_ALLOW:
+		printf("allow\n");
+		break;
+	case SECCOMP_RET_ERRNO:
+		printf("errno %u\n", k & SECCOMP_RET_DATA);
+		break;
+	case SECCOMP_RET_LOG:
+		printf("log\n");
+		break;
+	case SECCOMP_RET_KILL_PROCESS:
+		printf("kill\n");
+		break;
+	default:
+		printf("0x%08x\n", k);
+	}
+}
+
+/* The dump prints the filter, syscall numbers are shown with names. */
+static void dump(const struct sc_filter *f)
+{
+	static const char *jumps[] = { "ja", "jeq", "jgt", "jge", "jset" };
+	const struct sock_filter *insn;
+	const char *name;
+	int i, op, nr_loaded = 0;
+
+	for (i = 0; i < f->len; i++) {
+		insn = &f->insns[i];
+		printf("%4d: ", i);
+		switch (BPF_CLASS(insn->code)) {
+		case BPF_LD:
+			printf("ld   [%u]\n", insn->k);
+			nr_loaded = insn->k == 0;
+			break;
+		case BPF_RET:
+			printf("ret  ");
+			print_action(insn->k);
+			break;
+		case BPF_JMP:
+			op = BPF_OP(insn->code) >> 4;
+			if (op == 0) {
+				printf("ja   %u\n", i + 1 + insn->k);
+				break;
+			}
+			name = nr_loaded ? sc_syscall_name(insn->k) : NULL;
+			printf("%-4s 0x%x%s%s%s -> %d, %d\n", op < 5 ? jumps[op] : "j?", insn->k, name ? " (" : "",
+				   name ? name : "", name ? ")" : "", i + 1 + insn->jt, i + 1 + insn->jf);
+			break;
+		default:
+			printf("0x%04x %u %u 0x%x\n", insn->code, insn->jt, insn->jf, insn->k);
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The bench_profile allows every known syscall. The measured one gets a
+ * condition on its last argument (always true in the benchmark): since
+ * Linux 5.11 syscalls allowed regardless of their arguments are cached
+ * and don't run the filter at all, the others pay for every instruction.
+ */
+static int bench_profile(struct sc_profile *p, int bench_nr)
+{
+	struct sc_rule *r;
+	int nr;
+
+	p->def_action = SECCOMP_RET_ERRNO | 38;
+	p->n = 0;
+	for (nr = 0; nr < max_nr && p->n < sc_max_rules; nr++) {
+		if (!sc_syscall_name(nr) && nr != bench_nr)
+			continue;
+		r = &p->rules[p->n++];
+		r->nr = nr;
+		r->action = SECCOMP_RET_ALLOW;
+		r->nargs = 0;
+		if (nr == bench_nr) {
+			r->nargs = 1;
+			r->args[0].index = 5;
+			r->args[0].op = sc_eq;
+			r->args[0].value = 0;
+		}
+	}
+
+	return p->n == 0;
+}
+
+/* The bench_mode installs the filter in a child and times the syscall. */
+static int bench_mode(int mode, int nr, int iterations)
+{
+	double start, secs;
+	int i, pid, status;
+
+	if (mode != mode_none && sc_compile(&profile, mode == mode_linear, &filter))
+		return 1;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 2;
+	}
+
+	if (pid == 0) {
+		if (mode != mode_none && sc_install(&filter))
+			_exit(1);
+		start = now();
+		for (i = 0; i < iterations; i++)
+			syscall(nr, 0, 0, 0, 0, 0, 0);
+		secs = now() - start;
+		printf("%-7s %5d insns %8.1f ns/call\n", mode_names[mode], mode == mode_none ? 0 : filter.len,
+			   secs * 1e9 / iterations);
+		fflush(stdout);
+		_exit(0);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		return 3;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	int nr, mode;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (opts.bench) {
+		nr = sc_syscall_nr(opts.bench_syscall);
+		if (nr < 0) {
+			fprintf(stderr, "unknown syscall %s\n", opts.bench_syscall);
+			return 2;
+		}
+		if (bench_profile(&profile, nr))
+			return 3;
+		printf("%s, %d rules\n", opts.bench_syscall, profile.n);
+		for (mode = mode_none; mode <= mode_tree; mode++) {
+			if (bench_mode(mode, nr, opts.iterations))
+				return 4;
+		}
+		return 0;
+	}
+
+	if (opts.profile == NULL) {
+		fprintf(stderr, "Profile must be specified\n");
+		return 5;
+	}
+
+	if (sc_parse_profile(opts.profile, &profile) || sc_compile(&profile, opts.linear, &filter))
+		return 6;
+
+	dump(&filter);
+	return 0;
+}
@@ -0,0 +1,153 @@
+/* Extract a (gzipped) tar archive, see lib/untar.h. */
+#define _GNU_SOURCE
+#include <stdio.h>				/* printf */
+#include <stdlib.h>				/* exit */
+#include <string.h>				/* strncmp */
+#include <unistd.h>				/* sysconf */
+#include <fcntl.h>				/* open */
+#include "lib/untar.h"
+
+enum { int_max = 2147483647 };
+
+struct cmdline_opts {
+	struct untar_opts untar;
+	const char *archive;
+	const char *dest;
+	int print_digest;
+};
+
+/* The help prints information about using program. */
+static void help()
+{
+	puts("cuntar program: extract a tar or tar.gz archive\n"
+		 "\n"
+		 "Usage: cuntar [options] <archive> <directory>\n"
+		 "Example: ./cuntar -u 500 -g 500 alpine-minirootfs-3.21.3-x86_64.tar.gz alpine\n"
+		 "\n"
+		 "Options are:\n"
+		 " -w <count>   writer threads (default one per CPU, 0 - none)\n"
+		 " -u <uid>     add uid to the owner of every file\n"
+		 " -g <gid>     add gid to the group of every file\n"
+		 " -d <digest>  check the SHA-256 of the archive, [sha256:]<hex>\n"
+		 " -p           print the SHA-256 of the archive\n"
+		 " -h           display this help\n");
+}
+
+/* The pos_atoi converts from ASCII to int (only positive number). */
+static int pos_atoi(const char *s)
+{
+	int i;
+	unsigned long n = 0;
+
+	if (!s || !*s)
+		return -1;
+
+	for (i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+		n = n * 10 + s[i] - '0';
+
+		/* overflow */
+		if (n > int_max)
+			return -1;
+	}
+
+	return s[i] ? -1 : (int) n;
+}
+
+/* The init_cmdline_opts initializes struct cmdline_opts. */
+static void init_cmdline_opts(struct cmdline_opts *opts)
+{
+	memset(&opts->untar, 0, sizeof(opts->untar));
+	opts->untar.workers = sysconf(_SC_NPROCESSORS_ONLN);
+	opts->archive = NULL;
+	opts->dest = NULL;
+	opts->print_digest = 0;
+}
+
+/* The parse_cmdline parses command line arguments. */
+static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
+{
+	int idx = 1, n;
+	while (idx < argc) {
+		if (argv[idx][0] == '-' && argv[idx][1]) {
+			char optc = argv[idx][1];
+			if ((optc == 'w' || optc == 'u' || optc == 'g' || optc == 'd') &&
+				(idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
+				return 1;
+			}
+			switch (optc) {
+			case 'w':
+			case 'u':
+			case 'g':
+				n = pos_atoi(argv[idx + 1]);
+				if (n < 0) {
+					fprintf(stderr, "invalid -%c\n", optc);
+					return 2;
+				}
+				if (optc == 'w')
+					opts->untar.workers = n;
+				else if (optc == 'u')
+					opts->untar.uid_shift = n;
+				else
+					opts->untar.gid_shift = n;
+				idx += 2;
+				break;
+			case 'd':
+				opts->untar.digest = argv[idx + 1];
+				if (strncmp(opts->untar.digest, "sha256:", 7) == 0)
+					opts->untar.digest += 7;
+				idx += 2;
+				break;
+			case 'p':
+				opts->print_digest = 1;
+				idx++;
+				break;
+			case 'h':
+				help();
+				exit(0);
+			default:
+				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
+				return 3;
+			}
+		} else if (!opts->archive) {
+			opts->archive = argv[idx++];
+		} else if (!opts->dest) {
+			opts->dest = argv[idx++];
+		} else {
+			fprintf(stderr, "too many arguments\n");
+			return 4;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct cmdline_opts opts;
+	char hex[sha256_hex_len + 1];
+	int fd;
+
+	init_cmdline_opts(&opts);
+	if (parse_cmdline(argc, argv, &opts))
+		return 1;
+
+	if (!opts.archive || !opts.dest) {
+		fprintf(stderr, "Archive and directory must be specified\n");
+		return 2;
+	}
+
+	fd = strcmp(opts.archive, "-") ? open(opts.archive, O_RDONLY | O_CLOEXEC) : 0;
+	if (fd < 0) {
+		perror(opts.archive);
+		return 3;
+	}
+
+	opts.untar.digest_out = hex;
+	if (untar(fd, opts.dest, &opts.untar))
+		return 4;
+
+	if (opts.print_digest)
+		printf("sha256:%s\n", hex);
+	return 0;
+}
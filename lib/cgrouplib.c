@@ -0,0 +1,231 @@
+#define _GNU_SOURCE				/* snprintf */
+#include <stdio.h>				/* snprintf */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* strlen */
+#include <unistd.h>				/* access */
+#include <errno.h>				/* EEXIST */
+#include <poll.h>				/* poll */
+#include <time.h>				/* clock_gettime */
+#include <sys/types.h>			/* open */
+#include <sys/stat.h>			/* mkdir */
+#include <fcntl.h>
+#include "cgrouplib.h"
+
+static const char *controllers[] = { "+cpu", "+memory", "+io", "+pids", NULL };
+
+/* The cgroup_root returns the mount point of cgroup v2. */
+const char *cgroup_root(void)
+{
+	static const char *root;
+
+	if (!root) {
+		if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0)
+			root = "/sys/fs/cgroup";
+		else
+			root = "/sys/fs/cgroup/unified";
+	}
+
+	return root;
+}
+
+/* The cgroup_dir puts the parent cgroup of all containers to buf. */
+int cgroup_dir(char *buf, int size)
+{
+	if (snprintf(buf, size, "%s/docker-c", cgroup_root()) >= size)
+		return 1;
+	return 0;
+}
+
+/* The cgroup_path puts the path of a file in the cgroup of a container
+ * to buf (the cgroup itself if file is NULL).
+ */
+int cgroup_path(const char *name, const char *file, char *buf, int size)
+{
+	int n;
+
+	if (file)
+		n = snprintf(buf, size, "%s/docker-c/%s/%s", cgroup_root(), name, file);
+	else
+		n = snprintf(buf, size, "%s/docker-c/%s", cgroup_root(), name);
+
+	if (n >= size) {
+		fprintf(stderr, "cgroup path of %s is too long\n", name);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int write_file(const char *path, const char *val)
+{
+	int fd, len = strlen(val);
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return 1;
+
+	if (write(fd, val, len) != len) {
+		close(fd);
+		return 2;
+	}
+
+	close(fd);
+	return 0;
+}
+
+/* The enable_controllers delegates controllers to the cgroups of the
+ * containers. Controllers which aren't available are skipped.
+ */
+static void enable_controllers(const char *dir)
+{
+	char buf[cgroup_max_path];
+	int i;
+
+	for (i = 0; controllers[i]; i++) {
+		snprintf(buf, cgroup_max_path, "%s/cgroup.subtree_control", cgroup_root());
+		write_file(buf, controllers[i]);
+		snprintf(buf, cgroup_max_path, "%s/cgroup.subtree_control", dir);
+		write_file(buf, controllers[i]);
+	}
+}
+
+/* The cgroup_create creates the cgroup of a container and moves pid in. */
+int cgroup_create(const char *name, int pid)
+{
+	char buf[cgroup_max_path];
+	char val[16];
+
+	if (cgroup_dir(buf, cgroup_max_path))
+		return 1;
+
+	if (mkdir(buf, 0755) && errno != EEXIST) {
+		perror(buf);
+		return 2;
+	}
+	enable_controllers(buf);
+
+	if (cgroup_path(name, NULL, buf, cgroup_max_path))
+		return 3;
+
+	if (mkdir(buf, 0755) && errno != EEXIST) {
+		perror(buf);
+		return 4;
+	}
+
+	snprintf(val, sizeof(val), "%d", pid);
+	if (cgroup_write(name, "cgroup.procs", val)) {
+		perror("cgroup.procs");
+		return 5;
+	}
+
+	return 0;
+}
+
+/* The cgroup_write writes val to a file in the cgroup of a container. */
+int cgroup_write(const char *name, const char *file, const char *val)
+{
+	char buf[cgroup_max_path];
+
+	if (cgroup_path(name, file, buf, cgroup_max_path))
+		return 1;
+
+	return write_file(buf, val);
+}
+
+/* The is_frozen reads the state of the freezer from cgroup.events. */
+static int is_frozen(int fd)
+{
+	char buf[256], *p;
+	ssize_t n;
+
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+
+	p = strstr(buf, "frozen ");
+	return p ? p[7] == '1' : -1;
+}
+
+static long elapsed_ms(const struct timespec *start)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - start->tv_sec) * 1000 + (ts.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* The cgroup_freeze freezes (or thaws) the cgroups of n containers. The
+ * cgroup.freeze files are written first, so the kernel works on all of
+ * them at once; then the launcher sleeps in poll(2) until cgroup.events
+ * of each one reports the new state (a change of the file is POLLPRI),
+ * at most timeout_ms. It returns the number of cgroups which haven't
+ * reached the state, or -1.
+ */
+int cgroup_freeze(char **names, int n, int freeze, int timeout_ms)
+{
+	char buf[cgroup_max_path];
+	struct pollfd *pfd;
+	struct timespec start;
+	int i, left = 0, k, timeout, failed = 0;
+
+	pfd = malloc(n * sizeof(*pfd));
+	if (!pfd) {
+		perror("malloc");
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		pfd[i].fd = -1;
+		pfd[i].events = POLLPRI;
+		if (cgroup_path(names[i], "cgroup.events", buf, cgroup_max_path)) {
+			failed++;
+			continue;
+		}
+		pfd[i].fd = open(buf, O_RDONLY | O_CLOEXEC);
+		if (pfd[i].fd < 0 || cgroup_write(names[i], "cgroup.freeze", freeze ? "1" : "0")) {
+			perror(names[i]);
+			if (pfd[i].fd >= 0)
+				close(pfd[i].fd);
+			pfd[i].fd = -1;
+			failed++;
+		}
+	}
+
+	for (;;) {
+		/* Read before poll: only changes after a read are reported. */
+		for (i = 0, left = 0; i < n; i++) {
+			if (pfd[i].fd < 0)
+				continue;
+			if (is_frozen(pfd[i].fd) == freeze) {
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+			} else {
+				left++;
+			}
+		}
+		if (left == 0)
+			break;
+
+		timeout = timeout_ms - elapsed_ms(&start);
+		if (timeout <= 0)
+			break;
+		k = poll(pfd, n, timeout);
+		if (k < 0 && errno != EINTR) {
+			perror("poll cgroup.events");
+			break;
+		}
+	}
+
+	for (i = 0, k = 0; i < n; i++) {
+		if (pfd[i].fd >= 0) {
+			fprintf(stderr, "%s is not %s\n", names[i], freeze ? "frozen" : "thawed");
+			close(pfd[i].fd);
+			k++;
+		}
+	}
+	free(pfd);
+
+	return k + failed;
+}
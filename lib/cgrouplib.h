@@ -0,0 +1,17 @@
+#ifndef CGROUPLIB_SENTRY_H
+#define CGROUPLIB_SENTRY_H
+
+/* Every container gets a cgroup v2 <root>/docker-c/<name>, where root is
+ * /sys/fs/cgroup or /sys/fs/cgroup/unified on hybrid hosts.
+ */
+
+enum { cgroup_max_path = 256 };
+
+const char *cgroup_root(void);
+int cgroup_dir(char *buf, int size);
+int cgroup_path(const char *name, const char *file, char *buf, int size);
+int cgroup_create(const char *name, int pid);
+int cgroup_write(const char *name, const char *file, const char *val);
+int cgroup_freeze(char **names, int n, int freeze, int timeout_ms);
+
+#endif
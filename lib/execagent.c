@@ -0,0 +1,532 @@
+#define _GNU_SOURCE				/* execvpe, accept4 */
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* memset */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* EINTR */
+#include <signal.h>				/* sigprocmask */
+#include <poll.h>				/* poll */
+#include <time.h>				/* clock_gettime */
+#include <sys/types.h>
+#include <sys/stat.h>			/* chmod */
+#include <sys/socket.h>			/* socket */
+#include <sys/un.h>				/* sockaddr_un */
+#include <sys/wait.h>			/* waitpid */
+#include <sys/signalfd.h>		/* signalfd */
+#include "execagent.h"
+
+/* A client has this long to send its request: the agent reads requests
+ * of every client at the same time, but does not keep stalled ones.
+ */
+enum { request_timeout_ms = 1000 };
+
+/* A connection: its request being read, then its program running. */
+struct agent_job {
+	int conn;					/* -1 - free slot */
+	int pid;					/* 0 - the request is being read */
+	struct agent_req_hdr hdr;
+	unsigned int got;			/* bytes of the request read */
+	int fds[agent_nfds];
+	int nfds;
+	char *buf;					/* hdr.len bytes of strings */
+	long deadline;				/* ms, of the request */
+};
+
+static char *def_env[] = { "PATH=/usr/sbin:/usr/bin:/sbin:/bin", NULL };
+
+static int read_full(int fd, void *buf, int len)
+{
+	int n, done = 0;
+
+	while (done < len) {
+		n = read(fd, (char *) buf + done, len - done);
+		if (n == 0)
+			return 1;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 2;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, int len)
+{
+	int n, done = 0;
+
+	while (done < len) {
+		n = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+static int fill_sockaddr(struct sockaddr_un *sa, const char *path)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa->sun_path)) {
+		fprintf(stderr, "socket path %s is too long\n", path);
+		return 1;
+	}
+	strcpy(sa->sun_path, path);
+	return 0;
+}
+
+/* The agent_listen creates the unix socket the agent accepts requests on.
+ * The socket is created by the launcher in the host mount namespace, so
+ * host tools can reach it by path after the container has done pivot_root.
+ */
+int agent_listen(const char *path)
+{
+	struct sockaddr_un sa;
+	int sock;
+
+	if (fill_sockaddr(&sa, path))
+		return -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket agent");
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+		perror("bind agent");
+		close(sock);
+		return -1;
+	}
+
+	if (chmod(path, 0600)) {
+		perror("chmod agent");
+		close(sock);
+		return -1;
+	}
+
+	if (listen(sock, 128)) {
+		perror("listen agent");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* The close_rights closes the descriptors of every SCM_RIGHTS message
+ * received with msg.
+ */
+static void close_rights(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	int i, n, fd;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < n; i++) {
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			close(fd);
+		}
+	}
+}
+
+/* The recv_header reads what has come of the request header and the
+ * descriptors passed with it. It returns 0, -1 if more is to come or a
+ * positive error.
+ */
+static int recv_header(struct agent_job *j)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * agent_nfds)];
+	} cbuf;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int n;
+
+	iov.iov_base = (char *) &j->hdr + j->got;
+	iov.iov_len = sizeof(j->hdr) - j->got;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	n = recvmsg(j->conn, &msg, MSG_CMSG_CLOEXEC);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return -1;
+	if (n <= 0)
+		return 1;
+
+	/* Exactly agent_nfds descriptors, once; any others are closed. */
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg || (msg.msg_flags & MSG_CTRUNC)) {
+		if ((msg.msg_flags & MSG_CTRUNC) || j->nfds || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * agent_nfds) ||
+			CMSG_NXTHDR(&msg, cmsg)) {
+			close_rights(&msg);
+			return 2;
+		}
+		memcpy(j->fds, CMSG_DATA(cmsg), sizeof(int) * agent_nfds);
+		j->nfds = agent_nfds;
+	}
+
+	j->got += n;
+	return j->got < sizeof(j->hdr) ? -1 : 0;
+}
+
+/* The recv_request goes on reading the request of j, the header with the
+ * passed descriptors and then the strings, as far as they have come. It
+ * returns 0 once the request is complete, -1 if more is to come or a
+ * positive error.
+ */
+static int recv_request(struct agent_job *j)
+{
+	int n, ret;
+
+	if (j->got < sizeof(j->hdr)) {
+		ret = recv_header(j);
+		if (ret)
+			return ret;
+		if (j->nfds != agent_nfds || j->hdr.magic != agent_magic || j->hdr.len > agent_max_req ||
+			j->hdr.argc == 0 || j->hdr.argc + j->hdr.envc >= agent_max_args)
+			return 3;
+		j->buf = malloc(j->hdr.len ? j->hdr.len : 1);
+		if (!j->buf) {
+			perror("agent: malloc");
+			return 4;
+		}
+	}
+
+	while (j->got < sizeof(j->hdr) + j->hdr.len) {
+		n = read(j->conn, j->buf + j->got - sizeof(j->hdr), sizeof(j->hdr) + j->hdr.len - j->got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return -1;
+		if (n <= 0)
+			return 5;
+		j->got += n;
+	}
+
+	return 0;
+}
+
+/* The split_strings fills vec with n pointers to NUL-terminated strings
+ * stored one after another in buf.
+ */
+static char *split_strings(char *buf, char *end, char **vec, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		char *nul = memchr(buf, '\0', end - buf);
+		if (!nul)
+			return NULL;
+		vec[i] = buf;
+		buf = nul + 1;
+	}
+	vec[n] = NULL;
+
+	return buf;
+}
+
+static void send_reply(int conn, int status)
+{
+	struct agent_reply rep;
+
+	rep.status = status;
+	write_full(conn, &rep, sizeof(rep));
+	close(conn);
+}
+
+/* The release_request closes the descriptors passed with the request of
+ * j and frees its strings.
+ */
+static void release_request(struct agent_job *j)
+{
+	int i;
+
+	for (i = 0; i < j->nfds; i++)
+		close(j->fds[i]);
+	j->nfds = 0;
+	free(j->buf);
+	j->buf = NULL;
+}
+
+/* The start_job forks the program of the request of j, which has been
+ * read. It returns the pid of the program or -1. The vectors are static
+ * since the agent runs on the small clone stack of the container.
+ */
+static int start_job(struct agent_job *j, const sigset_t *mask)
+{
+	static char *argv[agent_max_args + 1];
+	static char *envp[agent_max_args + 1];
+	char *env;
+	int i, pid;
+
+	env = split_strings(j->buf, j->buf + j->hdr.len, argv, j->hdr.argc);
+	if (!env || !split_strings(env, j->buf + j->hdr.len, envp, j->hdr.envc)) {
+		fprintf(stderr, "agent: malformed request\n");
+		pid = -1;
+		goto out;
+	}
+
+	pid = fork();
+	if (pid == -1) {
+		perror("agent: fork");
+		goto out;
+	}
+
+	if (pid == 0) {
+		for (i = 0; i < agent_nfds; i++) {
+			if (dup2(j->fds[i], i) < 0)
+				_exit(126);
+		}
+		sigprocmask(SIG_UNBLOCK, mask, NULL);
+		execvpe(argv[0], argv, j->hdr.envc ? envp : def_env);
+		perror(argv[0]);
+		fflush(stderr);
+		_exit(127);
+	}
+
+ out:
+	release_request(j);
+	return pid;
+}
+
+/* The drop_job answers the connection of j with status and frees j. */
+static void drop_job(struct agent_job *j, int status)
+{
+	release_request(j);
+	send_reply(j->conn, status);
+	j->conn = -1;
+	j->pid = 0;
+}
+
+/* The accept_job accepts a connection into a free slot of jobs. */
+static void accept_job(int lsock, struct agent_job *jobs)
+{
+	struct agent_job *j;
+	int i, conn;
+
+	conn = accept4(lsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (conn < 0)
+		return;
+
+	for (i = 0; i < agent_max_jobs && jobs[i].conn >= 0; i++);
+	if (i == agent_max_jobs) {
+		fprintf(stderr, "agent: too many jobs\n");
+		send_reply(conn, -1);
+		return;
+	}
+
+	j = &jobs[i];
+	j->conn = conn;
+	j->pid = 0;
+	j->got = 0;
+	j->nfds = 0;
+	j->buf = NULL;
+	j->deadline = now_ms() + request_timeout_ms;
+}
+
+/* The agent_serve runs inside the container namespaces and never returns.
+ * Every accepted connection carries one exec request: the agent forks the
+ * program with the passed stdio and sends back its wait status when it is
+ * reaped. The requests are read without blocking, as they come, and
+ * several programs may run at the same time.
+ */
+void agent_serve(int lsock)
+{
+	static struct agent_job jobs[agent_max_jobs];
+	static struct pollfd pfd[2 + agent_max_jobs];
+	struct signalfd_siginfo si;
+	struct agent_job *j;
+	sigset_t mask;
+	int i, ret, pid, status;
+	long now, timeout;
+
+	for (i = 0; i < agent_max_jobs; i++)
+		jobs[i].conn = -1;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	pfd[0].fd = lsock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	pfd[1].events = POLLIN;
+	if (pfd[1].fd < 0) {
+		perror("agent: signalfd");
+		_exit(1);
+	}
+
+	for (;;) {
+		/* Poll the connections whose requests are being read. */
+		now = now_ms();
+		timeout = -1;
+		for (i = 0; i < agent_max_jobs; i++) {
+			j = &jobs[i];
+			pfd[2 + i].fd = j->conn >= 0 && !j->pid ? j->conn : -1;
+			pfd[2 + i].events = POLLIN;
+			if (pfd[2 + i].fd >= 0 && (timeout < 0 || j->deadline - now < timeout))
+				timeout = j->deadline > now ? j->deadline - now : 0;
+		}
+
+		if (poll(pfd, 2 + agent_max_jobs, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("agent: poll");
+			_exit(2);
+		}
+
+		if (pfd[0].revents & POLLIN)
+			accept_job(lsock, jobs);
+
+		now = now_ms();
+		for (i = 0; i < agent_max_jobs; i++) {
+			j = &jobs[i];
+			if (pfd[2 + i].fd < 0 || j->conn != pfd[2 + i].fd)
+				continue;
+			ret = pfd[2 + i].revents ? recv_request(j) : -1;
+			if (ret < 0 && j->deadline > now)
+				continue;
+			if (ret) {
+				fprintf(stderr, "agent: %s request\n", ret < 0 ? "stalled" : "bad");
+				drop_job(j, -1);
+				continue;
+			}
+			pid = start_job(j, &mask);
+			if (pid < 0)
+				drop_job(j, -1);
+			else
+				j->pid = pid;
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			read(pfd[1].fd, &si, sizeof(si));
+			while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+				for (i = 0; i < agent_max_jobs; i++) {
+					if (jobs[i].conn >= 0 && jobs[i].pid == pid) {
+						drop_job(&jobs[i], status);
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+/* The agent_exec asks the agent listening on path to run argv with envp
+ * (or its default environment if envp is empty) and fds as stdin, stdout
+ * and stderr. On success status holds the wait status of the program.
+ */
+int agent_exec(const char *path, char **argv, char **envp, const int *fds, int *status)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * agent_nfds)];
+	} cbuf;
+	static char buf[agent_max_req];
+	struct sockaddr_un sa;
+	struct agent_req_hdr hdr;
+	struct agent_reply rep;
+	struct iovec iov = {.iov_base = &hdr,.iov_len = sizeof(hdr) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int i, len, sock, ret = 0;
+
+	hdr.magic = agent_magic;
+	hdr.argc = 0;
+	hdr.envc = 0;
+	hdr.len = 0;
+	for (i = 0; argv[i]; i++, hdr.argc++) {
+		len = strlen(argv[i]) + 1;
+		if (hdr.len + len > agent_max_req)
+			return 1;
+		memcpy(buf + hdr.len, argv[i], len);
+		hdr.len += len;
+	}
+	for (i = 0; envp && envp[i]; i++, hdr.envc++) {
+		len = strlen(envp[i]) + 1;
+		if (hdr.len + len > agent_max_req)
+			return 1;
+		memcpy(buf + hdr.len, envp[i], len);
+		hdr.len += len;
+	}
+	if (hdr.argc + hdr.envc >= agent_max_args) {
+		fprintf(stderr, "too many arguments\n");
+		return 1;
+	}
+
+	if (fill_sockaddr(&sa, path))
+		return 2;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket");
+		return 3;
+	}
+
+	if (connect(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+		perror("connect");
+		ret = 4;
+		goto out;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cbuf, 0, sizeof(cbuf));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * agent_nfds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * agent_nfds);
+
+	if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(hdr) || write_full(sock, buf, hdr.len)) {
+		perror("send request");
+		ret = 5;
+		goto out;
+	}
+
+	if (read_full(sock, &rep, sizeof(rep))) {
+		fprintf(stderr, "agent closed the connection\n");
+		ret = 6;
+		goto out;
+	}
+
+	if (rep.status == -1) {
+		fprintf(stderr, "agent failed to run %s\n", argv[0]);
+		ret = 7;
+		goto out;
+	}
+	*status = rep.status;
+
+ out:
+	close(sock);
+	return ret;
+}
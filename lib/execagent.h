@@ -0,0 +1,33 @@
+#ifndef EXECAGENT_SENTRY_H
+#define EXECAGENT_SENTRY_H
+
+#include <stdint.h>
+
+/* Exec requests are sent over a unix stream socket. A request is a
+ * header followed by hdr.len bytes of NUL-terminated strings: first
+ * hdr.argc arguments, then hdr.envc environment entries. The stdin,
+ * stdout and stderr of the client are passed with the header as
+ * SCM_RIGHTS. The agent replies with struct agent_reply once the
+ * program has finished.
+ */
+
+enum { agent_magic = 0x64636578, agent_nfds = 3, agent_max_req = 64 * 1024,
+	agent_max_args = 256, agent_max_jobs = 64
+};
+
+struct agent_req_hdr {
+	uint32_t magic;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t len;
+};
+
+struct agent_reply {
+	int32_t status;				/* wait status, see waitpid(2) */
+};
+
+int agent_listen(const char *path);
+void agent_serve(int lsock);
+int agent_exec(const char *path, char **argv, char **envp, const int *fds, int *status);
+
+#endif
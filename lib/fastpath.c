@@ -0,0 +1,427 @@
+#define _GNU_SOURCE				/* syscall */
+#include <stdio.h>				/* perror */
+#include <string.h>				/* memset */
+#include <unistd.h>				/* syscall */
+#include <errno.h>				/* ENOENT */
+#include <stddef.h>				/* offsetof */
+#include <sys/syscall.h>		/* __NR_bpf */
+#include <sys/stat.h>			/* mkdir */
+#include <sys/ioctl.h>			/* SIOCGIFHWADDR */
+#include <sys/socket.h>			/* socket */
+#include <net/if.h>				/* struct ifreq */
+#include <arpa/inet.h>			/* inet_pton */
+#include <linux/bpf.h>			/* struct bpf_insn */
+#include <linux/if_ether.h>		/* ETH_P_IP */
+#include <linux/pkt_cls.h>		/* TC_ACT_OK */
+#include <linux/pkt_sched.h>	/* TC_H_CLSACT */
+#include "netlinklib.h"
+#include "fastpath.h"
+
+enum { max_insns = 96, max_fixups = 16, log_size = 65536 };
+
+/* Offsets in the packet, from the Ethernet header. */
+enum {
+	ip_off = ETH_HLEN,
+	ip_tos = ip_off + 1,
+	ip_ttl = ip_off + 8,
+	ip_proto = ip_off + 9,
+	ip_check = ip_off + 10,
+	ip_saddr = ip_off + 12,
+	ip_daddr = ip_off + 16,
+	ip_end = ip_off + 20
+};
+
+/* The parameters of bpf_fib_lookup live at the bottom of the stack. */
+enum { fib_size = sizeof(struct bpf_fib_lookup), fib = -fib_size };
+
+#define FIB(field) (fib + (int) offsetof(struct bpf_fib_lookup, field))
+
+static const char fp_dir[] = "/sys/fs/bpf/docker-c";
+static const char fp_map_path[] = "/sys/fs/bpf/docker-c/containers";
+
+/* A program being built; jumps to the end (pass the packet on) are fixed
+ * up when it is finished.
+ */
+struct prog {
+	struct bpf_insn insns[max_insns];
+	int len;
+	int fixups[max_fixups];
+	int nfixups;
+};
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static uint64_t ptr(const void *p)
+{
+	return (uint64_t) (unsigned long) p;
+}
+
+static int emit(struct prog *p, int code, int dst, int src, int off, int imm)
+{
+	struct bpf_insn *insn = &p->insns[p->len];
+
+	memset(insn, 0, sizeof(*insn));
+	insn->code = code;
+	insn->dst_reg = dst;
+	insn->src_reg = src;
+	insn->off = off;
+	insn->imm = imm;
+	return p->len++;
+}
+
+/* The emit_pass emits a conditional jump to the end. */
+static void emit_pass(struct prog *p, int op, int dst, int src, int imm)
+{
+	p->fixups[p->nfixups++] = emit(p, BPF_JMP | op, dst, src, 0, imm);
+}
+
+/* The land points the jump at to the next instruction. */
+static void land(struct prog *p, int at)
+{
+	p->insns[at].off = p->len - at - 1;
+}
+
+/* The emit_ipv4 checks the packet is IPv4 with the whole header in the
+ * linear data: r6 - the context, r7 - the Ethernet header, r8 - the end
+ * of the data.
+ */
+static void emit_ipv4(struct prog *p)
+{
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, protocol), 0);
+	emit_pass(p, BPF_JNE | BPF_K, BPF_REG_2, 0, htons(ETH_P_IP));
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_7, BPF_REG_6, offsetof(struct __sk_buff, data), 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_8, BPF_REG_6, offsetof(struct __sk_buff, data_end), 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_7, 0, 0);
+	emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, ip_end);
+	emit_pass(p, BPF_JGT | BPF_X, BPF_REG_2, BPF_REG_8, 0);
+}
+
+/* The emit_ttl decrements the TTL and updates the checksum of the header
+ * (see ip_decrease_ttl); an expiring packet goes to the stack, which
+ * sends the ICMP error.
+ */
+static void emit_ttl(struct prog *p)
+{
+	emit(p, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_2, BPF_REG_7, ip_ttl, 0);
+	emit_pass(p, BPF_JLE | BPF_K, BPF_REG_2, 0, 1);
+	emit(p, BPF_ALU64 | BPF_SUB | BPF_K, BPF_REG_2, 0, 0, 1);
+	emit(p, BPF_STX | BPF_MEM | BPF_B, BPF_REG_7, BPF_REG_2, ip_ttl, 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_H, BPF_REG_2, BPF_REG_7, ip_check, 0);
+	emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, htons(0x0100));
+	emit(p, BPF_JMP | BPF_JLT | BPF_K, BPF_REG_2, 0, 1, 0xffff);
+	emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, 1);
+	emit(p, BPF_STX | BPF_MEM | BPF_H, BPF_REG_7, BPF_REG_2, ip_check, 0);
+}
+
+static void emit_call(struct prog *p, int func)
+{
+	emit(p, BPF_JMP | BPF_CALL, 0, 0, 0, func);
+}
+
+static void emit_exit(struct prog *p)
+{
+	emit(p, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+/* The finish ends the program with passing the packet on. */
+static void finish(struct prog *p)
+{
+	int i;
+
+	for (i = 0; i < p->nfixups; i++)
+		land(p, p->fixups[i]);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, TC_ACT_OK);
+	emit_exit(p);
+}
+
+/* The build_to_container builds the program of the uplink. */
+static void build_to_container(struct prog *p, int map_fd)
+{
+	int i;
+
+	emit_ipv4(p);
+
+	/* r0 = lookup(map, &daddr) */
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_7, ip_daddr, 0);
+	emit(p, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_2, -4, 0);
+	emit(p, BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd);
+	emit(p, 0, 0, 0, 0, 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+	emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -4);
+	emit_call(p, BPF_FUNC_map_lookup_elem);
+	emit_pass(p, BPF_JEQ | BPF_K, BPF_REG_0, 0, 0);
+
+	emit_ttl(p);
+
+	/* The destination and source MAC addresses follow the ifindex. */
+	for (i = 0; i < 12; i += 4) {
+		emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_0, offsetof(struct fp_container, peer_mac) + i, 0);
+		emit(p, BPF_STX | BPF_MEM | BPF_W, BPF_REG_7, BPF_REG_2, i, 0);
+	}
+
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_0, offsetof(struct fp_container, ifindex), 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, 0);
+	emit_call(p, BPF_FUNC_redirect_peer);
+	emit_exit(p);
+
+	finish(p);
+}
+
+/* The build_from_container builds the program of the host end of a pair. */
+static void build_from_container(struct prog *p)
+{
+	int i, ok, neigh;
+
+	emit_ipv4(p);
+
+	/* The parameters of the lookup: zeroes, then the fields of the packet. */
+	for (i = fib; i < 0; i += 8)
+		emit(p, BPF_ST | BPF_MEM | BPF_DW, BPF_REG_10, 0, i, 0);
+	emit(p, BPF_ST | BPF_MEM | BPF_B, BPF_REG_10, 0, FIB(family), AF_INET);
+	emit(p, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_2, BPF_REG_7, ip_tos, 0);
+	emit(p, BPF_STX | BPF_MEM | BPF_B, BPF_REG_10, BPF_REG_2, FIB(tos), 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_B, BPF_REG_2, BPF_REG_7, ip_proto, 0);
+	emit(p, BPF_STX | BPF_MEM | BPF_B, BPF_REG_10, BPF_REG_2, FIB(l4_protocol), 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_7, ip_saddr, 0);
+	emit(p, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_2, FIB(ipv4_src), 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_7, ip_daddr, 0);
+	emit(p, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_2, FIB(ipv4_dst), 0);
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, ingress_ifindex), 0);
+	emit(p, BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_2, FIB(ifindex), 0);
+
+	/* r9 = fib_lookup(skb, &params, sizeof(params), 0) */
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0);
+	emit(p, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, fib);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, fib_size);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 0);
+	emit_call(p, BPF_FUNC_fib_lookup);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_9, BPF_REG_0, 0, 0);
+	ok = emit(p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_9, 0, 0, BPF_FIB_LKUP_RET_SUCCESS);
+	emit_pass(p, BPF_JNE | BPF_K, BPF_REG_9, 0, BPF_FIB_LKUP_RET_NO_NEIGH);
+	land(p, ok);
+
+	emit_ttl(p);
+	neigh = emit(p, BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_9, 0, 0, BPF_FIB_LKUP_RET_NO_NEIGH);
+
+	/* The addresses of the next hop; the stack is accessed aligned. */
+	for (i = 0; i < 6; i += 2) {
+		emit(p, BPF_LDX | BPF_MEM | BPF_H, BPF_REG_2, BPF_REG_10, FIB(dmac) + i, 0);
+		emit(p, BPF_STX | BPF_MEM | BPF_H, BPF_REG_7, BPF_REG_2, i, 0);
+		emit(p, BPF_LDX | BPF_MEM | BPF_H, BPF_REG_2, BPF_REG_10, FIB(smac) + i, 0);
+		emit(p, BPF_STX | BPF_MEM | BPF_H, BPF_REG_7, BPF_REG_2, ETH_ALEN + i, 0);
+	}
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_10, FIB(ifindex), 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, 0);
+	emit_call(p, BPF_FUNC_redirect);
+	emit_exit(p);
+
+	/* redirect_neigh(ifindex, NULL, 0, 0) resolves the next hop itself. */
+	land(p, neigh);
+	emit(p, BPF_LDX | BPF_MEM | BPF_W, BPF_REG_1, BPF_REG_10, FIB(ifindex), 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_2, 0, 0, 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, 0);
+	emit(p, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 0);
+	emit_call(p, BPF_FUNC_redirect_neigh);
+	emit_exit(p);
+
+	finish(p);
+}
+
+/* The load loads a program, printing the log of the verifier if it is
+ * rejected.
+ */
+static int load(const struct prog *p, const char *name)
+{
+	static char log[log_size];
+	union bpf_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_SCHED_CLS;
+	attr.insns = ptr(p->insns);
+	attr.insn_cnt = p->len;
+	attr.license = ptr("GPL");	/* fib_lookup is for GPL programs */
+	attr.log_buf = ptr(log);
+	attr.log_size = log_size;
+	attr.log_level = 1;
+	strncpy(attr.prog_name, name, sizeof(attr.prog_name) - 1);
+
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0) {
+		perror(name);
+		fprintf(stderr, "%s", log);
+	}
+	return fd;
+}
+
+/* The fp_map_open opens the map of containers, the first launcher creates
+ * and pins it.
+ */
+int fp_map_open(void)
+{
+	union bpf_attr attr;
+	int fd;
+
+	for (;;) {
+		memset(&attr, 0, sizeof(attr));
+		attr.pathname = ptr(fp_map_path);
+		fd = sys_bpf(BPF_OBJ_GET, &attr);
+		if (fd >= 0 || errno != ENOENT)
+			break;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.map_type = BPF_MAP_TYPE_HASH;
+		attr.key_size = 4;
+		attr.value_size = sizeof(struct fp_container);
+		attr.max_entries = fp_max_containers;
+		strncpy(attr.map_name, "fp_containers", sizeof(attr.map_name) - 1);
+		fd = sys_bpf(BPF_MAP_CREATE, &attr);
+		if (fd < 0)
+			break;
+
+		/* An unpinned map would be private to this launcher. */
+		if (mkdir(fp_dir, 0700) && errno != EEXIST) {
+			perror(fp_dir);
+			close(fd);
+			return -1;
+		}
+		memset(&attr, 0, sizeof(attr));
+		attr.pathname = ptr(fp_map_path);
+		attr.bpf_fd = fd;
+		if (sys_bpf(BPF_OBJ_PIN, &attr) == 0)
+			return fd;
+
+		/* Another launcher has pinned its map meanwhile. */
+		close(fd);
+		fd = -1;
+		if (errno != EEXIST)
+			break;
+	}
+
+	if (fd < 0)
+		perror(fp_map_path);
+	return fd;
+}
+
+/* The attach loads a program and attaches it to the ingress of the link. */
+static int attach(int sock, const char *ifname, const struct prog *p, const char *name)
+{
+	int fd, ret = 0;
+
+	fd = load(p, name);
+	if (fd < 0)
+		return 1;
+	if (qdisc_add_clsact(sock, ifname) ||
+		filter_add_bpf(sock, ifname, TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS), fd, name))
+		ret = 2;
+	close(fd);
+	return ret;
+}
+
+/* The fp_attach_uplink attaches the program of the uplink, which takes
+ * the addresses of the containers from the map.
+ */
+int fp_attach_uplink(int sock, const char *uplink, int map_fd)
+{
+	static struct prog p;
+
+	p.len = p.nfixups = 0;
+	build_to_container(&p, map_fd);
+	return attach(sock, uplink, &p, "fp_to_container");
+}
+
+/* The fp_attach_veth attaches the program of the host end of a pair. */
+int fp_attach_veth(int sock, const char *ifname)
+{
+	static struct prog p;
+
+	p.len = p.nfixups = 0;
+	build_from_container(&p);
+	return attach(sock, ifname, &p, "fp_from_cont");
+}
+
+static int link_mac(const char *ifname, uint8_t * mac)
+{
+	struct ifreq ifr;
+	int sock, ret = 0;
+
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket");
+		return 1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	if (ioctl(sock, SIOCGIFHWADDR, &ifr)) {
+		perror(ifname);
+		ret = 2;
+	}
+	memcpy(mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+	close(sock);
+	return ret;
+}
+
+/* The fp_add adds the container with the address ip behind the veth pair
+ * ifname - peername; the peer is still in the host namespace.
+ */
+int fp_add(int map_fd, const char *ip, const char *ifname, const char *peername)
+{
+	struct fp_container c;
+	union bpf_attr attr;
+	struct in_addr addr;
+
+	if (inet_pton(AF_INET, ip, &addr) != 1) {
+		fprintf(stderr, "invalid address %s\n", ip);
+		return 1;
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.ifindex = if_nametoindex(ifname);
+	if (!c.ifindex) {
+		perror("if_nametoindex");
+		return 2;
+	}
+	if (link_mac(peername, c.peer_mac) || link_mac(ifname, c.host_mac))
+		return 3;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = ptr(&addr);
+	attr.value = ptr(&c);
+	attr.flags = BPF_ANY;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+		perror("fp_add");
+		return 4;
+	}
+
+	return 0;
+}
+
+/* The fp_del removes the container with the address ip. */
+int fp_del(int map_fd, const char *ip)
+{
+	union bpf_attr attr;
+	struct in_addr addr;
+
+	if (inet_pton(AF_INET, ip, &addr) != 1) {
+		fprintf(stderr, "invalid address %s\n", ip);
+		return 1;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = ptr(&addr);
+	if (sys_bpf(BPF_MAP_DELETE_ELEM, &attr) && errno != ENOENT) {
+		perror("fp_del");
+		return 2;
+	}
+
+	return 0;
+}
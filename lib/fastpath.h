@@ -0,0 +1,39 @@
+#ifndef FASTPATH_SENTRY_H
+#define FASTPATH_SENTRY_H
+
+#include <stdint.h>
+
+/* The fast path moves packets between an uplink and the containers with
+ * tc BPF programs instead of the host stack:
+ *
+ * - on the ingress of the uplink a packet to the address of a container
+ *   (the map of containers) gets the MAC addresses of its veth pair and
+ *   is passed by bpf_redirect_peer to the container end of the pair. It
+ *   skips the routing of the host, the host end and the backlog queue of
+ *   the veth;
+ * - on the ingress of the host end of a pair a packet from the container
+ *   is routed with bpf_fib_lookup and sent out of the uplink, the next hop
+ *   resolved by bpf_redirect_neigh if the lookup has no neighbour yet.
+ *
+ * Both decrement the TTL as the host stack would. The rest (not IPv4, not
+ * in the map, local or unroutable, TTL expiring) goes on to the host stack.
+ * The map is pinned in the BPF filesystem, so the launchers share it: a
+ * launcher adds its container and removes it when the container is gone.
+ */
+
+enum { fp_max_containers = 1024 };
+
+/* A value of the map, the key is the IPv4 address of the container. */
+struct fp_container {
+	uint32_t ifindex;			/* of the host end */
+	uint8_t peer_mac[6];		/* the container end */
+	uint8_t host_mac[6];
+};
+
+int fp_map_open(void);
+int fp_attach_uplink(int sock, const char *uplink, int map_fd);
+int fp_attach_veth(int sock, const char *ifname);
+int fp_add(int map_fd, const char *ip, const char *ifname, const char *peername);
+int fp_del(int map_fd, const char *ip);
+
+#endif
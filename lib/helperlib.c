@@ -0,0 +1,95 @@
+#define _GNU_SOURCE				/* memfd_create, execveat */
+#include <stdio.h>				/* perror */
+#include <string.h>				/* strrchr */
+#include <unistd.h>				/* execveat */
+#include <errno.h>				/* EINVAL */
+#include <fcntl.h>				/* F_ADD_SEALS */
+#include <sys/types.h>
+#include <sys/stat.h>			/* fstat */
+#include <sys/mman.h>			/* memfd_create */
+#include <sys/sendfile.h>		/* sendfile */
+#include "helperlib.h"
+
+#ifndef MFD_EXEC
+#define MFD_EXEC 0x0010U		/* Linux 6.3, needed if vm.memfd_noexec=1 */
+#endif
+
+extern char **environ;
+
+/* The create_memfd creates an executable memfd named after the program. */
+static int create_memfd(const char *path)
+{
+	const char *name = strrchr(path, '/');
+	int fd;
+
+	name = name ? name + 1 : path;
+	fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_EXEC);
+	/* Older kernels don't know MFD_EXEC, their memfds are executable. */
+	if (fd < 0 && errno == EINVAL)
+		fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		perror("memfd_create");
+
+	return fd;
+}
+
+/* The helper_load copies the program of path to a memfd and seals it, so
+ * it can be neither written nor resized. It returns the descriptor
+ * (close-on-exec) or -1.
+ */
+int helper_load(const char *path)
+{
+	struct stat st;
+	off_t off = 0;
+	ssize_t n;
+	int fd, mfd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (fstat(fd, &st)) {
+		perror("fstat helper");
+		goto err;
+	}
+
+	mfd = create_memfd(path);
+	if (mfd < 0)
+		goto err;
+
+	while (off < st.st_size) {
+		n = sendfile(mfd, fd, &off, st.st_size - off);
+		if (n <= 0) {
+			perror("sendfile helper");
+			goto err_mfd;
+		}
+	}
+
+	if (fchmod(mfd, 0555) ||
+		fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)) {
+		perror("seal helper");
+		goto err_mfd;
+	}
+
+	close(fd);
+	return mfd;
+
+ err_mfd:
+	close(mfd);
+ err:
+	close(fd);
+	return -1;
+}
+
+/* The helper_exec runs the helper loaded to fd. The close-on-exec
+ * descriptor is fine for a static program, which is not reopened by an
+ * interpreter. It returns only on failure.
+ */
+int helper_exec(int fd, char **argv)
+{
+	execveat(fd, "", argv, environ, AT_EMPTY_PATH);
+	perror("execveat helper");
+	return 1;
+}
@@ -0,0 +1,14 @@
+#ifndef HELPERLIB_SENTRY_H
+#define HELPERLIB_SENTRY_H
+
+/* Helper programs (an init, a prober) run inside containers, but are not
+ * part of their images. The launcher loads a helper once into a sealed
+ * memfd, the children inherit the descriptor and exec it after
+ * pivot_root. Every container runs the same pages and can't change them.
+ * Helpers must be static: the rootfs may have no (or another) libc.
+ */
+
+int helper_load(const char *path);
+int helper_exec(int fd, char **argv);
+
+#endif
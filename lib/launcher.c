@@ -0,0 +1,1293 @@
+#define _GNU_SOURCE				/* accept4, MSG_CMSG_CLOEXEC */
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* memcpy */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* EEXIST */
+#include <signal.h>				/* SIGKILL */
+#include <sys/types.h>
+#include <sys/stat.h>			/* chmod */
+#include <sys/socket.h>			/* socketpair */
+#include <sys/un.h>				/* sockaddr_un */
+#include <sys/epoll.h>			/* epoll_wait */
+#include <sys/signalfd.h>		/* signalfd */
+#include <sys/syscall.h>		/* SYS_pidfd_send_signal */
+#include <sys/wait.h>			/* waitid */
+#include "launcher.h"
+
+enum { max_events = 64, max_job = 16 * 1024, worker_queue = 16, max_conns = 1024,
+	max_replies = lch_max_batch * lch_max_containers
+};
+
+/* The kinds of descriptors in the epoll of the daemon, the upper half of
+ * the event data; the lower half is the connection, the worker or the
+ * slot of the container.
+ */
+enum { ev_listen, ev_signal, ev_conn, ev_worker, ev_child };
+
+/* A create passed to a worker, followed by the strings of the arguments. */
+struct lch_job {
+	uint32_t slot;
+	uint32_t argc;
+	char name[lch_name_len];
+};
+
+/* The answer of a worker. The pidfd and the hold descriptor come with it
+ * as SCM_RIGHTS, only the pidfd if the create has failed after the clone.
+ */
+struct lch_done {
+	uint32_t slot;
+	int32_t err;
+	int32_t pid;
+};
+
+struct lch_container {
+	char name[lch_name_len];
+	int state;					/* 0 - free slot */
+	int pid;
+	int pidfd;					/* -1 - none or reaped */
+	int hold;					/* -1 - released */
+	int status;
+	int worker;					/* of a create */
+	int dead;					/* a failed create, freed once reaped */
+	struct lch_batch *b;		/* waits for the create or the stop */
+	int idx;					/* of the request in b */
+};
+
+/* A request of a message and its reply; a list has its replies apart. */
+struct lch_slot {
+	struct lch_req req;
+	const char *strs;
+	struct lch_reply rep;
+	struct lch_reply *list;
+	int nlist;
+};
+
+struct lch_batch {
+	int conn;					/* of the daemon */
+	char *buf;					/* the message */
+	struct lch_slot *slots;
+	int n;
+	int next;					/* the first request not run yet */
+	int pending;				/* creates and stops not done yet */
+	struct lch_batch *link;
+};
+
+/* A connection of a client. It is never waited for: the message is read
+ * and the answer written as far as the socket allows, the rest when the
+ * epoll reports it ready again.
+ */
+struct lch_conn {
+	int fd;						/* -1 - free slot */
+	struct lch_hdr hdr;
+	char *buf;					/* the message being read, then the answer */
+	uint32_t len;				/* of the answer, 0 - reading */
+	uint32_t done;				/* bytes read (the header included) or written */
+};
+
+struct lch_worker {
+	int sock;					/* -1 - gone */
+	int pid;
+	int jobs;
+};
+
+struct lch_daemon {
+	int epfd;
+	const struct lch_ops *ops;
+	struct lch_worker workers[lch_max_workers];
+	int nworkers;
+	struct lch_container ct[lch_max_containers];
+	int next_slot;
+	struct lch_batch *batches;
+	struct lch_conn conns[max_conns];
+};
+
+static const char *op_names[] = { "?", "create", "start", "stop", "delete", "list" };
+
+static const char *state_names[] = { "gone", "creating", "created", "running", "stopping", "stopped" };
+
+const char *lch_op_name(int op)
+{
+	return op >= lch_create && op <= lch_list ? op_names[op] : op_names[0];
+}
+
+const char *lch_state_name(int state)
+{
+	return state >= 0 && state <= lch_stopped ? state_names[state] : "?";
+}
+
+static int read_full(int fd, void *buf, int len)
+{
+	int n, done = 0;
+
+	while (done < len) {
+		n = read(fd, (char *) buf + done, len - done);
+		if (n == 0)
+			return 1;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 2;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, int len)
+{
+	int n, done = 0;
+
+	while (done < len) {
+		n = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+static int fill_sockaddr(struct sockaddr_un *sa, const char *path)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa->sun_path)) {
+		fprintf(stderr, "socket path %s is too long\n", path);
+		return 1;
+	}
+	strcpy(sa->sun_path, path);
+	return 0;
+}
+
+/* The split_strings fills vec with n pointers to NUL-terminated strings
+ * stored one after another in buf.
+ */
+static char *split_strings(char *buf, char *end, char **vec, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		char *nul = memchr(buf, '\0', end - buf);
+		if (!nul)
+			return NULL;
+		vec[i] = buf;
+		buf = nul + 1;
+	}
+	vec[n] = NULL;
+
+	return buf;
+}
+
+/* The lch_listen creates the unix socket the daemon accepts requests on. */
+int lch_listen(const char *path)
+{
+	struct sockaddr_un sa;
+	int sock;
+
+	if (fill_sockaddr(&sa, path))
+		return -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket launcher");
+		return -1;
+	}
+
+	unlink(path);
+	if (bind(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+		perror("bind launcher");
+		close(sock);
+		return -1;
+	}
+
+	if (chmod(path, 0600)) {
+		perror("chmod launcher");
+		close(sock);
+		return -1;
+	}
+
+	if (listen(sock, 128)) {
+		perror("listen launcher");
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* The send_done answers a job with the descriptors of the container. */
+static int send_done(int sock, struct lch_done *done, int pidfd, int hold)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * 2)];
+	} cbuf;
+	struct iovec iov = {.iov_base = done,.iov_len = sizeof(*done) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int fds[2], n = 0;
+
+	if (pidfd >= 0)
+		fds[n++] = pidfd;
+	if (pidfd >= 0 && hold >= 0)
+		fds[n++] = hold;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cbuf, 0, sizeof(cbuf));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (n) {
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+	}
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(*done);
+}
+
+/* The worker creates the containers of the jobs it gets, one by one, and
+ * exits when the daemon closes its end.
+ */
+static void worker(int sock, const struct lch_ops *ops)
+{
+	static char buf[sizeof(struct lch_job) + max_job];
+	static char *argv[lch_max_args + 1];
+	struct lch_job job;
+	struct lch_done done;
+	int n, pidfd, hold;
+
+	for (;;) {
+		n = recv(sock, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			_exit(n < 0);
+		if (n < (int) sizeof(job))
+			_exit(2);
+		memcpy(&job, buf, sizeof(job));
+
+		pidfd = hold = -1;
+		done.slot = job.slot;
+		done.pid = 0;
+		if (job.argc > lch_max_args || (job.argc && !split_strings(buf + sizeof(job), buf + n, argv, job.argc)))
+			done.err = EINVAL;
+		else
+			done.err = ops->create(ops->arg, job.name, job.slot, job.argc ? argv : NULL, &done.pid, &pidfd, &hold);
+
+		if (send_done(sock, &done, pidfd, hold))
+			_exit(3);
+		if (pidfd >= 0)
+			close(pidfd);
+		if (hold >= 0)
+			close(hold);
+	}
+}
+
+/* The start_workers forks the pool. A worker keeps only its own end of
+ * the socket pair: the containers it clones get its descriptors.
+ */
+static int start_workers(struct lch_daemon *d, int lsock, int n)
+{
+	int sv[2], i, j;
+
+	for (i = 0; i < n; i++) {
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+			perror("socketpair launcher");
+			return 1;
+		}
+
+		d->workers[i].pid = fork();
+		if (d->workers[i].pid == -1) {
+			perror("fork launcher worker");
+			close(sv[0]);
+			close(sv[1]);
+			return 2;
+		}
+		if (d->workers[i].pid == 0) {
+			close(lsock);
+			close(sv[0]);
+			for (j = 0; j < i; j++)
+				close(d->workers[j].sock);
+			worker(sv[1], d->ops);
+		}
+
+		close(sv[1]);
+		d->workers[i].sock = sv[0];
+		d->workers[i].jobs = 0;
+		d->nworkers++;
+	}
+
+	return 0;
+}
+
+static int watch(struct lch_daemon *d, int fd, int kind, int idx, int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.u64 = (uint64_t) kind << 32 | (uint32_t) idx;
+	if (epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		perror("epoll_ctl");
+		return 1;
+	}
+	return 0;
+}
+
+/* The arm watches the connection ci for events once more. */
+static int arm(struct lch_daemon *d, int ci, int events)
+{
+	struct epoll_event ev;
+
+	ev.events = events | EPOLLONESHOT;
+	ev.data.u64 = (uint64_t) ev_conn << 32 | (uint32_t) ci;
+	return epoll_ctl(d->epfd, EPOLL_CTL_MOD, d->conns[ci].fd, &ev);
+}
+
+static void close_conn(struct lch_daemon *d, int ci)
+{
+	struct lch_conn *cn = &d->conns[ci];
+
+	close(cn->fd);
+	free(cn->buf);
+	cn->fd = -1;
+	cn->buf = NULL;
+}
+
+/* The send_answer writes what the socket takes of the answer of the
+ * connection ci, the rest once it takes more. Then the connection is
+ * watched for the next message.
+ */
+static void send_answer(struct lch_daemon *d, int ci)
+{
+	struct lch_conn *cn = &d->conns[ci];
+	int n;
+
+	while (cn->done < cn->len) {
+		n = send(cn->fd, cn->buf + cn->done, cn->len - cn->done, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN) {
+			if (arm(d, ci, EPOLLOUT))
+				close_conn(d, ci);
+			return;
+		}
+		if (n < 0) {
+			close_conn(d, ci);
+			return;
+		}
+		cn->done += n;
+	}
+
+	free(cn->buf);
+	cn->buf = NULL;
+	cn->len = 0;
+	cn->done = 0;
+	if (arm(d, ci, EPOLLIN))
+		close_conn(d, ci);
+}
+
+/* The valid_name accepts a name which is a file name (of its cgroup). */
+static int valid_name(const char *name)
+{
+	return memchr(name, '\0', lch_name_len) && name[0] && !strchr(name, '/') && strcmp(name, ".") &&
+		strcmp(name, "..");
+}
+
+static struct lch_container *find(struct lch_daemon *d, const char *name)
+{
+	int i;
+
+	for (i = 0; i < lch_max_containers; i++) {
+		if (d->ct[i].state && !strcmp(d->ct[i].name, name))
+			return &d->ct[i];
+	}
+	return NULL;
+}
+
+/* The alloc_slot takes the free slots in turn, so a slot (and what is
+ * derived from it, a link name, an address) is not reused at once.
+ */
+static struct lch_container *alloc_slot(struct lch_daemon *d)
+{
+	int i, k;
+
+	for (k = 0; k < lch_max_containers; k++) {
+		i = (d->next_slot + k) % lch_max_containers;
+		if (!d->ct[i].state) {
+			d->next_slot = i + 1;
+			memset(&d->ct[i], 0, sizeof(d->ct[i]));
+			d->ct[i].pidfd = d->ct[i].hold = d->ct[i].worker = -1;
+			return &d->ct[i];
+		}
+	}
+	return NULL;
+}
+
+static void free_slot(struct lch_container *c)
+{
+	c->state = 0;
+}
+
+/* The pick_worker returns the worker with the fewest jobs, -1 if there
+ * is no worker left or -2 if every one has its queue full.
+ */
+static int pick_worker(struct lch_daemon *d)
+{
+	int i, w = -1;
+
+	for (i = 0; i < d->nworkers; i++) {
+		if (d->workers[i].sock >= 0 && (w < 0 || d->workers[i].jobs < d->workers[w].jobs))
+			w = i;
+	}
+	if (w >= 0 && d->workers[w].jobs >= worker_queue)
+		return -2;
+	return w;
+}
+
+static int send_job(struct lch_daemon *d, int w, int slot, const struct lch_slot *s)
+{
+	struct lch_job job;
+	struct iovec iov[2];
+	struct msghdr msg;
+
+	memset(&job, 0, sizeof(job));
+	job.slot = slot;
+	job.argc = s->req.argc;
+	strcpy(job.name, s->req.name);
+
+	iov[0].iov_base = &job;
+	iov[0].iov_len = sizeof(job);
+	iov[1].iov_base = (void *) s->strs;
+	iov[1].iov_len = s->req.len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	return sendmsg(d->workers[w].sock, &msg, MSG_NOSIGNAL) != (int) (sizeof(job) + s->req.len);
+}
+
+/* The reap collects the exit of the container, which is a child of the
+ * daemon, by its pidfd.
+ */
+static void reap(struct lch_container *c)
+{
+	siginfo_t si;
+
+	memset(&si, 0, sizeof(si));
+	while (waitid(P_PIDFD, c->pidfd, &si, WEXITED) < 0 && errno == EINTR);
+	if (si.si_code == CLD_EXITED)
+		c->status = (si.si_status & 0xff) << 8;
+	else
+		c->status = (si.si_status & 0x7f) | (si.si_code == CLD_DUMPED ? 0x80 : 0);
+
+	close(c->pidfd);
+	c->pidfd = -1;
+	if (c->hold >= 0)
+		close(c->hold);
+	c->hold = -1;
+}
+
+static void fill_reply(struct lch_reply *rep, const struct lch_container *c)
+{
+	rep->state = c ? c->state : 0;
+	rep->pid = c ? c->pid : 0;
+	rep->status = c && c->state == lch_stopped ? c->status : 0;
+}
+
+/* The send_replies answers a message and frees it. The connection is
+ * watched for the next message once the answer is written.
+ */
+static void send_replies(struct lch_daemon *d, struct lch_batch *b)
+{
+	struct lch_conn *cn = &d->conns[b->conn];
+	struct lch_batch **p;
+	struct lch_hdr *hdr;
+	struct lch_reply *rep;
+	struct lch_slot *s;
+	char *buf;
+	int i, n = 0;
+
+	for (p = &d->batches; *p != b; p = &(*p)->link);
+	*p = b->link;
+
+	for (i = 0; i < b->n; i++) {
+		s = &b->slots[i];
+		n += s->req.op == lch_list && !s->rep.err ? s->nlist : 1;
+	}
+
+	buf = malloc(sizeof(*hdr) + n * sizeof(*rep));
+	if (!buf) {
+		perror("malloc");
+		close_conn(d, b->conn);
+	}
+
+	if (buf) {
+		hdr = (struct lch_hdr *) buf;
+		rep = (struct lch_reply *) (hdr + 1);
+		hdr->magic = lch_magic;
+		hdr->n = n;
+		hdr->len = n * sizeof(*rep);
+		for (i = 0; i < b->n; i++) {
+			s = &b->slots[i];
+			if (s->req.op == lch_list && !s->rep.err) {
+				memcpy(rep, s->list, s->nlist * sizeof(*rep));
+				rep += s->nlist;
+			} else {
+				*rep++ = s->rep;
+			}
+		}
+
+		cn->buf = buf;
+		cn->len = sizeof(*hdr) + hdr->len;
+		cn->done = 0;
+		send_answer(d, b->conn);
+	}
+
+	for (i = 0; i < b->n; i++)
+		free(b->slots[i].list);
+	free(b->slots);
+	free(b->buf);
+	free(b);
+}
+
+/* The complete finishes the create or the stop the container has been
+ * waited for by, err of a create means it is not there.
+ */
+static void complete(struct lch_daemon *d, struct lch_container *c, int err)
+{
+	struct lch_batch *b = c->b;
+	struct lch_reply *rep;
+
+	if (!b)
+		return;
+	c->b = NULL;
+
+	rep = &b->slots[c->idx].rep;
+	fill_reply(rep, err ? NULL : c);
+	rep->err = err;
+	if (--b->pending == 0 && b->next == b->n)
+		send_replies(d, b);
+}
+
+static void do_list(struct lch_daemon *d, struct lch_slot *s)
+{
+	struct lch_container *c;
+	struct lch_reply *rep;
+	int i, n = 0;
+
+	for (i = 0; i < lch_max_containers; i++)
+		n += d->ct[i].state && !d->ct[i].dead;
+	s->list = malloc(n ? n * sizeof(*rep) : 1);
+	if (!s->list) {
+		s->rep.err = ENOMEM;
+		return;
+	}
+
+	for (i = 0, rep = s->list; i < lch_max_containers; i++) {
+		c = &d->ct[i];
+		if (!c->state || c->dead)
+			continue;
+		memset(rep, 0, sizeof(*rep));
+		rep->op = lch_list;
+		strcpy(rep->name, c->name);
+		fill_reply(rep, c);
+		rep++;
+	}
+	s->nlist = n;
+}
+
+/* The run starts a request on the container c (NULL - not found). A
+ * create or a stop of a running container is done later.
+ */
+static void run(struct lch_daemon *d, struct lch_batch *b, struct lch_slot *s, struct lch_container *c)
+{
+	int w;
+
+	switch (s->req.op) {
+	case lch_create:
+		w = pick_worker(d);
+		if (c) {
+			s->rep.err = EEXIST;
+		} else if (w < 0) {
+			s->rep.err = EAGAIN;
+		} else if (!(c = alloc_slot(d))) {
+			s->rep.err = ENOSPC;
+		} else if (send_job(d, w, c - d->ct, s)) {
+			perror("send job");
+			s->rep.err = EIO;
+		} else {
+			strcpy(c->name, s->req.name);
+			c->state = lch_creating;
+			c->worker = w;
+			c->b = b;
+			c->idx = s - b->slots;
+			d->workers[w].jobs++;
+			b->pending++;
+		}
+		return;
+	case lch_start:
+		if (c && c->state == lch_created) {
+			close(c->hold);
+			c->hold = -1;
+			c->state = lch_running;
+		}
+		s->rep.err = !c ? ENOENT : c->state == lch_running ? 0 : EINVAL;
+		break;
+	case lch_stop:
+		if (!c) {
+			s->rep.err = ENOENT;
+			break;
+		}
+		if (c->state == lch_stopped)
+			break;
+
+		/* Another stop (a SIGKILL after a SIGTERM, say) does not wait. */
+		if (syscall(SYS_pidfd_send_signal, c->pidfd, c->state == lch_created || !s->req.sig ? SIGKILL : s->req.sig,
+					NULL, 0)) {
+			s->rep.err = errno;
+			break;
+		}
+		if (c->state == lch_stopping)
+			break;
+		c->state = lch_stopping;
+		c->b = b;
+		c->idx = s - b->slots;
+		b->pending++;
+		return;
+	case lch_delete:
+		if (c && c->state == lch_stopped) {
+			d->ops->remove(d->ops->arg, c->name, c - d->ct);
+			free_slot(c);
+			c = NULL;
+		} else {
+			s->rep.err = c ? EBUSY : ENOENT;
+		}
+		break;
+	case lch_list:
+		do_list(d, s);
+		return;
+	}
+
+	fill_reply(&s->rep, c);
+}
+
+static int busy(const struct lch_container *c)
+{
+	return c->state == lch_creating || c->state == lch_stopping;
+}
+
+/* The run_batch runs the requests of a message in order, until one names
+ * a busy container, every worker has its queue full or a list comes while
+ * the requests before it are not done.
+ */
+static void run_batch(struct lch_daemon *d, struct lch_batch *b)
+{
+	struct lch_slot *s;
+	struct lch_container *c;
+
+	while (b->next < b->n) {
+		s = &b->slots[b->next];
+		c = s->rep.err || s->req.op == lch_list ? NULL : find(d, s->req.name);
+		if (c && busy(c) && !(s->req.op == lch_stop && c->state == lch_stopping))
+			return;
+		if (s->req.op == lch_list && b->pending)
+			return;
+		if (!c && !s->rep.err && s->req.op == lch_create && pick_worker(d) == -2)
+			return;
+		b->next++;
+		if (!s->rep.err)
+			run(d, b, s, c);
+	}
+
+	if (!b->pending)
+		send_replies(d, b);
+}
+
+/* The resume runs the messages which have waited, when a container has
+ * changed or a worker has taken a job off its queue.
+ */
+static void resume(struct lch_daemon *d)
+{
+	struct lch_batch *b, *next;
+
+	for (b = d->batches; b; b = next) {
+		next = b->link;
+		if (b->next < b->n)
+			run_batch(d, b);
+	}
+}
+
+/* The parse_batch checks the framing of a message and the requests in
+ * it. A request which makes no sense gets EINVAL, a message which can't
+ * be parsed closes the connection.
+ */
+static int parse_batch(struct lch_batch *b, int len)
+{
+	struct lch_slot *s;
+	const char *p;
+	uint32_t off = 0;
+	int i, argc;
+
+	for (i = 0; i < b->n; i++) {
+		s = &b->slots[i];
+		if (len - off < sizeof(s->req))
+			return 1;
+		memcpy(&s->req, b->buf + off, sizeof(s->req));
+		off += sizeof(s->req);
+		if (s->req.len > len - off)
+			return 2;
+		s->strs = b->buf + off;
+		off += s->req.len;
+
+		memset(&s->rep, 0, sizeof(s->rep));
+		s->rep.op = s->req.op;
+		s->req.name[lch_name_len - 1] = '\0';
+		strcpy(s->rep.name, s->req.name);
+
+		for (p = s->strs, argc = 0; p < s->strs + s->req.len; p += strlen(p) + 1, argc++);
+		if (s->req.op < lch_create || s->req.op > lch_list || (s->req.op != lch_list && !valid_name(s->req.name)))
+			s->rep.err = EINVAL;
+		else if (s->req.op == lch_create && (argc != s->req.argc || argc > lch_max_args))
+			s->rep.err = EINVAL;
+		else if (s->req.op == lch_create && (s->req.len > max_job || (argc && s->strs[s->req.len - 1])))
+			s->rep.err = s->req.len > max_job ? E2BIG : EINVAL;
+	}
+
+	return off != (uint32_t) len;
+}
+
+/* The read_some reads up to len bytes which have come on fd to buf and
+ * adds their number to done. It returns 0, -1 if none has come or a
+ * positive error.
+ */
+static int read_some(int fd, char *buf, uint32_t len, uint32_t *done)
+{
+	int n;
+
+	do
+		n = read(fd, buf, len);
+	while (n < 0 && errno == EINTR);
+	if (n < 0 && errno == EAGAIN)
+		return -1;
+	if (n <= 0)
+		return 1;
+
+	*done += n;
+	return 0;
+}
+
+/* The recv_msg reads what has come of a message on the connection cn.
+ * It returns 0 once the message is complete, -1 if more is to come or a
+ * positive error.
+ */
+static int recv_msg(struct lch_conn *cn)
+{
+	int ret;
+
+	while (cn->done < sizeof(cn->hdr)) {
+		ret = read_some(cn->fd, (char *) &cn->hdr + cn->done, sizeof(cn->hdr) - cn->done, &cn->done);
+		if (ret)
+			return ret;
+	}
+
+	if (!cn->buf) {
+		if (cn->hdr.magic != lch_magic || cn->hdr.n == 0 || cn->hdr.n > lch_max_batch ||
+			cn->hdr.len > lch_max_msg) {
+			fprintf(stderr, "launcher: bad message\n");
+			return 2;
+		}
+		cn->buf = malloc(cn->hdr.len + 1);
+		if (!cn->buf) {
+			perror("malloc");
+			return 3;
+		}
+	}
+
+	while (cn->done < sizeof(cn->hdr) + cn->hdr.len) {
+		ret = read_some(cn->fd, cn->buf + cn->done - sizeof(cn->hdr), sizeof(cn->hdr) + cn->hdr.len - cn->done,
+						&cn->done);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* The make_batch makes a batch of the message read on the connection ci,
+ * which passes its buffer to the batch.
+ */
+static struct lch_batch *make_batch(struct lch_daemon *d, int ci)
+{
+	struct lch_conn *cn = &d->conns[ci];
+	struct lch_batch *b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b) {
+		perror("calloc");
+		return NULL;
+	}
+	b->conn = ci;
+	b->n = cn->hdr.n;
+	b->slots = calloc(cn->hdr.n, sizeof(*b->slots));
+	if (!b->slots) {
+		perror("malloc");
+		free(b);
+		return NULL;
+	}
+
+	b->buf = cn->buf;
+	cn->buf = NULL;
+	cn->done = 0;
+	b->buf[cn->hdr.len] = '\0';
+	if (parse_batch(b, cn->hdr.len)) {
+		fprintf(stderr, "launcher: malformed message\n");
+		free(b->slots);
+		free(b->buf);
+		free(b);
+		return NULL;
+	}
+	return b;
+}
+
+static void on_listen(struct lch_daemon *d, int lsock)
+{
+	struct lch_conn *cn;
+	int i, conn;
+
+	conn = accept4(lsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (conn < 0) {
+		perror("accept launcher");
+		return;
+	}
+
+	for (i = 0; i < max_conns && d->conns[i].fd >= 0; i++);
+	if (i == max_conns) {
+		fprintf(stderr, "launcher: too many connections\n");
+		close(conn);
+		return;
+	}
+
+	cn = &d->conns[i];
+	cn->fd = conn;
+	cn->buf = NULL;
+	cn->len = 0;
+	cn->done = 0;
+	if (watch(d, conn, ev_conn, i, EPOLLIN | EPOLLONESHOT))
+		close_conn(d, i);
+}
+
+/* The on_conn goes on with the message being read on the connection ci
+ * or with the answer being written. A complete message is run.
+ */
+static void on_conn(struct lch_daemon *d, int ci)
+{
+	struct lch_batch *b;
+	int ret;
+
+	if (d->conns[ci].len) {
+		send_answer(d, ci);
+		return;
+	}
+
+	ret = recv_msg(&d->conns[ci]);
+	if (ret < 0) {
+		if (arm(d, ci, EPOLLIN))
+			close_conn(d, ci);
+		return;
+	}
+
+	b = ret ? NULL : make_batch(d, ci);
+	if (!b) {
+		close_conn(d, ci);
+		return;
+	}
+
+	b->link = d->batches;
+	d->batches = b;
+	run_batch(d, b);
+}
+
+/* The recv_done reads an answer of a worker. It returns the number of
+ * descriptors, -1 - no answer yet or -2 - the worker is gone.
+ */
+static int recv_done(int sock, struct lch_done *done, int *fds, int flags)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * 2)];
+	} cbuf;
+	struct iovec iov = {.iov_base = done,.iov_len = sizeof(*done) };
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	int n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof(cbuf.buf);
+
+	do
+		n = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return -1;
+	if (n != sizeof(*done))
+		return -2;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+		return 0;
+	n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+	return n;
+}
+
+/* The created takes the answer of worker w to a create. */
+static void created(struct lch_daemon *d, int w, const struct lch_done *done, const int *fds, int nfds)
+{
+	struct lch_container *c = NULL;
+	int i;
+
+	if (done->slot < lch_max_containers)
+		c = &d->ct[done->slot];
+	if (!c || c->state != lch_creating || c->worker != w || c->dead || (!done->err && nfds != 2)) {
+		fprintf(stderr, "launcher: bad answer of worker %d\n", w);
+		for (i = 0; i < nfds; i++)
+			close(fds[i]);
+		return;
+	}
+
+	d->workers[w].jobs--;
+	c->worker = -1;
+	c->pid = done->pid;
+	c->pidfd = nfds > 0 ? fds[0] : -1;
+	c->hold = nfds > 1 ? fds[1] : -1;
+
+	/* The daemon can't tell when it ends without the pidfd watched. */
+	if (c->pidfd >= 0 && watch(d, c->pidfd, ev_child, done->slot, EPOLLIN)) {
+		syscall(SYS_pidfd_send_signal, c->pidfd, SIGKILL, NULL, 0);
+		reap(c);
+		complete(d, c, done->err ? done->err : EIO);
+		free_slot(c);
+		return;
+	}
+
+	if (!done->err) {
+		c->state = lch_created;
+		complete(d, c, 0);
+		return;
+	}
+
+	/* The child of a failed create is told to exit; the name is taken
+	 * until it is reaped.
+	 */
+	complete(d, c, done->err);
+	if (c->pidfd >= 0)
+		c->dead = 1;
+	else
+		free_slot(c);
+}
+
+/* The worker_gone fails the creates a dead worker has not answered. */
+static void worker_gone(struct lch_daemon *d, int w)
+{
+	struct lch_container *c;
+	int i;
+
+	fprintf(stderr, "launcher: worker %d is gone\n", w);
+	close(d->workers[w].sock);
+	d->workers[w].sock = -1;
+	waitpid(d->workers[w].pid, NULL, 0);
+
+	for (i = 0; i < lch_max_containers; i++) {
+		c = &d->ct[i];
+		if (c->state == lch_creating && c->worker == w && !c->dead) {
+			complete(d, c, EIO);
+			free_slot(c);
+		}
+	}
+}
+
+static void on_worker(struct lch_daemon *d, int w)
+{
+	struct lch_done done;
+	int fds[2], n;
+
+	while ((n = recv_done(d->workers[w].sock, &done, fds, MSG_DONTWAIT)) >= 0)
+		created(d, w, &done, fds, n);
+	if (n == -2)
+		worker_gone(d, w);
+}
+
+static void on_child(struct lch_daemon *d, int slot)
+{
+	struct lch_container *c = &d->ct[slot];
+
+	if (c->pidfd < 0)
+		return;
+	reap(c);
+	if (c->dead) {
+		free_slot(c);
+		return;
+	}
+	c->state = lch_stopped;
+	complete(d, c, 0);
+}
+
+/* The stop_daemon waits for the creates the workers have got, then kills
+ * and removes every container. The messages waiting are dropped.
+ */
+static void stop_daemon(struct lch_daemon *d)
+{
+	struct lch_batch *b;
+	struct lch_container *c;
+	struct lch_done done;
+	int fds[2], i, n;
+
+	for (i = 0; i < d->nworkers; i++) {
+		if (d->workers[i].sock < 0)
+			continue;
+		shutdown(d->workers[i].sock, SHUT_WR);
+		while (d->workers[i].jobs > 0 && (n = recv_done(d->workers[i].sock, &done, fds, 0)) >= 0)
+			created(d, i, &done, fds, n);
+		close(d->workers[i].sock);
+		waitpid(d->workers[i].pid, NULL, 0);
+	}
+
+	while (d->batches) {
+		b = d->batches;
+		d->batches = b->link;
+		for (i = 0; i < b->n; i++)
+			free(b->slots[i].list);
+		free(b->slots);
+		free(b->buf);
+		free(b);
+	}
+
+	for (i = 0; i < lch_max_containers; i++) {
+		c = &d->ct[i];
+		if (!c->state)
+			continue;
+		if (c->pidfd >= 0) {
+			syscall(SYS_pidfd_send_signal, c->pidfd, SIGKILL, NULL, 0);
+			reap(c);
+		}
+		if (!c->dead)
+			d->ops->remove(d->ops->arg, c->name, i);
+		free_slot(c);
+	}
+
+	for (i = 0; i < max_conns; i++) {
+		if (d->conns[i].fd >= 0)
+			close_conn(d, i);
+	}
+}
+
+/* The lch_serve runs the daemon on the listening socket lsock with a pool
+ * of nworkers (0 - one per online CPU) until SIGINT or SIGTERM.
+ */
+int lch_serve(int lsock, int nworkers, const struct lch_ops *ops)
+{
+	static struct lch_daemon d;
+	struct epoll_event evs[max_events];
+	sigset_t mask;
+	int i, n, idx, sfd = -1, stop = 0, ret = 0;
+
+	if (nworkers <= 0)
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers <= 0)
+		nworkers = 1;
+	if (nworkers > lch_max_workers)
+		nworkers = lch_max_workers;
+
+	d.epfd = -1;
+	for (i = 0; i < max_conns; i++)
+		d.conns[i].fd = -1;
+	d.ops = ops;
+	d.nworkers = 0;
+	d.next_slot = 0;
+	d.batches = NULL;
+
+	/* The workers (and so the containers) keep the signals. */
+	if (start_workers(&d, lsock, nworkers)) {
+		ret = 1;
+		goto out;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (sfd < 0) {
+		perror("signalfd");
+		ret = 2;
+		goto out;
+	}
+
+	d.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (d.epfd < 0) {
+		perror("epoll_create1");
+		ret = 3;
+		goto out;
+	}
+	if (watch(&d, lsock, ev_listen, 0, EPOLLIN) || watch(&d, sfd, ev_signal, 0, EPOLLIN))
+		ret = 4;
+	for (i = 0; i < d.nworkers && !ret; i++) {
+		if (watch(&d, d.workers[i].sock, ev_worker, i, EPOLLIN))
+			ret = 4;
+	}
+
+	while (!ret && !stop) {
+		n = epoll_wait(d.epfd, evs, max_events, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("epoll_wait");
+			ret = 5;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			idx = (uint32_t) evs[i].data.u64;
+			switch (evs[i].data.u64 >> 32) {
+			case ev_listen:
+				on_listen(&d, lsock);
+				break;
+			case ev_signal:
+				stop = 1;
+				break;
+			case ev_conn:
+				on_conn(&d, idx);
+				break;
+			case ev_worker:
+				on_worker(&d, idx);
+				break;
+			case ev_child:
+				on_child(&d, idx);
+				break;
+			}
+		}
+		resume(&d);
+	}
+
+ out:
+	stop_daemon(&d);
+	if (d.epfd >= 0)
+		close(d.epfd);
+	if (sfd >= 0)
+		close(sfd);
+	return ret;
+}
+
+void lch_init(struct lch_msg *m)
+{
+	m->hdr.magic = lch_magic;
+	m->hdr.n = 0;
+	m->hdr.len = 0;
+}
+
+/* The lch_add appends a request to the message m; argv (NULL - the
+ * program of the daemon) goes with a create.
+ */
+int lch_add(struct lch_msg *m, int op, const char *name, int sig, char **argv)
+{
+	struct lch_req req;
+	int i, len;
+
+	if (m->hdr.n == lch_max_batch) {
+		fprintf(stderr, "too many requests\n");
+		return 1;
+	}
+	if (strlen(name) >= lch_name_len) {
+		fprintf(stderr, "name %s is too long\n", name);
+		return 2;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.op = op;
+	req.sig = sig;
+	strcpy(req.name, name);
+	for (i = 0; argv && argv[i]; i++)
+		req.len += strlen(argv[i]) + 1;
+	req.argc = i;
+	if (i > lch_max_args || req.len > max_job || m->hdr.len + sizeof(req) + req.len > lch_max_msg) {
+		fprintf(stderr, "too many arguments\n");
+		return 3;
+	}
+
+	memcpy(m->buf + m->hdr.len, &req, sizeof(req));
+	m->hdr.len += sizeof(req);
+	for (i = 0; argv && argv[i]; i++) {
+		len = strlen(argv[i]) + 1;
+		memcpy(m->buf + m->hdr.len, argv[i], len);
+		m->hdr.len += len;
+	}
+	m->hdr.n++;
+
+	return 0;
+}
+
+/* The lch_call sends the message m to the daemon listening on path and
+ * waits for the answer. It returns the number of replies in *rep (freed
+ * by the caller) or -1.
+ */
+int lch_call(const char *path, const struct lch_msg *m, struct lch_reply **rep)
+{
+	struct sockaddr_un sa;
+	struct lch_hdr hdr;
+	int sock, n = -1;
+
+	*rep = NULL;
+	if (fill_sockaddr(&sa, path))
+		return -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (connect(sock, (struct sockaddr *) &sa, sizeof(sa))) {
+		perror("connect");
+		goto out;
+	}
+
+	if (write_full(sock, &m->hdr, sizeof(m->hdr)) || write_full(sock, m->buf, m->hdr.len)) {
+		perror("send request");
+		goto out;
+	}
+
+	if (read_full(sock, &hdr, sizeof(hdr)) || hdr.magic != lch_magic || hdr.n > max_replies ||
+		hdr.len != hdr.n * sizeof(**rep)) {
+		fprintf(stderr, "daemon closed the connection\n");
+		goto out;
+	}
+
+	*rep = malloc(hdr.len ? hdr.len : 1);
+	if (!*rep) {
+		perror("malloc");
+		goto out;
+	}
+	if (read_full(sock, *rep, hdr.len)) {
+		fprintf(stderr, "daemon closed the connection\n");
+		free(*rep);
+		*rep = NULL;
+		goto out;
+	}
+	n = hdr.n;
+
+ out:
+	close(sock);
+	return n;
+}
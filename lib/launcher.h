@@ -0,0 +1,87 @@
+#ifndef LAUNCHER_SENTRY_H
+#define LAUNCHER_SENTRY_H
+
+#include <stdint.h>
+
+/* The launcher daemon (create_container -D) runs containers on requests
+ * sent over a unix stream socket. A message is struct lch_hdr followed by
+ * hdr.len bytes of hdr.n requests, each one struct lch_req followed by
+ * req.len bytes of NUL-terminated strings: req.argc arguments of a create
+ * (none - the program of the daemon). The answer is one message, struct
+ * lch_hdr followed by hdr.n struct lch_reply, sent when every request of
+ * the message is done: a reply per request, a list has one per container
+ * instead. A connection may carry any number of messages.
+ *
+ * - create sets up a container and leaves its program waiting;
+ * - start lets the program run;
+ * - stop sends req.sig (0 - SIGKILL, a container not started yet always
+ *   gets SIGKILL) and is done when the container has exited; a stop of a
+ *   container being stopped only sends its signal;
+ * - delete removes a stopped container and what it has left on the host;
+ * - list reports every container, once the requests before it are done.
+ *
+ * The requests of a message run in order, but the creates are passed to
+ * a pool of worker processes and run at the same time; a request naming
+ * a container which is being created or stopped waits for it. A worker
+ * clones a container with CLONE_PARENT, so every container is a child of
+ * the daemon, which watches their pidfds in its epoll loop.
+ */
+
+enum { lch_magic = 0x6463646c, lch_name_len = 64, lch_max_msg = 256 * 1024, lch_max_batch = 1024,
+	lch_max_args = 64, lch_max_containers = 1024, lch_max_workers = 64
+};
+
+enum { lch_create = 1, lch_start, lch_stop, lch_delete, lch_list };
+
+enum { lch_creating = 1, lch_created, lch_running, lch_stopping, lch_stopped };
+
+struct lch_hdr {
+	uint32_t magic;
+	uint32_t n;
+	uint32_t len;
+};
+
+struct lch_req {
+	uint16_t op;
+	uint16_t argc;
+	uint32_t len;				/* of the strings */
+	int32_t sig;				/* of a stop */
+	char name[lch_name_len];
+};
+
+struct lch_reply {
+	uint16_t op;
+	uint16_t state;				/* 0 - no such container (any more) */
+	int32_t err;				/* errno, 0 - done */
+	int32_t pid;				/* in the pid namespace of the daemon */
+	int32_t status;				/* wait status of a stopped container */
+	char name[lch_name_len];
+};
+
+/* What the daemon does with a container; slot is unique among the live
+ * containers and less than lch_max_containers. The create runs in a
+ * worker: it returns 0 or an errno, and the pid, the pidfd and the
+ * descriptor which holds the program back until it is closed (-1 when
+ * the create has failed). The remove runs in the daemon.
+ */
+struct lch_ops {
+	int (*create)(void *arg, const char *name, int slot, char **argv, int *pid, int *pidfd, int *hold);
+	void (*remove)(void *arg, const char *name, int slot);
+	void *arg;
+};
+
+/* A message being built by a client, see lch_add. */
+struct lch_msg {
+	struct lch_hdr hdr;
+	char buf[lch_max_msg];
+};
+
+const char *lch_op_name(int op);
+const char *lch_state_name(int state);
+int lch_listen(const char *path);
+int lch_serve(int lsock, int nworkers, const struct lch_ops *ops);
+void lch_init(struct lch_msg *m);
+int lch_add(struct lch_msg *m, int op, const char *name, int sig, char **argv);
+int lch_call(const char *path, const struct lch_msg *m, struct lch_reply **rep);
+
+#endif
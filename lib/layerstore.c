@@ -0,0 +1,479 @@
+#define _GNU_SOURCE				/* O_TMPFILE */
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* qsort */
+#include <string.h>				/* strlen */
+#include <unistd.h>				/* read */
+#include <errno.h>				/* EEXIST */
+#include <fcntl.h>				/* openat */
+#include <dirent.h>				/* fdopendir */
+#include <limits.h>				/* PATH_MAX */
+#include <sys/types.h>
+#include <sys/stat.h>			/* mkdirat */
+#include <sys/file.h>			/* flock */
+#include "layerstore.h"
+
+enum { copy_buf = 1024 * 1024 };
+
+static const char *store_dirs[] = { "blobs", "blobs/sha256", "images", "layers", "tmp" };
+
+/* The store_open opens the store at root and creates it if needed. */
+int store_open(struct layer_store *s, const char *root)
+{
+	unsigned int i;
+
+	if (mkdir(root, 0755) && errno != EEXIST) {
+		perror(root);
+		return 1;
+	}
+
+	s->dirfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (s->dirfd < 0) {
+		perror(root);
+		return 2;
+	}
+	s->root = root;
+	s->npins = 0;
+
+	for (i = 0; i < sizeof(store_dirs) / sizeof(store_dirs[0]); i++) {
+		if (mkdirat(s->dirfd, store_dirs[i], 0755) && errno != EEXIST) {
+			perror(store_dirs[i]);
+			close(s->dirfd);
+			return 3;
+		}
+	}
+
+	return 0;
+}
+
+void store_close(struct layer_store *s)
+{
+	while (s->npins > 0)
+		close(s->pins[--s->npins]);
+	close(s->dirfd);
+}
+
+/* The store_begin keeps the collector away until store_end: layers
+ * imported for an image have no references until the image is added.
+ */
+int store_begin(struct layer_store *s)
+{
+	if (flock(s->dirfd, LOCK_SH)) {
+		perror("flock store");
+		return 1;
+	}
+	return 0;
+}
+
+void store_end(struct layer_store *s)
+{
+	flock(s->dirfd, LOCK_UN);
+}
+
+static int valid_name(const char *name)
+{
+	return *name && *name != '.' && strlen(name) < store_max_name && !strchr(name, '/');
+}
+
+static int valid_digest(const char *hex)
+{
+	int i;
+
+	for (i = 0; i < sha256_hex_len; i++) {
+		if (!((hex[i] >= '0' && hex[i] <= '9') || (hex[i] >= 'a' && hex[i] <= 'f')))
+			return 0;
+	}
+	return hex[i] == '\0';
+}
+
+/* The copy_hashed copies fd to out and hashes the data on the way, so a
+ * layer is read once.
+ */
+static int copy_hashed(int fd, int out, char *hex)
+{
+	static char buf[copy_buf];
+	unsigned char digest[sha256_len];
+	struct sha256_ctx ctx;
+	ssize_t n, w, off;
+
+	sha256_init(&ctx);
+	for (;;) {
+		n = read(fd, buf, copy_buf);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("read layer");
+			return 1;
+		}
+		if (n == 0)
+			break;
+		sha256_update(&ctx, buf, n);
+		for (off = 0; off < n; off += w) {
+			w = write(out, buf + off, n - off);
+			if (w < 0) {
+				perror("write layer");
+				return 2;
+			}
+		}
+	}
+
+	sha256_final(&ctx, digest);
+	sha256_hex(digest, hex);
+	return 0;
+}
+
+/* The store_import reads a layer from fd into the store. The layer is
+ * written to an unnamed file, which gets a name under its digest only
+ * once it is complete and (if expect is not NULL) matches expect; if the
+ * store has it already, the copy is dropped. The digest is returned in
+ * hex.
+ */
+int store_import(struct layer_store *s, int fd, const char *expect, char *hex)
+{
+	char path[PATH_MAX], proc[64];
+	int tmp, ret = 0;
+
+	if (expect && !valid_digest(expect)) {
+		fprintf(stderr, "invalid digest %s\n", expect);
+		return 1;
+	}
+
+	tmp = openat(s->dirfd, "tmp", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0444);
+	if (tmp < 0) {
+		perror("open layer");
+		return 3;
+	}
+
+	if (copy_hashed(fd, tmp, hex)) {
+		ret = 4;
+		goto out;
+	}
+
+	if (expect && strcmp(expect, hex)) {
+		fprintf(stderr, "layer digest mismatch: expected %s, got %s\n", expect, hex);
+		ret = 5;
+		goto out;
+	}
+
+	/* The blob is named only when its data are on the disk. */
+	if (fdatasync(tmp)) {
+		perror("fdatasync layer");
+		ret = 6;
+		goto out;
+	}
+
+	/* linkat(AT_EMPTY_PATH) needs CAP_DAC_READ_SEARCH, /proc doesn't. */
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", tmp);
+	snprintf(path, PATH_MAX, "blobs/sha256/%s", hex);
+	if (linkat(AT_FDCWD, proc, s->dirfd, path, AT_SYMLINK_FOLLOW) && errno != EEXIST) {
+		perror("link layer");
+		ret = 7;
+	}
+
+ out:
+	close(tmp);
+	return ret;
+}
+
+/* The store_add_image creates the image of name from the layers (bottom
+ * first), which must be in the store. The image appears at once, with
+ * all its layers.
+ */
+int store_add_image(struct layer_store *s, const char *name, layer_digest * layers, int n)
+{
+	char tmp[PATH_MAX], blob[PATH_MAX], link[PATH_MAX];
+	int i, ret;
+
+	if (!valid_name(name)) {
+		fprintf(stderr, "invalid image name %s\n", name);
+		return 1;
+	}
+
+	snprintf(tmp, PATH_MAX, "images/.%s.%d", name, getpid());
+	if (mkdirat(s->dirfd, tmp, 0755)) {
+		perror(tmp);
+		return 3;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!valid_digest(layers[i])) {
+			fprintf(stderr, "invalid digest %s\n", layers[i]);
+			ret = 4;
+			goto err;
+		}
+		snprintf(blob, PATH_MAX, "blobs/sha256/%s", layers[i]);
+		snprintf(link, PATH_MAX, "%s/%03d-%s", tmp, i, layers[i]);
+		if (linkat(s->dirfd, blob, s->dirfd, link, 0)) {
+			perror(layers[i]);
+			ret = 5;
+			goto err;
+		}
+	}
+
+	snprintf(link, PATH_MAX, "images/%s", name);
+	if (renameat(s->dirfd, tmp, s->dirfd, link) == 0)
+		return 0;
+	if (errno == ENOTEMPTY || errno == EEXIST)
+		fprintf(stderr, "image %s exists\n", name);
+	else
+		perror(link);
+	ret = 6;
+
+ err:
+	store_remove_image(s, tmp + strlen("images/"));
+	return ret;
+}
+
+/* The store_remove_image drops the references of the image, its layers
+ * stay until the next collection.
+ */
+int store_remove_image(struct layer_store *s, const char *name)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int fd;
+
+	if (strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) {
+		fprintf(stderr, "invalid image name %s\n", name);
+		return 1;
+	}
+
+	snprintf(path, PATH_MAX, "images/%s", name);
+	fd = openat(s->dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		perror(name);
+		if (fd >= 0)
+			close(fd);
+		return 2;
+	}
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] != '.' && unlinkat(fd, de->d_name, 0))
+			perror(de->d_name);
+	}
+	closedir(dir);
+
+	if (unlinkat(s->dirfd, path, AT_REMOVEDIR)) {
+		perror(name);
+		return 3;
+	}
+
+	return 0;
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+/* The store_layers returns the number of layers of the image (bottom
+ * first) in layers or -1.
+ */
+int store_layers(struct layer_store *s, const char *name, layer_digest * layers, int max)
+{
+	static char names[store_max_layers][store_max_name];
+	char path[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+	int i, n = 0, fd;
+
+	if (!valid_name(name)) {
+		fprintf(stderr, "invalid image name %s\n", name);
+		return -1;
+	}
+
+	snprintf(path, PATH_MAX, "images/%s", name);
+	fd = openat(s->dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		perror(name);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.' || strlen(de->d_name) != 4 + sha256_hex_len)
+			continue;
+		if (n == max || n == store_max_layers) {
+			fprintf(stderr, "too many layers in %s\n", name);
+			n = -1;
+			break;
+		}
+		strcpy(names[n++], de->d_name);
+	}
+	closedir(dir);
+
+	if (n > 0) {
+		qsort(names, n, sizeof(names[0]), cmp_names);
+		for (i = 0; i < n; i++)
+			strcpy(layers[i], names[i] + 4);
+	}
+
+	return n;
+}
+
+/* The store_blob_path returns the path of a layer relative to the root. */
+int store_blob_path(struct layer_store *s, const char *hex, char *buf, int size)
+{
+	if (!valid_digest(hex))
+		return 1;
+	return snprintf(buf, size, "blobs/sha256/%s", hex) >= size ? 2 : 0;
+}
+
+/* The store_layer_path returns the path of an unpacked layer, from the
+ * root of the host.
+ */
+int store_layer_path(struct layer_store *s, const char *hex, char *buf, int size)
+{
+	if (!valid_digest(hex))
+		return 1;
+	return snprintf(buf, size, "%s/layers/%s", s->root, hex) >= size ? 2 : 0;
+}
+
+/* The remove_tree removes name in dirfd with everything under it. */
+static int remove_tree(int dirfd, const char *name)
+{
+	struct dirent *de;
+	DIR *dir;
+	int fd, ret = 0;
+
+	if (unlinkat(dirfd, name, 0) == 0 || errno == ENOENT)
+		return 0;
+	if (errno != EISDIR && errno != EPERM)
+		return 1;
+
+	fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		if (fd >= 0)
+			close(fd);
+		return 2;
+	}
+	while ((de = readdir(dir))) {
+		if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..") && remove_tree(fd, de->d_name))
+			ret = 3;
+	}
+	closedir(dir);
+
+	if (unlinkat(dirfd, name, AT_REMOVEDIR))
+		ret = 4;
+	return ret;
+}
+
+/* The store_pin keeps the layer hex from the collector until store_close,
+ * even if its image is removed meanwhile. It is called between
+ * store_begin and store_end, when the layer can't be collected yet.
+ */
+int store_pin(struct layer_store *s, const char *hex)
+{
+	char path[PATH_MAX];
+	int fd;
+
+	if (s->npins >= store_max_layers) {
+		fprintf(stderr, "too many layers pinned\n");
+		return 1;
+	}
+
+	snprintf(path, PATH_MAX, "blobs/sha256/%s", hex);
+	fd = openat(s->dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		return 2;
+	}
+
+	if (flock(fd, LOCK_SH)) {
+		perror("flock layer");
+		close(fd);
+		return 3;
+	}
+
+	s->pins[s->npins++] = fd;
+	return 0;
+}
+
+/* The pinned tells whether a running container uses the blob name. */
+static int pinned(int dirfd, const char *name)
+{
+	int fd, ret;
+
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	ret = flock(fd, LOCK_EX | LOCK_NB) && errno == EWOULDBLOCK;
+	close(fd);
+	return ret;
+}
+
+/* The store_gc removes the layers no image refers to, unpacked or not,
+ * and the leftovers of interrupted imports. It waits for the imports
+ * going on, but not for the containers: their layers are pinned.
+ */
+int store_gc(struct layer_store *s, int *removed, uint64_t *freed)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int fd, ret = 0;
+
+	*removed = 0;
+	*freed = 0;
+
+	if (flock(s->dirfd, LOCK_EX)) {
+		perror("flock store");
+		return 1;
+	}
+
+	fd = openat(s->dirfd, "images", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		perror("images");
+		ret = 2;
+		goto out;
+	}
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.' && strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+			store_remove_image(s, de->d_name);
+	}
+	closedir(dir);
+
+	fd = openat(s->dirfd, "blobs/sha256", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		perror("blobs");
+		ret = 3;
+		goto out;
+	}
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.' || fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW))
+			continue;
+		if (st.st_nlink > 1 || pinned(fd, de->d_name))
+			continue;
+		if (unlinkat(fd, de->d_name, 0)) {
+			perror(de->d_name);
+			continue;
+		}
+		(*removed)++;
+		*freed += st.st_size;
+		snprintf(path, PATH_MAX, "layers/%s", de->d_name);
+		if (remove_tree(s->dirfd, path))
+			fprintf(stderr, "can't remove %s\n", path);
+	}
+	closedir(dir);
+
+	/* Layers being unpacked when an import was interrupted. */
+	fd = openat(s->dirfd, "layers", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		perror("layers");
+		ret = 4;
+		goto out;
+	}
+	while ((de = readdir(dir))) {
+		if (de->d_name[0] == '.' && strcmp(de->d_name, ".") && strcmp(de->d_name, "..") &&
+			remove_tree(fd, de->d_name))
+			fprintf(stderr, "can't remove layers/%s\n", de->d_name);
+	}
+	closedir(dir);
+
+ out:
+	flock(s->dirfd, LOCK_UN);
+	return ret;
+}
@@ -0,0 +1,48 @@
+#ifndef LAYERSTORE_SENTRY_H
+#define LAYERSTORE_SENTRY_H
+
+#include <stdint.h>
+#include "sha256.h"
+
+/* Image layers are kept once per content, under their SHA-256 digest:
+ *
+ *   <root>/blobs/sha256/<hex>       the layer (read-only)
+ *   <root>/images/<name>/<NNN>-<hex> a hard link per layer of an image
+ *   <root>/layers/<hex>/             the layer unpacked, an overlayfs lower
+ *                                    directory (see lib/ocilayout.h)
+ *   <root>/tmp                       layers being imported
+ *
+ * The link count of a blob is the number of its references plus one, so
+ * the file system does the reference counting; the collector removes
+ * blobs with a single link. Images are created between store_begin and
+ * store_end, which hold a shared flock(2) on the root; the collector
+ * takes an exclusive one. A running container pins its layers with a
+ * shared flock on their blobs (store_pin) instead, so the collector only
+ * skips those layers and does not wait for the container.
+ */
+
+enum { store_max_name = 128, store_max_layers = 128 };
+
+typedef char layer_digest[sha256_hex_len + 1];
+
+struct layer_store {
+	const char *root;
+	int dirfd;
+	int pins[store_max_layers];	/* blobs locked by store_pin */
+	int npins;
+};
+
+int store_open(struct layer_store *s, const char *root);
+void store_close(struct layer_store *s);
+int store_begin(struct layer_store *s);
+void store_end(struct layer_store *s);
+int store_import(struct layer_store *s, int fd, const char *expect, char *hex);
+int store_add_image(struct layer_store *s, const char *name, layer_digest * layers, int n);
+int store_remove_image(struct layer_store *s, const char *name);
+int store_layers(struct layer_store *s, const char *name, layer_digest * layers, int max);
+int store_blob_path(struct layer_store *s, const char *hex, char *buf, int size);
+int store_layer_path(struct layer_store *s, const char *hex, char *buf, int size);
+int store_pin(struct layer_store *s, const char *hex);
+int store_gc(struct layer_store *s, int *removed, uint64_t *freed);
+
+#endif
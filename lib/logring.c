@@ -0,0 +1,357 @@
+#define _GNU_SOURCE				/* splice, tee, fallocate */
+#include <stdio.h>				/* perror */
+#include <string.h>				/* memset */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* EAGAIN */
+#include <fcntl.h>				/* splice */
+#include <time.h>				/* clock_gettime */
+#include <signal.h>				/* signal */
+#include <sys/types.h>
+#include <sys/stat.h>			/* fstat */
+#include <sys/mman.h>			/* mmap */
+#include <sys/epoll.h>			/* epoll_create1 */
+#include "logring.h"
+
+enum { header_size = 4096, record_bytes = 256, min_slots = 1024, max_slots = 1024 * 1024,
+	pipe_size = 1024 * 1024
+};
+
+/* The log_layout computes the number of records (a record per 256 bytes
+ * of data, a power of two) and the offset of the data area.
+ */
+static void log_layout(uint64_t data_size, uint32_t *nslots, uint32_t *data_start)
+{
+	uint32_t n = min_slots;
+
+	while (n < max_slots && (uint64_t) n * record_bytes < data_size)
+		n <<= 1;
+	*nslots = n;
+	*data_start = header_size + n * sizeof(struct log_record);
+}
+
+static int map_file(struct log_file *lf, int prot)
+{
+	struct stat st;
+
+	if (fstat(lf->fd, &st)) {
+		perror("fstat log");
+		return 1;
+	}
+	lf->size = st.st_size;
+	if (lf->size < header_size) {
+		fprintf(stderr, "log file is too short\n");
+		return 2;
+	}
+
+	lf->hdr = mmap(NULL, lf->size, prot, MAP_SHARED, lf->fd, 0);
+	if (lf->hdr == MAP_FAILED) {
+		perror("mmap log");
+		return 3;
+	}
+
+	return 0;
+}
+
+static int valid_header(const struct log_file *lf)
+{
+	const struct log_header *h = lf->hdr;
+
+	return h->magic == log_magic && h->version == log_version &&
+		h->data_start >= header_size + (uint64_t) h->nslots * sizeof(struct log_record) &&
+		h->data_start + h->data_size <= lf->size;
+}
+
+/* The log_open opens the log file for writing. A log with the same data
+ * size is continued (a container started again), otherwise the file is
+ * created anew and the whole of it is allocated on the disk up front.
+ */
+int log_open(struct log_file *lf, const char *path, uint64_t data_size)
+{
+	struct log_header *h;
+	uint32_t nslots, data_start;
+
+	lf->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+	if (lf->fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	log_layout(data_size, &nslots, &data_start);
+
+	if (lseek(lf->fd, 0, SEEK_END) == data_start + data_size) {
+		if (map_file(lf, PROT_READ | PROT_WRITE))
+			goto err;
+		if (valid_header(lf) && lf->hdr->data_size == data_size)
+			return 0;
+		munmap(lf->hdr, lf->size);
+	}
+
+	if (ftruncate(lf->fd, 0) || fallocate(lf->fd, 0, 0, data_start + data_size)) {
+		perror("fallocate log");
+		goto err;
+	}
+
+	if (map_file(lf, PROT_READ | PROT_WRITE))
+		goto err;
+
+	h = lf->hdr;
+	h->nslots = nslots;
+	h->data_start = data_start;
+	h->data_size = data_size;
+	h->version = log_version;
+	__sync_synchronize();
+	h->magic = log_magic;
+	return 0;
+
+ err:
+	close(lf->fd);
+	return 2;
+}
+
+/* The log_map maps the log file of path for reading. */
+int log_map(struct log_file *lf, const char *path)
+{
+	lf->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (lf->fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	if (map_file(lf, PROT_READ)) {
+		close(lf->fd);
+		return 2;
+	}
+
+	if (!valid_header(lf)) {
+		fprintf(stderr, "%s is not a log file\n", path);
+		log_close(lf);
+		return 3;
+	}
+
+	return 0;
+}
+
+void log_close(struct log_file *lf)
+{
+	munmap(lf->hdr, lf->size);
+	close(lf->fd);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The log_splice moves a chunk from pipe_fd to the data area and adds its
+ * record. The data never go through user space. If echo is not -1, the
+ * chunk is first copied to that pipe with tee(2), unless it is full. It
+ * returns the number of bytes moved, 0 at the end of the pipe or -1
+ * (EAGAIN if it is empty).
+ */
+int log_splice(struct log_file *lf, int pipe_fd, int stream, int echo)
+{
+	struct log_header *h = lf->hdr;
+	struct log_record *rec;
+	uint64_t pos, n;
+	loff_t off;
+	int len;
+
+	pos = h->data_head % h->data_size;
+	n = h->data_size - pos;
+	if (n > log_chunk)
+		n = log_chunk;
+
+	/* Exactly the copied bytes are moved, so the next tee starts
+	 * where this one has stopped.
+	 */
+	if (echo >= 0) {
+		len = tee(pipe_fd, echo, n, SPLICE_F_NONBLOCK);
+		if (len > 0)
+			n = len;
+	}
+
+	h->data_reserved = h->data_head + n;
+	__sync_synchronize();
+
+	off = h->data_start + pos;
+	len = splice(pipe_fd, NULL, lf->fd, &off, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len <= 0) {
+		h->data_reserved = h->data_head;
+		return len;
+	}
+
+	rec = &LOG_RECORDS(h)[h->rec_head % h->nslots];
+	rec->seq = 2 * h->rec_head + 1;
+	__sync_synchronize();
+	rec->off = h->data_head;
+	rec->len = len;
+	rec->stream = stream;
+	rec->time_ns = now_ns();
+	__sync_synchronize();
+	rec->seq = 2 * h->rec_head + 2;
+	__sync_synchronize();
+
+	h->data_head += len;
+	h->data_reserved = h->data_head;
+	h->rec_head++;
+	__sync_synchronize();
+
+	return len;
+}
+
+/* The log_read copies record n and its data (up to log_chunk bytes) to
+ * buf. It returns 0, 1 if the record is not written yet or 2 if it has
+ * been overwritten.
+ */
+int log_read(const struct log_file *lf, uint64_t n, struct log_record *rec, char *buf)
+{
+	const struct log_header *h = lf->hdr;
+	const struct log_record *slot;
+
+	if (n >= h->rec_head)
+		return 1;
+
+	slot = &LOG_RECORDS(h)[n % h->nslots];
+	rec->seq = slot->seq;
+	__sync_synchronize();
+	rec->off = slot->off;
+	rec->len = slot->len;
+	rec->stream = slot->stream;
+	rec->time_ns = slot->time_ns;
+	__sync_synchronize();
+	if (rec->seq != 2 * n + 2 || slot->seq != rec->seq || rec->len > log_chunk)
+		return 2;
+
+	memcpy(buf, (const char *) h + h->data_start + rec->off % h->data_size, rec->len);
+	__sync_synchronize();
+	if (h->data_reserved - rec->off > h->data_size)
+		return 2;
+
+	return 0;
+}
+
+/* The echo_fd returns fd if it is a pipe, so the output of a container
+ * can be copied there with tee(2), or -1.
+ */
+static int echo_fd(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) || !S_ISFIFO(st.st_mode))
+		return -1;
+	return fd;
+}
+
+/* The ship drains the stdout and stderr pipes of a container to the log
+ * until both of them are closed. If the launcher's own stdout or stderr is
+ * a pipe, the output is also copied there with tee(2); the copy is
+ * dropped rather than wait for a slow reader.
+ */
+static void ship(struct log_file *lf, const int *rfds)
+{
+	struct epoll_event ev, evs[2];
+	int echo[2], stream[2] = { log_stdout, log_stderr };
+	int i, n, nev, epfd, open_fds = 2;
+
+	echo[0] = echo_fd(1);
+	echo[1] = echo_fd(2);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		_exit(1);
+	}
+
+	for (i = 0; i < 2; i++) {
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, rfds[i], &ev)) {
+			perror("epoll_ctl");
+			_exit(2);
+		}
+	}
+
+	while (open_fds > 0) {
+		nev = epoll_wait(epfd, evs, 2, -1);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			_exit(3);
+		}
+
+		for (i = 0; i < nev; i++) {
+			int s = evs[i].data.u32;
+
+			n = log_splice(lf, rfds[s], stream[s], echo[s]);
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+				if (n < 0)
+					perror("log splice");
+				epoll_ctl(epfd, EPOLL_CTL_DEL, rfds[s], NULL);
+				close(rfds[s]);
+				open_fds--;
+			}
+		}
+	}
+
+	_exit(0);
+}
+
+/* The log_shipper_start opens the log, creates the stdout and stderr pipes
+ * of a container and forks the shipper. The write ends are returned in
+ * wfds (they are close-on-exec, dup2 them to 1 and 2). It returns the pid
+ * of the shipper or -1.
+ */
+int log_shipper_start(const char *path, uint64_t data_size, int *wfds)
+{
+	struct log_file lf;
+	int i, pid, pipes[2][2], rfds[2];
+
+	if (log_open(&lf, path, data_size))
+		return -1;
+
+	for (i = 0; i < 2; i++) {
+		if (pipe2(pipes[i], O_CLOEXEC | O_NONBLOCK)) {
+			perror("pipe2");
+			log_close(&lf);
+			return -1;
+		}
+		/* The container must not wait for the shipper, a large pipe
+		 * absorbs bursts.
+		 */
+		fcntl(pipes[i][1], F_SETPIPE_SZ, pipe_size);
+		/* Only the read end is non-blocking, the container writes as
+		 * to any pipe.
+		 */
+		fcntl(pipes[i][1], F_SETFL, 0);
+	}
+
+	pid = fork();
+	if (pid == -1)
+		perror("fork shipper");
+
+	if (pid == 0) {
+		/* The output of the container must not be lost to ^C. */
+		signal(SIGINT, SIG_IGN);
+		close(pipes[0][1]);
+		close(pipes[1][1]);
+		rfds[0] = pipes[0][0];
+		rfds[1] = pipes[1][0];
+		ship(&lf, rfds);
+	}
+
+	close(pipes[0][0]);
+	close(pipes[1][0]);
+	log_close(&lf);
+	for (i = 0; i < 2; i++) {
+		if (pid == -1)
+			close(pipes[i][1]);
+		else
+			wfds[i] = pipes[i][1];
+	}
+
+	return pid;
+}
@@ -0,0 +1,59 @@
+#ifndef LOGRING_SENTRY_H
+#define LOGRING_SENTRY_H
+
+#include <stdint.h>
+
+/* The output of a container is kept in a ring log file of a fixed size,
+ * preallocated with fallocate(2), so a chatty container can't fill the
+ * disk. The file is a header page, an index of records and the data area.
+ *
+ * The shipper splices every chunk read from a stdout/stderr pipe to the
+ * data area at data_head % data_size (a chunk never wraps) and adds a
+ * record for it. Readers map the file and read it without locks:
+ * record number n lives in recs[n % nslots], its seq is odd while it is
+ * being written and 2 * n + 2 once it is complete. Before the data area
+ * is overwritten data_reserved is moved forward, so a copy of the data
+ * of a record is intact if its offset is still within data_size of
+ * data_reserved after the copy.
+ */
+
+enum { log_magic = 0x6c6f6772, log_version = 1, log_chunk = 64 * 1024, log_def_mb = 16 };
+
+enum { log_stdout = 1, log_stderr = 2 };
+
+struct log_record {
+	uint64_t seq;
+	uint64_t off;				/* offset in the stream of all data */
+	uint32_t len;
+	uint32_t stream;			/* log_stdout or log_stderr */
+	uint64_t time_ns;			/* CLOCK_REALTIME */
+};
+
+struct log_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t data_start;		/* offset of the data area in the file */
+	uint64_t data_size;
+	uint64_t data_head;			/* bytes written so far */
+	uint64_t data_reserved;		/* bytes being written are below it */
+	uint64_t rec_head;			/* records written so far */
+};
+
+/* The records follow the header page. */
+#define LOG_RECORDS(hdr) ((struct log_record *) ((char *) (hdr) + 4096))
+
+struct log_file {
+	int fd;
+	struct log_header *hdr;
+	uint64_t size;				/* of the mapping */
+};
+
+int log_open(struct log_file *lf, const char *path, uint64_t data_size);
+int log_map(struct log_file *lf, const char *path);
+void log_close(struct log_file *lf);
+int log_splice(struct log_file *lf, int pipe_fd, int stream, int echo);
+int log_read(const struct log_file *lf, uint64_t n, struct log_record *rec, char *buf);
+int log_shipper_start(const char *path, uint64_t data_size, int *wfds);
+
+#endif
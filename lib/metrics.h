@@ -0,0 +1,53 @@
+#ifndef METRICS_SENTRY_H
+#define METRICS_SENTRY_H
+
+#include <stdint.h>
+
+/* Samples are written by cmetrics into a ring in a shared file (by default
+ * /dev/shm/docker-c-metrics). Readers map the file and read it without
+ * locks: sample number n lives in slots[n % nslots] and its seq is odd
+ * while it is being written and 2 * n + 2 once it is complete. A reader
+ * copies a slot and accepts it only if seq is the same before and after
+ * the copy. head is the number of samples written so far.
+ */
+
+enum { metrics_magic = 0x6d657472, metrics_version = 1, metrics_name_len = 48 };
+
+struct metrics_sample {
+	uint64_t seq;
+	uint64_t time_ns;			/* CLOCK_REALTIME */
+	char name[metrics_name_len];	/* container name */
+	uint64_t cpu_usage_usec;	/* cpu.stat */
+	uint64_t cpu_user_usec;
+	uint64_t cpu_system_usec;
+	uint64_t cpu_throttled_usec;
+	uint64_t mem_current;		/* memory.current */
+	uint64_t mem_anon;			/* memory.stat */
+	uint64_t mem_file;
+	uint64_t io_rbytes;			/* io.stat, all devices */
+	uint64_t io_wbytes;
+	uint64_t io_rios;
+	uint64_t io_wios;
+	uint64_t pids_current;		/* pids.current */
+	uint64_t net_rx_bytes;		/* veth, as seen by the container */
+	uint64_t net_tx_bytes;
+	uint64_t net_rx_packets;
+	uint64_t net_tx_packets;
+	uint64_t net_rx_dropped;
+	uint64_t net_tx_dropped;
+};
+
+struct metrics_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nslots;
+	uint32_t sample_size;
+	uint64_t head;
+	uint64_t pad[5];
+	struct metrics_sample slots[1];
+};
+
+#define METRICS_RING_SIZE(n) \
+	(sizeof(struct metrics_ring) + ((n) - 1) * sizeof(struct metrics_sample))
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE				/* snprintf */
 #include <asm/types.h>			/* netlink protocol */
 #include <linux/rtnetlink.h>
 #include <sys/socket.h>			/* socket */
@@ -8,6 +9,14 @@
 #include <net/if.h>				/* if_nametoindex */
 #include <linux/if.h>			/* IFF_UP */
 #include <arpa/inet.h>			/* inet_proton */
+#include <errno.h>				/* ENODEV */
+#include <linux/net_namespace.h>	/* NETNSA_FD */
+#include <linux/genetlink.h>	/* CTRL_CMD_GETFAMILY */
+#include <linux/ethtool_netlink.h>	/* ETHTOOL_MSG_FEATURES_SET */
+#include <fcntl.h>				/* open */
+#include <linux/pkt_sched.h>	/* struct tc_tbf_qopt */
+#include <linux/pkt_cls.h>		/* struct tc_police */
+#include <linux/if_ether.h>		/* ETH_P_ALL */
 #include "netlinklib.h"
 
 int addattr_l(struct nlmsghdr *n, int maxlen, int type, const void *data, int alen)
@@ -74,6 +83,100 @@ int netlink_request(int sock, struct nlmsghdr *nlh)
 	return 0;
 }
 
+/* The netlink_dump sends a request and passes every message of the reply
+ * to cb until the end of a dump (NLM_F_DUMP) or of a single reply.
+ */
+int netlink_dump(int sock, struct nlmsghdr *nlh, netlink_cb cb, void *arg)
+{
+	static char buf[page_size * 8];
+	struct sockaddr_nl sa = {.nl_family = AF_NETLINK };
+	struct nlmsghdr *h;
+	int len, dump = nlh->nlmsg_flags & NLM_F_DUMP;
+
+	if (sendto(sock, nlh, nlh->nlmsg_len, 0, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		perror("sendto");
+		return 1;
+	}
+
+	do {
+		len = recv(sock, buf, sizeof(buf), 0);
+		if (len < 0) {
+			perror("recv");
+			return 2;
+		}
+
+		for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+			if (h->nlmsg_type == NLMSG_DONE)
+				return 0;
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = (struct nlmsgerr *) NLMSG_DATA(h);
+				if (err->error < 0) {
+					fprintf(stderr, "NLMSG_ERROR: %s\n", strerror(-err->error));
+					return 3;
+				}
+				continue;
+			}
+			if (cb(h, arg))
+				return 4;
+		}
+	} while (dump);
+
+	return 0;
+}
+
+/* The parse_rtattr fills tb with attributes of a message, indexed by type. */
+void parse_rtattr(struct rtattr **tb, int max, struct rtattr *rta, int len)
+{
+	memset(tb, 0, sizeof(struct rtattr *) * (max + 1));
+
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type <= max)
+			tb[rta->rta_type] = rta;
+	}
+}
+
+static int nsid_cb(struct nlmsghdr *nlh, void *arg)
+{
+	struct rtattr *tb[NETNSA_MAX + 1];
+
+	if (nlh->nlmsg_type != RTM_NEWNSID)
+		return 0;
+
+	parse_rtattr(tb, NETNSA_MAX, (struct rtattr *) ((char *) NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct rtgenmsg))),
+				 nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct rtgenmsg)));
+	if (tb[NETNSA_NSID])
+		*(int *) arg = *(int *) RTA_DATA(tb[NETNSA_NSID]);
+	return 0;
+}
+
+/* The netns_id returns the id of the network namespace netns as seen from
+ * the namespace of sock (IFLA_LINK_NETNSID of links pointing there) or -1.
+ */
+int netns_id(int sock, int netns)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh;
+	struct rtgenmsg *g;
+	int nsid = -1;
+
+	memset(&msg, 0, page_size);
+
+	nlh = (struct nlmsghdr *) msg;
+	g = (struct rtgenmsg *) NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+	nlh->nlmsg_type = RTM_GETNSID;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	g->rtgen_family = AF_UNSPEC;
+
+	addattr_l(nlh, page_size, NETNSA_FD, &netns, 4);
+
+	if (netlink_dump(sock, nlh, nsid_cb, &nsid))
+		return -1;
+
+	return nsid;
+}
+
 int create_socket(void)
 {
 	int sock;
@@ -88,7 +191,29 @@ int create_socket(void)
 	return sock;
 }
 
-int create_veth_pair(int sock, const char *ifname, const char *peername)
+/* The add_link_opts adds tuning attributes of a new link. Zero fields
+ * keep the kernel defaults.
+ */
+static void add_link_opts(struct nlmsghdr *nlh, const struct link_opts *opts)
+{
+	if (!opts)
+		return;
+
+	if (opts->num_tx_queues)
+		addattr_l(nlh, page_size, IFLA_NUM_TX_QUEUES, &opts->num_tx_queues, 4);
+	if (opts->num_rx_queues)
+		addattr_l(nlh, page_size, IFLA_NUM_RX_QUEUES, &opts->num_rx_queues, 4);
+	if (opts->mtu)
+		addattr_l(nlh, page_size, IFLA_MTU, &opts->mtu, 4);
+	if (opts->gso_max_size)
+		addattr_l(nlh, page_size, IFLA_GSO_MAX_SIZE, &opts->gso_max_size, 4);
+	if (opts->gro_max_size)
+		addattr_l(nlh, page_size, IFLA_GRO_MAX_SIZE, &opts->gro_max_size, 4);
+	if (opts->txqlen)
+		addattr_l(nlh, page_size, IFLA_TXQLEN, &opts->txqlen, 4);
+}
+
+int create_veth_pair(int sock, const char *ifname, const char *peername, const struct link_opts *opts)
 {
 	char msg[page_size];
 	struct rtattr *linfo, *linfodata, *infopeer;
@@ -118,6 +243,7 @@ int create_veth_pair(int sock, const char *ifname, const char *peername)
 
 	/* Add name of the first interface. */
 	addattr_l(nlh, page_size, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+	add_link_opts(nlh, opts);
 
 
 	/* Add info about interface type. */
@@ -136,6 +262,7 @@ int create_veth_pair(int sock, const char *ifname, const char *peername)
 	nlh->nlmsg_len += sizeof(struct ifinfomsg);
 	/* Add name of the second interface. */
 	addattr_l(nlh, page_size, IFLA_IFNAME, peername, strlen(peername) + 1);
+	add_link_opts(nlh, opts);
 
 	addattr_nest_end(nlh, infopeer);
 	addattr_nest_end(nlh, linfodata);
@@ -150,6 +277,63 @@ int create_veth_pair(int sock, const char *ifname, const char *peername)
 	return 0;
 }
 
+/* The create_upper_link creates a macvlan or ipvlan link (kind) over the
+ * parent link, directly in the network namespace netns. mode is a
+ * MACVLAN_MODE_* or IPVLAN_MODE_* value.
+ */
+int create_upper_link(int sock, const char *kind, int mode, const char *ifname, const char *parent, int netns)
+{
+	char msg[page_size];
+	struct rtattr *linfo, *linfodata;
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	unsigned short ipvlan_mode = mode;
+	int parent_index;
+
+	memset(&msg, 0, page_size);
+
+	nlh = (struct nlmsghdr *) msg;
+	ifi = (struct ifinfomsg *) NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	nlh->nlmsg_type = RTM_NEWLINK;
+	nlh->nlmsg_flags = NLM_F_REQUEST |	/* Request. */
+		NLM_F_CREATE |			/* Create object. */
+		NLM_F_EXCL |			/* Do not update object if it exists. */
+		NLM_F_ACK;				/* Request for an ack on success. */
+
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_change = 0xffffffff;
+
+	parent_index = if_nametoindex(parent);
+	if (!parent_index) {
+		perror("if_nametoindex");
+		return 1;
+	}
+
+	addattr_l(nlh, page_size, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+	/* The lower device stays in our namespace, the new link is born in netns. */
+	addattr_l(nlh, page_size, IFLA_LINK, &parent_index, 4);
+	addattr_l(nlh, page_size, IFLA_NET_NS_FD, &netns, 4);
+
+	linfo = addattr_nest(nlh, page_size, IFLA_LINKINFO);
+	addattr_l(nlh, page_size, IFLA_INFO_KIND, kind, strlen(kind) + 1);
+	linfodata = addattr_nest(nlh, page_size, IFLA_INFO_DATA);
+	if (!strcmp(kind, "ipvlan"))
+		addattr_l(nlh, page_size, IFLA_IPVLAN_MODE, &ipvlan_mode, 2);
+	else
+		addattr_l(nlh, page_size, IFLA_MACVLAN_MODE, &mode, 4);
+	addattr_nest_end(nlh, linfodata);
+	addattr_nest_end(nlh, linfo);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "create_upper_link %s is failed\n", kind);
+		return 2;
+	}
+
+	return 0;
+}
+
 int if_to_netns(int sock, const char *ifname, int netns)
 {
 	char msg[page_size];
@@ -259,6 +443,46 @@ int addr_add(int sock, const char *ifname, const char *ip_addr, int ip_prefix)
 	return 0;
 }
 
+/* The route_add_default adds a default route via gateway gw. */
+int route_add_default(int sock, const char *gw)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh;
+	struct rtmsg *rtm;
+	struct in_addr addr;
+
+	memset(&msg, 0, page_size);
+
+	nlh = (struct nlmsghdr *) msg;
+	rtm = (struct rtmsg *) NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	nlh->nlmsg_type = RTM_NEWROUTE;
+	nlh->nlmsg_flags = NLM_F_REQUEST |	/* Request. */
+		NLM_F_CREATE |			/* Create object. */
+		NLM_F_EXCL |			/* Do not update object if it exists. */
+		NLM_F_ACK;				/* Request for an ack on success. */
+
+	rtm->rtm_family = AF_INET;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	rtm->rtm_protocol = RTPROT_BOOT;
+	rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+	rtm->rtm_type = RTN_UNICAST;
+
+	if (inet_pton(AF_INET, gw, &addr) != 1) {
+		perror("inet_pton");
+		return 1;
+	}
+	addattr_l(nlh, page_size, RTA_GATEWAY, &addr, 4);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "route_add_default is failed\n");
+		return 2;
+	}
+
+	return 0;
+}
+
 int if_del(int sock, const char *ifname)
 {
 	int ifi_index;
@@ -292,3 +516,512 @@ int if_del(int sock, const char *ifname)
 
 	return 0;
 }
+
+/* The if_del_batch deletes n links with one sendmsg(2): the requests are
+ * packed one after another in a single buffer and the acks are collected
+ * afterwards. Links which are already gone (e.g. a veth destroyed together
+ * with its network namespace) are not an error. It returns the number of
+ * links which could not be deleted.
+ */
+int if_del_batch(int sock, const char **ifnames, int n)
+{
+	char msg[page_size * 2];
+	struct sockaddr_nl sa = {.nl_family = AF_NETLINK };
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	int i, len, off = 0, acks = 0, failed = 0;
+
+	memset(&msg, 0, sizeof(msg));
+
+	for (i = 0; i < n; i++) {
+		nlh = (struct nlmsghdr *) (msg + off);
+		if (off + NLMSG_SPACE(sizeof(struct ifinfomsg) + RTA_SPACE(IFNAMSIZ)) > sizeof(msg)) {
+			fprintf(stderr, "if_del_batch: too many links\n");
+			return n;
+		}
+		ifi = (struct ifinfomsg *) NLMSG_DATA(nlh);
+
+		nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+		nlh->nlmsg_type = RTM_DELLINK;
+		nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+		nlh->nlmsg_seq = i + 1;
+
+		ifi->ifi_family = AF_UNSPEC;
+		ifi->ifi_change = 0xffffffff;
+		/* The kernel looks the link up by name, no if_nametoindex. */
+		addattr_l(nlh, sizeof(msg) - off, IFLA_IFNAME, ifnames[i], strlen(ifnames[i]) + 1);
+
+		off += NLMSG_ALIGN(nlh->nlmsg_len);
+	}
+
+	if (sendto(sock, msg, off, 0, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		perror("sendto");
+		return n;
+	}
+
+	while (acks < n) {
+		len = recv(sock, msg, sizeof(msg), 0);
+		if (len < 0) {
+			perror("recv");
+			return failed + n - acks;
+		}
+
+		for (nlh = (struct nlmsghdr *) msg; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			struct nlmsgerr *err;
+
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+			acks++;
+			err = (struct nlmsgerr *) NLMSG_DATA(nlh);
+			if (err->error < 0 && err->error != -ENODEV) {
+				i = nlh->nlmsg_seq - 1;
+				fprintf(stderr, "if_del_batch %s: %s\n", i >= 0 && i < n ? ifnames[i] : "?",
+						strerror(-err->error));
+				failed++;
+			}
+		}
+	}
+
+	return failed;
+}
+
+/* The cpu_mask writes the sysfs cpumask of the single CPU cpu to buf:
+ * comma-separated groups of 32 bits in hex, the highest group first.
+ */
+static void cpu_mask(char *buf, int size, int cpu)
+{
+	int g, len;
+
+	len = snprintf(buf, size, "%x", 1u << (cpu % 32));
+	for (g = cpu / 32; g > 0 && len + 9 < size; g--)
+		len += snprintf(buf + len, size - len, ",00000000");
+}
+
+/* The write_queue_files writes val to <file> of every <prefix>N queue
+ * of the link in sysfs (or a CPU of its own if val is NULL).
+ */
+static int write_queue_files(const char *ifname, const char *prefix, const char *file, const char *val)
+{
+	char path[page_size / 16];
+	char mask[page_size];
+	int i, fd, len, ncpu;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 0;; i++) {
+		snprintf(path, sizeof(path), "/sys/class/net/%s/queues/%s%d/%s", ifname, prefix, i, file);
+		fd = open(path, O_WRONLY);
+		if (fd < 0)
+			return i ? 0 : 1;
+
+		if (!val) {
+			/* tx-N is served by CPU N modulo number of CPUs. */
+			cpu_mask(mask, sizeof(mask), i % ncpu);
+			len = strlen(mask);
+			len = write(fd, mask, len) == len ? 0 : -1;
+		} else {
+			len = strlen(val);
+			len = write(fd, val, len) == len ? 0 : -1;
+		}
+		close(fd);
+
+		if (len) {
+			perror(path);
+			return 2;
+		}
+	}
+}
+
+/* The if_set_rps sets the RPS cpu mask (hex) of all rx queues. */
+int if_set_rps(const char *ifname, const char *mask)
+{
+	return write_queue_files(ifname, "rx-", "rps_cpus", mask);
+}
+
+/* The if_set_xps spreads tx queues over CPUs with XPS. */
+int if_set_xps(const char *ifname)
+{
+	return write_queue_files(ifname, "tx-", "xps_cpus", NULL);
+}
+
+int create_genl_socket(void)
+{
+	int sock;
+
+	sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+	if (sock < 0) {
+		perror("Cannot open generic netlink socket");
+		return -1;
+	}
+
+	return sock;
+}
+
+static int family_cb(struct nlmsghdr *nlh, void *arg)
+{
+	struct rtattr *tb[CTRL_ATTR_MAX + 1];
+
+	parse_rtattr(tb, CTRL_ATTR_MAX, (struct rtattr *) ((char *) NLMSG_DATA(nlh) + GENL_HDRLEN),
+				 nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+	if (tb[CTRL_ATTR_FAMILY_ID])
+		*(int *) arg = *(unsigned short *) RTA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+	return 0;
+}
+
+/* The genl_family_id resolves the id of a generic netlink family. */
+int genl_family_id(int sock, const char *name)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *g;
+	int id = -1;
+
+	memset(&msg, 0, page_size);
+
+	nlh = (struct nlmsghdr *) msg;
+	g = (struct genlmsghdr *) NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type = GENL_ID_CTRL;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	g->cmd = CTRL_CMD_GETFAMILY;
+	g->version = 1;
+
+	addattr_l(nlh, page_size, CTRL_ATTR_FAMILY_NAME, name, strlen(name) + 1);
+
+	if (netlink_dump(sock, nlh, family_cb, &id))
+		return -1;
+
+	return id;
+}
+
+/* The ethtool_set_features turns offloads (ethtool -K names, such as
+ * rx-gro or tx-tcp-segmentation) on or off through ethtool netlink.
+ */
+int ethtool_set_features(const char *ifname, const char *const *names, const int *on, int n)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh;
+	struct genlmsghdr *g;
+	struct rtattr *hdr, *wanted, *bits, *bit;
+	int i, sock, family, ret = 0;
+
+	sock = create_genl_socket();
+	if (sock < 0)
+		return 1;
+
+	family = genl_family_id(sock, ETHTOOL_GENL_NAME);
+	if (family < 0) {
+		fprintf(stderr, "ethtool netlink is not supported\n");
+		close(sock);
+		return 2;
+	}
+
+	memset(&msg, 0, page_size);
+
+	nlh = (struct nlmsghdr *) msg;
+	g = (struct genlmsghdr *) NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nlh->nlmsg_type = family;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	g->cmd = ETHTOOL_MSG_FEATURES_SET;
+	g->version = ETHTOOL_GENL_VERSION;
+
+	hdr = addattr_nest(nlh, page_size, ETHTOOL_A_FEATURES_HEADER | NLA_F_NESTED);
+	addattr_l(nlh, page_size, ETHTOOL_A_HEADER_DEV_NAME, ifname, strlen(ifname) + 1);
+	addattr_nest_end(nlh, hdr);
+
+	/* Only bits listed in the bitset are changed, a present
+	 * ETHTOOL_A_BITSET_BIT_VALUE flag means on.
+	 */
+	wanted = addattr_nest(nlh, page_size, ETHTOOL_A_FEATURES_WANTED | NLA_F_NESTED);
+	bits = addattr_nest(nlh, page_size, ETHTOOL_A_BITSET_BITS | NLA_F_NESTED);
+	for (i = 0; i < n; i++) {
+		bit = addattr_nest(nlh, page_size, ETHTOOL_A_BITSET_BITS_BIT | NLA_F_NESTED);
+		addattr_l(nlh, page_size, ETHTOOL_A_BITSET_BIT_NAME, names[i], strlen(names[i]) + 1);
+		if (on[i])
+			addattr_l(nlh, page_size, ETHTOOL_A_BITSET_BIT_VALUE, NULL, 0);
+		addattr_nest_end(nlh, bit);
+	}
+	addattr_nest_end(nlh, bits);
+	addattr_nest_end(nlh, wanted);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "ethtool_set_features %s is failed\n", ifname);
+		ret = 3;
+	}
+
+	close(sock);
+	return ret;
+}
+
+/* The tc_msg starts a request of type (RTM_NEWQDISC, RTM_NEWTCLASS or
+ * RTM_NEWTFILTER) for the object kind on the link.
+ */
+static int tc_msg(struct nlmsghdr *nlh, int type, const char *ifname, unsigned int parent, unsigned int handle,
+				  const char *kind)
+{
+	struct tcmsg *tcm;
+	int ifindex;
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex) {
+		perror("if_nametoindex");
+		return 1;
+	}
+
+	memset(nlh, 0, page_size);
+	tcm = (struct tcmsg *) NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST |	/* Request. */
+		NLM_F_CREATE |			/* Create object. */
+		NLM_F_EXCL |			/* Do not update object if it exists. */
+		NLM_F_ACK;				/* Request for an ack on success. */
+
+	tcm->tcm_family = AF_UNSPEC;
+	tcm->tcm_ifindex = ifindex;
+	tcm->tcm_parent = parent;
+	tcm->tcm_handle = handle;
+	addattr_l(nlh, page_size, TCA_KIND, kind, strlen(kind) + 1);
+	return 0;
+}
+
+/* The xmit_ticks returns the time to send size bytes at rate in the ticks
+ * of the packet scheduler (64 ns, see PSCHED_SHIFT).
+ */
+static unsigned int xmit_ticks(unsigned long long rate, unsigned int size)
+{
+	return size * 1000000000ULL / rate >> 6;
+}
+
+/* The set_rate fills a rate spec; a rate of 4 GB/s and more is passed in
+ * a 64 bit attribute (rate64) too. The link layer is set, so the kernel
+ * needs no rate table.
+ */
+static void set_rate(struct tc_ratespec *r, unsigned long long rate)
+{
+	r->rate = rate >= 1ULL << 32 ? ~0U : rate;
+	r->linklayer = TC_LINKLAYER_ETHERNET;
+}
+
+/* The qdisc_add adds a qdisc which needs no options (fq_codel with the
+ * defaults, ingress).
+ */
+int qdisc_add(int sock, const char *ifname, const char *kind, unsigned int parent, unsigned int handle)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+
+	if (tc_msg(nlh, RTM_NEWQDISC, ifname, parent, handle, kind))
+		return 1;
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "qdisc_add %s is failed\n", kind);
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The qdisc_add_tbf adds the root token bucket filter: rate in bytes per
+ * second, a bucket of burst bytes and a queue of limit bytes.
+ */
+int qdisc_add_tbf(int sock, const char *ifname, unsigned long long rate, unsigned int burst, unsigned int limit)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+	struct tc_tbf_qopt qopt;
+	struct rtattr *opts;
+
+	if (tc_msg(nlh, RTM_NEWQDISC, ifname, TC_H_ROOT, 0, "tbf"))
+		return 1;
+
+	memset(&qopt, 0, sizeof(qopt));
+	set_rate(&qopt.rate, rate);
+	qopt.limit = limit;
+	qopt.buffer = xmit_ticks(rate, burst);
+
+	opts = addattr_nest(nlh, page_size, TCA_OPTIONS);
+	addattr_l(nlh, page_size, TCA_TBF_PARMS, &qopt, sizeof(qopt));
+	addattr_l(nlh, page_size, TCA_TBF_BURST, &burst, 4);
+	if (rate >= 1ULL << 32)
+		addattr_l(nlh, page_size, TCA_TBF_RATE64, &rate, 8);
+	addattr_nest_end(nlh, opts);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "qdisc_add_tbf is failed\n");
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The qdisc_add_htb adds the root HTB qdisc handle, unclassified traffic
+ * goes to the class defcls (the minor of a class id).
+ */
+int qdisc_add_htb(int sock, const char *ifname, unsigned int handle, unsigned int defcls)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+	struct tc_htb_glob glob;
+	struct rtattr *opts;
+
+	if (tc_msg(nlh, RTM_NEWQDISC, ifname, TC_H_ROOT, handle, "htb"))
+		return 1;
+
+	memset(&glob, 0, sizeof(glob));
+	glob.version = TC_HTB_PROTOVER;
+	glob.rate2quantum = 10;
+	glob.defcls = defcls;
+
+	opts = addattr_nest(nlh, page_size, TCA_OPTIONS);
+	addattr_l(nlh, page_size, TCA_HTB_INIT, &glob, sizeof(glob));
+	addattr_nest_end(nlh, opts);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "qdisc_add_htb is failed\n");
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The class_add_htb adds the HTB class classid, guaranteed rate and
+ * allowed to borrow up to ceil (bytes per second), with bursts of burst
+ * bytes at the link speed.
+ */
+int class_add_htb(int sock, const char *ifname, unsigned int parent, unsigned int classid, unsigned long long rate,
+				  unsigned long long ceil, unsigned int burst)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+	struct tc_htb_opt hopt;
+	struct rtattr *opts;
+
+	if (tc_msg(nlh, RTM_NEWTCLASS, ifname, parent, classid, "htb"))
+		return 1;
+
+	memset(&hopt, 0, sizeof(hopt));
+	set_rate(&hopt.rate, rate);
+	set_rate(&hopt.ceil, ceil);
+	hopt.buffer = xmit_ticks(rate, burst);
+	hopt.cbuffer = xmit_ticks(ceil, burst);
+
+	opts = addattr_nest(nlh, page_size, TCA_OPTIONS);
+	addattr_l(nlh, page_size, TCA_HTB_PARMS, &hopt, sizeof(hopt));
+	if (rate >= 1ULL << 32)
+		addattr_l(nlh, page_size, TCA_HTB_RATE64, &rate, 8);
+	if (ceil >= 1ULL << 32)
+		addattr_l(nlh, page_size, TCA_HTB_CEIL64, &ceil, 8);
+	addattr_nest_end(nlh, opts);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "class_add_htb is failed\n");
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The filter_add_police adds a matchall filter to the qdisc parent (the
+ * ingress one, say) which drops the traffic above rate (bytes per second)
+ * with bursts of burst bytes. The police action still wants a rate table,
+ * though the kernel computes the times itself.
+ */
+int filter_add_police(int sock, const char *ifname, unsigned int parent, unsigned long long rate, unsigned int burst)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+	struct rtattr *opts, *acts, *act, *popts;
+	unsigned int rtab[TC_RTAB_SIZE / sizeof(unsigned int)];
+	struct tc_police p;
+	int i;
+
+	if (tc_msg(nlh, RTM_NEWTFILTER, ifname, parent, 0, "matchall"))
+		return 1;
+	/* The priority and the protocol of the filter. */
+	((struct tcmsg *) NLMSG_DATA(nlh))->tcm_info = TC_H_MAKE(1 << 16, htons(ETH_P_ALL));
+
+	memset(&p, 0, sizeof(p));
+	p.action = TC_ACT_SHOT;
+	p.burst = xmit_ticks(rate, burst);
+	p.mtu = 65535;				/* a GSO packet is checked by segments */
+	set_rate(&p.rate, rate);
+	p.rate.cell_log = 8;		/* 255 cells cover the mtu */
+	p.rate.cell_align = -1;
+	for (i = 0; i < (int) (sizeof(rtab) / sizeof(rtab[0])); i++)
+		rtab[i] = xmit_ticks(rate, (i + 1) << p.rate.cell_log);
+
+	opts = addattr_nest(nlh, page_size, TCA_OPTIONS);
+	acts = addattr_nest(nlh, page_size, TCA_MATCHALL_ACT);
+	act = addattr_nest(nlh, page_size, 1);
+	addattr_l(nlh, page_size, TCA_ACT_KIND, "police", 7);
+	popts = addattr_nest(nlh, page_size, TCA_ACT_OPTIONS);
+	addattr_l(nlh, page_size, TCA_POLICE_TBF, &p, sizeof(p));
+	addattr_l(nlh, page_size, TCA_POLICE_RATE, rtab, sizeof(rtab));
+	if (rate >= 1ULL << 32)
+		addattr_l(nlh, page_size, TCA_POLICE_RATE64, &rate, 8);
+	addattr_nest_end(nlh, popts);
+	addattr_nest_end(nlh, act);
+	addattr_nest_end(nlh, acts);
+	addattr_nest_end(nlh, opts);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "filter_add_police is failed\n");
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The qdisc_add_clsact adds the clsact qdisc, which runs filters on the
+ * ingress and egress of the link. A clsact there already is kept.
+ */
+int qdisc_add_clsact(int sock, const char *ifname)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+
+	if (tc_msg(nlh, RTM_NEWQDISC, ifname, TC_H_CLSACT, TC_H_MAKE(TC_H_CLSACT, 0), "clsact"))
+		return 1;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK;
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "qdisc_add_clsact is failed\n");
+		return 2;
+	}
+
+	return 0;
+}
+
+/* The filter_add_bpf attaches the BPF program prog_fd in direct action
+ * mode (its return code is the verdict) to parent, as the filter 1 of
+ * priority 1: it replaces the program of an earlier call.
+ */
+int filter_add_bpf(int sock, const char *ifname, unsigned int parent, int prog_fd, const char *name)
+{
+	char msg[page_size];
+	struct nlmsghdr *nlh = (struct nlmsghdr *) msg;
+	struct rtattr *opts;
+	unsigned int flags = TCA_BPF_FLAG_ACT_DIRECT;
+
+	if (tc_msg(nlh, RTM_NEWTFILTER, ifname, parent, 1, "bpf"))
+		return 1;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK;
+	((struct tcmsg *) NLMSG_DATA(nlh))->tcm_info = TC_H_MAKE(1 << 16, htons(ETH_P_ALL));
+
+	opts = addattr_nest(nlh, page_size, TCA_OPTIONS);
+	addattr_l(nlh, page_size, TCA_BPF_FD, &prog_fd, 4);
+	addattr_l(nlh, page_size, TCA_BPF_NAME, name, strlen(name) + 1);
+	addattr_l(nlh, page_size, TCA_BPF_FLAGS, &flags, 4);
+	addattr_nest_end(nlh, opts);
+
+	if (netlink_request(sock, nlh)) {
+		fprintf(stderr, "filter_add_bpf %s is failed\n", name);
+		return 2;
+	}
+
+	return 0;
+}
@@ -8,16 +8,49 @@
 
 enum { page_size = 4096 };
 
+struct rtattr;
+
+/* Tuning of a new link, zero fields keep the kernel defaults. */
+struct link_opts {
+	int num_tx_queues;
+	int num_rx_queues;
+	int mtu;
+	int gso_max_size;
+	int gro_max_size;
+	int txqlen;
+};
+typedef int (*netlink_cb)(struct nlmsghdr *nlh, void *arg);
+
 int netlink_request(int sock, struct nlmsghdr *nlh);
 int addattr_l(struct nlmsghdr *n, int maxlen, int type, const void *data, int alen);
 struct rtattr *addattr_nest(struct nlmsghdr *n, int maxlen, int type);
+int addattr_nest_end(struct nlmsghdr *n, struct rtattr *nest);
 int netlink_request(int sock, struct nlmsghdr *nlh);
 int add_veth_pair(const char *ifname, const char *peername);
+int netlink_dump(int sock, struct nlmsghdr *nlh, netlink_cb cb, void *arg);
+void parse_rtattr(struct rtattr **tb, int max, struct rtattr *rta, int len);
+int netns_id(int sock, int netns);
 int create_socket(void);
-int create_veth_pair(int sock, const char *ifname, const char *peername);
+int create_veth_pair(int sock, const char *ifname, const char *peername, const struct link_opts *opts);
+int create_upper_link(int sock, const char *kind, int mode, const char *ifname, const char *parent, int netns);
 int if_to_netns(int sock, const char *ifname, int netns);
 int if_up(int sock, const char *ifname);
 int addr_add(int sock, const char *ifname, const char *ip_addr, int ip_prefix);
+int route_add_default(int sock, const char *gw);
 int if_del(int sock, const char *ifname);
+int if_del_batch(int sock, const char **ifnames, int n);
+int if_set_rps(const char *ifname, const char *mask);
+int if_set_xps(const char *ifname);
+int create_genl_socket(void);
+int genl_family_id(int sock, const char *name);
+int ethtool_set_features(const char *ifname, const char *const *names, const int *on, int n);
+int qdisc_add(int sock, const char *ifname, const char *kind, unsigned int parent, unsigned int handle);
+int qdisc_add_tbf(int sock, const char *ifname, unsigned long long rate, unsigned int burst, unsigned int limit);
+int qdisc_add_htb(int sock, const char *ifname, unsigned int handle, unsigned int defcls);
+int class_add_htb(int sock, const char *ifname, unsigned int parent, unsigned int classid, unsigned long long rate,
+				  unsigned long long ceil, unsigned int burst);
+int filter_add_police(int sock, const char *ifname, unsigned int parent, unsigned long long rate, unsigned int burst);
+int qdisc_add_clsact(int sock, const char *ifname);
+int filter_add_bpf(int sock, const char *ifname, unsigned int parent, int prog_fd, const char *name);
 
 #endif
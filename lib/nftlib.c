@@ -0,0 +1,507 @@
+#define _GNU_SOURCE				/* snprintf */
+#include <stdio.h>				/* perror */
+#include <string.h>				/* memset */
+#include <unistd.h>				/* close */
+#include <errno.h>				/* ENOENT */
+#include <net/if.h>				/* IFNAMSIZ */
+#include <netinet/in.h>			/* IPPROTO_TCP */
+#include <arpa/inet.h>			/* inet_pton */
+#include <sys/socket.h>			/* socket */
+#include <linux/rtnetlink.h>	/* RTN_LOCAL */
+#include <linux/netfilter.h>	/* NF_INET_PRE_ROUTING */
+#include <linux/netfilter/nfnetlink.h>	/* NFNL_MSG_BATCH_BEGIN */
+#include <linux/netfilter/nf_tables.h>	/* NFT_MSG_NEWTABLE */
+#include "netlinklib.h"
+#include "nftlib.h"
+
+enum { nft_batch_size = page_size * 16, nft_max_ports = 64 };
+
+enum { prio_raw = -300, prio_dstnat = -100, prio_srcnat = 100 };
+
+/* The batch holds all messages of one nf_tables transaction. */
+struct nft_batch {
+	char buf[nft_batch_size];
+	int off;
+	int seq;					/* seq of the last message */
+	int first;					/* seq of the first message */
+	int nmsg;					/* messages which are acked */
+	const char *table;
+};
+
+static const char *table_prefix = "docker-c-";
+
+int create_nft_socket(void)
+{
+	int sock;
+
+	/* NETLINK_NETFILTER used to program nf_tables. */
+	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+	if (sock < 0) {
+		perror("Cannot open netfilter netlink socket");
+		return -1;
+	}
+
+	return sock;
+}
+
+/* The nft_table_name makes the name of the table of a container. */
+int nft_table_name(const char *name, char *buf, int size)
+{
+	if (snprintf(buf, size, "%s%s", table_prefix, name) >= size) {
+		fprintf(stderr, "table name %s%s is too long\n", table_prefix, name);
+		return 1;
+	}
+	return 0;
+}
+
+static int batch_left(const struct nft_batch *b)
+{
+	return nft_batch_size - b->off;
+}
+
+/* The batch_msg starts a new message at the end of the batch. */
+static struct nlmsghdr *batch_msg(struct nft_batch *b, int type, int flags, int family)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *) (b->buf + b->off);
+	struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_seq = ++b->seq;
+	nfg->nfgen_family = family;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(NFNL_SUBSYS_NFTABLES);
+
+	return nlh;
+}
+
+static void batch_end_msg(struct nft_batch *b, struct nlmsghdr *nlh)
+{
+	b->off += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static struct nlmsghdr *batch_nft_msg(struct nft_batch *b, int type, int flags)
+{
+	b->nmsg++;
+	return batch_msg(b, (NFNL_SUBSYS_NFTABLES << 8) | type, flags | NLM_F_ACK, NFPROTO_IPV4);
+}
+
+/* The batch_init starts a new batch. Sequence numbers go on from the
+ * previous batch, so acks left from it are not taken for the new ones.
+ */
+static void batch_init(struct nft_batch *b)
+{
+	int seq = b->seq;
+
+	memset(b, 0, sizeof(*b));
+	b->seq = seq;
+	b->first = seq + 1;
+	batch_end_msg(b, batch_msg(b, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC));
+}
+
+static void addattr_u32(struct nlmsghdr *nlh, int maxlen, int type, unsigned int val)
+{
+	val = htonl(val);
+	addattr_l(nlh, maxlen, type, &val, 4);
+}
+
+static void addattr_str(struct nlmsghdr *nlh, int maxlen, int type, const char *str)
+{
+	addattr_l(nlh, maxlen, type, str, strlen(str) + 1);
+}
+
+/* The add_chain adds a base chain of the table on hook. */
+static void add_chain(struct nft_batch *b, const char *chain, const char *type, int hook, int prio)
+{
+	struct nlmsghdr *nlh = batch_nft_msg(b, NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	struct rtattr *nest;
+	int max = batch_left(b);
+
+	addattr_str(nlh, max, NFTA_CHAIN_TABLE, b->table);
+	addattr_str(nlh, max, NFTA_CHAIN_NAME, chain);
+	addattr_str(nlh, max, NFTA_CHAIN_TYPE, type);
+	nest = addattr_nest(nlh, max, NFTA_CHAIN_HOOK | NLA_F_NESTED);
+	addattr_u32(nlh, max, NFTA_HOOK_HOOKNUM, hook);
+	addattr_u32(nlh, max, NFTA_HOOK_PRIORITY, prio);
+	addattr_nest_end(nlh, nest);
+
+	batch_end_msg(b, nlh);
+}
+
+/* Expressions of a rule are NFTA_LIST_ELEM nests, each one is a name
+ * and its data. The expr_start/expr_end helpers open and close them.
+ */
+static struct rtattr *expr_start(struct nlmsghdr *nlh, int max, const char *name, struct rtattr **data)
+{
+	struct rtattr *elem = addattr_nest(nlh, max, NFTA_LIST_ELEM | NLA_F_NESTED);
+
+	addattr_str(nlh, max, NFTA_EXPR_NAME, name);
+	*data = addattr_nest(nlh, max, NFTA_EXPR_DATA | NLA_F_NESTED);
+	return elem;
+}
+
+static void expr_end(struct nlmsghdr *nlh, struct rtattr *elem, struct rtattr *data)
+{
+	addattr_nest_end(nlh, data);
+	addattr_nest_end(nlh, elem);
+}
+
+/* The expr_value adds an NFTA_DATA_VALUE nest of type. */
+static void expr_value(struct nlmsghdr *nlh, int max, int type, const void *val, int len)
+{
+	struct rtattr *nest = addattr_nest(nlh, max, type | NLA_F_NESTED);
+
+	addattr_l(nlh, max, NFTA_DATA_VALUE, val, len);
+	addattr_nest_end(nlh, nest);
+}
+
+static void expr_cmp(struct nlmsghdr *nlh, int max, int op, const void *val, int len)
+{
+	struct rtattr *elem, *data;
+
+	elem = expr_start(nlh, max, "cmp", &data);
+	addattr_u32(nlh, max, NFTA_CMP_SREG, NFT_REG_1);
+	addattr_u32(nlh, max, NFTA_CMP_OP, op);
+	expr_value(nlh, max, NFTA_CMP_DATA, val, len);
+	expr_end(nlh, elem, data);
+}
+
+static void expr_meta(struct nlmsghdr *nlh, int max, int key)
+{
+	struct rtattr *elem, *data;
+
+	elem = expr_start(nlh, max, "meta", &data);
+	addattr_u32(nlh, max, NFTA_META_KEY, key);
+	addattr_u32(nlh, max, NFTA_META_DREG, NFT_REG_1);
+	expr_end(nlh, elem, data);
+}
+
+static void expr_payload(struct nlmsghdr *nlh, int max, int base, int offset, int len)
+{
+	struct rtattr *elem, *data;
+
+	elem = expr_start(nlh, max, "payload", &data);
+	addattr_u32(nlh, max, NFTA_PAYLOAD_DREG, NFT_REG_1);
+	addattr_u32(nlh, max, NFTA_PAYLOAD_BASE, base);
+	addattr_u32(nlh, max, NFTA_PAYLOAD_OFFSET, offset);
+	addattr_u32(nlh, max, NFTA_PAYLOAD_LEN, len);
+	expr_end(nlh, elem, data);
+}
+
+static void expr_immediate(struct nlmsghdr *nlh, int max, int reg, const void *val, int len)
+{
+	struct rtattr *elem, *data;
+
+	elem = expr_start(nlh, max, "immediate", &data);
+	addattr_u32(nlh, max, NFTA_IMMEDIATE_DREG, reg);
+	expr_value(nlh, max, NFTA_IMMEDIATE_DATA, val, len);
+	expr_end(nlh, elem, data);
+}
+
+/* The match_tcp_port matches TCP packets with the port in network byte
+ * order as a destination (sport == 0) or a source port.
+ */
+static void match_tcp_port(struct nlmsghdr *nlh, int max, unsigned short port, int sport)
+{
+	unsigned char proto = IPPROTO_TCP;
+
+	expr_meta(nlh, max, NFT_META_L4PROTO);
+	expr_cmp(nlh, max, NFT_CMP_EQ, &proto, 1);
+	/* struct tcphdr: source at offset 0, dest at offset 2 */
+	expr_payload(nlh, max, NFT_PAYLOAD_TRANSPORT_HEADER, sport ? 0 : 2, 2);
+	expr_cmp(nlh, max, NFT_CMP_EQ, &port, 2);
+}
+
+/* The match_ip_addr matches the destination (saddr == 0) or the source
+ * address of IPv4 packets.
+ */
+static void match_ip_addr(struct nlmsghdr *nlh, int max, const struct in_addr *addr, int saddr)
+{
+	/* struct iphdr: saddr at offset 12, daddr at offset 16 */
+	expr_payload(nlh, max, NFT_PAYLOAD_NETWORK_HEADER, saddr ? 12 : 16, 4);
+	expr_cmp(nlh, max, NFT_CMP_EQ, addr, 4);
+}
+
+static struct nlmsghdr *rule_start(struct nft_batch *b, const char *chain, struct rtattr **exprs)
+{
+	struct nlmsghdr *nlh = batch_nft_msg(b, NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+
+	addattr_str(nlh, batch_left(b), NFTA_RULE_TABLE, b->table);
+	addattr_str(nlh, batch_left(b), NFTA_RULE_CHAIN, chain);
+	*exprs = addattr_nest(nlh, batch_left(b), NFTA_RULE_EXPRESSIONS | NLA_F_NESTED);
+	return nlh;
+}
+
+static void rule_end(struct nft_batch *b, struct nlmsghdr *nlh, struct rtattr *exprs)
+{
+	addattr_nest_end(nlh, exprs);
+	batch_end_msg(b, nlh);
+}
+
+/* The add_dnat_rule adds
+ *   fib daddr type local tcp dport <host port> dnat to <addr>:<port>
+ * to chain, so the port is published on every local address.
+ */
+static void add_dnat_rule(struct nft_batch *b, const char *chain, const struct in_addr *addr,
+						  const struct nft_port *p)
+{
+	struct nlmsghdr *nlh;
+	struct rtattr *exprs, *elem, *data;
+	unsigned short hport = htons(p->host_port), cport = htons(p->cont_port);
+	unsigned int local = RTN_LOCAL;
+	int max = batch_left(b);
+
+	nlh = rule_start(b, chain, &exprs);
+
+	elem = expr_start(nlh, max, "fib", &data);
+	addattr_u32(nlh, max, NFTA_FIB_DREG, NFT_REG_1);
+	addattr_u32(nlh, max, NFTA_FIB_RESULT, NFT_FIB_RESULT_ADDRTYPE);
+	addattr_u32(nlh, max, NFTA_FIB_FLAGS, NFTA_FIB_F_DADDR);
+	expr_end(nlh, elem, data);
+	/* The address type is kept in the register in host byte order. */
+	expr_cmp(nlh, max, NFT_CMP_EQ, &local, 4);
+
+	match_tcp_port(nlh, max, hport, 0);
+
+	expr_immediate(nlh, max, NFT_REG_1, addr, 4);
+	expr_immediate(nlh, max, NFT_REG_2, &cport, 2);
+
+	elem = expr_start(nlh, max, "nat", &data);
+	addattr_u32(nlh, max, NFTA_NAT_TYPE, NFT_NAT_DNAT);
+	addattr_u32(nlh, max, NFTA_NAT_FAMILY, NFPROTO_IPV4);
+	addattr_u32(nlh, max, NFTA_NAT_REG_ADDR_MIN, NFT_REG_1);
+	addattr_u32(nlh, max, NFTA_NAT_REG_PROTO_MIN, NFT_REG_2);
+	expr_end(nlh, elem, data);
+
+	rule_end(b, nlh, exprs);
+}
+
+/* The add_masq_rule adds
+ *   ip saddr <addr> oifname != <oif> masquerade
+ * so the replies of the outside world find their way back.
+ */
+static void add_masq_rule(struct nft_batch *b, const char *chain, const struct in_addr *addr, const char *oif)
+{
+	struct nlmsghdr *nlh;
+	struct rtattr *exprs, *elem, *data;
+	char name[IFNAMSIZ];
+	int max = batch_left(b);
+
+	memset(name, 0, IFNAMSIZ);
+	strncpy(name, oif, IFNAMSIZ - 1);
+
+	nlh = rule_start(b, chain, &exprs);
+
+	match_ip_addr(nlh, max, addr, 1);
+	expr_meta(nlh, max, NFT_META_OIFNAME);
+	expr_cmp(nlh, max, NFT_CMP_NEQ, name, IFNAMSIZ);
+
+	elem = expr_start(nlh, max, "masq", &data);
+	expr_end(nlh, elem, data);
+
+	rule_end(b, nlh, exprs);
+}
+
+/* The add_notrack_rule adds
+ *   ip daddr <addr> tcp dport <port> notrack
+ * or the same for the replies (ip saddr, tcp sport) if reply is set.
+ */
+static void add_notrack_rule(struct nft_batch *b, const char *chain, const struct in_addr *addr,
+							 const struct nft_port *p, int reply)
+{
+	struct nlmsghdr *nlh;
+	struct rtattr *exprs, *elem, *data;
+	unsigned short port = htons(p->cont_port);
+	int max = batch_left(b);
+
+	nlh = rule_start(b, chain, &exprs);
+
+	match_ip_addr(nlh, max, addr, reply);
+	match_tcp_port(nlh, max, port, reply);
+
+	elem = expr_start(nlh, max, "notrack", &data);
+	expr_end(nlh, elem, data);
+
+	rule_end(b, nlh, exprs);
+}
+
+/* The batch_send sends the transaction and collects an ack for every
+ * message. The kernel applies all of them or none. An error equal to
+ * ignore is not reported, the batch_send returns 4 if there were only
+ * such errors (the transaction is aborted all the same).
+ */
+static int batch_send(int sock, struct nft_batch *b, int ignore)
+{
+	struct sockaddr_nl sa = {.nl_family = AF_NETLINK };
+	struct nlmsghdr *nlh;
+	int len, flags, acks = 0, failed = 0, skipped = 0;
+
+	batch_end_msg(b, batch_msg(b, NFNL_MSG_BATCH_END, 0, AF_UNSPEC));
+
+	if (sendto(sock, b->buf, b->off, 0, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
+		perror("sendto");
+		return 1;
+	}
+
+	/* Even an aborted batch is acked message by message, all the acks are
+	 * read so that none is left for the next batch on the socket. After
+	 * an error the kernel may stop early, then the socket runs dry.
+	 */
+	while (acks < b->nmsg) {
+		flags = failed || skipped ? MSG_DONTWAIT : 0;
+		len = recv(sock, b->buf, nft_batch_size, flags);
+		if (len < 0 && flags && errno == EAGAIN)
+			break;
+		if (len < 0) {
+			perror("recv");
+			return 2;
+		}
+
+		for (nlh = (struct nlmsghdr *) b->buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			struct nlmsgerr *err;
+
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+			if ((int) nlh->nlmsg_seq < b->first || (int) nlh->nlmsg_seq > b->seq)
+				continue;
+			acks++;
+			err = (struct nlmsgerr *) NLMSG_DATA(nlh);
+			if (err->error < 0 && err->error == -ignore) {
+				skipped++;
+			} else if (err->error < 0) {
+				fprintf(stderr, "nf_tables message %d: %s\n", nlh->nlmsg_seq, strerror(-err->error));
+				failed++;
+			}
+		}
+	}
+
+	if (failed)
+		return 3;
+	return skipped ? 4 : 0;
+}
+
+/* The nft_publish creates the table of the container with the published
+ * ports in one transaction. Packets to a published host port on any local
+ * address are DNATed to cont_ip, packets of the container leaving through
+ * another link than oif are masqueraded.
+ */
+int nft_publish(const char *name, const char *cont_ip, const char *oif, const struct nft_port *ports, int n)
+{
+	static struct nft_batch b;
+	char table[nft_max_table];
+	struct nlmsghdr *nlh;
+	struct in_addr addr;
+	int i, sock, ret, ndnat = 0, nnotrack = 0;
+
+	if (n > nft_max_ports) {
+		fprintf(stderr, "too many published ports\n");
+		return 1;
+	}
+
+	if (nft_table_name(name, table, nft_max_table))
+		return 2;
+
+	if (inet_pton(AF_INET, cont_ip, &addr) != 1) {
+		fprintf(stderr, "bad address %s\n", cont_ip);
+		return 3;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (ports[i].notrack)
+			nnotrack++;
+		else
+			ndnat++;
+	}
+
+	batch_init(&b);
+	b.table = table;
+
+	nlh = batch_nft_msg(&b, NFT_MSG_NEWTABLE, NLM_F_CREATE);
+	addattr_str(nlh, batch_left(&b), NFTA_TABLE_NAME, table);
+	batch_end_msg(&b, nlh);
+
+	if (ndnat) {
+		/* prerouting for the traffic from outside, output for the
+		 * connections the host opens itself.
+		 */
+		add_chain(&b, "prerouting", "nat", NF_INET_PRE_ROUTING, prio_dstnat);
+		add_chain(&b, "output", "nat", NF_INET_LOCAL_OUT, prio_dstnat);
+		add_chain(&b, "postrouting", "nat", NF_INET_POST_ROUTING, prio_srcnat);
+		for (i = 0; i < n; i++) {
+			if (ports[i].notrack)
+				continue;
+			add_dnat_rule(&b, "prerouting", &addr, &ports[i]);
+			add_dnat_rule(&b, "output", &addr, &ports[i]);
+		}
+		add_masq_rule(&b, "postrouting", &addr, oif);
+	}
+
+	if (nnotrack) {
+		/* The replies come back through prerouting of the host. */
+		add_chain(&b, "raw-prerouting", "filter", NF_INET_PRE_ROUTING, prio_raw);
+		add_chain(&b, "raw-output", "filter", NF_INET_LOCAL_OUT, prio_raw);
+		for (i = 0; i < n; i++) {
+			if (!ports[i].notrack)
+				continue;
+			add_notrack_rule(&b, "raw-prerouting", &addr, &ports[i], 0);
+			add_notrack_rule(&b, "raw-prerouting", &addr, &ports[i], 1);
+			add_notrack_rule(&b, "raw-output", &addr, &ports[i], 0);
+		}
+	}
+
+	sock = create_nft_socket();
+	if (sock < 0)
+		return 4;
+
+	ret = batch_send(sock, &b, 0);
+	close(sock);
+
+	return ret ? 5 : 0;
+}
+
+/* The add_deltable queues deletion of the table of a container. */
+static int add_deltable(struct nft_batch *b, const char *name)
+{
+	char table[nft_max_table];
+	struct nlmsghdr *nlh;
+
+	if (nft_table_name(name, table, nft_max_table))
+		return 1;
+
+	nlh = batch_nft_msg(b, NFT_MSG_DELTABLE, 0);
+	addattr_str(nlh, batch_left(b), NFTA_TABLE_NAME, table);
+	batch_end_msg(b, nlh);
+	return 0;
+}
+
+/* The nft_unpublish deletes the tables of n containers in one transaction.
+ * A missing table (a container without published ports) is not an error,
+ * but it aborts the transaction; then the tables are deleted one by one.
+ * It returns the number of tables which could not be deleted.
+ */
+int nft_unpublish(int sock, const char **names, int n)
+{
+	static struct nft_batch b;
+	int i, ret, failed = 0;
+
+	batch_init(&b);
+	for (i = 0; i < n; i++) {
+		if (add_deltable(&b, names[i]))
+			return n;
+	}
+
+	ret = batch_send(sock, &b, ENOENT);
+	if (ret == 0 || (ret == 4 && n == 1))
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		batch_init(&b);
+		add_deltable(&b, names[i]);
+		ret = batch_send(sock, &b, ENOENT);
+		if (ret && ret != 4)
+			failed++;
+	}
+
+	return failed;
+}
@@ -0,0 +1,24 @@
+#ifndef NFTLIB_SENTRY_H
+#define NFTLIB_SENTRY_H
+
+/* Published ports of a container live in an nf_tables table of their own,
+ * docker-c-<name>, so they are added with one transaction and removed by
+ * deleting the table. Forwarding stays in the kernel: published ports are
+ * DNATed to the container, a notrack port bypasses conntrack for traffic
+ * sent to the container address directly (and is not DNATed).
+ */
+
+enum { nft_max_table = 64 };
+
+struct nft_port {
+	int host_port;
+	int cont_port;
+	int notrack;
+};
+
+int create_nft_socket(void);
+int nft_table_name(const char *name, char *buf, int size);
+int nft_publish(const char *name, const char *cont_ip, const char *oif, const struct nft_port *ports, int n);
+int nft_unpublish(int sock, const char **names, int n);
+
+#endif
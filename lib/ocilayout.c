@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* strncmp */
+#include <unistd.h>				/* read */
+#include <errno.h>				/* ENOTEMPTY */
+#include <fcntl.h>				/* open */
+#include <limits.h>				/* PATH_MAX */
+#include <pthread.h>			/* pthread_create */
+#include <sys/stat.h>			/* fstat */
+#include "ocilayout.h"
+#include "untar.h"
+
+enum { max_json = 4 * 1024 * 1024, max_index_depth = 4 };
+
+static const char ref_annotation[] = "org.opencontainers.image.ref.name";
+
+#if defined(__x86_64__)
+static const char *this_arch = "amd64";
+#elif defined(__aarch64__)
+static const char *this_arch = "arm64";
+#else
+static const char *this_arch = "";
+#endif
+
+/* A few helpers to walk a JSON document in place. A value is a pointer
+ * to its first character, NULL if it is missing or broken.
+ */
+
+static const char *ws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return p;
+}
+
+static const char *skip_string(const char *p)
+{
+	for (p++; *p && *p != '"'; p++) {
+		if (*p == '\\' && !*++p)
+			return NULL;
+	}
+	return *p ? p + 1 : NULL;
+}
+
+static const char *skip_value(const char *p)
+{
+	int depth = 0;
+
+	if (*p == '"')
+		return skip_string(p);
+
+	if (*p == '{' || *p == '[') {
+		while (*p) {
+			if (*p == '"') {
+				p = skip_string(p);
+				if (!p)
+					return NULL;
+				continue;
+			}
+			if (*p == '{' || *p == '[')
+				depth++;
+			else if ((*p == '}' || *p == ']') && --depth == 0)
+				return p + 1;
+			p++;
+		}
+		return NULL;
+	}
+
+	/* number, true, false or null */
+	while (*p && !strchr(",}] \t\r\n", *p))
+		p++;
+	return p;
+}
+
+/* The member returns the value of key in the object obj. */
+static const char *member(const char *obj, const char *key)
+{
+	const char *p, *end, *name;
+	size_t len = strlen(key);
+
+	if (!obj || *obj != '{')
+		return NULL;
+
+	for (p = ws(obj + 1); *p == '"'; p = ws(p + 1)) {
+		name = p + 1;
+		end = skip_string(p);
+		if (!end)
+			return NULL;
+		p = ws(end);
+		if (*p != ':')
+			return NULL;
+		p = ws(p + 1);
+		if ((size_t) (end - 1 - name) == len && !strncmp(name, key, len))
+			return p;
+		p = skip_value(p);
+		if (!p)
+			return NULL;
+		p = ws(p);
+		if (*p != ',')
+			break;
+	}
+
+	return NULL;
+}
+
+/* The element returns the i-th value of the array arr. */
+static const char *element(const char *arr, int i)
+{
+	const char *p;
+
+	if (!arr || *arr != '[')
+		return NULL;
+
+	for (p = ws(arr + 1); *p && *p != ']'; i--) {
+		if (i == 0)
+			return p;
+		p = skip_value(p);
+		if (!p)
+			return NULL;
+		p = ws(p);
+		if (*p == ',')
+			p = ws(p + 1);
+	}
+
+	return NULL;
+}
+
+/* The string copies the string value v (without escapes) to buf. */
+static int string(const char *v, char *buf, size_t size)
+{
+	const char *end;
+
+	if (!v || *v != '"')
+		return 1;
+	end = strchr(v + 1, '"');
+	if (!end || memchr(v + 1, '\\', end - v - 1) || (size_t) (end - v - 1) >= size)
+		return 2;
+	memcpy(buf, v + 1, end - v - 1);
+	buf[end - v - 1] = '\0';
+	return 0;
+}
+
+static int is_string(const char *v, const char *s)
+{
+	char buf[256];
+
+	return string(v, buf, sizeof(buf)) == 0 && !strcmp(buf, s);
+}
+
+/* The read_doc reads a JSON document of the layout. If hex is not NULL,
+ * the document is a blob which must match its digest.
+ */
+static char *read_doc(const char *layout, const char *name, const char *hex)
+{
+	unsigned char digest[sha256_len];
+	char path[PATH_MAX], got[sha256_hex_len + 1];
+	struct sha256_ctx ctx;
+	struct stat st;
+	char *doc;
+	ssize_t n;
+	int fd;
+
+	snprintf(path, PATH_MAX, "%s/%s", layout, name);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	if (st.st_size > max_json) {
+		fprintf(stderr, "%s: too big\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	doc = malloc(st.st_size + 1);
+	if (!doc) {
+		perror("malloc");
+		close(fd);
+		return NULL;
+	}
+	n = read(fd, doc, st.st_size);
+	close(fd);
+	if (n != st.st_size) {
+		perror(path);
+		free(doc);
+		return NULL;
+	}
+	doc[n] = '\0';
+
+	if (hex) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, doc, n);
+		sha256_final(&ctx, digest);
+		sha256_hex(digest, got);
+		if (strcmp(hex, got)) {
+			fprintf(stderr, "%s: digest mismatch\n", path);
+			free(doc);
+			return NULL;
+		}
+	}
+
+	return doc;
+}
+
+/* The parse_digest returns the hex of a sha256:<hex> digest. */
+static int parse_digest(const char *v, char *hex)
+{
+	char buf[8 + sha256_hex_len];
+	int i;
+
+	if (string(v, buf, sizeof(buf)) || strncmp(buf, "sha256:", 7) || strlen(buf + 7) != sha256_hex_len) {
+		fprintf(stderr, "unsupported digest\n");
+		return 1;
+	}
+	for (i = 0; i < sha256_hex_len; i++) {
+		if (!strchr("0123456789abcdef", buf[7 + i])) {
+			fprintf(stderr, "invalid digest %s\n", buf);
+			return 2;
+		}
+	}
+	strcpy(hex, buf + 7);
+	return 0;
+}
+
+/* The pick_manifest returns the descriptor of ref in the index, or the
+ * one of this platform, or the first one.
+ */
+static const char *pick_manifest(const char *index, const char *ref)
+{
+	const char *manifests, *d, *platform;
+	int i;
+
+	manifests = member(index, "manifests");
+	for (i = 0; (d = element(manifests, i)); i++) {
+		if (ref) {
+			if (is_string(member(member(d, "annotations"), ref_annotation), ref))
+				return d;
+			continue;
+		}
+		platform = member(d, "platform");
+		if (!platform || (is_string(member(platform, "os"), "linux") &&
+						  is_string(member(platform, "architecture"), this_arch)))
+			return d;
+	}
+
+	if (ref)
+		fprintf(stderr, "no manifest %s\n", ref);
+	else if (!(d = element(manifests, 0)))
+		fprintf(stderr, "no manifests\n");
+	return ref ? NULL : d;
+}
+
+static int supported_layer(const char *v)
+{
+	char type[256];
+	size_t len;
+
+	if (string(v, type, sizeof(type)))
+		return 0;
+	len = strlen(type);
+	return (len > 4 && !strcmp(type + len - 4, ".tar")) || (len > 9 && !strcmp(type + len - 9, ".tar+gzip")) ||
+		(len > 9 && !strcmp(type + len - 9, ".tar.gzip"));
+}
+
+int oci_read_layers(const char *layout, const char *ref, layer_digest * layers, int max)
+{
+	char name[PATH_MAX], hex[sha256_hex_len + 1];
+	const char *d, *list;
+	char *doc, *next;
+	int i, n = -1, depth;
+
+	doc = read_doc(layout, "index.json", NULL);
+	if (!doc)
+		return -1;
+
+	for (depth = 0; depth < max_index_depth; depth++) {
+		d = pick_manifest(doc, depth ? NULL : ref);
+		if (!d || parse_digest(member(d, "digest"), hex))
+			goto out;
+		snprintf(name, PATH_MAX, "blobs/sha256/%s", hex);
+		next = read_doc(layout, name, hex);
+		free(doc);
+		doc = next;
+		if (!doc)
+			return -1;
+		if (!member(doc, "manifests"))
+			break;
+	}
+
+	list = member(doc, "layers");
+	if (!list) {
+		fprintf(stderr, "no layers in the manifest\n");
+		goto out;
+	}
+	for (i = 0; (d = element(list, i)); i++) {
+		if (i == max) {
+			fprintf(stderr, "too many layers\n");
+			goto out;
+		}
+		if (!supported_layer(member(d, "mediaType"))) {
+			fprintf(stderr, "layer %d: unsupported media type\n", i);
+			goto out;
+		}
+		if (parse_digest(member(d, "digest"), layers[i]))
+			goto out;
+	}
+	n = i;
+
+ out:
+	free(doc);
+	return n;
+}
+
+struct unpack {
+	struct layer_store *s;
+	const char *hex;
+	char tmp[PATH_MAX];
+	char dest[PATH_MAX];
+	struct untar_opts o;
+	pthread_t thread;
+	int run;
+	int ret;
+};
+
+/* The unpack_layer unpacks a layer next to its place and renames it into
+ * place, so a layer directory is complete if it exists.
+ */
+static void *unpack_layer(void *arg)
+{
+	struct unpack *u = arg;
+	char blob[PATH_MAX], path[PATH_MAX];
+	int fd;
+
+	store_blob_path(u->s, u->hex, blob, PATH_MAX);
+	snprintf(path, PATH_MAX, "%s/%s", u->s->root, blob);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		perror(path);
+		u->ret = 1;
+		return NULL;
+	}
+	if (untar(fd, u->tmp, &u->o)) {
+		fprintf(stderr, "layer %s is broken\n", u->hex);
+		u->ret = 2;
+	}
+	close(fd);
+
+	/* Another import may have won, its layer is the same. The loser is
+	 * left to the collector.
+	 */
+	if (!u->ret && rename(u->tmp, u->dest) && errno != ENOTEMPTY && errno != EEXIST) {
+		perror(u->dest);
+		u->ret = 3;
+	}
+	return NULL;
+}
+
+int oci_unpack(struct layer_store *s, layer_digest * layers, int n, uid_t id_shift)
+{
+	static struct unpack us[store_max_layers];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, k, nrun = 0, ret = 0;
+
+	for (i = 0; i < n && i < store_max_layers; i++) {
+		us[i].run = 0;
+		if (store_layer_path(s, layers[i], us[i].dest, PATH_MAX) || access(us[i].dest, F_OK) == 0)
+			continue;
+		for (k = 0; k < i && strcmp(layers[k], layers[i]); k++);
+		if (k < i)
+			continue;
+		us[i].run = 1;
+		nrun++;
+	}
+
+	for (i = 0; i < n && i < store_max_layers; i++) {
+		if (!us[i].run)
+			continue;
+		us[i].ret = 0;
+		us[i].s = s;
+		us[i].hex = layers[i];
+		snprintf(us[i].tmp, PATH_MAX, "%s/layers/.%s.%d", s->root, layers[i], getpid());
+		memset(&us[i].o, 0, sizeof(us[i].o));
+		/* The CPUs are shared by the layers, every layer has a reader. */
+		us[i].o.workers = cpus > nrun ? cpus / nrun : 0;
+		us[i].o.uid_shift = id_shift;
+		us[i].o.gid_shift = id_shift;
+		us[i].o.whiteouts = 1;
+		if (pthread_create(&us[i].thread, NULL, unpack_layer, &us[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			us[i].run = 0;
+			ret = 1;
+		}
+	}
+
+	for (i = 0; i < n && i < store_max_layers; i++) {
+		if (!us[i].run)
+			continue;
+		pthread_join(us[i].thread, NULL);
+		if (us[i].ret)
+			ret = 2;
+	}
+
+	return ret;
+}
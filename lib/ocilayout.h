@@ -0,0 +1,29 @@
+#ifndef OCILAYOUT_SENTRY_H
+#define OCILAYOUT_SENTRY_H
+
+#include <sys/types.h>
+#include "layerstore.h"
+
+/* An OCI image layout is a directory standing in for a registry:
+ *
+ *   <layout>/index.json        descriptors of the manifests (or indexes)
+ *   <layout>/blobs/sha256/<hex> manifests, configs and layers
+ *
+ * The oci_read_layers finds the manifest tagged ref (the annotation
+ * org.opencontainers.image.ref.name) or, with ref NULL, the first one;
+ * an image index is followed to the manifest of this platform. Manifests
+ * are checked against their digests. The layers (tar or tar+gzip) are
+ * returned bottom first.
+ *
+ * The oci_unpack unpacks layers of the store, which are not unpacked yet,
+ * each to its own directory, all of them at once: an image is unpacked in
+ * the time of its largest layer. Whiteouts are converted for overlayfs and
+ * owners shifted by id_shift, so the directories make the lower directory
+ * stack of a container (see create_container -i, which idmaps the layers
+ * and needs no shift).
+ */
+
+int oci_read_layers(const char *layout, const char *ref, layer_digest * layers, int max);
+int oci_unpack(struct layer_store *s, layer_digest * layers, int n, uid_t id_shift);
+
+#endif
@@ -0,0 +1,477 @@
+#define _GNU_SOURCE				/* splice, setns */
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* memset */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* EAGAIN */
+#include <fcntl.h>				/* splice */
+#include <sched.h>				/* setns */
+#include <signal.h>				/* sigwaitinfo */
+#include <sys/types.h>
+#include <sys/wait.h>			/* waitpid */
+#include <sys/socket.h>			/* socket */
+#include <sys/epoll.h>			/* epoll_create1 */
+#include <sys/prctl.h>			/* PR_SET_PDEATHSIG */
+#include <netinet/in.h>			/* sockaddr_in */
+#include <arpa/inet.h>			/* inet_pton */
+#include "portproxy.h"
+
+enum { proxy_chunk = 64 * 1024, proxy_pipe_size = 256 * 1024, proxy_max_events = 64, proxy_backlog = 512 };
+
+enum { ep_listener = 1, ep_end = 2 };
+
+struct proxy_listener {
+	int type;					/* ep_listener */
+	int fd;
+	struct sockaddr_in target;
+};
+
+struct proxy_conn;
+
+/* The epoll data of a socket of a connection. */
+struct proxy_end {
+	int type;					/* ep_end */
+	int fd;
+	struct proxy_conn *conn;
+};
+
+/* One direction of a connection: from src to dst through a pipe (or buf
+ * in the copy mode). pending bytes are in the pipe, not yet sent.
+ */
+struct proxy_half {
+	int src;
+	int dst;
+	int pipe[2];
+	char *buf;
+	int pending;
+	int off;
+	int eof;
+	int shut;
+};
+
+struct proxy_conn {
+	struct proxy_end end[2];	/* client, container */
+	struct proxy_half half[2];	/* to the container, to the client */
+	int connecting;
+	int dead;
+	struct proxy_conn *next;	/* in the list of dead connections */
+};
+
+struct proxy_worker {
+	int epfd;
+	int copy;
+	struct proxy_conn *dead;
+};
+
+static int make_addr(struct sockaddr_in *sa, const char *addr, int port)
+{
+	memset(sa, 0, sizeof(*sa));
+	sa->sin_family = AF_INET;
+	sa->sin_port = htons(port);
+	if (!addr)
+		return 0;
+	if (inet_pton(AF_INET, addr, &sa->sin_addr) != 1) {
+		fprintf(stderr, "bad address %s\n", addr);
+		return 1;
+	}
+	return 0;
+}
+
+/* The open_listener opens one of the SO_REUSEPORT listeners of a port,
+ * the kernel spreads new connections among them.
+ */
+static int open_listener(const char *addr, int port)
+{
+	struct sockaddr_in sa;
+	int fd, on = 1;
+
+	if (make_addr(&sa, addr, port))
+		return -1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+		perror("setsockopt");
+		close(fd);
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) || listen(fd, proxy_backlog)) {
+		perror("bind proxy port");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void free_conn(struct proxy_conn *c)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (c->half[i].pipe[0] >= 0) {
+			close(c->half[i].pipe[0]);
+			close(c->half[i].pipe[1]);
+		}
+		free(c->half[i].buf);
+	}
+	free(c);
+}
+
+/* The kill_conn closes the sockets (it removes them from epoll too), the
+ * memory is freed after the current batch of events.
+ */
+static void kill_conn(struct proxy_worker *w, struct proxy_conn *c)
+{
+	if (c->dead)
+		return;
+	c->dead = 1;
+	if (c->end[0].fd >= 0)
+		close(c->end[0].fd);
+	if (c->end[1].fd >= 0)
+		close(c->end[1].fd);
+	c->next = w->dead;
+	w->dead = c;
+}
+
+static int init_half(struct proxy_half *h, int src, int dst, int copy)
+{
+	h->src = src;
+	h->dst = dst;
+	h->pipe[0] = h->pipe[1] = -1;
+	h->buf = NULL;
+
+	if (copy) {
+		h->buf = malloc(proxy_chunk);
+		if (!h->buf) {
+			perror("malloc");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (pipe2(h->pipe, O_NONBLOCK | O_CLOEXEC)) {
+		perror("pipe2");
+		return 2;
+	}
+	/* A larger pipe means fewer splice calls, the default size is fine
+	 * if it can't be changed.
+	 */
+	fcntl(h->pipe[1], F_SETPIPE_SZ, proxy_pipe_size);
+	return 0;
+}
+
+/* The pump_half moves data from src to dst until either of them would
+ * block. At the end of src the write side of dst is shut down once all
+ * pending data are sent. It returns -1 if the connection is broken.
+ */
+static int pump_half(struct proxy_half *h, int copy)
+{
+	int n;
+
+	for (;;) {
+		while (h->pending) {
+			if (copy)
+				n = write(h->dst, h->buf + h->off, h->pending);
+			else
+				n = splice(h->pipe[0], NULL, h->dst, NULL, h->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0)
+				return errno == EAGAIN || errno == EINTR ? 0 : -1;
+			h->pending -= n;
+			h->off += n;
+		}
+
+		if (h->eof) {
+			if (!h->shut) {
+				shutdown(h->dst, SHUT_WR);
+				h->shut = 1;
+			}
+			return 0;
+		}
+
+		if (copy)
+			n = read(h->src, h->buf, proxy_chunk);
+		else
+			n = splice(h->src, NULL, h->pipe[1], NULL, proxy_pipe_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		if (n == 0)
+			h->eof = 1;
+		h->pending = n;
+		h->off = 0;
+	}
+}
+
+static int add_end(struct proxy_worker *w, struct proxy_end *e)
+{
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = e;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, e->fd, &ev)) {
+		perror("epoll_ctl");
+		return 1;
+	}
+	return 0;
+}
+
+/* The accept_conn accepts a client and starts connecting to the target
+ * in the container. The container side is served once it is connected.
+ */
+static void accept_conn(struct proxy_worker *w, struct proxy_listener *l)
+{
+	struct proxy_conn *c;
+	int fd, i;
+
+	while ((fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		c = calloc(1, sizeof(*c));
+		if (!c) {
+			perror("calloc");
+			close(fd);
+			continue;
+		}
+		c->end[0].type = c->end[1].type = ep_end;
+		c->end[0].conn = c->end[1].conn = c;
+		c->end[0].fd = fd;
+		c->half[0].pipe[0] = c->half[1].pipe[0] = -1;
+
+		c->end[1].fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (c->end[1].fd < 0) {
+			perror("socket");
+			kill_conn(w, c);
+			continue;
+		}
+
+		for (i = 0; i < 2; i++) {
+			if (init_half(&c->half[i], c->end[i].fd, c->end[1 - i].fd, w->copy))
+				break;
+		}
+		if (i < 2) {
+			kill_conn(w, c);
+			continue;
+		}
+
+		if (connect(c->end[1].fd, (struct sockaddr *) &l->target, sizeof(l->target)) && errno != EINPROGRESS) {
+			perror("connect");
+			kill_conn(w, c);
+			continue;
+		}
+		c->connecting = 1;
+
+		if (add_end(w, &c->end[0]) || add_end(w, &c->end[1]))
+			kill_conn(w, c);
+	}
+
+	if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+		perror("accept4");
+}
+
+static void serve_conn(struct proxy_worker *w, struct proxy_end *e, int events)
+{
+	struct proxy_conn *c = e->conn;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (c->dead)
+		return;
+
+	/* The client may send data before the container side is ready,
+	 * it is read when the connect completes (edge triggered, so the
+	 * readiness of the client is not lost).
+	 */
+	if (c->connecting) {
+		if (e != &c->end[1] || !(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+			return;
+		if (getsockopt(e->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+			kill_conn(w, c);
+			return;
+		}
+		c->connecting = 0;
+	}
+
+	if (pump_half(&c->half[0], w->copy) || pump_half(&c->half[1], w->copy)) {
+		kill_conn(w, c);
+		return;
+	}
+
+	if (c->half[0].shut && c->half[1].shut)
+		kill_conn(w, c);
+}
+
+static void worker(int netns, int copy, struct proxy_listener *ls, int n)
+{
+	static struct epoll_event evs[proxy_max_events];
+	struct proxy_worker w;
+	struct proxy_conn *c;
+	struct epoll_event ev;
+	int i, nev;
+
+	w.copy = copy;
+	w.dead = NULL;
+	w.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (w.epfd < 0) {
+		perror("epoll_create1");
+		_exit(1);
+	}
+
+	for (i = 0; i < n; i++) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = &ls[i];
+		if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, ls[i].fd, &ev)) {
+			perror("epoll_ctl");
+			_exit(2);
+		}
+	}
+
+	/* The listeners stay in the host namespace, the sockets created
+	 * from now on belong to the container.
+	 */
+	if (netns >= 0 && setns(netns, CLONE_NEWNET)) {
+		perror("setns");
+		_exit(3);
+	}
+
+	for (;;) {
+		nev = epoll_wait(w.epfd, evs, proxy_max_events, -1);
+		if (nev < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			_exit(4);
+		}
+
+		for (i = 0; i < nev; i++) {
+			if (*(int *) evs[i].data.ptr == ep_listener)
+				accept_conn(&w, evs[i].data.ptr);
+			else
+				serve_conn(&w, evs[i].data.ptr, evs[i].events);
+		}
+
+		while (w.dead) {
+			c = w.dead;
+			w.dead = c->next;
+			free_conn(c);
+		}
+	}
+}
+
+/* The master runs the workers and kills them when it is told to stop,
+ * so the launcher has one process to deal with. The workers are reaped
+ * before it exits, their CPU time is counted in its rusage.
+ */
+static void master(const struct proxy_conf *conf, struct proxy_listener *ls, int nworkers)
+{
+	int pids[proxy_max_workers];
+	siginfo_t si;
+	sigset_t mask;
+	int i, j, alive = 0;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	for (i = 0; i < nworkers; i++) {
+		pids[i] = fork();
+		if (pids[i] == -1) {
+			perror("fork proxy worker");
+			break;
+		}
+		if (pids[i] == 0) {
+			sigprocmask(SIG_UNBLOCK, &mask, NULL);
+			prctl(PR_SET_PDEATHSIG, SIGKILL);
+			/* Every worker keeps only its own listeners. */
+			for (j = 0; j < nworkers * conf->nports; j++) {
+				if (j / conf->nports != i)
+					close(ls[j].fd);
+			}
+			worker(conf->netns, conf->copy, ls + i * conf->nports, conf->nports);
+		}
+		alive++;
+	}
+
+	for (j = 0; j < nworkers * conf->nports; j++)
+		close(ls[j].fd);
+
+	while (alive > 0) {
+		if (sigwaitinfo(&mask, &si) < 0)
+			continue;
+		if (si.si_signo != SIGCHLD) {
+			for (j = 0; j < i; j++)
+				kill(pids[j], SIGKILL);
+		}
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			alive--;
+	}
+
+	_exit(0);
+}
+
+/* The proxy_start opens the listeners of all workers and forks the
+ * proxy. It returns the pid of the proxy (see proxy_stop) or -1.
+ */
+int proxy_start(const struct proxy_conf *conf)
+{
+	struct proxy_listener *ls;
+	int i, j, n, pid, nworkers = conf->workers;
+
+	if (nworkers <= 0)
+		nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nworkers <= 0)
+		nworkers = 1;
+	if (nworkers > proxy_max_workers)
+		nworkers = proxy_max_workers;
+
+	if (conf->nports > proxy_max_ports) {
+		fprintf(stderr, "too many proxy ports\n");
+		return -1;
+	}
+
+	n = nworkers * conf->nports;
+	ls = calloc(n, sizeof(*ls));
+	if (!ls) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		const struct proxy_port *p = &conf->ports[i % conf->nports];
+
+		ls[i].type = ep_listener;
+		ls[i].fd = -1;
+		if (make_addr(&ls[i].target, p->addr, p->port))
+			break;
+		ls[i].fd = open_listener(conf->bind_addr, p->host_port);
+		if (ls[i].fd < 0)
+			break;
+	}
+
+	pid = -1;
+	if (i == n) {
+		pid = fork();
+		if (pid == -1)
+			perror("fork proxy");
+		if (pid == 0)
+			master(conf, ls, nworkers);
+	}
+
+	for (j = 0; j < i; j++)
+		close(ls[j].fd);
+	free(ls);
+
+	return pid;
+}
+
+/* The proxy_stop stops the proxy and its workers. */
+void proxy_stop(int pid)
+{
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
@@ -0,0 +1,32 @@
+#ifndef PORTPROXY_SENTRY_H
+#define PORTPROXY_SENTRY_H
+
+/* A userspace TCP forwarder from host ports into the network namespace of
+ * a container, for setups where the host firewall can't be programmed.
+ * Listening sockets are created in the host namespace, then every worker
+ * joins the container namespace with setns(2), so the sockets it connects
+ * are created there. Data is moved with splice(2) through a pipe per
+ * direction, a worker serves its own SO_REUSEPORT listeners with epoll.
+ */
+
+enum { proxy_max_workers = 64, proxy_max_ports = 16 };
+
+struct proxy_port {
+	int host_port;
+	const char *addr;			/* in the container, usually 127.0.0.1 */
+	int port;
+};
+
+struct proxy_conf {
+	int netns;					/* ns/net of the container, -1 - stay */
+	int workers;				/* 0 - one per online CPU */
+	int copy;					/* read/write instead of splice */
+	const char *bind_addr;		/* NULL - any */
+	const struct proxy_port *ports;
+	int nports;
+};
+
+int proxy_start(const struct proxy_conf *conf);
+void proxy_stop(int pid);
+
+#endif
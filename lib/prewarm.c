@@ -0,0 +1,257 @@
+#define _GNU_SOURCE				/* readahead, O_NOATIME */
+#include <stdio.h>				/* fopen */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* strlen */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* ENOENT */
+#include <fcntl.h>				/* readahead */
+#include <limits.h>				/* PATH_MAX */
+#include <signal.h>				/* signal */
+#include <ftw.h>				/* nftw */
+#include <time.h>				/* clock_gettime */
+#include <sys/mman.h>			/* mincore */
+#include <sys/stat.h>			/* fstat */
+#include "prewarm.h"
+
+enum { walk_fds = 64 };
+
+/* The state of a walk of the image, nftw(3) passes no argument. */
+static FILE *walk_out;			/* the profile, NULL - evict */
+static size_t walk_root_len;
+static long walk_files, walk_pages;
+static long page_size;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The open_file opens a file of the image without changing its atime,
+ * which needs to own it (or CAP_FOWNER).
+ */
+static int open_file(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOATIME | O_CLOEXEC);
+	if (fd < 0 && errno == EPERM)
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+	return fd;
+}
+
+/* The visit drops the cached pages of a file, or writes its cached ranges
+ * to the profile.
+ */
+static int visit(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	unsigned char *vec;
+	long i, n, start;
+	void *map;
+	int fd, cached = 0;
+
+	if (flag != FTW_F || !S_ISREG(st->st_mode) || st->st_size == 0 || strchr(path, '\n'))
+		return 0;
+
+	fd = open_file(path);
+	if (fd < 0)
+		return 0;
+	if (!walk_out) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+
+	n = (st->st_size + page_size - 1) / page_size;
+	vec = malloc(n);
+	if (vec && mincore(map, st->st_size, vec) == 0) {
+		for (i = 0; i < n;) {
+			if (!(vec[i] & 1)) {
+				i++;
+				continue;
+			}
+			for (start = i; i < n && (vec[i] & 1); i++);
+			fprintf(walk_out, "%ld %ld %s\n", start, i - start, path + walk_root_len);
+			walk_pages += i - start;
+			cached = 1;
+		}
+	}
+	walk_files += cached;
+
+	free(vec);
+	munmap(map, st->st_size);
+	return 0;
+}
+
+/* The walk visits every file of the image. */
+static int walk(const char *root, const char *layers)
+{
+	char path[PATH_MAX];
+	const char *p, *end;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	walk_root_len = strlen(root) + 1;
+	if (!layers)
+		return nftw(root, visit, walk_fds, FTW_PHYS);
+
+	for (p = layers; *p; p = *end ? end + 1 : end) {
+		end = strchr(p, ':');
+		if (!end)
+			end = p + strlen(p);
+		snprintf(path, PATH_MAX, "%s/%.*s", root, (int) (end - p), p);
+		if (nftw(path, visit, walk_fds, FTW_PHYS))
+			return 1;
+	}
+	return 0;
+}
+
+/* The prewarm_evict drops the cached pages of the image before a profile
+ * is recorded.
+ */
+int prewarm_evict(const char *root, const char *layers)
+{
+	walk_out = NULL;
+	if (walk(root, layers)) {
+		perror(root);
+		return 1;
+	}
+	return 0;
+}
+
+/* The prewarm_record_start forks a process which writes the profile delay
+ * seconds later. It returns its pid or -1.
+ */
+int prewarm_record_start(const char *root, const char *layers, const char *profile, int delay)
+{
+	char tmp[PATH_MAX];
+	int pid;
+
+	pid = fork();
+	if (pid == -1)
+		perror("fork prewarm");
+	if (pid != 0)
+		return pid;
+
+	signal(SIGINT, SIG_IGN);
+	sleep(delay);
+
+	snprintf(tmp, PATH_MAX, "%s.tmp", profile);
+	walk_out = fopen(tmp, "w");
+	if (!walk_out) {
+		perror(tmp);
+		_exit(1);
+	}
+	if (walk(root, layers) || fclose(walk_out) || rename(tmp, profile)) {
+		perror(profile);
+		_exit(2);
+	}
+
+	fprintf(stderr, "prewarm: recorded %ld files, %ld pages\n", walk_files, walk_pages);
+	_exit(0);
+}
+
+/* The replay reads the ranges of the profile ahead. */
+static void replay(FILE *in, const char *root)
+{
+	char line[PATH_MAX + 64], path[PATH_MAX], last[PATH_MAX] = "";
+	unsigned char *vec = NULL;
+	long start, count, i, hit, files = 0, pages = 0, cached = 0, fpages = 0;
+	struct stat st;
+	void *map = MAP_FAILED;
+	double t, cold = 0;
+	int fd = -1, off, len;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	while (fgets(line, sizeof(line), in)) {
+		len = strlen(line);
+		if (len == 0 || line[len - 1] != '\n' || sscanf(line, "%ld %ld %n", &start, &count, &off) != 2)
+			continue;
+		line[len - 1] = '\0';
+
+		if (strcmp(line + off, last)) {
+			if (map != MAP_FAILED)
+				munmap(map, st.st_size);
+			if (fd >= 0)
+				close(fd);
+			free(vec);
+			map = MAP_FAILED;
+			vec = NULL;
+			strcpy(last, line + off);
+			snprintf(path, PATH_MAX, "%s/%s", root, last);
+			fd = open_file(path);
+			if (fd < 0 || fstat(fd, &st) || st.st_size == 0)
+				continue;
+			fpages = (st.st_size + page_size - 1) / page_size;
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			vec = malloc(fpages);
+			if (map != MAP_FAILED && vec && mincore(map, st.st_size, vec))
+				memset(vec, 0, fpages);
+			files++;
+		}
+		if (fd < 0 || map == MAP_FAILED || !vec || start >= fpages)
+			continue;
+
+		if (count > fpages - start)
+			count = fpages - start;
+		for (hit = 0, i = start; i < start + count; i++)
+			hit += vec[i] & 1;
+		cached += hit;
+		pages += count;
+		if (hit == count)
+			continue;
+
+		/* The container would have waited for these pages itself;
+		 * readahead(2) only starts the reads, touching waits for them.
+		 */
+		t = now();
+		readahead(fd, (off_t) start * page_size, (size_t) count * page_size);
+		for (i = start; i < start + count; i++)
+			(void) ((volatile unsigned char *) map)[i * page_size];
+		cold += now() - t;
+	}
+
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	if (fd >= 0)
+		close(fd);
+	free(vec);
+
+	fprintf(stderr, "prewarm: %ld files, %ld pages, %ld%% cached, %ld read ahead: up to %.1f ms saved\n",
+			files, pages, pages ? cached * 100 / pages : 0, pages - cached, cold * 1000);
+}
+
+/* The prewarm_start forks the replayer of the profile if there is one. It
+ * returns the pid, 0 - no profile yet, or -1.
+ */
+int prewarm_start(const char *root, const char *profile)
+{
+	FILE *in;
+	int pid;
+
+	in = fopen(profile, "re");
+	if (!in && errno == ENOENT)
+		return 0;
+	if (!in) {
+		perror(profile);
+		return -1;
+	}
+
+	pid = fork();
+	if (pid == -1)
+		perror("fork prewarm");
+	if (pid != 0) {
+		fclose(in);
+		return pid;
+	}
+
+	signal(SIGINT, SIG_IGN);
+	replay(in, root);
+	_exit(0);
+}
@@ -0,0 +1,32 @@
+#ifndef PREWARM_SENTRY_H
+#define PREWARM_SENTRY_H
+
+/* A cold container waits for its first binaries, libraries and configs to
+ * be read from the disk. The prewarmer reads them ahead instead, while
+ * the launcher is still setting the container up.
+ *
+ * A profile is the list of the page ranges of the image files which a
+ * container had in the page cache some seconds after its start:
+ *
+ *   <first page> <pages> <path relative to the root>
+ *
+ * It is recorded by sampling mincore(2) of every file of the image. The
+ * layers of the store are shared by every container of the image, so
+ * their pages are dropped from the cache first (POSIX_FADV_DONTNEED, clean
+ * pages only) only on request; otherwise the profile also holds what was
+ * cached before the container started. The image is root, or the layers
+ * (separated by ':') under root.
+ *
+ * The replayer counts the pages of the profile already cached and issues
+ * readahead(2) for the ranges with pages missing. The time those reads
+ * take is what the container would have waited for them on a cold start,
+ * the latency saved at most; it is reported with the hit rate.
+ */
+
+enum { prewarm_window = 5 };	/* seconds from the start to the sample */
+
+int prewarm_evict(const char *root, const char *layers);
+int prewarm_record_start(const char *root, const char *layers, const char *profile, int delay);
+int prewarm_start(const char *root, const char *profile);
+
+#endif
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE				/* pread */
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* strtoull */
+#include <string.h>				/* strncmp */
+#include <unistd.h>				/* pread */
+#include <errno.h>				/* EINTR */
+#include <fcntl.h>				/* open */
+#include <stdint.h>				/* uint64_t */
+#include <sys/epoll.h>			/* epoll_wait */
+#include "cgrouplib.h"
+#include "psimon.h"
+
+enum { max_events = 16, file_buf = 512, unpriv_window_us = 2000000 };
+
+static const char *files[psi_nfiles] = {
+	"cpu.pressure", "memory.pressure", "io.pressure", "memory.events", "cgroup.events"
+};
+
+static const char *kind_names[] = { "cpu", "memory", "io", "oom", "oom_kill", "exit" };
+
+const char *psi_kind_name(enum psi_kind kind)
+{
+	return kind_names[kind];
+}
+
+int psi_init(struct psi_monitor *m)
+{
+	m->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (m->epfd < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
+	m->n = 0;
+	m->live = 0;
+	return 0;
+}
+
+/* The read_file reads a cgroup file again; kernfs reports a change of the
+ * file only once it has been read since the last one.
+ */
+static int read_file(int fd, char *buf, int size)
+{
+	ssize_t n;
+
+	n = pread(fd, buf, size - 1, 0);
+	if (n < 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+/* The counter returns the value of the "key value" line of a flat keyed
+ * cgroup file.
+ */
+static unsigned long long counter(const char *buf, const char *key)
+{
+	size_t len = strlen(key);
+	const char *p = buf;
+
+	while (p) {
+		if (!strncmp(p, key, len) && p[len] == ' ')
+			return strtoull(p + len + 1, NULL, 10);
+		p = strchr(p, '\n');
+		if (p)
+			p++;
+	}
+	return 0;
+}
+
+/* The set_trigger arms a PSI trigger. Without CAP_SYS_RESOURCE the window
+ * must be a multiple of 2 s: then the window is rounded up and the stall
+ * scaled with it.
+ */
+static int set_trigger(int fd, int stall_us, int window_us)
+{
+	char trigger[64];
+	int len, win;
+
+	len = snprintf(trigger, sizeof(trigger), "some %d %d", stall_us, window_us);
+	if (write(fd, trigger, len + 1) >= 0)
+		return 0;
+	if (errno != EINVAL || window_us % unpriv_window_us == 0)
+		return -1;
+
+	win = (window_us / unpriv_window_us + 1) * unpriv_window_us;
+	len = snprintf(trigger, sizeof(trigger), "some %lld %d", (long long) stall_us * win / window_us, win);
+	return write(fd, trigger, len + 1) < 0 ? -1 : 0;
+}
+
+static void close_container(struct psi_container *c)
+{
+	int i;
+
+	for (i = 0; i < psi_nfiles; i++) {
+		if (c->fds[i] >= 0)
+			close(c->fds[i]);
+		c->fds[i] = -1;
+	}
+}
+
+/* The psi_add starts watching the cgroup of the container name. */
+int psi_add(struct psi_monitor *m, const char *name, int stall_us, int window_us)
+{
+	char path[cgroup_max_path], buf[file_buf];
+	struct psi_container *c;
+	struct epoll_event ev;
+	int i;
+
+	if (m->n == psi_max_containers) {
+		fprintf(stderr, "too many containers to watch\n");
+		return 1;
+	}
+
+	c = &m->ct[m->n];
+	snprintf(c->name, psi_name_len, "%s", name);
+	c->oom = c->oom_kill = 0;
+	for (i = 0; i < psi_nfiles; i++)
+		c->fds[i] = -1;
+
+	for (i = 0; i < psi_nfiles; i++) {
+		if (cgroup_path(name, files[i], path, cgroup_max_path))
+			goto err;
+		c->fds[i] = open(path, (i <= psi_io ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+		if (c->fds[i] < 0 && errno == ENOENT && i != psi_cgroup_events)
+			continue;
+		if (c->fds[i] < 0) {
+			perror(path);
+			goto err;
+		}
+
+		/* A trigger lives as long as its descriptor. */
+		if (i <= psi_io && set_trigger(c->fds[i], stall_us, window_us)) {
+			perror(path);
+			goto err;
+		}
+		if (i > psi_io && read_file(c->fds[i], buf, file_buf))
+			buf[0] = '\0';
+		if (i == psi_oom_events) {
+			c->oom = counter(buf, "oom");
+			c->oom_kill = counter(buf, "oom_kill");
+		}
+		if (i == psi_cgroup_events && counter(buf, "populated") == 0) {
+			fprintf(stderr, "cgroup %s is empty\n", name);
+			goto err;
+		}
+
+		ev.events = EPOLLPRI;
+		ev.data.u64 = (uint64_t) m->n << 8 | i;
+		if (epoll_ctl(m->epfd, EPOLL_CTL_ADD, c->fds[i], &ev)) {
+			perror("epoll_ctl");
+			goto err;
+		}
+	}
+
+	m->n++;
+	m->live++;
+	return 0;
+
+ err:
+	close_container(c);
+	return 2;
+}
+
+static void drop(struct psi_monitor *m, struct psi_container *c, psi_handler h, void *arg)
+{
+	struct psi_event e;
+
+	close_container(c);
+	m->live--;
+
+	e.name = c->name;
+	e.kind = psi_ev_exit;
+	e.pressure = NULL;
+	e.count = 0;
+	h(&e, arg);
+}
+
+/* The psi_run passes the events to h until every container is gone. */
+int psi_run(struct psi_monitor *m, psi_handler h, void *arg)
+{
+	struct epoll_event evs[max_events];
+	char buf[file_buf];
+	struct psi_container *c;
+	struct psi_event e;
+	unsigned long long v;
+	int i, n, f;
+
+	while (m->live > 0) {
+		n = epoll_wait(m->epfd, evs, max_events, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("epoll_wait");
+			return 1;
+		}
+
+		for (i = 0; i < n; i++) {
+			c = &m->ct[evs[i].data.u64 >> 8];
+			f = evs[i].data.u64 & 0xff;
+			if (c->fds[f] < 0)
+				continue;
+
+			/* The cgroup is gone. */
+			if ((evs[i].events & EPOLLERR) || read_file(c->fds[f], buf, file_buf)) {
+				drop(m, c, h, arg);
+				continue;
+			}
+
+			e.name = c->name;
+			e.pressure = NULL;
+			e.count = 0;
+			switch (f) {
+			case psi_cpu:
+			case psi_memory:
+			case psi_io:
+				e.kind = psi_ev_cpu + f - psi_cpu;
+				e.pressure = buf;
+				h(&e, arg);
+				break;
+			case psi_oom_events:
+				v = counter(buf, "oom");
+				if (v > c->oom) {
+					e.kind = psi_ev_oom;
+					e.count = c->oom = v;
+					h(&e, arg);
+				}
+				v = counter(buf, "oom_kill");
+				if (v > c->oom_kill) {
+					e.kind = psi_ev_oom_kill;
+					e.count = c->oom_kill = v;
+					h(&e, arg);
+				}
+				break;
+			case psi_cgroup_events:
+				if (counter(buf, "populated") == 0)
+					drop(m, c, h, arg);
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void psi_close(struct psi_monitor *m)
+{
+	int i;
+
+	for (i = 0; i < m->n; i++)
+		close_container(&m->ct[i]);
+	close(m->epfd);
+}
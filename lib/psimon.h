@@ -0,0 +1,57 @@
+#ifndef PSIMON_SENTRY_H
+#define PSIMON_SENTRY_H
+
+/* The pressure monitor watches the cgroups of containers in one epoll(7)
+ * loop and sleeps until something happens:
+ *
+ * - a PSI trigger on cpu.pressure, memory.pressure and io.pressure fires
+ *   (POLLPRI) when tasks of the cgroup stalled for more than stall_us
+ *   within window_us ("some" - at least one task stalled); unprivileged
+ *   (no CAP_SYS_RESOURCE) windows are stretched to a multiple of 2 s;
+ * - memory.events is modified (POLLPRI) and its oom or oom_kill counter
+ *   has grown;
+ * - cgroup.events says the cgroup is empty, or the cgroup is removed
+ *   (POLLERR); the container is dropped then. The psi_add refuses a
+ *   cgroup which is empty already.
+ *
+ * Every event is passed to a handler, which may act on it (raise
+ * memory.high, say). The files missing on a host (memory.events without
+ * the memory controller, pressure files without CONFIG_PSI) are skipped.
+ */
+
+enum { psi_max_containers = 64, psi_name_len = 64 };
+
+enum { psi_cpu, psi_memory, psi_io, psi_oom_events, psi_cgroup_events, psi_nfiles };
+
+enum psi_kind { psi_ev_cpu, psi_ev_memory, psi_ev_io, psi_ev_oom, psi_ev_oom_kill, psi_ev_exit };
+
+struct psi_event {
+	const char *name;			/* of the container */
+	enum psi_kind kind;
+	const char *pressure;		/* the pressure file, for the PSI kinds */
+	unsigned long long count;	/* the counter, for the oom kinds */
+};
+
+typedef void (*psi_handler) (const struct psi_event * e, void *arg);
+
+struct psi_container {
+	char name[psi_name_len];
+	int fds[psi_nfiles];
+	unsigned long long oom;
+	unsigned long long oom_kill;
+};
+
+struct psi_monitor {
+	int epfd;
+	struct psi_container ct[psi_max_containers];
+	int n;
+	int live;
+};
+
+const char *psi_kind_name(enum psi_kind kind);
+int psi_init(struct psi_monitor *m);
+int psi_add(struct psi_monitor *m, const char *name, int stall_us, int window_us);
+int psi_run(struct psi_monitor *m, psi_handler h, void *arg);
+void psi_close(struct psi_monitor *m);
+
+#endif
@@ -0,0 +1,548 @@
+#define _GNU_SOURCE				/* strtoull */
+#include <stdio.h>				/* fopen */
+#include <stdlib.h>				/* qsort */
+#include <string.h>				/* strcmp */
+#include <errno.h>				/* EPERM */
+#include <stddef.h>				/* offsetof */
+#include <sys/prctl.h>			/* PR_SET_NO_NEW_PRIVS */
+#include <sys/syscall.h>		/* __NR_read */
+#include <linux/seccomp.h>		/* SECCOMP_RET_ALLOW */
+#include <linux/audit.h>		/* AUDIT_ARCH_X86_64 */
+#include "seccomplib.h"
+
+#if defined(__x86_64__)
+#define SC_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define SC_ARCH AUDIT_ARCH_AARCH64
+#else
+#error "seccomp: unknown architecture"
+#endif
+
+/* x32 syscalls have the same arch as x86_64 and this bit in nr. */
+#define X32_SYSCALL_BIT 0x40000000
+
+enum { max_line = 512, leaf_size = 3, max_jump = 255, max_actions = 16 };
+
+struct sc_name {
+	const char *name;
+	int nr;
+};
+
+/* The rules of one syscall: the label of their code or -1 if the syscall
+ * goes straight to action.
+ */
+struct sc_group {
+	int nr;
+	int label;
+	uint32_t action;
+};
+
+#define SC(name) { #name, __NR_##name }
+
+/* Names are known for x86_64 only, other architectures use numbers. */
+static const struct sc_name names[] = {
+#if defined(__x86_64__)
+	SC(read), SC(write), SC(open), SC(close), SC(stat), SC(fstat), SC(lstat), SC(poll), SC(lseek),
+	SC(mmap), SC(mprotect), SC(munmap), SC(brk), SC(rt_sigaction), SC(rt_sigprocmask),
+	SC(rt_sigreturn), SC(ioctl), SC(pread64), SC(pwrite64), SC(readv), SC(writev), SC(access),
+	SC(pipe), SC(select), SC(sched_yield), SC(mremap), SC(msync), SC(mincore), SC(madvise),
+	SC(shmget), SC(shmat), SC(shmctl), SC(dup), SC(dup2), SC(pause), SC(nanosleep), SC(getitimer),
+	SC(alarm), SC(setitimer), SC(getpid), SC(sendfile), SC(socket), SC(connect), SC(accept),
+	SC(sendto), SC(recvfrom), SC(sendmsg), SC(recvmsg), SC(shutdown), SC(bind), SC(listen),
+	SC(getsockname), SC(getpeername), SC(socketpair), SC(setsockopt), SC(getsockopt), SC(clone),
+	SC(fork), SC(vfork), SC(execve), SC(exit), SC(wait4), SC(kill), SC(uname), SC(semget), SC(semop),
+	SC(semctl), SC(shmdt), SC(msgget), SC(msgsnd), SC(msgrcv), SC(msgctl), SC(fcntl), SC(flock),
+	SC(fsync), SC(fdatasync), SC(truncate), SC(ftruncate), SC(getdents), SC(getcwd), SC(chdir),
+	SC(fchdir), SC(rename), SC(mkdir), SC(rmdir), SC(creat), SC(link), SC(unlink), SC(symlink),
+	SC(readlink), SC(chmod), SC(fchmod), SC(chown), SC(fchown), SC(lchown), SC(umask),
+	SC(gettimeofday), SC(getrlimit), SC(getrusage), SC(sysinfo), SC(times), SC(ptrace), SC(getuid),
+	SC(syslog), SC(getgid), SC(setuid), SC(setgid), SC(geteuid), SC(getegid), SC(setpgid),
+	SC(getppid), SC(getpgrp), SC(setsid), SC(setreuid), SC(setregid), SC(getgroups), SC(setgroups),
+	SC(setresuid), SC(getresuid), SC(setresgid), SC(getresgid), SC(getpgid), SC(setfsuid),
+	SC(setfsgid), SC(getsid), SC(capget), SC(capset), SC(rt_sigpending), SC(rt_sigtimedwait),
+	SC(rt_sigqueueinfo), SC(rt_sigsuspend), SC(sigaltstack), SC(utime), SC(mknod), SC(uselib),
+	SC(personality), SC(ustat), SC(statfs), SC(fstatfs), SC(sysfs), SC(getpriority), SC(setpriority),
+	SC(sched_setparam), SC(sched_getparam), SC(sched_setscheduler), SC(sched_getscheduler),
+	SC(sched_get_priority_max), SC(sched_get_priority_min), SC(sched_rr_get_interval), SC(mlock),
+	SC(munlock), SC(mlockall), SC(munlockall), SC(vhangup), SC(modify_ldt), SC(pivot_root),
+	SC(_sysctl), SC(prctl), SC(arch_prctl), SC(adjtimex), SC(setrlimit), SC(chroot), SC(sync),
+	SC(acct), SC(settimeofday), SC(mount), SC(umount2), SC(swapon), SC(swapoff), SC(reboot),
+	SC(sethostname), SC(setdomainname), SC(iopl), SC(ioperm), SC(create_module), SC(init_module),
+	SC(delete_module), SC(get_kernel_syms), SC(query_module), SC(quotactl), SC(nfsservctl),
+	SC(getpmsg), SC(putpmsg), SC(afs_syscall), SC(tuxcall), SC(security), SC(gettid), SC(readahead),
+	SC(setxattr), SC(lsetxattr), SC(fsetxattr), SC(getxattr), SC(lgetxattr), SC(fgetxattr),
+	SC(listxattr), SC(llistxattr), SC(flistxattr), SC(removexattr), SC(lremovexattr),
+	SC(fremovexattr), SC(tkill), SC(time), SC(futex), SC(sched_setaffinity), SC(sched_getaffinity),
+	SC(set_thread_area), SC(io_setup), SC(io_destroy), SC(io_getevents), SC(io_submit), SC(io_cancel),
+	SC(get_thread_area), SC(lookup_dcookie), SC(epoll_create), SC(epoll_ctl_old), SC(epoll_wait_old),
+	SC(remap_file_pages), SC(getdents64), SC(set_tid_address), SC(restart_syscall), SC(semtimedop),
+	SC(fadvise64), SC(timer_create), SC(timer_settime), SC(timer_gettime), SC(timer_getoverrun),
+	SC(timer_delete), SC(clock_settime), SC(clock_gettime), SC(clock_getres), SC(clock_nanosleep),
+	SC(exit_group), SC(epoll_wait), SC(epoll_ctl), SC(tgkill), SC(utimes), SC(vserver), SC(mbind),
+	SC(set_mempolicy), SC(get_mempolicy), SC(mq_open), SC(mq_unlink), SC(mq_timedsend),
+	SC(mq_timedreceive), SC(mq_notify), SC(mq_getsetattr), SC(kexec_load), SC(waitid), SC(add_key),
+	SC(request_key), SC(keyctl), SC(ioprio_set), SC(ioprio_get), SC(inotify_init),
+	SC(inotify_add_watch), SC(inotify_rm_watch), SC(migrate_pages), SC(openat), SC(mkdirat),
+	SC(mknodat), SC(fchownat), SC(futimesat), SC(newfstatat), SC(unlinkat), SC(renameat), SC(linkat),
+	SC(symlinkat), SC(readlinkat), SC(fchmodat), SC(faccessat), SC(pselect6), SC(ppoll), SC(unshare),
+	SC(set_robust_list), SC(get_robust_list), SC(splice), SC(tee), SC(sync_file_range), SC(vmsplice),
+	SC(move_pages), SC(utimensat), SC(epoll_pwait), SC(signalfd), SC(timerfd_create), SC(eventfd),
+	SC(fallocate), SC(timerfd_settime), SC(timerfd_gettime), SC(accept4), SC(signalfd4), SC(eventfd2),
+	SC(epoll_create1), SC(dup3), SC(pipe2), SC(inotify_init1), SC(preadv), SC(pwritev),
+	SC(rt_tgsigqueueinfo), SC(perf_event_open), SC(recvmmsg), SC(fanotify_init), SC(fanotify_mark),
+	SC(prlimit64), SC(name_to_handle_at), SC(open_by_handle_at), SC(clock_adjtime), SC(syncfs),
+	SC(sendmmsg), SC(setns), SC(getcpu), SC(process_vm_readv), SC(process_vm_writev), SC(kcmp),
+	SC(finit_module), SC(sched_setattr), SC(sched_getattr), SC(renameat2), SC(seccomp), SC(getrandom),
+	SC(memfd_create), SC(kexec_file_load), SC(bpf), SC(execveat), SC(userfaultfd), SC(membarrier),
+	SC(mlock2), SC(copy_file_range), SC(preadv2), SC(pwritev2), SC(pkey_mprotect), SC(pkey_alloc),
+	SC(pkey_free), SC(statx), SC(io_pgetevents), SC(rseq), SC(pidfd_send_signal), SC(io_uring_setup),
+	SC(io_uring_enter), SC(io_uring_register), SC(open_tree), SC(move_mount), SC(fsopen),
+	SC(fsconfig), SC(fsmount), SC(fspick), SC(pidfd_open), SC(clone3), SC(close_range), SC(openat2),
+	SC(pidfd_getfd), SC(faccessat2), SC(process_madvise), SC(epoll_pwait2), SC(mount_setattr),
+	SC(quotactl_fd), SC(landlock_create_ruleset), SC(landlock_add_rule), SC(landlock_restrict_self),
+	SC(memfd_secret), SC(process_mrelease), SC(futex_waitv), SC(set_mempolicy_home_node),
+#endif
+	{ NULL, -1 }
+};
+
+/* The filter is built from its end backwards, so every jump target is
+ * known when a jump is emitted. A label is the number of instructions
+ * from an instruction to the end of the program.
+ */
+struct builder {
+	struct sc_filter *f;
+	int pos;					/* instructions emitted */
+	int overflow;
+	uint32_t actions[max_actions];
+	int action_labels[max_actions];
+	int nactions;
+};
+
+int sc_syscall_nr(const char *name)
+{
+	char *end;
+	long nr;
+	int i;
+
+	for (i = 0; names[i].name; i++) {
+		if (!strcmp(names[i].name, name))
+			return names[i].nr;
+	}
+
+	nr = strtol(name, &end, 0);
+	if (*name && !*end && nr >= 0 && nr < X32_SYSCALL_BIT)
+		return nr;
+	return -1;
+}
+
+const char *sc_syscall_name(int nr)
+{
+	int i;
+
+	for (i = 0; names[i].name; i++) {
+		if (names[i].nr == nr)
+			return names[i].name;
+	}
+	return NULL;
+}
+
+static int parse_action(const char *s, uint32_t *action)
+{
+	char *end;
+	unsigned long err;
+
+	if (!strcmp(s, "allow")) {
+		*action = SECCOMP_RET_ALLOW;
+	} else if (!strcmp(s, "deny")) {
+		*action = SECCOMP_RET_ERRNO | EPERM;
+	} else if (!strcmp(s, "kill")) {
+		*action = SECCOMP_RET_KILL_PROCESS;
+	} else if (!strcmp(s, "log")) {
+		*action = SECCOMP_RET_LOG;
+	} else if (!strncmp(s, "errno:", 6)) {
+		err = strtoul(s + 6, &end, 0);
+		if (!s[6] || *end || err > SECCOMP_RET_DATA)
+			return 1;
+		*action = SECCOMP_RET_ERRNO | err;
+	} else {
+		return 2;
+	}
+
+	return 0;
+}
+
+static int parse_op(const char *s)
+{
+	static const char *ops[] = { "==", "!=", "<", "<=", ">", ">=", "&", NULL };
+	int i;
+
+	for (i = 0; ops[i]; i++) {
+		if (!strcmp(s, ops[i]))
+			return sc_eq + i;
+	}
+	return 0;
+}
+
+/* The parse_rule parses the syscall and the conditions of a rule. */
+static int parse_rule(char *name, struct sc_rule *r)
+{
+	char *arg, *op, *val, *end;
+	struct sc_arg *a;
+
+	r->nr = sc_syscall_nr(name);
+	if (r->nr < 0) {
+		fprintf(stderr, "unknown syscall %s\n", name);
+		return 1;
+	}
+
+	r->nargs = 0;
+	while ((arg = strtok(NULL, " \t\n")) != NULL) {
+		op = strtok(NULL, " \t\n");
+		val = strtok(NULL, " \t\n");
+		if (!op || !val || strncmp(arg, "arg", 3) || arg[3] < '0' || arg[3] > '5' || arg[4]) {
+			fprintf(stderr, "condition of %s is arg<0-5> <op> <value>\n", name);
+			return 2;
+		}
+		if (r->nargs == sc_max_args) {
+			fprintf(stderr, "too many conditions of %s\n", name);
+			return 3;
+		}
+
+		a = &r->args[r->nargs++];
+		a->index = arg[3] - '0';
+		a->op = parse_op(op);
+		errno = 0;
+		a->value = strtoull(val, &end, 0);
+		if (!a->op || *end || errno) {
+			fprintf(stderr, "invalid condition %s %s %s\n", arg, op, val);
+			return 4;
+		}
+	}
+
+	return 0;
+}
+
+/* The sc_parse_profile reads a profile (see seccomplib.h). */
+int sc_parse_profile(const char *path, struct sc_profile *p)
+{
+	char line[max_line];
+	char *action, *name;
+	FILE *fp;
+	int lineno = 0, ret = 0;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return 1;
+	}
+
+	p->def_action = SECCOMP_RET_KILL_PROCESS;
+	p->n = 0;
+
+	while (!ret && fgets(line, max_line, fp)) {
+		lineno++;
+		action = strtok(line, " \t\n");
+		if (!action || action[0] == '#')
+			continue;
+		name = strtok(NULL, " \t\n");
+		if (!name) {
+			fprintf(stderr, "%s:%d: syscall is not given\n", path, lineno);
+			ret = 2;
+			break;
+		}
+
+		if (!strcmp(action, "default")) {
+			if (parse_action(name, &p->def_action)) {
+				fprintf(stderr, "%s:%d: unknown action %s\n", path, lineno, name);
+				ret = 3;
+			}
+			continue;
+		}
+
+		if (p->n == sc_max_rules) {
+			fprintf(stderr, "%s:%d: too many rules\n", path, lineno);
+			ret = 4;
+			break;
+		}
+		if (parse_action(action, &p->rules[p->n].action)) {
+			fprintf(stderr, "%s:%d: unknown action %s\n", path, lineno, action);
+			ret = 5;
+			break;
+		}
+		if (parse_rule(name, &p->rules[p->n])) {
+			fprintf(stderr, "%s:%d: invalid rule\n", path, lineno);
+			ret = 6;
+			break;
+		}
+		p->n++;
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+/* The emit puts an instruction before the ones emitted so far and returns
+ * its label.
+ */
+static int emit(struct builder *b, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+	struct sock_filter *insn;
+
+	if (b->pos == sc_max_insns) {
+		b->overflow = 1;
+		return b->pos;
+	}
+
+	insn = &b->f->insns[sc_max_insns - ++b->pos];
+	insn->code = code;
+	insn->jt = jt;
+	insn->jf = jf;
+	insn->k = k;
+	return b->pos;
+}
+
+static int emit_ja(struct builder *b, int target)
+{
+	return emit(b, BPF_JMP | BPF_JA, 0, 0, b->pos - target);
+}
+
+static int emit_load(struct builder *b, uint32_t off)
+{
+	return emit(b, BPF_LD | BPF_W | BPF_ABS, 0, 0, off);
+}
+
+/* The emit_jump emits a conditional jump to jt or jf. A conditional jump
+ * reaches 255 instructions, a farther target goes through a JA.
+ */
+static int emit_jump(struct builder *b, uint16_t op, uint32_t k, int jt, int jf)
+{
+	if (b->pos - jf > max_jump - 1)
+		jf = emit_ja(b, jf);
+	if (b->pos - jt > max_jump)
+		jt = emit_ja(b, jt);
+
+	return emit(b, BPF_JMP | op | BPF_K, b->pos - jt, b->pos - jf, k);
+}
+
+/* The action_label returns the label of a RET of an action. A RET out of
+ * reach of a conditional jump is emitted again here, which is as short as
+ * a JA to it and saves executing the JA.
+ */
+static int action_label(struct builder *b, uint32_t action)
+{
+	int i;
+
+	for (i = 0; i < b->nactions && b->actions[i] != action; i++);
+
+	if (i == b->nactions) {
+		if (b->nactions == max_actions) {
+			b->overflow = 1;
+			return b->pos;
+		}
+		b->actions[b->nactions++] = action;
+	} else if (b->pos - b->action_labels[i] < max_jump - 1) {
+		return b->action_labels[i];
+	}
+
+	b->action_labels[i] = emit(b, BPF_RET | BPF_K, 0, 0, action);
+	return b->action_labels[i];
+}
+
+#define ARG_LO(i) (offsetof(struct seccomp_data, args) + 8 * (i))
+#define ARG_HI(i) (ARG_LO(i) + 4)
+
+/* The emit_cond emits a check of a 64-bit argument (cBPF compares 32 bits
+ * at a time, the high word first) going to ok or fail.
+ */
+static int emit_cond(struct builder *b, const struct sc_arg *a, int ok, int fail)
+{
+	uint32_t hi = a->value >> 32, lo = (uint32_t) a->value;
+	int l;
+
+	switch (a->op) {
+	case sc_eq:
+		l = emit_jump(b, BPF_JEQ, lo, ok, fail);
+		l = emit_load(b, ARG_LO(a->index));
+		l = emit_jump(b, BPF_JEQ, hi, l, fail);
+		break;
+	case sc_ne:
+		l = emit_jump(b, BPF_JEQ, lo, fail, ok);
+		l = emit_load(b, ARG_LO(a->index));
+		l = emit_jump(b, BPF_JEQ, hi, l, ok);
+		break;
+	case sc_gt:
+	case sc_le:
+		/* hi > vhi || hi == vhi && lo > vlo */
+		if (a->op == sc_le) {
+			l = ok;
+			ok = fail;
+			fail = l;
+		}
+		l = emit_jump(b, BPF_JGT, lo, ok, fail);
+		l = emit_load(b, ARG_LO(a->index));
+		l = emit_jump(b, BPF_JEQ, hi, l, fail);
+		l = emit_jump(b, BPF_JGT, hi, ok, l);
+		break;
+	case sc_ge:
+	case sc_lt:
+		if (a->op == sc_lt) {
+			l = ok;
+			ok = fail;
+			fail = l;
+		}
+		l = emit_jump(b, BPF_JGE, lo, ok, fail);
+		l = emit_load(b, ARG_LO(a->index));
+		l = emit_jump(b, BPF_JEQ, hi, l, fail);
+		l = emit_jump(b, BPF_JGT, hi, ok, l);
+		break;
+	default:					/* sc_and */
+		l = emit_jump(b, BPF_JSET, lo, ok, fail);
+		l = emit_load(b, ARG_LO(a->index));
+		if (hi)
+			l = emit_jump(b, BPF_JSET, hi, ok, l);
+		break;
+	}
+
+	if (a->op == sc_and && !hi)
+		return l;
+	return emit_load(b, ARG_HI(a->index));
+}
+
+/* The emit_rules emits the rules of one syscall, from first to last
+ * (rules[0..n)); the syscall number is not needed any more there. If the
+ * first rule has no conditions, nothing is emitted and *action is set.
+ */
+static int emit_rules(struct builder *b, const struct sc_rule **rules, int n, uint32_t def, uint32_t *action)
+{
+	int i, j, next = -1, ok;
+
+	*action = rules[0]->action;
+	if (rules[0]->nargs == 0)
+		return -1;
+
+	for (i = n - 1; i >= 0; i--) {
+		if (next < 0)
+			next = action_label(b, def);
+		ok = action_label(b, rules[i]->action);
+		if (rules[i]->nargs == 0) {
+			next = ok;
+			continue;
+		}
+		for (j = rules[i]->nargs - 1; j >= 0; j--)
+			ok = emit_cond(b, &rules[i]->args[j], ok, next);
+		next = ok;
+	}
+
+	return next;
+}
+
+/* The target returns the label of the code of syscall group i. */
+static int target(struct builder *b, const struct sc_group *g)
+{
+	return g->label < 0 ? action_label(b, g->action) : g->label;
+}
+
+/* The emit_dispatch emits the search of nr (it is in A) among the sorted
+ * groups gs[lo..hi) jumping to the code of the syscall or to the default
+ * action. With linear the numbers are compared one by one.
+ */
+static int emit_dispatch(struct builder *b, const struct sc_group *gs, int lo, int hi, uint32_t def, int linear)
+{
+	int i, l, mid, left, right;
+
+	if (linear || hi - lo <= leaf_size) {
+		l = action_label(b, def);
+		for (i = hi - 1; i >= lo; i--)
+			l = emit_jump(b, BPF_JEQ, gs[i].nr, target(b, &gs[i]), l);
+		return l;
+	}
+
+	mid = (lo + hi) / 2;
+	right = emit_dispatch(b, gs, mid, hi, def, linear);
+	left = emit_dispatch(b, gs, lo, mid, def, linear);
+	return emit_jump(b, BPF_JGE, gs[mid].nr, right, left);
+}
+
+static int cmp_rules(const void *a, const void *b)
+{
+	const struct sc_rule *ra = *(const struct sc_rule * const *) a;
+	const struct sc_rule *rb = *(const struct sc_rule * const *) b;
+
+	if (ra->nr != rb->nr)
+		return ra->nr < rb->nr ? -1 : 1;
+	/* keep the order of the profile within a syscall */
+	return ra < rb ? -1 : ra > rb;
+}
+
+/* The sc_compile compiles the profile to a cBPF filter (see seccomplib.h),
+ * with linear the syscall number is compared with every rule in turn.
+ */
+int sc_compile(const struct sc_profile *p, int linear, struct sc_filter *f)
+{
+	static const struct sc_rule *sorted[sc_max_rules];
+	static struct sc_group groups[sc_max_rules];
+	struct sc_group g;
+	struct builder b;
+	int i, j, n = 0, entry;
+
+	memset(&b, 0, sizeof(b));
+	b.f = f;
+
+	for (i = 0; i < p->n; i++)
+		sorted[i] = &p->rules[i];
+	qsort(sorted, p->n, sizeof(sorted[0]), cmp_rules);
+
+	/* The code of the syscalls with conditions, a block per syscall. */
+	for (i = p->n; i > 0; i = j) {
+		for (j = i - 1; j > 0 && sorted[j - 1]->nr == sorted[i - 1]->nr; j--);
+		groups[n].nr = sorted[j]->nr;
+		groups[n].label = emit_rules(&b, sorted + j, i - j, p->def_action, &groups[n].action);
+		n++;
+	}
+	/* Blocks were emitted from the highest number down. */
+	for (i = 0; i < n / 2; i++) {
+		g = groups[i];
+		groups[i] = groups[n - 1 - i];
+		groups[n - 1 - i] = g;
+	}
+
+	entry = emit_dispatch(&b, groups, 0, n, p->def_action, linear);
+#if defined(__x86_64__)
+	entry = emit_jump(&b, BPF_JGE, X32_SYSCALL_BIT, action_label(&b, SECCOMP_RET_KILL_PROCESS), entry);
+#endif
+	entry = emit_load(&b, offsetof(struct seccomp_data, nr));
+	emit_jump(&b, BPF_JEQ, SC_ARCH, entry, action_label(&b, SECCOMP_RET_KILL_PROCESS));
+	emit_load(&b, offsetof(struct seccomp_data, arch));
+
+	if (b.overflow) {
+		fprintf(stderr, "seccomp filter is too long\n");
+		return 1;
+	}
+
+	f->len = b.pos;
+	memmove(f->insns, f->insns + sc_max_insns - b.pos, b.pos * sizeof(struct sock_filter));
+	return 0;
+}
+
+/* The sc_install installs the filter for the calling thread and all its
+ * future children. no_new_privs is needed to do that without CAP_SYS_ADMIN.
+ */
+int sc_install(const struct sc_filter *f)
+{
+	struct sock_fprog prog;
+
+	prog.len = f->len;
+	prog.filter = (struct sock_filter *) f->insns;
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
+		perror("prctl no_new_privs");
+		return 1;
+	}
+
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog)) {
+		perror("prctl seccomp");
+		return 2;
+	}
+
+	return 0;
+}
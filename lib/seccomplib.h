@@ -0,0 +1,57 @@
+#ifndef SECCOMPLIB_SENTRY_H
+#define SECCOMPLIB_SENTRY_H
+
+#include <stdint.h>
+#include <linux/filter.h>		/* struct sock_filter */
+
+/* A seccomp profile is a text file, one rule per line:
+ *
+ *   default <action>
+ *   <action> <syscall> [arg<N> <op> <value>]...
+ *
+ * where action is allow, deny (EPERM), errno:<N>, kill or log, op is one
+ * of == != < <= > >= and & (any bit of value set), values are unsigned
+ * 64-bit numbers (0x for hex). Conditions of a rule must all hold, the
+ * first rule of a syscall which matches wins, the default action is
+ * taken for the rest. Syscalls are given by name or number.
+ *
+ * The compiler checks the architecture, then finds the syscall with a
+ * binary search over the sorted syscall numbers (a few comparisons
+ * instead of one per rule) and checks the arguments of its rules.
+ */
+
+enum { sc_max_rules = 512, sc_max_args = 6, sc_max_insns = 4096 };
+
+enum { sc_eq = 1, sc_ne, sc_lt, sc_le, sc_gt, sc_ge, sc_and };
+
+struct sc_arg {
+	int index;
+	int op;
+	uint64_t value;
+};
+
+struct sc_rule {
+	int nr;
+	uint32_t action;			/* SECCOMP_RET_* */
+	int nargs;
+	struct sc_arg args[sc_max_args];
+};
+
+struct sc_profile {
+	uint32_t def_action;
+	struct sc_rule rules[sc_max_rules];
+	int n;
+};
+
+struct sc_filter {
+	struct sock_filter insns[sc_max_insns];
+	int len;
+};
+
+int sc_syscall_nr(const char *name);
+const char *sc_syscall_name(int nr);
+int sc_parse_profile(const char *path, struct sc_profile *p);
+int sc_compile(const struct sc_profile *p, int linear, struct sc_filter *f);
+int sc_install(const struct sc_filter *f);
+
+#endif
@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <string.h>				/* memcpy */
+#include "sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>				/* __get_cpuid_count */
+#include <immintrin.h>			/* _mm_sha256rnds2_epu32 */
+#define SHA256_NI
+#endif
+
+typedef void (*block_fn) (uint32_t * state, const unsigned char *data, size_t blocks);
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void blocks_portable(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+	uint32_t w[64], s[8], t1, t2;
+	int i;
+
+	for (; blocks > 0; blocks--, data += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = (uint32_t) data[4 * i] << 24 | (uint32_t) data[4 * i + 1] << 16 |
+				(uint32_t) data[4 * i + 2] << 8 | data[4 * i + 3];
+		for (i = 16; i < 64; i++)
+			w[i] = w[i - 16] + (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+				w[i - 7] + (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+		memcpy(s, state, sizeof(s));
+		for (i = 0; i < 64; i++) {
+			t1 = s[7] + (ROR(s[4], 6) ^ ROR(s[4], 11) ^ ROR(s[4], 25)) + ((s[4] & s[5]) ^ (~s[4] & s[6])) +
+				K[i] + w[i];
+			t2 = (ROR(s[0], 2) ^ ROR(s[0], 13) ^ ROR(s[0], 22)) + ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+			s[7] = s[6];
+			s[6] = s[5];
+			s[5] = s[4];
+			s[4] = s[3] + t1;
+			s[3] = s[2];
+			s[2] = s[1];
+			s[1] = s[0];
+			s[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; i++)
+			state[i] += s[i];
+	}
+}
+
+#ifdef SHA256_NI
+/* The blocks_ni does four rounds per sha256rnds2 pair. The instructions
+ * keep the state as ABEF and CDGH, it is shuffled in and out once per
+ * call. The message schedule of the next four words is computed from
+ * the last sixteen with sha256msg1/msg2, kept in w[i % 4]. make.sh builds
+ * without optimization, which would keep every intrinsic in memory.
+ */
+__attribute__ ((target("sha,sse4.1,ssse3"), optimize("O2")))
+static void blocks_ni(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m128i st0, st1, tmp, msg, abef, cdgh, w[4];
+	int i;
+
+	tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+	st1 = _mm_loadu_si128((const __m128i *) &state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);	/* CDAB */
+	st1 = _mm_shuffle_epi32(st1, 0x1b);	/* EFGH */
+	st0 = _mm_alignr_epi8(tmp, st1, 8);	/* ABEF */
+	st1 = _mm_blend_epi16(st1, tmp, 0xf0);	/* CDGH */
+
+	for (; blocks > 0; blocks--, data += 64) {
+		abef = st0;
+		cdgh = st1;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), bswap);
+			} else {
+				tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+				w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+			}
+			msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *) &K[4 * i]));
+			st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+		}
+
+		st0 = _mm_add_epi32(st0, abef);
+		st1 = _mm_add_epi32(st1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(st0, 0x1b);	/* FEBA */
+	st1 = _mm_shuffle_epi32(st1, 0xb1);	/* DCHG */
+	st0 = _mm_blend_epi16(tmp, st1, 0xf0);	/* DCBA */
+	st1 = _mm_alignr_epi8(st1, tmp, 8);	/* HGFE */
+	_mm_storeu_si128((__m128i *) & state[0], st0);
+	_mm_storeu_si128((__m128i *) & state[4], st1);
+}
+
+/* The has_sha_ni checks CPUID for SHA (leaf 7) and SSSE3/SSE4.1 (leaf 1). */
+static int has_sha_ni(void)
+{
+	unsigned int a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSSE3) || !(c & bit_SSE4_1))
+		return 0;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return 0;
+	return (b >> 29) & 1;
+}
+#endif
+
+static block_fn block_func;
+
+/* The sha256_select picks the block function, the portable one if asked
+ * or if the CPU has no SHA extensions. It returns its name.
+ */
+const char *sha256_select(int portable)
+{
+#ifdef SHA256_NI
+	if (!portable && has_sha_ni()) {
+		block_func = blocks_ni;
+		return "sha-ni";
+	}
+#endif
+	block_func = blocks_portable;
+	return "portable";
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	if (!block_func)
+		sha256_select(0);
+	memcpy(ctx->state, init, sizeof(init));
+	ctx->len = 0;
+	ctx->nbuf = 0;
+}
+
+/* The sha256_update hashes whole blocks straight from data, only a
+ * partial block is buffered.
+ */
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t n;
+
+	ctx->len += len;
+
+	if (ctx->nbuf) {
+		n = 64 - ctx->nbuf < len ? 64 - ctx->nbuf : len;
+		memcpy(ctx->buf + ctx->nbuf, p, n);
+		ctx->nbuf += n;
+		p += n;
+		len -= n;
+		if (ctx->nbuf < 64)
+			return;
+		block_func(ctx->state, ctx->buf, 1);
+		ctx->nbuf = 0;
+	}
+
+	if (len >= 64) {
+		block_func(ctx->state, p, len / 64);
+		p += len & ~(size_t) 63;
+		len &= 63;
+	}
+
+	memcpy(ctx->buf, p, len);
+	ctx->nbuf = len;
+}
+
+void sha256_final(struct sha256_ctx *ctx, unsigned char *digest)
+{
+	uint64_t bits = ctx->len * 8;
+	int i;
+
+	ctx->buf[ctx->nbuf++] = 0x80;
+	if (ctx->nbuf > 56) {
+		memset(ctx->buf + ctx->nbuf, 0, 64 - ctx->nbuf);
+		block_func(ctx->state, ctx->buf, 1);
+		ctx->nbuf = 0;
+	}
+	memset(ctx->buf + ctx->nbuf, 0, 56 - ctx->nbuf);
+	for (i = 0; i < 8; i++)
+		ctx->buf[56 + i] = bits >> (56 - 8 * i);
+	block_func(ctx->state, ctx->buf, 1);
+
+	for (i = 0; i < 32; i++)
+		digest[i] = ctx->state[i / 4] >> (24 - 8 * (i % 4));
+}
+
+void sha256_hex(const unsigned char *digest, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < sha256_len; i++) {
+		hex[2 * i] = digits[digest[i] >> 4];
+		hex[2 * i + 1] = digits[digest[i] & 15];
+	}
+	hex[sha256_hex_len] = '\0';
+}
@@ -0,0 +1,27 @@
+#ifndef SHA256_SENTRY_H
+#define SHA256_SENTRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* SHA-256 (FIPS 180-4). The block function is chosen on first use: the
+ * SHA extensions of x86 CPUs (SHA-NI) if the CPU has them, otherwise
+ * portable C.
+ */
+
+enum { sha256_len = 32, sha256_hex_len = 64 };
+
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t len;				/* bytes hashed so far */
+	unsigned char buf[64];
+	unsigned int nbuf;
+};
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(struct sha256_ctx *ctx, unsigned char *digest);
+void sha256_hex(const unsigned char *digest, char *hex);
+const char *sha256_select(int portable);
+
+#endif
@@ -0,0 +1,178 @@
+#define _GNU_SOURCE				/* pipe2 */
+#include <stdio.h>				/* perror */
+#include <string.h>				/* strncpy */
+#include <unistd.h>				/* fork */
+#include <errno.h>				/* EINTR */
+#include <fcntl.h>				/* O_CLOEXEC */
+#include <poll.h>				/* poll */
+#include <signal.h>				/* signal */
+#include <time.h>				/* nanosleep */
+#include <sys/stat.h>			/* rmdir */
+#include "netlinklib.h"
+#include "nftlib.h"
+#include "teardown.h"
+
+enum { rmdir_tries = 50, rmdir_delay_ms = 20 };
+
+/* The read_batch reads as many queued requests as are available, waiting
+ * td_linger_ms for more once the first one has come. A single write of a
+ * request is atomic (it is less than PIPE_BUF), so the pipe always holds
+ * whole requests. It returns the number of requests or 0 at the end.
+ */
+static int read_batch(int fd, struct teardown_req *reqs)
+{
+	struct pollfd pfd;
+	int n, len = 0, size = sizeof(struct teardown_req) * td_max_batch;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	do {
+		n = read(fd, (char *) reqs + len, size - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	} while (len < size && poll(&pfd, 1, td_linger_ms) > 0);
+
+	return len / sizeof(struct teardown_req);
+}
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+}
+
+/* The remove_cgroup removes an empty cgroup. The last processes of a
+ * container may still be exiting, so rmdir(2) is retried for a while.
+ */
+static void remove_cgroup(const char *path)
+{
+	int i;
+
+	for (i = 0; i < rmdir_tries; i++) {
+		if (!rmdir(path) || errno == ENOENT)
+			return;
+		if (errno != EBUSY)
+			break;
+		sleep_ms(rmdir_delay_ms);
+	}
+	perror(path);
+}
+
+/* The process_batch removes nf_tables tables and links with one netlink
+ * request each and then cgroups (they become empty last).
+ */
+static void process_batch(int sock, struct teardown_req *reqs, int n)
+{
+	const char *links[td_max_batch];
+	const char *tables[td_max_batch];
+	int i, nft, nlinks = 0, ntables = 0;
+
+	for (i = 0; i < n; i++) {
+		if (reqs[i].type == td_link)
+			links[nlinks++] = reqs[i].arg;
+		if (reqs[i].type == td_nft)
+			tables[ntables++] = reqs[i].arg;
+	}
+
+	if (ntables) {
+		nft = create_nft_socket();
+		if (nft >= 0 && nft_unpublish(nft, tables, ntables))
+			fprintf(stderr, "teardown: some published ports are not removed\n");
+		if (nft >= 0)
+			close(nft);
+	}
+
+	if (nlinks && sock >= 0 && if_del_batch(sock, links, nlinks))
+		fprintf(stderr, "teardown: some links are not deleted\n");
+
+	for (i = 0; i < n; i++) {
+		if (reqs[i].type == td_cgroup)
+			remove_cgroup(reqs[i].arg);
+	}
+}
+
+static void reaper(int fd)
+{
+	static struct teardown_req reqs[td_max_batch];
+	int n, sock;
+
+	sock = create_socket();
+	while ((n = read_batch(fd, reqs)) > 0)
+		process_batch(sock, reqs, n);
+
+	if (sock >= 0)
+		close(sock);
+	_exit(0);
+}
+
+/* The teardown_start forks the reaper process. */
+int teardown_start(struct teardown_queue *q)
+{
+	int fd[2];
+
+	if (pipe2(fd, O_CLOEXEC) == -1) {
+		perror("pipe2");
+		return 1;
+	}
+
+	q->pid = fork();
+	if (q->pid == -1) {
+		perror("fork");
+		close(fd[0]);
+		close(fd[1]);
+		return 2;
+	}
+
+	if (q->pid == 0) {
+		close(fd[1]);
+		/* The launcher may be killed by ^C, cleanup must go on. */
+		signal(SIGINT, SIG_IGN);
+		reaper(fd[0]);
+	}
+
+	close(fd[0]);
+	q->fd = fd[1];
+	return 0;
+}
+
+/* The teardown_add queues removal of a link, a cgroup or the nft table
+ * of a container (arg is the container name) and returns without waiting
+ * for it.
+ */
+int teardown_add(struct teardown_queue *q, int type, const char *arg)
+{
+	struct teardown_req req;
+
+	memset(&req, 0, sizeof(req));
+	req.type = type;
+	if (strlen(arg) >= td_max_arg) {
+		fprintf(stderr, "teardown: %s is too long\n", arg);
+		return 1;
+	}
+	strncpy(req.arg, arg, td_max_arg - 1);
+
+	while (write(q->fd, &req, sizeof(req)) != sizeof(req)) {
+		if (errno != EINTR) {
+			perror("teardown write");
+			return 2;
+		}
+	}
+
+	return 0;
+}
+
+/* The teardown_stop closes the queue. The reaper finishes the queued work
+ * in the background and exits; the caller doesn't wait for it.
+ */
+void teardown_stop(struct teardown_queue *q)
+{
+	close(q->fd);
+	q->fd = -1;
+}
@@ -0,0 +1,29 @@
+#ifndef TEARDOWN_SENTRY_H
+#define TEARDOWN_SENTRY_H
+
+/* Teardown of containers runs in a background reaper process. The
+ * launcher queues links, cgroups and nf_tables tables to remove
+ * and goes on; the reaper collects whatever has been queued meanwhile and
+ * removes it in batches (all links of a batch are deleted with one netlink
+ * send, all tables with one nf_tables transaction).
+ */
+
+enum { td_link = 1, td_cgroup = 2, td_nft = 3 };
+
+enum { td_max_arg = 256, td_max_batch = 64, td_linger_ms = 10 };
+
+struct teardown_req {
+	int type;
+	char arg[td_max_arg];
+};
+
+struct teardown_queue {
+	int fd;						/* write end of the queue */
+	int pid;					/* reaper process */
+};
+
+int teardown_start(struct teardown_queue *q);
+int teardown_add(struct teardown_queue *q, int type, const char *arg);
+void teardown_stop(struct teardown_queue *q);
+
+#endif
@@ -0,0 +1,1127 @@
+#define _GNU_SOURCE				/* O_PATH, AT_EMPTY_PATH */
+#include <stdio.h>				/* perror */
+#include <stdlib.h>				/* malloc */
+#include <string.h>				/* memcpy */
+#include <unistd.h>				/* read */
+#include <errno.h>				/* EEXIST */
+#include <fcntl.h>				/* openat */
+#include <limits.h>				/* PATH_MAX */
+#include <pthread.h>			/* pthread_create */
+#include <sys/stat.h>			/* mkdirat */
+#include <sys/sysmacros.h>		/* makedev */
+#include <sys/xattr.h>			/* fsetxattr */
+#include <zlib.h>				/* inflate */
+#include "untar.h"
+
+enum { block = 512, in_size = 256 * 1024, buf_size = 256 * 1024, max_dirs = 16384, max_xattrs = 16,
+	job_max = 4 * 1024 * 1024, pool_budget = 64 * 1024 * 1024, max_pending = 8192
+};
+
+/* OCI whiteouts: .wh.<name> deletes name of a lower layer, .wh..wh..opq
+ * hides the whole lower directory.
+ */
+static const char wh_prefix[] = ".wh.";
+static const char wh_opaque[] = ".wh..opq";
+
+/* The archive, inflated on demand. */
+struct reader {
+	int fd;
+	int gz;
+	int eof;					/* of the descriptor */
+	z_stream z;
+	struct sha256_ctx sha;
+	unsigned char in[in_size];
+	const unsigned char *next;	/* unread input if not gz */
+	size_t avail;
+};
+
+struct xattr {
+	char *name;
+	char *value;
+	size_t len;
+};
+
+struct entry {
+	char path[PATH_MAX];
+	char link[PATH_MAX];
+	int type;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	unsigned long long size;
+	time_t mtime;
+	dev_t dev;
+	struct xattr xattrs[max_xattrs];
+	int nxattrs;
+};
+
+/* A directory created or entered, with its attributes if the archive has
+ * them (set once everything under it is written).
+ */
+struct dir {
+	char *path;
+	int fd;
+	int has_attrs;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	time_t mtime;
+	struct xattr *xattrs;
+	int nxattrs;
+};
+
+struct job {
+	struct job *next;
+	int dirfd;
+	char *name;
+	char *data;
+	size_t size;
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	time_t mtime;
+	struct xattr *xattrs;
+	int nxattrs;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* jobs queued or stopping */
+	pthread_cond_t done;		/* bytes released */
+	struct job *head, *tail;
+	size_t bytes;				/* data of queued and running jobs */
+	int running;
+	int stop;
+	int failed;
+	int nthreads;
+	pthread_t threads[64];
+};
+
+/* The state of one extraction; extractions may run in parallel. */
+struct untar {
+	const struct untar_opts *o;
+	struct reader *r;
+	struct reader reader;
+	char buf[buf_size];			/* for data written here or skipped */
+	struct pool *pool;
+	struct dir dirs[max_dirs];	/* open addressing on the path */
+	int ndirs;
+	char *pending[max_pending];	/* files queued since the last drain */
+	int npending;
+	int chown;					/* only root can give files away */
+	int warned_nodes;
+};
+
+static int rd_init(struct reader *r, int fd)
+{
+	ssize_t n;
+
+	memset(&r->z, 0, sizeof(r->z));
+	r->fd = fd;
+	r->eof = 0;
+	sha256_init(&r->sha);
+
+	n = read(fd, r->in, in_size);
+	if (n < 0) {
+		perror("read archive");
+		return 1;
+	}
+	r->eof = n == 0;
+	sha256_update(&r->sha, r->in, n);
+
+	r->gz = n >= 2 && r->in[0] == 0x1f && r->in[1] == 0x8b;
+	r->next = r->in;
+	r->avail = n;
+	if (!r->gz)
+		return 0;
+
+	/* 32 - detect the gzip header */
+	if (inflateInit2(&r->z, 15 + 32) != Z_OK) {
+		fprintf(stderr, "inflateInit2 is failed\n");
+		return 2;
+	}
+	r->z.next_in = r->in;
+	r->z.avail_in = n;
+	return 0;
+}
+
+static int rd_fill(struct reader *r)
+{
+	ssize_t n;
+
+	do
+		n = read(r->fd, r->in, in_size);
+	while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		perror("read archive");
+		return 1;
+	}
+	r->eof = n == 0;
+	sha256_update(&r->sha, r->in, n);
+	r->next = r->in;
+	r->avail = n;
+	r->z.next_in = r->in;
+	r->z.avail_in = n;
+	return 0;
+}
+
+/* The rd_read reads n bytes of the tar stream to buf. It returns the
+ * number of bytes read, less than n only at the end, or -1.
+ */
+static ssize_t rd_read(struct reader *r, void *buf, size_t n)
+{
+	unsigned char *p = buf;
+	size_t got = 0, k;
+	int ret;
+
+	if (!r->gz) {
+		while (got < n) {
+			if (r->avail == 0) {
+				if (r->eof)
+					break;
+				if (rd_fill(r))
+					return -1;
+				continue;
+			}
+			k = n - got < r->avail ? n - got : r->avail;
+			memcpy(p + got, r->next, k);
+			r->next += k;
+			r->avail -= k;
+			got += k;
+		}
+		return got;
+	}
+
+	r->z.next_out = p;
+	r->z.avail_out = n;
+	while (r->z.avail_out > 0) {
+		if (r->z.avail_in == 0) {
+			if (r->eof)
+				break;
+			if (rd_fill(r))
+				return -1;
+			if (r->eof)
+				break;
+		}
+		ret = inflate(&r->z, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			/* gzip allows members one after another */
+			if (inflateReset(&r->z) != Z_OK)
+				return -1;
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			fprintf(stderr, "inflate: %s\n", r->z.msg ? r->z.msg : "error");
+			return -1;
+		}
+	}
+
+	return n - r->z.avail_out;
+}
+
+static int rd_skip(struct untar *u, unsigned long long n)
+{
+	size_t k;
+
+	while (n > 0) {
+		k = n < buf_size ? n : buf_size;
+		if (rd_read(u->r, u->buf, k) != (ssize_t) k)
+			return 1;
+		n -= k;
+	}
+	return 0;
+}
+
+/* The rd_finish reads the rest of the input for the digest. */
+static int rd_finish(struct reader *r, unsigned char *digest)
+{
+	while (!r->eof) {
+		if (rd_fill(r))
+			return 1;
+	}
+	if (r->gz)
+		inflateEnd(&r->z);
+	sha256_final(&r->sha, digest);
+	return 0;
+}
+
+static void free_xattrs(struct xattr *x, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		free(x[i].name);
+		free(x[i].value);
+	}
+}
+
+static void free_job(struct job *j)
+{
+	free_xattrs(j->xattrs, j->nxattrs);
+	free(j->xattrs);
+	free(j->data);
+	free(j->name);
+	free(j);
+}
+
+/* The pool_worker writes files until the pool is stopped. */
+static void *pool_worker(void *arg)
+{
+	struct pool *p = arg;
+	struct job *j;
+	int fd, i, err;
+	ssize_t n;
+	size_t off;
+	struct timespec ts[2];
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		while (!p->head && !p->stop)
+			pthread_cond_wait(&p->work, &p->lock);
+		j = p->head;
+		if (!j) {
+			pthread_mutex_unlock(&p->lock);
+			return NULL;
+		}
+		p->head = j->next;
+		if (!p->head)
+			p->tail = NULL;
+		p->running++;
+		pthread_mutex_unlock(&p->lock);
+
+		err = 0;
+		fd = openat(j->dirfd, j->name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+		if (fd < 0 && errno == EEXIST && unlinkat(j->dirfd, j->name, 0) == 0)
+			fd = openat(j->dirfd, j->name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+		if (fd < 0) {
+			perror(j->name);
+			err = 1;
+		}
+		for (off = 0; !err && off < j->size; off += n) {
+			n = write(fd, j->data + off, j->size - off);
+			if (n < 0) {
+				perror(j->name);
+				err = 1;
+			}
+		}
+		if (!err && j->uid != (uid_t) - 1 && fchown(fd, j->uid, j->gid)) {
+			perror(j->name);
+			err = 1;
+		}
+		/* After chown, which clears set-user-ID. */
+		if (!err && fchmod(fd, j->mode)) {
+			perror(j->name);
+			err = 1;
+		}
+		for (i = 0; !err && i < j->nxattrs; i++) {
+			if (fsetxattr(fd, j->xattrs[i].name, j->xattrs[i].value, j->xattrs[i].len, 0))
+				perror(j->xattrs[i].name);
+		}
+		ts[0].tv_sec = ts[1].tv_sec = j->mtime;
+		ts[0].tv_nsec = ts[1].tv_nsec = 0;
+		if (!err)
+			futimens(fd, ts);
+		if (fd >= 0)
+			close(fd);
+
+		pthread_mutex_lock(&p->lock);
+		p->bytes -= j->size;
+		p->running--;
+		p->failed |= err;
+		pthread_cond_broadcast(&p->done);
+		pthread_mutex_unlock(&p->lock);
+
+		free_job(j);
+	}
+}
+
+static struct pool *pool_start(int nthreads)
+{
+	struct pool *p;
+	int i;
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		perror("calloc");
+		return NULL;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	if (nthreads > (int) (sizeof(p->threads) / sizeof(p->threads[0])))
+		nthreads = sizeof(p->threads) / sizeof(p->threads[0]);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&p->threads[i], NULL, pool_worker, p))
+			break;
+		p->nthreads++;
+	}
+
+	return p;
+}
+
+/* The pool_add queues a job, waiting while the queued data are over the
+ * budget. A job larger than the budget runs alone.
+ */
+static void pool_add(struct pool *p, struct job *j)
+{
+	pthread_mutex_lock(&p->lock);
+	while (p->bytes > 0 && p->bytes + j->size > pool_budget)
+		pthread_cond_wait(&p->done, &p->lock);
+	p->bytes += j->size;
+	j->next = NULL;
+	if (p->tail)
+		p->tail->next = j;
+	else
+		p->head = j;
+	p->tail = j;
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* The pool_drain waits for all jobs, it returns 1 if one has failed. */
+static int pool_drain(struct pool *p)
+{
+	int failed;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->head || p->running)
+		pthread_cond_wait(&p->done, &p->lock);
+	failed = p->failed;
+	pthread_mutex_unlock(&p->lock);
+	return failed;
+}
+
+static int pool_stop(struct pool *p)
+{
+	int i, failed;
+
+	failed = pool_drain(p);
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+	free(p);
+	return failed;
+}
+
+static unsigned long hash_path(const char *s)
+{
+	unsigned long h = 5381;
+
+	while (*s)
+		h = h * 33 + (unsigned char) *s++;
+	return h;
+}
+
+static struct dir *find_dir(struct untar *u, const char *path)
+{
+	unsigned long i = hash_path(path) % max_dirs;
+
+	while (u->dirs[i].path && strcmp(u->dirs[i].path, path))
+		i = (i + 1) % max_dirs;
+	return &u->dirs[i];
+}
+
+/* The pending_slot finds path among the files queued since the last
+ * drain, or the free slot for it.
+ */
+static char **pending_slot(struct untar *u, const char *path)
+{
+	unsigned long i = hash_path(path) % max_pending;
+
+	while (u->pending[i] && strcmp(u->pending[i], path))
+		i = (i + 1) % max_pending;
+	return &u->pending[i];
+}
+
+/* The drain waits for the queued files and forgets them; it returns 1
+ * if one has failed.
+ */
+static int drain(struct untar *u)
+{
+	int i, failed;
+
+	if (!u->pool)
+		return 0;
+	failed = pool_drain(u->pool);
+	for (i = 0; u->npending > 0 && i < max_pending; i++) {
+		if (u->pending[i]) {
+			free(u->pending[i]);
+			u->pending[i] = NULL;
+			u->npending--;
+		}
+	}
+	return failed;
+}
+
+/* The wait_pending drains the pool if a file path is still queued: the
+ * write must not overtake an entry of the same name later in the archive.
+ */
+static int wait_pending(struct untar *u, const char *path)
+{
+	return u->npending && *pending_slot(u, path) ? drain(u) : 0;
+}
+
+/* The get_dir returns the directory of path, created if it is missing. It
+ * is opened from its parent with O_NOFOLLOW: a symlink in the archive
+ * can't lead out of the destination.
+ */
+/* The own_new_dir gives a directory the archive has no entry for to the
+ * shifted root, as if the archive were extracted by it.
+ */
+static void own_new_dir(struct untar *u, int fd)
+{
+	if (u->chown && (u->o->uid_shift || u->o->gid_shift) && fchown(fd, u->o->uid_shift, u->o->gid_shift))
+		perror("chown directory");
+}
+
+static struct dir *get_dir(struct untar *u, const char *path)
+{
+	char parent[PATH_MAX];
+	const char *name;
+	struct dir *d, *pd;
+	int fd;
+
+	d = find_dir(u, path);
+	if (d->path)
+		return d;
+
+	/* A file of the same name may be waiting for a writer. */
+	if (wait_pending(u, path))
+		return NULL;
+
+	/* Leave room for a free slot, the table is never resized. */
+	if (u->ndirs >= max_dirs - 1) {
+		fprintf(stderr, "too many directories\n");
+		return NULL;
+	}
+
+	name = strrchr(path, '/');
+	if (name) {
+		memcpy(parent, path, name - path);
+		parent[name - path] = '\0';
+		name++;
+	} else {
+		parent[0] = '\0';
+		name = path;
+	}
+
+	pd = get_dir(u, parent);
+	if (!pd)
+		return NULL;
+
+	fd = openat(pd->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT) {
+		if (mkdirat(pd->fd, name, 0755) && errno != EEXIST) {
+			perror(path);
+			return NULL;
+		}
+		fd = openat(pd->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd >= 0)
+			own_new_dir(u, fd);
+	}
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	/* The slot may have been taken by a parent meanwhile. */
+	d = find_dir(u, path);
+	d->path = strdup(path);
+	d->fd = fd;
+	d->has_attrs = 0;
+	u->ndirs++;
+	return d;
+}
+
+/* The normalize strips leading slashes and "." components; paths with
+ * ".." are refused.
+ */
+static int normalize(char *path)
+{
+	char *src = path, *dst = path, *end;
+	size_t len;
+
+	while (*src) {
+		while (*src == '/')
+			src++;
+		end = strchr(src, '/');
+		len = end ? (size_t) (end - src) : strlen(src);
+		if (len == 2 && src[0] == '.' && src[1] == '.')
+			return 1;
+		if (len > 0 && !(len == 1 && src[0] == '.')) {
+			if (dst != path)
+				*dst++ = '/';
+			memmove(dst, src, len);
+			dst += len;
+		}
+		src += len;
+	}
+	*dst = '\0';
+	return 0;
+}
+
+/* The split returns the directory of the entry and its name in it. */
+static struct dir *split(struct untar *u, char *path, const char **name)
+{
+	char *slash = strrchr(path, '/');
+	struct dir *d;
+
+	if (!slash) {
+		*name = path;
+		return get_dir(u, "");
+	}
+	*slash = '\0';
+	d = get_dir(u, path);
+	*slash = '/';
+	*name = slash + 1;
+	return d;
+}
+
+static unsigned long long parse_num(const char *p, int len)
+{
+	unsigned long long n = 0;
+	int i;
+
+	/* base-256 for large values (GNU) */
+	if ((unsigned char) p[0] & 0x80) {
+		n = (unsigned char) p[0] & 0x7f;
+		for (i = 1; i < len; i++)
+			n = n << 8 | (unsigned char) p[i];
+		return n;
+	}
+
+	for (i = 0; i < len && (p[i] == ' ' || p[i] == '\0'); i++);
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+		n = n * 8 + p[i] - '0';
+	return n;
+}
+
+static int add_xattr(struct entry *e, const char *name, const char *value, size_t len)
+{
+	struct xattr *x;
+
+	if (e->nxattrs == max_xattrs)
+		return 0;
+	x = &e->xattrs[e->nxattrs];
+	x->name = strdup(name);
+	x->value = malloc(len ? len : 1);
+	if (!x->name || !x->value) {
+		free(x->name);
+		free(x->value);
+		return 1;
+	}
+	memcpy(x->value, value, len);
+	x->len = len;
+	e->nxattrs++;
+	return 0;
+}
+
+/* The parse_pax applies the records "<len> <key>=<value>\n" of a pax
+ * header to the next entry.
+ */
+static int parse_pax(struct entry *e, char *buf, size_t size, int *has_path, int *has_link)
+{
+	char *p = buf, *key, *value, *end;
+	unsigned long len;
+
+	while (p < buf + size) {
+		len = strtoul(p, &key, 10);
+		if (len == 0 || *key != ' ' || p + len > buf + size || p[len - 1] != '\n')
+			return 1;
+		key++;
+		end = p + len - 1;
+		value = memchr(key, '=', end - key);
+		if (!value)
+			return 1;
+		*value++ = '\0';
+		*end = '\0';
+
+		if (!strcmp(key, "path") && end - value < PATH_MAX) {
+			strcpy(e->path, value);
+			*has_path = 1;
+		} else if (!strcmp(key, "linkpath") && end - value < PATH_MAX) {
+			strcpy(e->link, value);
+			*has_link = 1;
+		} else if (!strcmp(key, "size")) {
+			e->size = strtoull(value, NULL, 10);
+		} else if (!strcmp(key, "uid")) {
+			e->uid = strtoul(value, NULL, 10);
+		} else if (!strcmp(key, "gid")) {
+			e->gid = strtoul(value, NULL, 10);
+		} else if (!strcmp(key, "mtime")) {
+			e->mtime = strtol(value, NULL, 10);
+		} else if (!strncmp(key, "SCHILY.xattr.", 13)) {
+			if (add_xattr(e, key + 13, value, end - value))
+				return 2;
+		}
+		p += len;
+	}
+
+	return 0;
+}
+
+/* The read_entry reads the headers of the next entry (pax and GNU long
+ * name headers included). It returns 0, 1 at the end of the archive or
+ * -1.
+ */
+static int read_entry(struct untar *u, struct entry *e)
+{
+	unsigned char h[block];
+	char *ext = NULL;
+	unsigned long long size;
+	unsigned int sum, i;
+	int has_path = 0, has_link = 0, ret;
+	ssize_t len;
+
+	/* Unset, unless a pax header has them. */
+	e->nxattrs = 0;
+	e->size = ~0ULL;
+	e->uid = ~0U;
+	e->gid = ~0U;
+	for (;;) {
+		if (rd_read(u->r, h, block) != block)
+			return -1;
+
+		for (i = 0; i < block && h[i] == 0; i++);
+		if (i == block)
+			return 1;
+
+		for (sum = 0, i = 0; i < block; i++)
+			sum += i >= 148 && i < 156 ? ' ' : h[i];
+		if (sum != parse_num((char *) h + 148, 8)) {
+			fprintf(stderr, "bad tar header checksum\n");
+			return -1;
+		}
+
+		e->type = h[156];
+		size = parse_num((char *) h + 124, 12);
+
+		if (e->type == 'x' || e->type == 'g' || e->type == 'L' || e->type == 'K') {
+			len = (size + block - 1) / block * block;
+			ext = malloc(size + block + 1);
+			if (!ext || rd_read(u->r, ext, len) != len) {
+				free(ext);
+				return -1;
+			}
+			ext[size] = '\0';
+			ret = 0;
+			if (e->type == 'x') {
+				ret = parse_pax(e, ext, size, &has_path, &has_link);
+			} else if (e->type == 'L' && size < PATH_MAX) {
+				strcpy(e->path, ext);
+				has_path = 1;
+			} else if (e->type == 'K' && size < PATH_MAX) {
+				strcpy(e->link, ext);
+				has_link = 1;
+			}
+			free(ext);
+			if (ret) {
+				fprintf(stderr, "bad pax header\n");
+				return -1;
+			}
+			continue;
+		}
+		break;
+	}
+
+	if (!has_path) {
+		i = 0;
+		/* ustar splits long names in prefix and name */
+		if (!memcmp(h + 257, "ustar", 5) && h[345]) {
+			memcpy(e->path, h + 345, 155);
+			e->path[155] = '\0';
+			i = strlen(e->path);
+			e->path[i++] = '/';
+		}
+		memcpy(e->path + i, h, 100);
+		e->path[i + 100] = '\0';
+	}
+	if (!has_link) {
+		memcpy(e->link, h + 157, 100);
+		e->link[100] = '\0';
+	}
+	if (e->size == ~0ULL)
+		e->size = size;
+	if (e->uid == ~0U)
+		e->uid = parse_num((char *) h + 108, 8);
+	if (e->gid == ~0U)
+		e->gid = parse_num((char *) h + 116, 8);
+	e->mode = parse_num((char *) h + 100, 8) & 07777;
+	e->mtime = parse_num((char *) h + 136, 12);
+	e->dev = makedev(parse_num((char *) h + 329, 8), parse_num((char *) h + 337, 8));
+	if (e->type == '\0' || e->type == '7')
+		e->type = '0';
+
+	return 0;
+}
+
+static void set_owner(struct untar *u, struct entry *e)
+{
+	if (!u->chown) {
+		e->uid = -1;
+		e->gid = -1;
+		return;
+	}
+	e->uid += u->o->uid_shift;
+	e->gid += u->o->gid_shift;
+}
+
+/* The write_file writes a regular file: in a worker if it fits a job,
+ * otherwise here, streaming from the archive.
+ */
+static int write_file(struct untar *u, struct entry *e, struct dir *d, const char *name)
+{
+	struct timespec ts[2];
+	struct job *j;
+	char *path;
+	unsigned long long left;
+	size_t k;
+	int fd, i;
+
+	if (u->pool && e->size <= job_max) {
+		j = calloc(1, sizeof(*j));
+		if (!j)
+			return 1;
+		j->dirfd = d->fd;
+		j->name = strdup(name);
+		j->data = malloc(e->size ? e->size : 1);
+		j->xattrs = e->nxattrs ? malloc(e->nxattrs * sizeof(struct xattr)) : NULL;
+		if (!j->name || !j->data || (e->nxattrs && !j->xattrs)) {
+			perror("malloc");
+			free_job(j);
+			return 2;
+		}
+		if (rd_read(u->r, j->data, e->size) != (ssize_t) e->size || rd_skip(u, -e->size & (block - 1))) {
+			free_job(j);
+			return 3;
+		}
+		if (u->npending >= max_pending / 2 && drain(u)) {
+			free_job(j);
+			return 7;
+		}
+		path = *pending_slot(u, e->path) = strdup(e->path);
+		if (!path) {
+			perror("strdup");
+			free_job(j);
+			return 8;
+		}
+		u->npending++;
+		j->size = e->size;
+		j->mode = e->mode;
+		j->uid = e->uid;
+		j->gid = e->gid;
+		j->mtime = e->mtime;
+		if (e->nxattrs)
+			memcpy(j->xattrs, e->xattrs, e->nxattrs * sizeof(struct xattr));
+		j->nxattrs = e->nxattrs;
+		e->nxattrs = 0;
+		pool_add(u->pool, j);
+		return 0;
+	}
+
+	fd = openat(d->fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0 && errno == EEXIST && unlinkat(d->fd, name, 0) == 0)
+		fd = openat(d->fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		perror(e->path);
+		return 4;
+	}
+
+	for (left = e->size; left > 0; left -= k) {
+		k = left < buf_size ? left : buf_size;
+		if (rd_read(u->r, u->buf, k) != (ssize_t) k || write(fd, u->buf, k) != (ssize_t) k) {
+			perror(e->path);
+			close(fd);
+			return 5;
+		}
+	}
+	if (rd_skip(u, -e->size & (block - 1))) {
+		close(fd);
+		return 6;
+	}
+
+	if ((e->uid != (uid_t) - 1 && fchown(fd, e->uid, e->gid)) || fchmod(fd, e->mode))
+		perror(e->path);
+	for (i = 0; i < e->nxattrs; i++) {
+		if (fsetxattr(fd, e->xattrs[i].name, e->xattrs[i].value, e->xattrs[i].len, 0))
+			perror(e->xattrs[i].name);
+	}
+	ts[0].tv_sec = ts[1].tv_sec = e->mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	futimens(fd, ts);
+	close(fd);
+	return 0;
+}
+
+/* The set_link_attrs sets owner and times of a non-regular entry. */
+static void set_link_attrs(struct entry *e, struct dir *d, const char *name)
+{
+	struct timespec ts[2];
+
+	if (e->uid != (uid_t) - 1 && fchownat(d->fd, name, e->uid, e->gid, AT_SYMLINK_NOFOLLOW))
+		perror(e->path);
+	ts[0].tv_sec = ts[1].tv_sec = e->mtime;
+	ts[0].tv_nsec = ts[1].tv_nsec = 0;
+	utimensat(d->fd, name, ts, AT_SYMLINK_NOFOLLOW);
+}
+
+/* The whiteout turns an OCI whiteout into its overlayfs form: a deleted
+ * name is a 0/0 character device, an opaque directory has the opaque
+ * xattr (trusted.* for the host, user.* for a userxattr mount).
+ */
+static int whiteout(struct untar *u, struct entry *e, struct dir *d, const char *name)
+{
+	if (!strcmp(name, wh_opaque)) {
+		if (fsetxattr(d->fd, "trusted.overlay.opaque", "y", 1, 0) && errno != EPERM) {
+			perror(e->path);
+			return 1;
+		}
+		if (fsetxattr(d->fd, "user.overlay.opaque", "y", 1, 0)) {
+			perror(e->path);
+			return 2;
+		}
+	} else {
+		unlinkat(d->fd, name, 0);
+		if (mknodat(d->fd, name, S_IFCHR, makedev(0, 0))) {
+			perror(e->path);
+			return 3;
+		}
+	}
+
+	return rd_skip(u, (e->size + block - 1) / block * block);
+}
+
+static int extract_entry(struct untar *u, struct entry *e)
+{
+	char target[PATH_MAX];
+	const char *name, *tname;
+	struct dir *d, *td;
+	int ret;
+
+	if (normalize(e->path)) {
+		fprintf(stderr, "%s: path with ..\n", e->path);
+		return 1;
+	}
+
+	if (e->type == '5') {
+		d = get_dir(u, e->path);
+		if (!d)
+			return 2;
+		free_xattrs(d->xattrs, d->nxattrs);
+		free(d->xattrs);
+		d->has_attrs = 1;
+		d->mode = e->mode;
+		d->uid = e->uid;
+		d->gid = e->gid;
+		d->mtime = e->mtime;
+		d->xattrs = NULL;
+		d->nxattrs = 0;
+		if (e->nxattrs) {
+			d->xattrs = malloc(e->nxattrs * sizeof(struct xattr));
+			if (!d->xattrs)
+				return 3;
+			memcpy(d->xattrs, e->xattrs, e->nxattrs * sizeof(struct xattr));
+			d->nxattrs = e->nxattrs;
+			e->nxattrs = 0;
+		}
+		return rd_skip(u, (e->size + block - 1) / block * block);
+	}
+
+	if (e->path[0] == '\0') {
+		fprintf(stderr, "entry without a name\n");
+		return 4;
+	}
+
+	/* Entries of a name run in archive order, whatever their type. */
+	if (wait_pending(u, e->path))
+		return 12;
+
+	d = split(u, e->path, &name);
+	if (!d)
+		return 5;
+
+	if (u->o->whiteouts && !strncmp(name, wh_prefix, strlen(wh_prefix)))
+		return drain(u) ? 13 : whiteout(u, e, d, name + strlen(wh_prefix));
+
+	switch (e->type) {
+	case '0':
+		return write_file(u, e, d, name);
+	case '1':
+		strcpy(target, e->link);
+		if (normalize(target)) {
+			fprintf(stderr, "%s: link with ..\n", e->path);
+			return 6;
+		}
+		td = split(u, target, &tname);
+		if (!td)
+			return 7;
+		/* The target may still be in the queue. */
+		if (drain(u))
+			return 8;
+		unlinkat(d->fd, name, 0);
+		if (linkat(td->fd, tname, d->fd, name, 0)) {
+			perror(e->path);
+			return 9;
+		}
+		break;
+	case '2':
+		if (symlinkat(e->link, d->fd, name) && !(errno == EEXIST && unlinkat(d->fd, name, 0) == 0 &&
+												 symlinkat(e->link, d->fd, name) == 0)) {
+			perror(e->path);
+			return 10;
+		}
+		set_link_attrs(e, d, name);
+		break;
+	case '3':
+	case '4':
+	case '6':
+		unlinkat(d->fd, name, 0);
+		ret = mknodat(d->fd, name, e->mode | (e->type == '3' ? S_IFCHR : e->type == '4' ? S_IFBLK : S_IFIFO),
+					  e->dev);
+		if (ret && errno == EPERM) {
+			if (!u->warned_nodes++)
+				fprintf(stderr, "%s: device nodes are skipped, no permission\n", e->path);
+			break;
+		}
+		if (ret) {
+			perror(e->path);
+			return 11;
+		}
+		set_link_attrs(e, d, name);
+		fchmodat(d->fd, name, e->mode, 0);
+		break;
+	default:
+		fprintf(stderr, "%s: skipped type '%c'\n", e->path, e->type);
+	}
+
+	return rd_skip(u, (e->size + block - 1) / block * block);
+}
+
+/* The finish_dirs sets the attributes of the directories, now that
+ * nothing is added to them, and closes them.
+ */
+static void finish_dirs(struct untar *u)
+{
+	struct timespec ts[2];
+	struct dir *d;
+	int i, k;
+
+	for (i = 0; i < max_dirs; i++) {
+		d = &u->dirs[i];
+		if (!d->path)
+			continue;
+		if (d->has_attrs) {
+			if (d->uid != (uid_t) - 1 && fchown(d->fd, d->uid, d->gid))
+				perror(d->path);
+			if (fchmod(d->fd, d->mode))
+				perror(d->path);
+			for (k = 0; k < d->nxattrs; k++) {
+				if (fsetxattr(d->fd, d->xattrs[k].name, d->xattrs[k].value, d->xattrs[k].len, 0))
+					perror(d->xattrs[k].name);
+			}
+			ts[0].tv_sec = ts[1].tv_sec = d->mtime;
+			ts[0].tv_nsec = ts[1].tv_nsec = 0;
+			futimens(d->fd, ts);
+			free_xattrs(d->xattrs, d->nxattrs);
+			free(d->xattrs);
+		}
+		close(d->fd);
+		free(d->path);
+	}
+}
+
+/* The untar extracts the archive from fd to the directory dest, created
+ * if needed. It returns 0 or a positive error.
+ */
+int untar(int fd, const char *dest, const struct untar_opts *o)
+{
+	unsigned char digest[sha256_len];
+	char hex[sha256_hex_len + 1];
+	struct untar *u;
+	struct entry *e;
+	struct dir *root;
+	int ret = 0, end, created;
+
+	u = calloc(1, sizeof(*u));
+	e = malloc(sizeof(*e));
+	if (!u || !e) {
+		perror("malloc");
+		free(u);
+		return 1;
+	}
+	u->o = o;
+	u->r = &u->reader;
+	u->chown = geteuid() == 0;
+
+	created = mkdir(dest, 0755) == 0;
+	if (!created && errno != EEXIST) {
+		perror(dest);
+		ret = 2;
+		goto out;
+	}
+	root = find_dir(u, "");
+	root->fd = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root->fd < 0) {
+		perror(dest);
+		ret = 3;
+		goto out;
+	}
+	if (created)
+		own_new_dir(u, root->fd);
+	root->path = strdup("");
+	u->ndirs = 1;
+
+	if (rd_init(u->r, fd)) {
+		ret = 4;
+		goto out;
+	}
+
+	if (o->workers > 0) {
+		u->pool = pool_start(o->workers);
+		if (!u->pool) {
+			ret = 5;
+			goto out;
+		}
+	}
+
+	for (;;) {
+		end = read_entry(u, e);
+		if (end < 0) {
+			fprintf(stderr, "broken archive\n");
+			ret = 6;
+			break;
+		}
+		if (end)
+			break;
+		set_owner(u, e);
+		if (extract_entry(u, e)) {
+			ret = 7;
+			break;
+		}
+		free_xattrs(e->xattrs, e->nxattrs);
+	}
+
+	if (u->pool && (drain(u) | pool_stop(u->pool)) && !ret)
+		ret = 8;
+
+	if (!ret && rd_finish(u->r, digest) == 0) {
+		sha256_hex(digest, hex);
+		if (o->digest_out)
+			strcpy(o->digest_out, hex);
+		if (o->digest && strcmp(o->digest, hex)) {
+			fprintf(stderr, "archive digest mismatch: expected %s, got %s\n", o->digest, hex);
+			ret = 9;
+		}
+	}
+
+	finish_dirs(u);
+
+ out:
+	free(e);
+	free(u);
+	return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef UNTAR_SENTRY_H
+#define UNTAR_SENTRY_H
+
+#include <sys/types.h>
+#include "sha256.h"
+
+/* The extractor reads a tar archive (gzip compressed or not) from a
+ * descriptor in one pass: the compressed data are hashed with SHA-256 and
+ * inflated straight into the buffers of the tar entries. Directories,
+ * links and special files are created by the reading thread, in archive
+ * order; regular files are handed with their data to a pool of writer
+ * threads, and an entry whose name is still queued waits for them, so the
+ * result is the same as in archive order. Every file is created with openat(2) relative to a descriptor
+ * of its directory which is kept open, no path is looked up twice, and no
+ * symlink of the archive is followed. Owners, modes, times and xattrs
+ * (pax SCHILY.xattr) of directories are set at the end.
+ *
+ * Owners are shifted by uid_shift and gid_shift: the root of a rootfs for
+ * a user namespace mapping 0 to 500 is uid 500 on the disk. A layer of an
+ * image is extracted with whiteouts, to be a lower directory of overlayfs.
+ */
+
+struct untar_opts {
+	int workers;				/* writer threads, 0 - write in the reader */
+	uid_t uid_shift;
+	gid_t gid_shift;
+	const char *digest;			/* expected SHA-256 of the archive or NULL */
+	char *digest_out;			/* sha256_hex_len + 1 bytes or NULL */
+	int whiteouts;				/* make OCI whiteouts overlayfs ones */
+};
+
+int untar(int fd, const char *dest, const struct untar_opts *o);
+
+#endif
@@ -18,18 +18,42 @@ run ()
 	"$@" || exit 1
 }
 
+# Extra sources, libraries and link flags of a program.
+libs ()
+{
+	case "$1" in
+	create_container.c) echo "lib/netlinklib.c lib/execagent.c lib/teardown.c lib/cgrouplib.c lib/nftlib.c lib/portproxy.c lib/logring.c lib/seccomplib.c lib/helperlib.c lib/layerstore.c lib/sha256.c lib/prewarm.c lib/psimon.c lib/fastpath.c lib/launcher.c" ;;
+	cexec.c) echo "lib/execagent.c" ;;
+	cctl.c) echo "lib/launcher.c" ;;
+	cmetrics.c) echo "lib/netlinklib.c lib/cgrouplib.c" ;;
+	cfreeze.c) echo "lib/cgrouplib.c" ;;
+	cproxy.c) echo "lib/portproxy.c" ;;
+	clogs.c) echo "lib/logring.c" ;;
+	cseccomp.c) echo "lib/seccomplib.c" ;;
+	cinit.c) echo "-static" ;;
+	cimage.c) echo "lib/layerstore.c lib/ocilayout.c lib/untar.c lib/sha256.c -lz -lpthread" ;;
+	cuntar.c) echo "lib/untar.c lib/sha256.c -lz -lpthread" ;;
+	esac
+}
+
+ALPINE=alpine-minirootfs-3.21.3-x86_64.tar.gz
+ALPINE_SHA256=1a694899e406ce55d32334c47ac0b2efb6c06d7e878102d1840892ad44cd5239
+
+# The rootfs keeps the owners of the archive, create_container idmaps its
+# mount to each container. cuntar checks the digest while it extracts, so
+# a corrupted rootfs is never renamed into place.
 if [ ! -d "alpine" ]; then
-	mkdir alpine
-	tar -xzf alpine-minirootfs-3.21.3-x86_64.tar.gz -C alpine
+	if [ ! -x cuntar ] || [ cuntar -ot cuntar.c ]; then
+		run gcc -o cuntar -g $CFLAGS cuntar.c `libs cuntar.c`
+	fi
+	rm -rf alpine.tmp
+	run ./cuntar -d $ALPINE_SHA256 $ALPINE alpine.tmp
+	run mv alpine.tmp alpine
 fi
 
 if [ "$#" -eq  0 ]; then
 	for file in $SRC; do
-		if [ "$file" == "create_container.c" ]; then
-			run gcc -o "${file%.c}" -g $CFLAGS "$file" "lib/netlinklib.c"
-			continue
-		fi
-		run gcc -o "${file%.c}" -g $CFLAGS "$file"
+		run gcc -o "${file%.c}" -g $CFLAGS "$file" `libs "$file"`
 	done
 	exit 0
 fi
@@ -48,10 +72,6 @@ if [ "$#" -gt  0 ]; then
 			rm -f *.c~
 		fi
 	else
-		if [ "$1" == "create_container.c" ]; then
-			run gcc -o "${1%.c}" -g $CFLAGS "$1" "lib/netlinklib.c"
-			exit 0
-		fi
-		run gcc -o "${1%.c}" -g $CFLAGS "$1"
+		run gcc -o "${1%.c}" -g $CFLAGS "$1" `libs "$1"`
 	fi
 fi
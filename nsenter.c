@@ -9,12 +9,23 @@
 #include <fcntl.h>
 #include <string.h>				/* strncpy */
 #include <sys/wait.h>			/* wait */
+#include <sys/syscall.h>		/* SYS_pidfd_open */
+#include <errno.h>				/* EINVAL */
+#include <poll.h>				/* poll */
+#include <dirent.h>				/* opendir */
+#include <sys/ioctl.h>			/* ioctl */
+#include <linux/nsfs.h>			/* NS_GET_NSTYPE */
 
 /* Linux core 5.6 */
 #ifndef CLONE_NEWTIME
 #define CLONE_NEWTIME	0x00000080
 #endif
 
+/* Linux core 5.3 */
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 enum { a_flag = 1 << 0, m_flag = 1 << 1, u_flag = 1 << 2,
 	i_flag = 1 << 3, n_flag = 1 << 4, p_flag = 1 << 5,
 	U_flag = 1 << 6, c_flag = 1 << 7, T_flag = 1 << 8
@@ -22,12 +33,39 @@ enum { a_flag = 1 << 0, m_flag = 1 << 1, u_flag = 1 << 2,
 
 enum { max_buf = 32, max_ns = 8, int_max = 2147483647 };
 
+enum { max_path = 4096, max_jobs = 1024, def_jobs = 32, out_chunk = 4096 };
+
+struct target_set {
+	int *pids;
+	int *errs;
+	int n;
+	int cap;
+};
+
 struct cmdline_opts {
 	int target;
+	struct target_set set;
+	const char *cgroup;
+	const char *nsfile;
+	int jobs;
 	unsigned int flags;
 	char **argv;
 };
 
+/* One target of a fan-out run. Output of the program is collected from
+ * the pipe until the end of file and printed as a single block.
+ */
+struct fanout_job {
+	int pid;
+	int target;
+	int fd;
+	char *out;
+	int len;
+	int cap;
+	int status;
+	int err;
+};
+
 struct ns_info {
 	unsigned int flag;
 	const char *name;
@@ -52,9 +90,14 @@ static void help()
 		 "\n"
 		 "Usage: nsenter -t <target> [options] <program> \n"
 		 "Example: ./nsenter -t `pidof <program_name>` /bin/bash\n"
+		 "         ./nsenter -g /sys/fs/cgroup/docker-c -j 64 /bin/hostname\n"
 		 "\n"
 		 "Options are:\n"
 		 " -t <target>  target process to get namespaces from\n"
+		 "              (a comma separated list runs program in every target)\n"
+		 " -g <cgroup>  run program in every process of a cgroup subtree\n"
+		 " -N <nsfile>  run program in every process of a namespace\n"
+		 " -j <jobs>    number of targets entered in parallel (default 32)\n"
 		 " -a           enter all namespaces (default)\n"
 		 " -m           enter mount namespace\n"
 		 " -u           enter UTS namespace\n"
@@ -63,7 +106,10 @@ static void help()
 		 " -p           enter pid namespace\n"
 		 " -U           enter user namespace\n"
 		 " -c           enter cgroup namespace\n"
-		 " -T           enter time namespace\n" " -h           display this help\n");
+		 " -T           enter time namespace\n" " -h           display this help\n"
+		 "\n"
+		 "With several targets output of every target is printed separately\n"
+		 "and targets sharing all requested namespaces are entered once.\n");
 }
 
 /* The pos_atoi converts from ASCII to int (only positive number). */
@@ -86,10 +132,58 @@ static int pos_atoi(const char *s)
 	return n;
 }
 
+/* The add_target appends pid to the target set. */
+static int add_target(struct target_set *set, int pid)
+{
+	int *pids;
+
+	if (set->n == set->cap) {
+		set->cap = set->cap ? set->cap * 2 : 64;
+		pids = realloc(set->pids, set->cap * sizeof(int));
+		if (!pids) {
+			perror("realloc");
+			return 1;
+		}
+		set->pids = pids;
+	}
+	set->pids[set->n++] = pid;
+
+	return 0;
+}
+
+/* The parse_targets parses a comma separated list of pids. */
+static int parse_targets(const char *s, struct target_set *set)
+{
+	int pid;
+
+	while (*s) {
+		pid = pos_atoi(s);
+		if (pid <= 0)
+			return 1;
+		if (add_target(set, pid))
+			return 2;
+		while (*s >= '0' && *s <= '9')
+			s++;
+		if (*s == ',')
+			s++;
+		else if (*s)
+			return 3;
+	}
+
+	return 0;
+}
+
 /* The init_cmdline_opts initializes struct cmline_opts. */
 static void init_cmdline_opts(struct cmdline_opts *opts)
 {
 	opts->target = 0;
+	opts->set.pids = NULL;
+	opts->set.errs = NULL;
+	opts->set.n = 0;
+	opts->set.cap = 0;
+	opts->cgroup = NULL;
+	opts->nsfile = NULL;
+	opts->jobs = def_jobs;
 	opts->flags = 0;
 	opts->argv = NULL;
 }
@@ -101,17 +195,34 @@ static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
 	while (idx < argc) {
 		if (argv[idx][0] == '-') {
 			char optc = argv[idx][1];
-			if (optc == 't' && (idx + 1 >= argc || argv[idx + 1][0] == '-')) {
+			if ((optc == 't' || optc == 'g' || optc == 'N' || optc == 'j') &&
+				(idx + 1 >= argc || argv[idx + 1][0] == '-')) {
 				fprintf(stderr, "-%c needs argument; try -h for help\n", optc);
 				return 1;
 			}
 			switch (optc) {
 			case 't':
-				opts->target = pos_atoi(argv[idx + 1]);
-				if (opts->target == -1) {
+				if (parse_targets(argv[idx + 1], &opts->set)) {
 					fprintf(stderr, "invalid pid for target\n");
 					return 2;
 				}
+				opts->target = opts->set.pids[0];
+				idx += 2;
+				break;
+			case 'g':
+				opts->cgroup = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'N':
+				opts->nsfile = argv[idx + 1];
+				idx += 2;
+				break;
+			case 'j':
+				opts->jobs = pos_atoi(argv[idx + 1]);
+				if (opts->jobs <= 0 || opts->jobs > max_jobs) {
+					fprintf(stderr, "number of jobs must be in 1..%d\n", max_jobs);
+					return 2;
+				}
 				idx += 2;
 				break;
 			case 'a':
@@ -157,7 +268,7 @@ static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
 				fprintf(stderr, "unknowm option '%c'\n", argv[idx][1]);
 				return 3;
 			}
-		} else if (opts->target) {
+		} else if (opts->target || opts->cgroup || opts->nsfile) {
 			opts->argv = &argv[idx];
 			break;
 		} else {
@@ -172,29 +283,98 @@ static int parse_cmdline(int argc, char *argv[], struct cmdline_opts *opts)
 	return 0;
 }
 
-/* The exec_in_container reassociates process with namespace(s) and
- * executes program in a new namespace(s).
+/* The kernel_namespaces drops namespaces the kernel is built without
+ * (no /proc/self/ns/<name>, e.g. time namespaces before Linux 5.6).
  */
-int exec_in_container(struct cmdline_opts *opts)
+static unsigned int kernel_namespaces(unsigned int flags)
+{
+	char buf[max_buf];
+	struct stat st;
+	int i;
+
+	for (i = 0; i < max_ns; i++) {
+		snprintf(buf, max_buf, "/proc/self/ns/%s", ns_list[i].name);
+		if (stat(buf, &st) && errno == ENOENT)
+			flags &= ~ns_list[i].flag;
+	}
+
+	return flags;
+}
+
+/* The same_user_ns checks if the target process lives in our user namespace.
+ * Joining its own user namespace is an error, so it must be skipped.
+ */
+static int same_user_ns(int target)
+{
+	char buf[max_buf];
+	struct stat self, other;
+
+	snprintf(buf, max_buf, "/proc/%d/ns/user", target);
+	if (stat("/proc/self/ns/user", &self) || stat(buf, &other))
+		return 0;
+
+	return self.st_dev == other.st_dev && self.st_ino == other.st_ino;
+}
+
+/* The join_by_pidfd joins all requested namespaces of the target in one
+ * setns(2) call on a pidfd (Linux 5.8). Entering is atomic and a reused
+ * PID cannot be entered by mistake. It returns -1 if the kernel doesn't
+ * support it and the namespaces must be joined one by one.
+ */
+static int join_by_pidfd(int target, unsigned int flags)
+{
+	int i, pidfd, nstype = 0;
+
+	for (i = 0; i < max_ns; i++) {
+		if (flags & ns_list[i].flag)
+			nstype |= ns_list[i].clone_flag;
+	}
+
+	if ((nstype & CLONE_NEWUSER) && same_user_ns(target))
+		nstype &= ~CLONE_NEWUSER;
+
+	pidfd = syscall(SYS_pidfd_open, target, 0);
+	if (pidfd == -1) {
+		if (errno == ENOSYS)
+			return -1;
+		perror("pidfd_open");
+		return 1;
+	}
+
+	if (setns(pidfd, nstype)) {
+		if (errno == EINVAL) {
+			close(pidfd);
+			return -1;
+		}
+		perror("setns");
+		close(pidfd);
+		return 2;
+	}
+
+	close(pidfd);
+	return 0;
+}
+
+/* The join_by_nsfd opens /proc/<pid>/ns/ files and joins namespaces
+ * one by one (fallback for kernels older than 5.8).
+ */
+static int join_by_nsfd(int target, unsigned int flags)
 {
 	char *start;
 	char buf[max_buf];
 	int fd[max_ns];
-	int n, i, pid;
+	int n, i;
 
 	for (i = 0; i < max_ns; i++)
 		fd[i] = -1;
 
 	/* Prepare /proc/<pid>/ns/ path. */
-	n = snprintf(buf, max_buf, "/proc/%d/ns/", opts->target);
+	n = snprintf(buf, max_buf, "/proc/%d/ns/", target);
 	start = buf + n;
 
-	if (opts->flags & a_flag)
-		opts->flags = ~opts->flags;
-
 	/* Open all requested namespaces. */
 	for (i = 0; i < max_ns; i++) {
-		if (!(opts->flags & ns_list[i].flag))
+		if (!(flags & ns_list[i].flag))
 			continue;
 
 		strncpy(start, ns_list[i].name, max_buf - (start - buf));
@@ -218,6 +398,22 @@ int exec_in_container(struct cmdline_opts *opts)
 		close(fd[i]);
 	}
 
+	return 0;
+}
+
+/* The exec_in_container reassociates process with namespace(s) and
+ * executes program in a new namespace(s).
+ */
+int exec_in_container(struct cmdline_opts *opts)
+{
+	int ret, pid;
+
+	ret = join_by_pidfd(opts->target, opts->flags);
+	if (ret == -1)
+		ret = join_by_nsfd(opts->target, opts->flags);
+	if (ret)
+		return 1;
+
 	/* clone(child_stack=NULL, CLONE_CHILD_CLEARTID|CLONE_CHILD_SETTID|SIGCHLD,
 	 *       child_tidptr=0x7f117f138850);
 	 */
@@ -238,6 +434,348 @@ int exec_in_container(struct cmdline_opts *opts)
 	return 0;
 }
 
+/* The collect_cgroup adds all processes of the cgroup subtree at path. */
+static int collect_cgroup(const char *path, struct target_set *set)
+{
+	char buf[max_path];
+	struct dirent *ent;
+	FILE *f;
+	DIR *dir;
+	int pid;
+
+	snprintf(buf, max_path, "%s/cgroup.procs", path);
+	f = fopen(buf, "r");
+	if (!f) {
+		perror(buf);
+		return 1;
+	}
+	while (fscanf(f, "%d", &pid) == 1) {
+		if (add_target(set, pid)) {
+			fclose(f);
+			return 2;
+		}
+	}
+	fclose(f);
+
+	dir = opendir(path);
+	if (!dir) {
+		perror(path);
+		return 3;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_type != DT_DIR || ent->d_name[0] == '.')
+			continue;
+		snprintf(buf, max_path, "%s/%s", path, ent->d_name);
+		if (collect_cgroup(buf, set)) {
+			closedir(dir);
+			return 4;
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/* The collect_ns adds all processes which are members of the namespace
+ * referred to by nsfile (/proc/<pid>/ns/<name> or a bind mount of it).
+ */
+static int collect_ns(const char *nsfile, struct target_set *set)
+{
+	char buf[max_path];
+	struct dirent *ent;
+	struct stat ns, st;
+	const char *name = NULL;
+	DIR *dir;
+	int fd, i, pid, type;
+
+	fd = open(nsfile, O_RDONLY);
+	if (fd == -1) {
+		perror(nsfile);
+		return 1;
+	}
+	type = ioctl(fd, NS_GET_NSTYPE);
+	if (type == -1 || fstat(fd, &ns)) {
+		perror("NS_GET_NSTYPE");
+		close(fd);
+		return 2;
+	}
+	close(fd);
+
+	for (i = 0; i < max_ns; i++) {
+		if (ns_list[i].clone_flag == type)
+			name = ns_list[i].name;
+	}
+	if (!name) {
+		fprintf(stderr, "%s: unknown namespace type\n", nsfile);
+		return 3;
+	}
+
+	dir = opendir("/proc");
+	if (!dir) {
+		perror("/proc");
+		return 4;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		pid = pos_atoi(ent->d_name);
+		if (pid <= 0 || pid == getpid())
+			continue;
+		snprintf(buf, max_path, "/proc/%d/ns/%s", pid, name);
+		if (stat(buf, &st) || st.st_ino != ns.st_ino || st.st_dev != ns.st_dev)
+			continue;
+		if (add_target(set, pid)) {
+			closedir(dir);
+			return 5;
+		}
+	}
+	closedir(dir);
+
+	return 0;
+}
+
+/* The ns_key fills key with inode numbers of the requested namespaces
+ * of the target. Targets with equal keys share all those namespaces.
+ * It returns errno if a namespace of the target can't be read.
+ */
+static int ns_key(int target, unsigned int flags, ino_t *key)
+{
+	char buf[max_buf];
+	struct stat st;
+	int i;
+
+	for (i = 0; i < max_ns; i++) {
+		key[i] = 0;
+		if (!(flags & ns_list[i].flag))
+			continue;
+		snprintf(buf, max_buf, "/proc/%d/ns/%s", target, ns_list[i].name);
+		if (stat(buf, &st))
+			return errno;
+		key[i] = st.st_ino;
+	}
+
+	return 0;
+}
+
+/* The unique_targets leaves one target per distinct set of namespaces.
+ * Targets whose namespaces can't be read (the process is gone or access
+ * is denied) are kept with the errno in set->errs to be reported failed.
+ */
+static int unique_targets(struct target_set *set, unsigned int flags)
+{
+	ino_t (*keys)[max_ns];
+	int i, j, err, n = 0;
+
+	keys = malloc(set->n * sizeof(*keys));
+	set->errs = calloc(set->n, sizeof(int));
+	if (set->n && (!keys || !set->errs)) {
+		perror("malloc");
+		free(keys);
+		return 1;
+	}
+
+	for (i = 0; i < set->n; i++) {
+		err = ns_key(set->pids[i], flags, keys[n]);
+		for (j = 0; !err && j < n; j++) {
+			if (!set->errs[j] && !memcmp(keys[j], keys[n], sizeof(keys[n])))
+				break;
+		}
+		if (!err && j < n)
+			continue;
+		set->errs[n] = err;
+		set->pids[n++] = set->pids[i];
+	}
+	set->n = n;
+
+	free(keys);
+	return 0;
+}
+
+/* The run_in_target joins the namespaces of the target and runs program.
+ * It is called in a forked child and returns its exit code.
+ */
+static int run_in_target(int target, unsigned int flags, char **argv)
+{
+	int ret, pid, status;
+
+	ret = join_by_pidfd(target, flags);
+	if (ret == -1)
+		ret = join_by_nsfd(target, flags);
+	if (ret)
+		return 126;
+
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		return 126;
+	}
+
+	if (pid == 0) {
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		fflush(stderr);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) == -1)
+		return 126;
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+/* The start_job forks a child which runs the program in the target with
+ * stdout and stderr redirected to a pipe.
+ */
+static int start_job(struct fanout_job *job, struct cmdline_opts *opts)
+{
+	int fd[2], null;
+
+	if (pipe(fd) == -1) {
+		perror("pipe");
+		return 1;
+	}
+
+	job->pid = fork();
+	if (job->pid == -1) {
+		perror("fork");
+		close(fd[0]);
+		close(fd[1]);
+		return 2;
+	}
+
+	if (job->pid == 0) {
+		close(fd[0]);
+		null = open("/dev/null", O_RDONLY);
+		if (null >= 0)
+			dup2(null, 0);
+		dup2(fd[1], 1);
+		dup2(fd[1], 2);
+		_exit(run_in_target(job->target, opts->flags, opts->argv));
+	}
+
+	close(fd[1]);
+	job->fd = fd[0];
+	return 0;
+}
+
+/* The drain_job reads available output of the job. It returns 1 on the
+ * end of file.
+ */
+static int drain_job(struct fanout_job *job)
+{
+	char *out;
+	int n;
+
+	if (job->cap - job->len < out_chunk) {
+		out = realloc(job->out, job->cap + out_chunk * 4);
+		if (!out) {
+			perror("realloc");
+			return 1;
+		}
+		job->out = out;
+		job->cap += out_chunk * 4;
+	}
+
+	n = read(job->fd, job->out + job->len, job->cap - job->len);
+	if (n < 0 && errno == EINTR)
+		return 0;
+	if (n <= 0)
+		return 1;
+
+	job->len += n;
+	return 0;
+}
+
+/* The finish_job reaps the job and prints its output as one block. */
+static void finish_job(struct fanout_job *job)
+{
+	close(job->fd);
+	job->fd = -1;
+	if (waitpid(job->pid, &job->status, 0) == -1)
+		job->status = 126 << 8;
+
+	printf("==> %d: exit %d <==\n", job->target, WEXITSTATUS(job->status));
+	fwrite(job->out, 1, job->len, stdout);
+	if (job->len && job->out[job->len - 1] != '\n')
+		putchar('\n');
+	fflush(stdout);
+
+	free(job->out);
+	job->out = NULL;
+}
+
+/* The exec_in_targets runs program in every target, at most opts->jobs
+ * at a time, and prints a summary of exit codes.
+ */
+int exec_in_targets(struct cmdline_opts *opts)
+{
+	struct pollfd pfd[max_jobs];
+	struct fanout_job *jobs, *run[max_jobs];
+	int i, n, next = 0, nrun = 0, failed = 0;
+
+	if (opts->cgroup && collect_cgroup(opts->cgroup, &opts->set))
+		return 1;
+	if (opts->nsfile && collect_ns(opts->nsfile, &opts->set))
+		return 2;
+	if (unique_targets(&opts->set, opts->flags))
+		return 3;
+
+	jobs = calloc(opts->set.n, sizeof(*jobs));
+	if (opts->set.n && !jobs) {
+		perror("calloc");
+		return 4;
+	}
+
+	while (next < opts->set.n || nrun) {
+		while (next < opts->set.n && nrun < opts->jobs) {
+			jobs[next].target = opts->set.pids[next];
+			jobs[next].err = opts->set.errs[next];
+			if (jobs[next].err || start_job(&jobs[next], opts)) {
+				jobs[next].status = 126 << 8;
+				failed++;
+				next++;
+				continue;
+			}
+			run[nrun++] = &jobs[next++];
+		}
+		if (!nrun)
+			break;
+
+		for (i = 0; i < nrun; i++) {
+			pfd[i].fd = run[i]->fd;
+			pfd[i].events = POLLIN;
+		}
+
+		if (poll(pfd, nrun, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 5;
+		}
+
+		for (i = nrun - 1; i >= 0; i--) {
+			if (!pfd[i].revents || !drain_job(run[i]))
+				continue;
+			finish_job(run[i]);
+			if (run[i]->status)
+				failed++;
+			run[i] = run[--nrun];
+		}
+	}
+
+	n = opts->set.n;
+	printf("==> %d targets: %d ok, %d failed <==\n", n, n - failed, failed);
+	for (i = 0; i < n; i++) {
+		if (jobs[i].err)
+			printf("%d: %s\n", jobs[i].target, strerror(jobs[i].err));
+		else if (jobs[i].status)
+			printf("%d: exit %d\n", jobs[i].target, WEXITSTATUS(jobs[i].status));
+	}
+
+	free(jobs);
+	free(opts->set.errs);
+	return failed ? 6 : 0;
+}
+
 int main(int argc, char **argv)
 {
 	struct cmdline_opts opts;
@@ -256,7 +794,7 @@ int main(int argc, char **argv)
 			printf("args_prog: %s\n", opts.argv[i]);
 		}*/
 
-	if (opts.target == 0) {
+	if (opts.target == 0 && !opts.cgroup && !opts.nsfile) {
 		fprintf(stderr, "The -t parameter must be specified\n");
 		return 2;
 	}
@@ -266,6 +804,13 @@ int main(int argc, char **argv)
 		return 3;
 	}
 
+	if (opts.flags & a_flag)
+		opts.flags = kernel_namespaces(~opts.flags);
+
+	/* Exit status is not zero if the program failed in any target. */
+	if (opts.set.n > 1 || opts.cgroup || opts.nsfile)
+		return exec_in_targets(&opts) ? 5 : 0;
+
 	if (exec_in_container(&opts)) {
 		fprintf(stderr, "exec_in_container is failed\n");
 		return 4;
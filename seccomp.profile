@@ -0,0 +1,50 @@
+# Default seccomp profile for create_container -S: everything is allowed
+# except what a container has no business doing. See lib/seccomplib.h.
+default allow
+
+# kernel modules, kexec, reboot, swap, clock
+deny init_module
+deny finit_module
+deny delete_module
+deny kexec_load
+deny kexec_file_load
+deny reboot
+deny swapon
+deny swapoff
+deny settimeofday
+deny clock_settime
+deny clock_adjtime
+deny adjtimex
+
+# kernel keyring, BPF, perf, accounting
+deny add_key
+deny request_key
+deny keyctl
+deny bpf
+deny perf_event_open
+deny acct
+deny lookup_dcookie
+
+# tracing and other processes' memory
+deny ptrace
+deny process_vm_readv
+deny process_vm_writev
+deny kcmp
+
+# file handles bypass the mount namespace
+deny open_by_handle_at
+deny name_to_handle_at
+
+# no nested user namespaces (CLONE_NEWUSER)
+deny clone arg0 & 0x10000000
+deny unshare arg0 & 0x10000000
+# clone3 hides its flags in memory; ENOSYS makes glibc fall back to clone
+errno:38 clone3
+
+# userfaultfd stalls the kernel at will
+deny userfaultfd
+
+# old personalities (READ_IMPLIES_EXEC and the like), except the queries
+allow personality arg0 == 0
+allow personality arg0 == 0xffffffff
+deny personality